@@ -0,0 +1,1550 @@
+/*
+arc-store - the client archives of the CAs, with what they share kept once
+
+Every archive in private/arc has its own copy of what the other archives
+of its tree have too: CA_cert.pem, ta.key, the same template files. With
+tens of thousands of clients that is as many copies, and as many again
+in every backup. arc-store keeps the entries of the archives instead:
+
+	arc-store import [-r] [-j threads] <tree> [name ...]
+	    reads the archives in private/arc of the tree, all of them or
+	    the names, into the store; -r removes each one once it's in
+	arc-store get [-o file] <tree> <name>
+	    writes the archive out again, to stdout or the file
+	arc-store export [-j threads] <tree> <out_dir>
+	    writes out every archive of the tree, on the threads
+	arc-store gc
+	    removes the blobs no archive has any more, once manifests
+	    were removed, and what seen has of those archives
+
+The data of a file that more than one archive has is a blob, compressed
+by itself and named by its SHA-256, blobs/<hh>/<hash>.gz. An archive is
+a manifest, <tree>/<name>.mf: the list of its parts, then the parts only
+it has, compressed: its tar headers as they were, the files no other
+archive has and the end of the tar. Every part and every blob is a whole
+gzip member, so writing the archive out is copying them one after the
+other as they are, with copy_file_range() to a file, which shares the
+blocks where the filesystem can, or sendfile() to a pipe or a socket;
+nothing is compressed again. gunzip reads the members as one stream and
+the tar in it is the one that was imported, byte for byte; the .tar.gz
+itself isn't, it has more members.
+
+A file becomes a blob when an import finds it in two archives, or in one
+and in seen, the hashes of what imports before saw and in which archive,
+or the blob is there already; the archive that had it first keeps its
+own copy. An archive imported again doesn't share with itself. Files that
+are alike but not the same, the .conf with another name in it, aren't
+shared. The store has the keys of the clients, it's for its owner only.
+
+Usage: arc-store [-s store] import [-r] [-j threads] <tree> [name ...]
+       arc-store [-s store] get [-o file] <tree> <name>
+       arc-store [-s store] export [-j threads] <tree> <out_dir>
+       arc-store [-s store] gc
+
+16oct2026, v0.1
+ - first version
+
+17oct2026, v0.2
+ - gc takes the archives that have no manifest any more out of seen,
+   what only one archive has left isn't shared for them
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <zlib.h>
+#include <openssl/sha.h>
+
+#define MANIFEST_MAGIC "ARCSTORE1"
+#define TAR_BLOCK      512
+#define HASH_LEN       SHA256_DIGEST_LENGTH
+#define OWNER_LEN      8      /* of the SHA-256 of tree/name */
+#define SEEN_LEN       ( HASH_LEN + OWNER_LEN )
+#define COPY_BUFF      65536
+
+/* how write_archive() copies the parts */
+enum
+{
+	COPY_RANGE,           /* copy_file_range(), to a file */
+	COPY_SENDFILE,        /* sendfile(), to a pipe or socket too */
+	COPY_RW               /* read() and write() */
+};
+
+/* a part of an archive, from its manifest */
+typedef struct part
+{
+	char type;            /* 'i' in the manifest, 'b' a blob */
+	unsigned char hash[HASH_LEN];
+	long off;             /* of an 'i', after the list */
+	long len;             /* compressed */
+} part;
+
+/* a buffer that grows */
+typedef struct buff
+{
+	unsigned char *data;
+	long len, size;
+} buff;
+
+/* an archive being imported */
+typedef struct arc_in
+{
+	buff list;            /* the manifest's list of parts */
+	buff own;             /* the parts only it has, compressed */
+	buff raw;             /* the part being put together */
+	int n_parts;
+	long gz_len;          /* the archive it makes */
+} arc_in;
+
+/* the archives of a tree on the threads */
+typedef struct arc_run
+{
+	char *store;
+	char *tree;           /* its name in the store */
+	char *dir;            /* private/arc to import, or where to export */
+	char **names;
+	int n_names;
+	int pass;             /* import: 1 hashes the files, 2 stores them */
+	int remove;
+	buff hashes;          /* of every file in pass 1 and its archive, sorted */
+	buff seen;            /* the same of earlier imports */
+	int next, failed;
+	long bytes_in, bytes_out, blobs_new;
+	pthread_mutex_t lock;
+} arc_run;
+
+/* prototypes */
+int  import( char *store, char *tree_dir, char **names, int n_names, int remove, int n_threads );
+int  get( char *store, char *tree, char *name, char *out_file );
+int  export( char *store, char *tree, char *out_dir, int n_threads );
+int  gc( char *store );
+int  open_store( char *store, int create, int how );
+int  list_names( char *dir, char *suffix, char ***names, int *n_names );
+void free_names( char **names, int n_names );
+int  run_threads( arc_run *run, int n_threads );
+void *arc_worker( void *arg );
+int  take_archive( arc_run *run, char *name );
+int  read_archive( char *path, buff *tar );
+long tar_entry_size( unsigned char *hdr );
+int  is_shared( arc_run *run, unsigned char *hash, unsigned char *owner );
+int  put_blob( arc_run *run, unsigned char *hash, unsigned char *data, long len, long *gz_len );
+int  flush_own( arc_in *a );
+int  gz_member( unsigned char *in, long len, buff *out );
+int  write_manifest( arc_run *run, char *name, arc_in *a );
+int  read_manifest( char *path, FILE **f, part **parts, int *n_parts, long *data_off );
+int  write_archive( char *store, char *tree, char *name, int out, long *len );
+int  copy_range( int in, off_t off, long len, int out, int *mode );
+int  load_seen( arc_run *run );
+int  save_seen( arc_run *run );
+long prune_seen( char *store, buff *owners );
+int  append( buff *b, const void *p, long n );
+long find_key( buff *b, int rec_len, unsigned char *key, int key_len );
+int  has_key( buff *b, int rec_len, unsigned char *key, int key_len );
+void hash_hex( unsigned char *hash, char *hex );
+int  hex_hash( char *hex, unsigned char *hash );
+void blob_path( char *store, unsigned char *hash, char *path, size_t size );
+int  tree_name( char *tree, char *name, size_t size );
+int  compare_hash( const void *a, const void *b );
+int  compare_seen( const void *a, const void *b );
+int  compare_owner( const void *a, const void *b );
+int  compare_name( const void *a, const void *b );
+double now( void );
+
+static char *help =
+	"\n"
+	"Usage: arc-store [-s store] import [-r] [-j threads] <tree> [name ...]\n"
+	"       arc-store [-s store] get [-o file] <tree> <name>\n"
+	"       arc-store [-s store] export [-j threads] <tree> <out_dir>\n"
+	"       arc-store [-s store] gc\n"
+	"  Keeps the archives of private/arc with the files they share once.\n"
+	"Commands:\n"
+	"  import         - Reads the archives of the tree, or the names, into\n"
+	"                   the store\n"
+	"  get            - Writes an archive out again\n"
+	"  export         - Writes out every archive of the tree\n"
+	"  gc             - Removes the blobs no archive has any more\n"
+	"Options:\n"
+	"  -s <store>     - The store, it defaults to arc.store\n"
+	"  -r             - Removes an archive once it is in the store\n"
+	"  -j <threads>   - Number of threads, it defaults to the number of CPUs\n"
+	"  -o <file>      - Writes to the file instead of stdout\n"
+	"  -h             - Displays this help\n"
+	"Examples:\n"
+	"  arc-store import -r ../openvpn\n"
+	"  arc-store get openvpn A1 > A1.tar.gz\n"
+	"  arc-store export -j 8 www /srv/www-arc\n"
+	"\n";
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char *store = "arc.store", *out_file = NULL, *cmd;
+	int n_threads, remove = 0, ok, c;
+
+	n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+	while ( -1 != ( c = getopt( argc, argv, "+hs:" ) ) )
+	{
+		if ( 's' != c )
+		{
+			fprintf( stderr, help );
+			exit( EXIT_FAILURE );
+		}
+		store = optarg;
+	}
+	if ( optind == argc )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	cmd = argv[optind];
+	argv += optind;
+	argc -= optind;
+	optind = 1;
+	while ( -1 != ( c = getopt( argc, argv, "hrj:o:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'r':
+				remove = 1;
+				break;
+			case 'j':
+				if ( ( n_threads = atoi( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: number of threads must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'o':
+				out_file = optarg;
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+	argv += optind;
+	argc -= optind;
+	if ( n_threads < 1 )
+		n_threads = 1;
+
+	if ( !strcmp( cmd, "import" ) && argc >= 1 )
+		ok = import( store, argv[0], argv + 1, argc - 1, remove, n_threads );
+	else if ( !strcmp( cmd, "get" ) && 2 == argc )
+		ok = get( store, argv[0], argv[1], out_file );
+	else if ( !strcmp( cmd, "export" ) && 2 == argc )
+		ok = export( store, argv[0], argv[1], n_threads );
+	else if ( !strcmp( cmd, "gc" ) && 0 == argc )
+		ok = gc( store );
+	else
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	return( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/******
+ import--
+ ******/
+
+int import( char *store, char *tree_dir, char **names, int n_names, int remove, int n_threads )
+{
+	/* Hashes the files of all the archives first, what two of them have
+	   is a blob, then stores them */
+	arc_run run;
+	char tree[64], dir[PATH_MAX], **all = NULL;
+	double start;
+	int lock, ok = 1;
+
+	if ( !tree_name( tree_dir, tree, sizeof( tree ) ) )
+		return 0;
+	snprintf( dir, sizeof( dir ), "%s/private/arc", tree_dir );
+	if ( 0 == n_names )
+	{
+		if ( !list_names( dir, ".tar.gz", &all, &n_names ) )
+			return 0;
+		names = all;
+	}
+	if ( -1 == ( lock = open_store( store, 1, LOCK_EX ) ) )
+		return 0;
+
+	memset( &run, 0, sizeof( run ) );
+	run.store = store;
+	run.tree = tree;
+	run.dir = dir;
+	run.names = names;
+	run.n_names = n_names;
+	run.remove = remove;
+	pthread_mutex_init( &run.lock, NULL );
+	start = now();
+	if ( !load_seen( &run ) )
+		ok = 0;
+
+	run.pass = 1;
+	if ( ok && !run_threads( &run, n_threads ) )
+		ok = 0;
+	if ( ok && run.failed > 0 )
+	{
+		fprintf( stderr, "Error: %d of %d archives can't be read, none were imported.\n",
+				run.failed, n_names );
+		ok = 0;
+	}
+	if ( ok )
+	{
+		qsort( run.hashes.data, run.hashes.len / SEEN_LEN, SEEN_LEN, compare_seen );
+		run.pass = 2;
+		ok = run_threads( &run, n_threads ) && save_seen( &run );
+	}
+	if ( ok )
+	{
+		fprintf( stderr, "Import: %d of %d archives of %s, %ld bytes read, %ld stored, %ld new blobs, %.2fs.\n",
+				n_names - run.failed, n_names, tree, run.bytes_in, run.bytes_out,
+				run.blobs_new, now() - start );
+		if ( run.failed > 0 )
+			ok = 0;
+	}
+
+	close( lock );
+	pthread_mutex_destroy( &run.lock );
+	free( run.hashes.data );
+	free( run.seen.data );
+	if ( NULL != all )
+		free_names( all, n_names );
+	return ok;
+}
+
+/***
+ get--
+ ***/
+
+int get( char *store, char *tree, char *name, char *out_file )
+{
+	char name_in_store[64];
+	long len;
+	int lock, out = 1, ok;
+
+	if ( !tree_name( tree, name_in_store, sizeof( name_in_store ) ) )
+		return 0;
+	if ( -1 == ( lock = open_store( store, 0, LOCK_SH ) ) )
+		return 0;
+	if ( NULL != out_file &&
+			-1 == ( out = open( out_file, O_WRONLY | O_CREAT | O_TRUNC, 0600 ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", out_file, strerror( errno ) );
+		close( lock );
+		return 0;
+	}
+	ok = write_archive( store, name_in_store, name, out, &len );
+	if ( NULL != out_file && 0 != close( out ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", out_file, strerror( errno ) );
+		ok = 0;
+	}
+	close( lock );
+	return ok;
+}
+
+/******
+ export--
+ ******/
+
+int export( char *store, char *tree, char *out_dir, int n_threads )
+{
+	arc_run run;
+	char name_in_store[64], dir[PATH_MAX];
+	double start, t;
+	int lock, ok;
+
+	if ( !tree_name( tree, name_in_store, sizeof( name_in_store ) ) )
+		return 0;
+	if ( -1 == ( lock = open_store( store, 0, LOCK_SH ) ) )
+		return 0;
+	memset( &run, 0, sizeof( run ) );
+	snprintf( dir, sizeof( dir ), "%s/%s", store, name_in_store );
+	if ( !list_names( dir, ".mf", &run.names, &run.n_names ) )
+	{
+		close( lock );
+		return 0;
+	}
+	if ( 0 != mkdir( out_dir, 0700 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", out_dir, strerror( errno ) );
+		free_names( run.names, run.n_names );
+		close( lock );
+		return 0;
+	}
+
+	run.store = store;
+	run.tree = name_in_store;
+	run.dir = out_dir;
+	pthread_mutex_init( &run.lock, NULL );
+	start = now();
+	ok = run_threads( &run, n_threads ) && 0 == run.failed;
+	t = now() - start;
+	fprintf( stderr, "Export: %d of %d archives of %s, %ld bytes, %.2fs, %.0f/s.\n",
+			run.n_names - run.failed, run.n_names, name_in_store, run.bytes_out, t,
+			t > 0 ? run.n_names / t : 0.0 );
+
+	pthread_mutex_destroy( &run.lock );
+	free_names( run.names, run.n_names );
+	close( lock );
+	return ok;
+}
+
+/**
+ gc--
+ **/
+
+int gc( char *store )
+{
+	/* The blobs of every manifest of every tree, the others go; so do
+	   the archives in seen that have no manifest */
+	buff used, owners;
+	part *parts;
+	DIR *d, *td;
+	struct dirent *de, *te;
+	struct stat st;
+	FILE *f;
+	char path[PATH_MAX + NAME_MAX + 2], sub[PATH_MAX];
+	unsigned char hash[HASH_LEN];
+	long data_off, n_used, freed = 0, n_freed = 0, n_dropped, j;
+	int lock, n_parts, i, ok = 1;
+
+	if ( -1 == ( lock = open_store( store, 0, LOCK_EX ) ) )
+		return 0;
+	memset( &used, 0, sizeof( used ) );
+	memset( &owners, 0, sizeof( owners ) );
+	if ( NULL == ( d = opendir( store ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", store, strerror( errno ) );
+		close( lock );
+		return 0;
+	}
+	while ( ok && NULL != ( de = readdir( d ) ) )
+	{
+		if ( '.' == de->d_name[0] || !strcmp( de->d_name, "blobs" ) )
+			continue;
+		snprintf( sub, sizeof( sub ), "%s/%s", store, de->d_name );
+		if ( 0 != stat( sub, &st ) || !S_ISDIR( st.st_mode ) )
+			continue;
+		if ( NULL == ( td = opendir( sub ) ) )
+		{
+			fprintf( stderr, "Error: can't read %s: %s.\n", sub, strerror( errno ) );
+			ok = 0;
+			break;
+		}
+		while ( ok && NULL != ( te = readdir( td ) ) )
+		{
+			i = strlen( te->d_name );
+			if ( i < 4 || strcmp( te->d_name + i - 3, ".mf" ) )
+				continue;
+			/* its owner in seen, as take_archive() has it */
+			snprintf( path, sizeof( path ), "%s/%.*s", de->d_name, i - 3, te->d_name );
+			SHA256( (unsigned char *)path, strlen( path ), hash );
+			snprintf( path, sizeof( path ), "%s/%s", sub, te->d_name );
+			if ( !append( &owners, hash, OWNER_LEN ) ||
+					!read_manifest( path, &f, &parts, &n_parts, &data_off ) )
+			{
+				ok = 0;
+				break;
+			}
+			for ( i = 0; ok && i < n_parts; ++i )
+				if ( 'b' == parts[i].type && !append( &used, parts[i].hash, HASH_LEN ) )
+					ok = 0;
+			free( parts );
+			fclose( f );
+		}
+		closedir( td );
+	}
+	closedir( d );
+	qsort( owners.data, owners.len / OWNER_LEN, OWNER_LEN, compare_owner );
+	if ( !ok || ( n_dropped = prune_seen( store, &owners ) ) < 0 )
+	{
+		fprintf( stderr, "Error: nothing was removed.\n" );
+		free( used.data );
+		free( owners.data );
+		close( lock );
+		return 0;
+	}
+	qsort( used.data, used.len / HASH_LEN, HASH_LEN, compare_hash );
+	for ( n_used = 0, j = 0; j < used.len; j += HASH_LEN )
+		if ( 0 == j || memcmp( used.data + j, used.data + j - HASH_LEN, HASH_LEN ) )
+			++n_used;
+
+	snprintf( path, sizeof( path ), "%s/blobs", store );
+	if ( NULL != ( d = opendir( path ) ) )
+	{
+		while ( NULL != ( de = readdir( d ) ) )
+		{
+			if ( '.' == de->d_name[0] )
+				continue;
+			snprintf( sub, sizeof( sub ), "%s/blobs/%s", store, de->d_name );
+			if ( NULL == ( td = opendir( sub ) ) )
+				continue;
+			while ( NULL != ( te = readdir( td ) ) )
+			{
+				if ( strlen( te->d_name ) != 2 * HASH_LEN + 3 ||
+						strcmp( te->d_name + 2 * HASH_LEN, ".gz" ) ||
+						!hex_hash( te->d_name, hash ) ||
+						has_key( &used, HASH_LEN, hash, HASH_LEN ) )
+					continue;
+				snprintf( path, sizeof( path ), "%s/%s", sub, te->d_name );
+				if ( 0 == stat( path, &st ) && 0 == unlink( path ) )
+				{
+					freed += st.st_size;
+					++n_freed;
+				}
+			}
+			closedir( td );
+		}
+		closedir( d );
+	}
+	fprintf( stderr, "Gc: %ld blobs in use, %ld removed, %ld bytes; %ld out of seen.\n",
+			n_used, n_freed, freed, n_dropped );
+	free( used.data );
+	free( owners.data );
+	close( lock );
+	return 1;
+}
+
+/**********
+ open_store--
+ **********/
+
+int open_store( char *store, int create, int how )
+{
+	/* The lock of the store: import and gc have it alone, get and export
+	   together, so gc doesn't take a blob from under them */
+	char path[PATH_MAX];
+	int fd;
+
+	if ( create )
+	{
+		snprintf( path, sizeof( path ), "%s/blobs", store );
+		if ( ( 0 != mkdir( store, 0700 ) && EEXIST != errno ) ||
+				( 0 != mkdir( path, 0700 ) && EEXIST != errno ) )
+		{
+			fprintf( stderr, "Error: can't make %s: %s.\n", path, strerror( errno ) );
+			return -1;
+		}
+	}
+	snprintf( path, sizeof( path ), "%s/lock", store );
+	if ( -1 == ( fd = open( path, create ? O_RDWR | O_CREAT : O_RDONLY, 0600 ) ) )
+	{
+		if ( ENOENT == errno && !create )
+			fprintf( stderr, "Error: no store at %s.\n", store );
+		else
+			fprintf( stderr, "Error: can't open %s: %s.\n", path, strerror( errno ) );
+		return -1;
+	}
+	if ( 0 != flock( fd, how ) )
+	{
+		fprintf( stderr, "Error: can't lock %s: %s.\n", path, strerror( errno ) );
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+/**********
+ list_names--
+ **********/
+
+int list_names( char *dir, char *suffix, char ***names, int *n_names )
+{
+	/* The files in dir ending in suffix, without it, sorted */
+	DIR *d;
+	struct dirent *de;
+	char **more;
+	int size = 0, len, n = strlen( suffix );
+
+	*names = NULL;
+	*n_names = 0;
+	if ( NULL == ( d = opendir( dir ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", dir, strerror( errno ) );
+		return 0;
+	}
+	while ( NULL != ( de = readdir( d ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len <= n || '.' == de->d_name[0] || strcmp( de->d_name + len - n, suffix ) )
+			continue;
+		if ( *n_names == size )
+		{
+			size = size ? 2 * size : 256;
+			if ( NULL == ( more = realloc( *names, size * sizeof( char * ) ) ) )
+				break;
+			*names = more;
+		}
+		if ( NULL == ( (*names)[*n_names] = strndup( de->d_name, len - n ) ) )
+			break;
+		++*n_names;
+	}
+	closedir( d );
+	if ( NULL != de )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		free_names( *names, *n_names );
+		return 0;
+	}
+	qsort( *names, *n_names, sizeof( char * ), compare_name );
+	return 1;
+}
+
+/**********
+ free_names--
+ **********/
+
+void free_names( char **names, int n_names )
+{
+	int i;
+
+	for ( i = 0; i < n_names; ++i )
+		free( names[i] );
+	free( names );
+	return;
+}
+
+/***********
+ run_threads--
+ ***********/
+
+int run_threads( arc_run *run, int n_threads )
+{
+	pthread_t *threads;
+	int n_started = 0, i;
+
+	run->next = 0;
+	run->failed = 0;
+	if ( n_threads > run->n_names )
+		n_threads = run->n_names > 0 ? run->n_names : 1;
+	if ( NULL != ( threads = calloc( n_threads, sizeof( pthread_t ) ) ) )
+		for ( ; n_started < n_threads; ++n_started )
+			if ( pthread_create( &threads[n_started], NULL, arc_worker, run ) )
+				break;
+	if ( 0 == n_started )
+		arc_worker( run ); /* on this thread then */
+	for ( i = 0; i < n_started; ++i )
+		pthread_join( threads[i], NULL );
+	free( threads );
+	return 1;
+}
+
+/**********
+ arc_worker--
+ **********/
+
+void *arc_worker( void *arg )
+{
+	/* Takes the next archive, to hash, store or write out */
+	arc_run *run = arg;
+	char path[PATH_MAX], tmp[PATH_MAX + 8], *name;
+	long len;
+	int out, ok;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &run->lock );
+		name = run->next < run->n_names ? run->names[run->next++] : NULL;
+		pthread_mutex_unlock( &run->lock );
+		if ( NULL == name )
+			break;
+
+		if ( 0 != run->pass )
+			ok = take_archive( run, name );
+		else
+		{
+			/* written to .tmp and renamed, a half written archive is
+			   never there under its name */
+			snprintf( path, sizeof( path ), "%s/%s.tar.gz", run->dir, name );
+			snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+			if ( -1 == ( out = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600 ) ) )
+			{
+				fprintf( stderr, "Error: can't write %s: %s.\n", tmp, strerror( errno ) );
+				ok = 0;
+			}
+			else
+			{
+				ok = write_archive( run->store, run->tree, name, out, &len );
+				if ( 0 != close( out ) || ( ok && 0 != rename( tmp, path ) ) )
+				{
+					fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+					ok = 0;
+				}
+				if ( !ok )
+					unlink( tmp );
+				else
+				{
+					pthread_mutex_lock( &run->lock );
+					run->bytes_out += len;
+					pthread_mutex_unlock( &run->lock );
+				}
+			}
+		}
+		if ( !ok )
+		{
+			pthread_mutex_lock( &run->lock );
+			++run->failed;
+			pthread_mutex_unlock( &run->lock );
+		}
+	}
+	return NULL;
+}
+
+/************
+ take_archive--
+ ************/
+
+int take_archive( arc_run *run, char *name )
+{
+	/* Pass 1 adds the hash of every file of the archive to run->hashes.
+	   Pass 2 stores it: the header of every entry goes in its own part,
+	   and its data too unless it's shared, then it's a blob. Only the
+	   data of a regular file that ends in zeros up to its last block,
+	   as tar writes it, can be a blob, the rest goes as it was. */
+	arc_in a;
+	buff tar, hashes;
+	struct stat st;
+	unsigned char *hdr, hash[HASH_LEN], owner[HASH_LEN];
+	char path[PATH_MAX], hex[2 * HASH_LEN + 1], line[128];
+	long p, size, padded, i, gz_len;
+	int blob, ok = 1;
+
+	snprintf( path, sizeof( path ), "%s/%s.tar.gz", run->dir, name );
+	memset( &a, 0, sizeof( a ) );
+	memset( &hashes, 0, sizeof( hashes ) );
+	if ( !read_archive( path, &tar ) )
+		return 0;
+	snprintf( line, sizeof( line ), "%s/%s", run->tree, name );
+	SHA256( (unsigned char *)line, strlen( line ), owner );
+
+	for ( p = 0; ok && p + TAR_BLOCK <= tar.len; p += TAR_BLOCK + padded )
+	{
+		hdr = tar.data + p;
+		for ( i = 0; i < TAR_BLOCK && 0 == hdr[i]; ++i )
+			;
+		if ( TAR_BLOCK == i )
+			break; /* the end */
+		if ( -1 == ( size = tar_entry_size( hdr ) ) )
+		{
+			fprintf( stderr, "Error: %s isn't a tar archive, or it's damaged.\n", path );
+			ok = 0;
+			break;
+		}
+		padded = ( size + TAR_BLOCK - 1 ) / TAR_BLOCK * TAR_BLOCK;
+		if ( p + TAR_BLOCK + padded > tar.len )
+		{
+			fprintf( stderr, "Error: %s is cut short.\n", path );
+			ok = 0;
+			break;
+		}
+
+		blob = ( '0' == hdr[156] || '\0' == hdr[156] ) && size > 0;
+		for ( i = size; blob && i < padded; ++i )
+			if ( 0 != hdr[TAR_BLOCK + i] )
+				blob = 0;
+		if ( blob )
+			SHA256( hdr + TAR_BLOCK, size, hash );
+		if ( 1 == run->pass )
+		{
+			if ( blob && ( !append( &hashes, hash, HASH_LEN ) ||
+						!append( &hashes, owner, OWNER_LEN ) ) )
+				ok = 0;
+			continue;
+		}
+
+		if ( !blob || !is_shared( run, hash, owner ) )
+		{
+			ok = append( &a.raw, hdr, TAR_BLOCK + padded );
+			continue;
+		}
+		if ( !append( &a.raw, hdr, TAR_BLOCK ) || !flush_own( &a ) ||
+				!put_blob( run, hash, hdr + TAR_BLOCK, padded, &gz_len ) )
+		{
+			ok = 0;
+			break;
+		}
+		hash_hex( hash, hex );
+		snprintf( line, sizeof( line ), "b %s %ld\n", hex, gz_len );
+		ok = append( &a.list, line, strlen( line ) );
+		++a.n_parts;
+		a.gz_len += gz_len;
+	}
+
+	/* after the entries only zero blocks, tar's end and its padding */
+	for ( i = p; ok && i < tar.len && 0 == tar.data[i]; ++i )
+		;
+	if ( ok && ( i < tar.len || 0 != tar.len % TAR_BLOCK || 0 == p ) )
+	{
+		fprintf( stderr, "Error: %s isn't a tar archive, or it's damaged.\n", path );
+		ok = 0;
+	}
+
+	if ( 1 == run->pass )
+	{
+		pthread_mutex_lock( &run->lock );
+		if ( ok && !append( &run->hashes, hashes.data, hashes.len ) )
+			ok = 0;
+		pthread_mutex_unlock( &run->lock );
+		free( hashes.data );
+	}
+	else
+	{
+		/* the end of the tar and whatever comes after it, as it was */
+		if ( ok && ( !append( &a.raw, tar.data + p, tar.len - p ) || !flush_own( &a ) ||
+					!write_manifest( run, name, &a ) ) )
+			ok = 0;
+		if ( ok && 0 == stat( path, &st ) )
+		{
+			pthread_mutex_lock( &run->lock );
+			run->bytes_in += st.st_size;
+			run->bytes_out += a.list.len + a.own.len;
+			pthread_mutex_unlock( &run->lock );
+		}
+		if ( ok && run->remove && 0 != unlink( path ) )
+			fprintf( stderr, "Error: %s is in the store but can't be removed: %s.\n",
+					path, strerror( errno ) );
+		free( a.list.data );
+		free( a.own.data );
+		free( a.raw.data );
+	}
+	if ( !ok )
+		fprintf( stderr, "Error: %s wasn't imported.\n", path );
+	free( tar.data );
+	return ok;
+}
+
+/************
+ read_archive--
+ ************/
+
+int read_archive( char *path, buff *tar )
+{
+	gzFile gz;
+	int n = 0;
+
+	memset( tar, 0, sizeof( buff ) );
+	if ( NULL == ( gz = gzopen( path, "rb" ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	for ( ;; )
+	{
+		if ( tar->size - tar->len < COPY_BUFF )
+		{
+			if ( !append( tar, NULL, COPY_BUFF ) )
+				break;
+			tar->len -= COPY_BUFF;
+		}
+		if ( ( n = gzread( gz, tar->data + tar->len, tar->size - tar->len ) ) <= 0 )
+			break;
+		tar->len += n;
+	}
+	gzclose( gz );
+	if ( 0 != n )
+	{
+		fprintf( stderr, "Error: can't read %s.\n", path );
+		free( tar->data );
+		return 0;
+	}
+	return 1;
+}
+
+/**************
+ tar_entry_size--
+ **************/
+
+long tar_entry_size( unsigned char *hdr )
+{
+	/* The size of an entry's data, if its header checks out, -1 if not */
+	unsigned long sum = 0, chksum = 0, size = 0;
+	int i;
+
+	for ( i = 0; i < TAR_BLOCK; ++i )
+		sum += ( i >= 148 && i < 156 ) ? ' ' : hdr[i];
+	for ( i = 148; i < 156 && ' ' == hdr[i]; ++i )
+		;
+	for ( ; i < 156 && hdr[i] >= '0' && hdr[i] <= '7'; ++i )
+		chksum = 8 * chksum + hdr[i] - '0';
+	if ( sum != chksum )
+		return -1;
+	for ( i = 124; i < 136 && ' ' == hdr[i]; ++i )
+		;
+	for ( ; i < 136 && hdr[i] >= '0' && hdr[i] <= '7'; ++i )
+		size = 8 * size + hdr[i] - '0';
+	if ( i < 136 && '\0' != hdr[i] && ' ' != hdr[i] )
+		return -1;
+	return ( size > LONG_MAX / 2 ) ? -1 : (long)size;
+}
+
+/*********
+ is_shared--
+ *********/
+
+int is_shared( arc_run *run, unsigned char *hash, unsigned char *owner )
+{
+	/* Another archive of this import has it, or of one before, or it's
+	   a blob already */
+	buff *b[2];
+	char path[PATH_MAX];
+	struct stat st;
+	long i;
+	int k;
+
+	b[0] = &run->hashes;
+	b[1] = &run->seen;
+	for ( k = 0; k < 2; ++k )
+		for ( i = find_key( b[k], SEEN_LEN, hash, HASH_LEN ) * SEEN_LEN;
+				i < b[k]->len && 0 == memcmp( b[k]->data + i, hash, HASH_LEN );
+				i += SEEN_LEN )
+			if ( memcmp( b[k]->data + i + HASH_LEN, owner, OWNER_LEN ) )
+				return 1;
+	blob_path( run->store, hash, path, sizeof( path ) );
+	return 0 == stat( path, &st );
+}
+
+/********
+ put_blob--
+ ********/
+
+int put_blob( arc_run *run, unsigned char *hash, unsigned char *data, long len, long *gz_len )
+{
+	/* Writes the blob if it isn't there. Two threads can write the same
+	   one at once, each to a file of its own, renamed: it's the same. */
+	buff gz;
+	struct stat st;
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	int fd, ok;
+
+	blob_path( run->store, hash, path, sizeof( path ) );
+	if ( 0 == stat( path, &st ) )
+	{
+		*gz_len = st.st_size;
+		return 1;
+	}
+	*strrchr( path, '/' ) = '\0';
+	if ( 0 != mkdir( path, 0700 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	blob_path( run->store, hash, path, sizeof( path ) );
+
+	memset( &gz, 0, sizeof( gz ) );
+	if ( !gz_member( data, len, &gz ) )
+		return 0;
+	snprintf( tmp, sizeof( tmp ), "%s.XXXXXX", path );
+	if ( -1 == ( fd = mkstemp( tmp ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", tmp, strerror( errno ) );
+		free( gz.data );
+		return 0;
+	}
+	ok = write( fd, gz.data, gz.len ) == gz.len;
+	if ( 0 != close( fd ) || !ok || 0 != rename( tmp, path ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		unlink( tmp );
+		free( gz.data );
+		return 0;
+	}
+	*gz_len = gz.len;
+	free( gz.data );
+	pthread_mutex_lock( &run->lock );
+	++run->blobs_new;
+	run->bytes_out += *gz_len;
+	pthread_mutex_unlock( &run->lock );
+	return 1;
+}
+
+/*********
+ flush_own--
+ *********/
+
+int flush_own( arc_in *a )
+{
+	/* What's put together in raw becomes a part of the manifest */
+	char line[64];
+	long len = a->own.len;
+
+	if ( 0 == a->raw.len )
+		return 1;
+	if ( !gz_member( a->raw.data, a->raw.len, &a->own ) )
+		return 0;
+	len = a->own.len - len;
+	snprintf( line, sizeof( line ), "i %ld\n", len );
+	if ( !append( &a->list, line, strlen( line ) ) )
+		return 0;
+	++a->n_parts;
+	a->gz_len += len;
+	a->raw.len = 0;
+	return 1;
+}
+
+/*********
+ gz_member--
+ *********/
+
+int gz_member( unsigned char *in, long len, buff *out )
+{
+	/* A whole gzip member of in, added to out. The header has no time
+	   or name in it, the same data makes the same member. */
+	z_stream z;
+	long bound;
+	int ret;
+
+	memset( &z, 0, sizeof( z ) );
+	if ( Z_OK != deflateInit2( &z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+				Z_DEFAULT_STRATEGY ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	bound = deflateBound( &z, len );
+	if ( !append( out, NULL, bound ) )
+	{
+		deflateEnd( &z );
+		return 0;
+	}
+	out->len -= bound;
+	z.next_in = in;
+	z.avail_in = len;
+	z.next_out = out->data + out->len;
+	z.avail_out = bound;
+	ret = deflate( &z, Z_FINISH );
+	deflateEnd( &z );
+	if ( Z_STREAM_END != ret )
+	{
+		fprintf( stderr, "Error: can't compress.\n" );
+		return 0;
+	}
+	out->len += z.total_out;
+	return 1;
+}
+
+/**************
+ write_manifest--
+ **************/
+
+int write_manifest( arc_run *run, char *name, arc_in *a )
+{
+	/* The line with the number of parts and the length of the archive,
+	   the list, then the parts of its own. Written to a file of its own
+	   and renamed, like a blob. */
+	char path[PATH_MAX], tmp[PATH_MAX + 8], head[64];
+	FILE *f;
+	int fd, ok;
+
+	snprintf( path, sizeof( path ), "%s/%s", run->store, run->tree );
+	if ( 0 != mkdir( path, 0700 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	snprintf( path, sizeof( path ), "%s/%s/%s.mf", run->store, run->tree, name );
+	snprintf( tmp, sizeof( tmp ), "%s.XXXXXX", path );
+	if ( -1 == ( fd = mkstemp( tmp ) ) || NULL == ( f = fdopen( fd, "w" ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", tmp, strerror( errno ) );
+		if ( -1 != fd )
+		{
+			close( fd );
+			unlink( tmp );
+		}
+		return 0;
+	}
+	snprintf( head, sizeof( head ), "%s %d %ld\n", MANIFEST_MAGIC, a->n_parts, a->gz_len );
+	ok = fputs( head, f ) >= 0 &&
+		fwrite( a->list.data, 1, a->list.len, f ) == (size_t)a->list.len &&
+		fwrite( a->own.data, 1, a->own.len, f ) == (size_t)a->own.len;
+	if ( 0 != fclose( f ) || !ok || 0 != rename( tmp, path ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		unlink( tmp );
+		return 0;
+	}
+	return 1;
+}
+
+/*************
+ read_manifest--
+ *************/
+
+int read_manifest( char *path, FILE **f, part **parts, int *n_parts, long *data_off )
+{
+	/* The list of parts; the file stays open for the parts in it, from
+	   data_off on */
+	char line[128], magic[16], hex[2 * HASH_LEN + 1];
+	long gz_len, off = 0;
+	int i;
+
+	*parts = NULL;
+	if ( NULL == ( *f = fopen( path, "r" ) ) )
+	{
+		if ( ENOENT == errno )
+			fprintf( stderr, "Error: no archive %s in the store.\n", path );
+		else
+			fprintf( stderr, "Error: can't read %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	if ( NULL == fgets( line, sizeof( line ), *f ) ||
+			3 != sscanf( line, "%15s %d %ld", magic, n_parts, &gz_len ) ||
+			strcmp( magic, MANIFEST_MAGIC ) || *n_parts < 0 ||
+			NULL == ( *parts = calloc( *n_parts + 1, sizeof( part ) ) ) )
+		goto bad;
+	for ( i = 0; i < *n_parts; ++i )
+	{
+		if ( NULL == fgets( line, sizeof( line ), *f ) )
+			goto bad;
+		(*parts)[i].type = line[0];
+		if ( 'i' == line[0] && 1 == sscanf( line + 1, "%ld", &(*parts)[i].len ) )
+		{
+			(*parts)[i].off = off;
+			off += (*parts)[i].len;
+		}
+		else if ( 'b' != line[0] ||
+				2 != sscanf( line + 1, "%64s %ld", hex, &(*parts)[i].len ) ||
+				!hex_hash( hex, (*parts)[i].hash ) )
+			goto bad;
+		if ( (*parts)[i].len <= 0 )
+			goto bad;
+	}
+	*data_off = ftell( *f );
+	return 1;
+
+bad:
+	fprintf( stderr, "Error: %s isn't a manifest, or it's damaged.\n", path );
+	free( *parts );
+	fclose( *f );
+	return 0;
+}
+
+/*************
+ write_archive--
+ *************/
+
+int write_archive( char *store, char *tree, char *name, int out, long *len )
+{
+	/* The parts one after the other, copied as they are */
+	part *parts;
+	struct stat st;
+	FILE *f;
+	char path[PATH_MAX];
+	long data_off;
+	int n_parts, mode, fd, i, ok = 1;
+
+	*len = 0;
+	snprintf( path, sizeof( path ), "%s/%s/%s.mf", store, tree, name );
+	if ( !read_manifest( path, &f, &parts, &n_parts, &data_off ) )
+		return 0;
+	mode = ( 0 == fstat( out, &st ) && S_ISREG( st.st_mode ) ) ? COPY_RANGE : COPY_SENDFILE;
+	for ( i = 0; ok && i < n_parts; ++i )
+	{
+		if ( 'i' == parts[i].type )
+		{
+			ok = copy_range( fileno( f ), data_off + parts[i].off, parts[i].len, out, &mode );
+			if ( !ok )
+				fprintf( stderr, "Error: can't write %s/%s from %s: %s.\n",
+						tree, name, path, errno ? strerror( errno ) : "it's short" );
+		}
+		else
+		{
+			blob_path( store, parts[i].hash, path, sizeof( path ) );
+			if ( -1 == ( fd = open( path, O_RDONLY ) ) || 0 != fstat( fd, &st ) ||
+					st.st_size != parts[i].len )
+			{
+				fprintf( stderr, "Error: blob %s of %s/%s is %s.\n", path, tree, name,
+						-1 == fd ? "missing" : "damaged" );
+				ok = 0;
+			}
+			else if ( !( ok = copy_range( fd, 0, parts[i].len, out, &mode ) ) )
+				fprintf( stderr, "Error: can't write %s/%s from %s: %s.\n",
+						tree, name, path, errno ? strerror( errno ) : "it's short" );
+			if ( -1 != fd )
+				close( fd );
+		}
+		*len += parts[i].len;
+	}
+	free( parts );
+	fclose( f );
+	return ok;
+}
+
+/**********
+ copy_range--
+ **********/
+
+int copy_range( int in, off_t off, long len, int out, int *mode )
+{
+	/* len bytes of in from off, to where out is. Each way that doesn't
+	   go for out, the next is tried, and stays for the rest of it. */
+	unsigned char buff[COPY_BUFF];
+	ssize_t n, w, done;
+	off_t o;
+
+#ifndef SYS_copy_file_range
+	if ( COPY_RANGE == *mode )
+		*mode = COPY_SENDFILE;
+#endif
+	while ( len > 0 )
+	{
+		errno = 0;
+#ifdef SYS_copy_file_range
+		if ( COPY_RANGE == *mode )
+		{
+			o = off;
+			n = syscall( SYS_copy_file_range, in, &o, out, NULL, (size_t)len, 0 );
+			if ( n < 0 && ( ENOSYS == errno || EXDEV == errno || EINVAL == errno ||
+						EOPNOTSUPP == errno || EBADF == errno ) )
+			{
+				*mode = COPY_SENDFILE;
+				continue;
+			}
+		}
+		else
+#endif
+		if ( COPY_SENDFILE == *mode )
+		{
+			o = off;
+			n = sendfile( out, in, &o, len );
+			if ( n < 0 && ( ENOSYS == errno || EINVAL == errno ) )
+			{
+				*mode = COPY_RW;
+				continue;
+			}
+		}
+		else
+		{
+			n = pread( in, buff, len < COPY_BUFF ? len : COPY_BUFF, off );
+			for ( done = 0; n > 0 && done < n; done += w )
+				if ( ( w = write( out, buff + done, n - done ) ) <= 0 )
+				{
+					n = -1;
+					break;
+				}
+		}
+		if ( n < 0 && EINTR == errno )
+			continue;
+		if ( n <= 0 )
+			return 0;
+		off += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/*********
+ load_seen--
+ *********/
+
+int load_seen( arc_run *run )
+{
+	/* seen is the hashes one after the other, each with its archive's */
+	struct stat st;
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf( path, sizeof( path ), "%s/seen", run->store );
+	if ( NULL == ( f = fopen( path, "rb" ) ) )
+	{
+		if ( ENOENT == errno )
+			return 1;
+		fprintf( stderr, "Error: can't read %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	if ( 0 != fstat( fileno( f ), &st ) || !append( &run->seen, NULL, st.st_size ) ||
+			fread( run->seen.data, 1, st.st_size, f ) != (size_t)st.st_size )
+	{
+		fprintf( stderr, "Error: can't read %s.\n", path );
+		fclose( f );
+		return 0;
+	}
+	fclose( f );
+	run->seen.len -= run->seen.len % SEEN_LEN;
+	qsort( run->seen.data, run->seen.len / SEEN_LEN, SEEN_LEN, compare_seen );
+	return 1;
+}
+
+/*********
+ save_seen--
+ *********/
+
+int save_seen( arc_run *run )
+{
+	/* The hashes of this import with their archives that weren't seen
+	   before, once each */
+	unsigned char *h, *last = NULL;
+	char path[PATH_MAX];
+	FILE *f = NULL;
+	long i;
+	int fd, ok = 1;
+
+	snprintf( path, sizeof( path ), "%s/seen", run->store );
+	if ( -1 == ( fd = open( path, O_WRONLY | O_APPEND | O_CREAT, 0600 ) ) ||
+			NULL == ( f = fdopen( fd, "ab" ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		if ( -1 != fd )
+			close( fd );
+		return 0;
+	}
+	for ( i = 0; ok && i < run->hashes.len; i += SEEN_LEN )
+	{
+		h = run->hashes.data + i;
+		if ( ( NULL != last && 0 == memcmp( h, last, SEEN_LEN ) ) ||
+				has_key( &run->seen, SEEN_LEN, h, SEEN_LEN ) )
+			continue;
+		ok = fwrite( h, 1, SEEN_LEN, f ) == SEEN_LEN;
+		last = h;
+	}
+	if ( 0 != fclose( f ) || !ok )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	return 1;
+}
+
+/**********
+ prune_seen--
+ **********/
+
+long prune_seen( char *store, buff *owners )
+{
+	/* seen with only the hashes of the owners, sorted, the others' go:
+	   an archive that is gone would keep sharing what one archive has.
+	   Written to seen.tmp and renamed. Returns how many went, or -1 */
+	arc_run run;
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	FILE *f = NULL;
+	long i, n_kept = 0;
+	int fd, ok;
+
+	memset( &run, 0, sizeof( run ) );
+	run.store = store;
+	if ( !load_seen( &run ) )
+		return -1;
+	for ( i = 0; i < run.seen.len; i += SEEN_LEN )
+		if ( has_key( owners, OWNER_LEN, run.seen.data + i + HASH_LEN, OWNER_LEN ) )
+			memmove( run.seen.data + SEEN_LEN * n_kept++, run.seen.data + i, SEEN_LEN );
+	i = run.seen.len / SEEN_LEN - n_kept;
+	if ( 0 == i )
+	{
+		free( run.seen.data );
+		return 0;
+	}
+
+	snprintf( path, sizeof( path ), "%s/seen", store );
+	snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+	ok = -1 != ( fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600 ) ) &&
+		NULL != ( f = fdopen( fd, "wb" ) ) &&
+		fwrite( run.seen.data, SEEN_LEN, n_kept, f ) == (size_t)n_kept;
+	if ( NULL != f )
+		ok = 0 == fclose( f ) && ok;
+	else if ( -1 != fd )
+		close( fd );
+	if ( !ok || 0 != rename( tmp, path ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		unlink( tmp );
+		i = -1;
+	}
+	free( run.seen.data );
+	return i;
+}
+
+/******
+ append--
+ ******/
+
+int append( buff *b, const void *p, long n )
+{
+	/* n bytes of p to the end of b, or room for them if p is NULL */
+	unsigned char *more;
+	long size;
+
+	if ( b->len + n > b->size )
+	{
+		for ( size = b->size ? 2 * b->size : 4096; size < b->len + n; size *= 2 )
+			;
+		if ( NULL == ( more = realloc( b->data, size ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			return 0;
+		}
+		b->data = more;
+		b->size = size;
+	}
+	if ( NULL != p )
+		memcpy( b->data + b->len, p, n );
+	b->len += n;
+	return 1;
+}
+
+/********
+ find_key--
+ ********/
+
+long find_key( buff *b, int rec_len, unsigned char *key, int key_len )
+{
+	/* The first record of the sorted b that starts with key, or where
+	   it would be */
+	long lo = 0, hi = b->len / rec_len, mid;
+
+	while ( lo < hi )
+	{
+		mid = ( lo + hi ) / 2;
+		if ( memcmp( b->data + mid * rec_len, key, key_len ) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*******
+ has_key--
+ *******/
+
+int has_key( buff *b, int rec_len, unsigned char *key, int key_len )
+{
+	long i = find_key( b, rec_len, key, key_len ) * rec_len;
+
+	return i < b->len && 0 == memcmp( b->data + i, key, key_len );
+}
+
+/********
+ hash_hex--
+ ********/
+
+void hash_hex( unsigned char *hash, char *hex )
+{
+	int i;
+
+	for ( i = 0; i < HASH_LEN; ++i )
+		sprintf( hex + 2 * i, "%02x", hash[i] );
+	return;
+}
+
+/********
+ hex_hash--
+ ********/
+
+int hex_hash( char *hex, unsigned char *hash )
+{
+	unsigned int b;
+	int i;
+
+	for ( i = 0; i < HASH_LEN; ++i )
+	{
+		if ( !strchr( "0123456789abcdef", hex[2 * i] ) || '\0' == hex[2 * i] ||
+				!strchr( "0123456789abcdef", hex[2 * i + 1] ) || '\0' == hex[2 * i + 1] ||
+				1 != sscanf( hex + 2 * i, "%2x", &b ) )
+			return 0;
+		hash[i] = b;
+	}
+	return 1;
+}
+
+/*********
+ blob_path--
+ *********/
+
+void blob_path( char *store, unsigned char *hash, char *path, size_t size )
+{
+	char hex[2 * HASH_LEN + 1];
+
+	hash_hex( hash, hex );
+	snprintf( path, size, "%s/blobs/%.2s/%s.gz", store, hex, hex );
+	return;
+}
+
+/*********
+ tree_name--
+ *********/
+
+int tree_name( char *tree, char *name, size_t size )
+{
+	/* The last part of the tree's path, openvpn, www, asterisk */
+	char *p, *end = tree + strlen( tree );
+
+	while ( end > tree && '/' == end[-1] )
+		--end;
+	for ( p = end; p > tree && '/' != p[-1]; --p )
+		;
+	if ( p == end || end - p >= (long)size || '.' == *p )
+	{
+		fprintf( stderr, "Error: no tree name in %s, give its directory, e.g. ../openvpn.\n",
+				tree );
+		return 0;
+	}
+	memcpy( name, p, end - p );
+	name[end - p] = '\0';
+	return 1;
+}
+
+/************
+ compare_hash--
+ ************/
+
+int compare_hash( const void *a, const void *b )
+{
+	return memcmp( a, b, HASH_LEN );
+}
+
+/************
+ compare_seen--
+ ************/
+
+int compare_seen( const void *a, const void *b )
+{
+	return memcmp( a, b, SEEN_LEN );
+}
+
+/*************
+ compare_owner--
+ *************/
+
+int compare_owner( const void *a, const void *b )
+{
+	return memcmp( a, b, OWNER_LEN );
+}
+
+/************
+ compare_name--
+ ************/
+
+int compare_name( const void *a, const void *b )
+{
+	return strcmp( *(char **)a, *(char **)b );
+}
+
+/***
+ now--
+ ***/
+
+double now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -0,0 +1,486 @@
+/*
+bench-mc - times each phase of a gen-mc issuance on its own
+
+Runs every phase of issuing a MiniCert -n times over and reports the
+throughput, the mean, p50 and p99 latency, and the OpenSSL allocations
+per operation. Without -k a throwaway 1024-bit test CA is made first.
+Nothing it issues is kept, the files go to a scratch directory that is
+emptied again.
+
+  keygen   - a 512-bit user key, RSA_generate_key() and RSA_check_key()
+             with the tries per usable key counted
+  bulkgen  - a 512-bit user key from a genmc_keygen, the way batch mode
+             makes them; every one is put through RSA_check_key() after
+             the clock stops
+  ca_load  - reading the CA PEM file and checking the key
+  digest   - SHA-1 over the user info and user modulus
+  sign     - RSA_private_encrypt() of the digest with the CA key
+  signer   - digest and signature through a ready made genmc_signer
+  base64   - encoding the MiniCert and the private exponent with
+             genmc_b64_encode(), the code it picked is shown at the end
+  b64_evp  - the same with EVP_EncodeBlock(), the output has to match
+  unbase64 - decoding the two again with genmc_b64_decode()
+             The three base64 phases are timed over B64_ROUNDS rounds
+             each, one round is too short for the clock
+  write    - writing the .mini_cert and .mini_pkey files
+  issue    - genmc_issue() end to end, user key included
+
+Run it before and after a change, on the same host, and compare the
+lines; a phase that slows down or allocates more is a regression.
+
+16oct2026, v0.1
+ - first version
+16oct2026, v0.2
+ - add the signer phase
+16oct2026, v0.3
+ - add the bulkgen phase
+16oct2026, v0.4
+ - add the b64_evp and unbase64 phases and -B to pick the base64 code;
+   the base64 phase no longer counts BN_bn2bin() of the private exponent
+ - the base64 phases time B64_ROUNDS rounds
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+#include "genmc.h"
+
+#define B64_ROUNDS 100
+
+enum
+{
+	PHASE_KEYGEN = 0,
+	PHASE_BULKGEN,
+	PHASE_CA_LOAD,
+	PHASE_DIGEST,
+	PHASE_SIGN,
+	PHASE_SIGNER,
+	PHASE_BASE64,
+	PHASE_B64_EVP,
+	PHASE_UNBASE64,
+	PHASE_WRITE,
+	PHASE_ISSUE,
+	PHASE_COUNT            /* keep last */
+};
+
+static char *phase_names[PHASE_COUNT] =
+{
+	"keygen",
+	"bulkgen",
+	"ca_load",
+	"digest",
+	"sign",
+	"signer",
+	"base64",
+	"b64_evp",
+	"unbase64",
+	"write",
+	"issue"
+};
+
+/* samples of one phase */
+typedef struct phase_stats
+{
+	double *ns;            /* nanoseconds per iteration */
+	int n;
+	unsigned long allocs;  /* OpenSSL allocations over all iterations */
+} phase_stats;
+
+/* OpenSSL's allocations go through these, bench-mc is single threaded */
+static unsigned long alloc_count = 0;
+
+static void *count_malloc( size_t size );
+static void *count_realloc( void *ptr, size_t size );
+static void count_free( void *ptr );
+
+double now_ns( void );
+void phase_start( double *t0, unsigned long *a0 );
+void phase_stop( phase_stats *ps, double t0, unsigned long a0 );
+void report( phase_stats *ps, int n_phases, unsigned long keygen_tries );
+int  compare_doubles( const void *a, const void *b );
+int  make_test_ca( const char *ca_file );
+void die( const char *what, int err );
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char help[] =
+		"bench-mc - times each phase of a gen-mc issuance\n"
+		"Usage: bench-mc [-n iterations] [-k cakey.pem] [-O scratch dir]\n"
+		"                [-B scalar|sse4|avx2]\n"
+		"  -n <count>  - iterations of every phase, default 200\n"
+		"  -k <file>   - CA key pair in PEM, default a throwaway test CA\n"
+		"  -O <dir>    - scratch directory for the written files, default /tmp\n"
+		"  -B <code>   - base64 code to use, default the best the CPU has\n"
+		"  -h          - this help\n";
+	phase_stats ps[PHASE_COUNT];
+	char ca_file[600], scratch[256], dir[512], mcfile[600], pkfile[600];
+	char mc_b64[GENMC_MC_B64_SIZE], pk_b64[GENMC_PK_B64_SIZE];
+	char mc_evp[GENMC_MC_B64_SIZE], pk_evp[GENMC_PK_B64_SIZE];
+	unsigned char mess3[GENMC_MC_LEN + 2], u_pr_e2[GENMC_USER_MOD_LEN * 2];
+	char *b64_code = NULL;
+	unsigned char user_info[GENMC_USER_INFO_LEN];
+	unsigned char mess[GENMC_MC_LEN], mess2[GENMC_MC_LEN];
+	unsigned char m[EVP_MAX_MD_SIZE];
+	unsigned char sigret[GENMC_SIG_LEN];
+	unsigned char u_pr_e[GENMC_USER_MOD_LEN * 2];
+	unsigned int m_len;
+	unsigned long keygen_tries = 0, a0;
+	char expiry_date[16];
+	struct tm expiry_tm;
+	EVP_MD_CTX mdctx;
+	const EVP_MD *md;
+	RSA *ca_rsa, *user_rsa, *rsa;
+	genmc_ctx *ctx;
+	genmc_signer *signer;
+	genmc_keygen *keygen;
+	FILE *fp;
+	double t0;
+	int iterations = 200, own_ca = 0;
+	int mess_len, u_pr_e_len, err, i, c, p, r, len1, len2;
+
+	strcpy( ca_file, "" );
+	strcpy( scratch, "/tmp" );
+	while ( -1 != ( c = getopt( argc, argv, "hn:k:O:B:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'n':
+				iterations = atoi( optarg );
+				break;
+			case 'k':
+				strncpy( ca_file, optarg, sizeof( ca_file ) - 1 );
+				break;
+			case 'O':
+				strncpy( scratch, optarg, sizeof( scratch ) - 1 );
+				break;
+			case 'B':
+				b64_code = optarg;
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE );
+		}
+	}
+	if ( iterations < 1 )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	if ( GENMC_OK != ( err = genmc_b64_use( b64_code ) ) )
+		die( b64_code, err );
+
+	/* has to be in place before OpenSSL allocates anything */
+	CRYPTO_set_mem_functions( count_malloc, count_realloc, count_free );
+
+	snprintf( dir, sizeof( dir ), "%s/bench-mc.%ld", scratch, (long)getpid() );
+	if ( 0 != mkdir( dir, 0700 ) )
+	{
+		fprintf( stderr, "Error: can't make scratch directory %s\n", dir );
+		exit( EXIT_FAILURE );
+	}
+	if ( 0 == strlen( ca_file ) )
+	{
+		snprintf( ca_file, sizeof( ca_file ), "%s/test_ca.pem", dir );
+		if ( !make_test_ca( ca_file ) )
+			die( "making the test CA", GENMC_ERR_KEYGEN );
+		own_ca = 1;
+	}
+
+	if ( GENMC_OK != ( err = genmc_load_ca_key( ca_file, &ca_rsa ) ) )
+		die( ca_file, err );
+	if ( GENMC_OK != ( err = genmc_init( &ctx, ca_rsa ) ) )
+		die( ca_file, err );
+	if ( GENMC_OK != ( err = genmc_signer_new( &signer, ca_rsa ) ) )
+		die( ca_file, err );
+	if ( GENMC_OK != ( err = genmc_keygen_new( &keygen ) ) )
+		die( "bulkgen", err );
+	md = EVP_get_digestbyname( "sha1" );
+
+	err = genmc_pack_user_info( user_info, "Bench User", "1234567",
+			expiry_date, "365", 0, &expiry_tm );
+	if ( GENMC_OK != err )
+		die( "packing the user info", err );
+
+	for ( p = 0; p < PHASE_COUNT; ++p )
+	{
+		ps[p].n = 0;
+		ps[p].allocs = 0;
+		if ( NULL == ( ps[p].ns = malloc( iterations * sizeof( double ) ) ) )
+			die( "", GENMC_ERR_NOMEM );
+	}
+
+	for ( i = 0; i < iterations; ++i )
+	{
+		/* the same loop as genmc_gen_user_key(), so the tries show */
+		phase_start( &t0, &a0 );
+		for ( c = 0, user_rsa = NULL; c < 16 && NULL == user_rsa; ++c )
+		{
+			++keygen_tries;
+			user_rsa = RSA_generate_key( GENMC_USER_BITS, RSA_F4, NULL, NULL );
+			if ( NULL == user_rsa )
+				die( "keygen", GENMC_ERR_KEYGEN );
+			if ( !RSA_check_key( user_rsa ) )
+			{
+				RSA_free( user_rsa );
+				user_rsa = NULL;
+			}
+		}
+		phase_stop( &ps[PHASE_KEYGEN], t0, a0 );
+		if ( NULL == user_rsa )
+			die( "keygen", GENMC_ERR_NO_USABLE_KEY );
+
+		phase_start( &t0, &a0 );
+		err = genmc_keygen_make( keygen, &rsa );
+		phase_stop( &ps[PHASE_BULKGEN], t0, a0 );
+		if ( GENMC_OK != err )
+			die( "bulkgen", err );
+		if ( 1 != RSA_check_key( rsa ) )
+			die( "bulkgen, RSA_check_key() failed", GENMC_ERR_NO_USABLE_KEY );
+		RSA_free( rsa );
+
+		phase_start( &t0, &a0 );
+		if ( GENMC_OK != ( err = genmc_load_ca_key( ca_file, &rsa ) ) ||
+				GENMC_OK != ( err = genmc_check_ca_key( rsa ) ) )
+			die( "ca_load", err );
+		RSA_free( rsa );
+		phase_stop( &ps[PHASE_CA_LOAD], t0, a0 );
+
+		memcpy( mess, user_info, GENMC_USER_INFO_LEN );
+		mess_len = GENMC_USER_INFO_LEN;
+		mess_len += BN_bn2bin( user_rsa->n, mess + mess_len );
+
+		phase_start( &t0, &a0 );
+		EVP_MD_CTX_init( &mdctx );
+		c = EVP_DigestInit_ex( &mdctx, md, NULL )
+			&& EVP_DigestUpdate( &mdctx, mess, mess_len )
+			&& EVP_DigestFinal_ex( &mdctx, m, &m_len );
+		EVP_MD_CTX_cleanup( &mdctx );
+		phase_stop( &ps[PHASE_DIGEST], t0, a0 );
+		if ( !c )
+			die( "digest", GENMC_ERR_DIGEST );
+
+		phase_start( &t0, &a0 );
+		c = RSA_private_encrypt( m_len, m, sigret, ca_rsa, RSA_PKCS1_PADDING );
+		phase_stop( &ps[PHASE_SIGN], t0, a0 );
+		if ( c <= 0 )
+			die( "sign", GENMC_ERR_SIGN );
+		memcpy( mess2, mess, mess_len );
+		memcpy( mess + mess_len, sigret, c );
+		mess_len += c;
+		mess_len += BN_bn2bin( ca_rsa->n, mess + mess_len );
+
+		c = GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN;
+		phase_start( &t0, &a0 );
+		err = genmc_signer_sign( signer, mess2, &c );
+		phase_stop( &ps[PHASE_SIGNER], t0, a0 );
+		if ( GENMC_OK != err || memcmp( mess, mess2, GENMC_MC_LEN ) )
+			die( "signer", GENMC_OK != err ? err : GENMC_ERR_SIGN );
+
+		u_pr_e_len = BN_bn2bin( user_rsa->d, u_pr_e );
+		phase_start( &t0, &a0 );
+		for ( r = 0; r < B64_ROUNDS; ++r )
+			if ( GENMC_OK != ( err = genmc_b64_encode( mess, mess_len, mc_b64,
+					sizeof( mc_b64 ) ) ) ||
+					GENMC_OK != ( err = genmc_b64_encode( u_pr_e, u_pr_e_len,
+					pk_b64, sizeof( pk_b64 ) ) ) )
+				die( "base64", err );
+		phase_stop( &ps[PHASE_BASE64], t0, a0 );
+
+		phase_start( &t0, &a0 );
+		for ( r = 0; r < B64_ROUNDS; ++r )
+		{
+			EVP_EncodeBlock( (unsigned char *)mc_evp, mess, mess_len );
+			EVP_EncodeBlock( (unsigned char *)pk_evp, u_pr_e, u_pr_e_len );
+		}
+		phase_stop( &ps[PHASE_B64_EVP], t0, a0 );
+		if ( strcmp( mc_b64, mc_evp ) || strcmp( pk_b64, pk_evp ) )
+			die( "base64 differs from EVP_EncodeBlock()", GENMC_ERR_B64_IMPL );
+
+		phase_start( &t0, &a0 );
+		for ( r = 0; r < B64_ROUNDS; ++r )
+			if ( GENMC_OK != ( err = genmc_b64_decode( mc_b64, strlen( mc_b64 ),
+					mess3, sizeof( mess3 ), &len1 ) ) ||
+					GENMC_OK != ( err = genmc_b64_decode( pk_b64, strlen( pk_b64 ),
+					u_pr_e2, sizeof( u_pr_e2 ), &len2 ) ) )
+				die( "unbase64", err );
+		phase_stop( &ps[PHASE_UNBASE64], t0, a0 );
+		if ( len1 != mess_len || memcmp( mess3, mess, len1 ) ||
+				len2 != u_pr_e_len || memcmp( u_pr_e2, u_pr_e, len2 ) )
+			die( "unbase64 doesn't give the bytes back", GENMC_ERR_MC_CORRUPT );
+
+		/* the way gen-mc writes them, -O batch mode names included */
+		snprintf( mcfile, sizeof( mcfile ), "%s/u%d.mini_cert", dir, i );
+		snprintf( pkfile, sizeof( pkfile ), "%s/u%d.mini_pkey", dir, i );
+		phase_start( &t0, &a0 );
+		if ( NULL == ( fp = fopen( mcfile, "w" ) ) || EOF == fputs( mc_b64, fp ) ||
+				0 != fclose( fp ) || NULL == ( fp = fopen( pkfile, "w" ) ) ||
+				EOF == fputs( pk_b64, fp ) || 0 != fclose( fp ) )
+			die( mcfile, GENMC_ERR_BUFFER );
+		phase_stop( &ps[PHASE_WRITE], t0, a0 );
+		unlink( mcfile );
+		unlink( pkfile );
+		RSA_free( user_rsa );
+
+		phase_start( &t0, &a0 );
+		if ( GENMC_OK != ( err = genmc_issue( ctx, user_info, NULL, mc_b64,
+				sizeof( mc_b64 ), pk_b64, sizeof( pk_b64 ) ) ) )
+			die( "issue", err );
+		phase_stop( &ps[PHASE_ISSUE], t0, a0 );
+	}
+
+	report( ps, PHASE_COUNT, keygen_tries );
+	fprintf( stdout, "base64 code: %s\n", genmc_b64_impl() );
+
+	for ( p = 0; p < PHASE_COUNT; ++p )
+		free( ps[p].ns );
+	genmc_signer_free( signer );
+	genmc_keygen_free( keygen );
+	genmc_free( ctx );
+	RSA_free( ca_rsa );
+	if ( own_ca )
+		unlink( ca_file );
+	rmdir( dir );
+	return EXIT_SUCCESS;
+}
+
+/******
+ now_ns--
+ ******/
+
+double now_ns( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/***********
+ phase_start--
+ ***********/
+
+void phase_start( double *t0, unsigned long *a0 )
+{
+	*a0 = alloc_count;
+	*t0 = now_ns();
+	return;
+}
+
+/**********
+ phase_stop--
+ **********/
+
+void phase_stop( phase_stats *ps, double t0, unsigned long a0 )
+{
+	ps->ns[ps->n++] = now_ns() - t0;
+	ps->allocs += alloc_count - a0;
+	return;
+}
+
+/******
+ report--
+ ******/
+
+void report( phase_stats *ps, int n_phases, unsigned long keygen_tries )
+{
+	/* one line per phase, the same columns every run so two runs can be
+	   put side by side with diff or paste */
+	double total, p50, p99;
+	int p, i;
+
+	fprintf( stdout, "%-8s %8s %12s %12s %12s %12s %10s\n", "phase", "iters",
+			"ops/s", "mean_us", "p50_us", "p99_us", "allocs/op" );
+	for ( p = 0; p < n_phases; ++p )
+	{
+		qsort( ps[p].ns, ps[p].n, sizeof( double ), compare_doubles );
+		for ( i = 0, total = 0; i < ps[p].n; ++i )
+			total += ps[p].ns[i];
+		p50 = ps[p].ns[ ( ps[p].n - 1 ) / 2 ];
+		p99 = ps[p].ns[ (int)( ( ps[p].n - 1 ) * 0.99 ) ];
+		fprintf( stdout, "%-8s %8d %12.1f %12.2f %12.2f %12.2f %10.1f\n",
+				phase_names[p], ps[p].n,
+				total > 0 ? ps[p].n * 1e9 / total : 0.0,
+				total / ps[p].n / 1e3, p50 / 1e3, p99 / 1e3,
+				(double)ps[p].allocs / ps[p].n );
+	}
+	fprintf( stdout, "keygen tries: %lu for %d keys, %.3f per usable key\n",
+			keygen_tries, ps[PHASE_KEYGEN].n,
+			(double)keygen_tries / ps[PHASE_KEYGEN].n );
+	return;
+}
+
+/***************
+ compare_doubles--
+ ***************/
+
+int compare_doubles( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return ( x > y ) - ( x < y );
+}
+
+/************
+ make_test_ca--
+ ************/
+
+int make_test_ca( const char *ca_file )
+{
+	RSA *rsa;
+	FILE *fp;
+	int ok;
+
+	if ( NULL == ( rsa = RSA_generate_key( GENMC_CA_BITS, RSA_F4, NULL, NULL ) ) )
+		return 0;
+	if ( NULL == ( fp = fopen( ca_file, "w" ) ) )
+	{
+		RSA_free( rsa );
+		return 0;
+	}
+	ok = PEM_write_RSAPrivateKey( fp, rsa, NULL, NULL, 0, NULL, NULL );
+	ok = ( 0 == fclose( fp ) ) && ok;
+	RSA_free( rsa );
+	return ok;
+}
+
+/***
+ die--
+ ***/
+
+void die( const char *what, int err )
+{
+	fprintf( stderr, "Error: %s: %s\n", what, genmc_strerror( err ) );
+	exit( EXIT_FAILURE );
+}
+
+/*****************
+ OpenSSL allocators--
+ *****************/
+
+static void *count_malloc( size_t size )
+{
+	++alloc_count;
+	return malloc( size );
+}
+
+static void *count_realloc( void *ptr, size_t size )
+{
+	++alloc_count;
+	return realloc( ptr, size );
+}
+
+static void count_free( void *ptr )
+{
+	free( ptr );
+	return;
+}
@@ -32,6 +32,116 @@ An attempt to re-invent the Sipura|Linksys's "gen_mc" utility
  - change default expiry date to Jan 2038 (posix long date rollover)
  - check expiry date to make sure it isn't in the past
  - add -v option to display user info and MC expiry date to stdout
+16oct2026, v0.99
+ - add -b option to issue a whole roster of users in one run, the CA
+   key is read and checked only once
+ - add -O option, the directory batch MiniCerts and keys are written to
+ - a bad roster record is reported and skipped, the batch carries on
+ - split main() into helpers shared by the single and batch modes
+16oct2026, v1.00
+ - batch mode makes the user keys on a pool of worker threads while the
+   main thread signs and writes them out in roster order
+ - add -j option for the number of key generation threads, it defaults
+   to the number of online CPUs
+ - set up the OpenSSL locking and thread id callbacks
+16oct2026, v1.01
+ - add -F option to fill a key spool with ready made, checked user keys
+   up to the -W high watermark whenever it drops below the low one
+ - add -s option to take user keys from the spool, so issuing is down to
+   the hash and the signature; a new key is made if the spool is empty
+ - a spool key is claimed with rename(), it is used at most once even
+   with several issuers at work
+16oct2026, v1.02
+ - the user info packing, key generation, signing and base64 encoding
+   moved into libgenmc (genmc.c, genmc_spool.c, genmc.h), it returns
+   error codes and writes into the caller's buffers. gen-mc is now a
+   front end over it, libgenmc.make builds the static and shared library
+ - MiniCert and key files are written from the encoded buffers
+16oct2026, v1.03
+ - the MiniCert and key are encoded once in memory and the same bytes go
+   to every output, nothing is read back from the files for stdout
+ - add -f option to write framed records to a file descriptor or pipe
+ - add -N option to write no MiniCert and key files at all
+16oct2026, v1.04
+ - add -V option to check a MiniCert, or every *.mini_cert in a directory
+   on the -j threads, against the CA: its embedded CA modulus, the SHA-1
+   and PKCS#1 signature and the expiry date. The report is one tab
+   separated line per MiniCert, valid, expired, wrong_ca or corrupt
+ - -k may be a public key or the CA certificate with -V
+16oct2026, v1.05
+ - the CA key is made ready for signing once, in a genmc_signer that
+   keeps its Montgomery contexts, blinding and digest context, instead of
+   per signature
+16oct2026, v1.06
+ - batch mode runs on the libgenmc issuing pipeline: packing, key
+   generation, signing, base64 and output are stages joined by bounded
+   queues, results still come out in roster order
+ - add -P option for the number of key, signing and base64 threads
+ - with -v batch mode shows how busy each stage was
+16oct2026, v1.07
+ - add -S option to add the issued MiniCerts and keys to a single file
+   store of fixed size records with an index by user id and display
+   name (libgenmc genmc_store.c), instead of or as well as the files
+ - add -L option to look a user up in the store, or write out all of it
+16oct2026, v1.08
+ - add -R option to re-sign existing MiniCerts, in files or a store, on
+   the -j threads: the user modulus is kept so the phones keep their
+   keys, only the expiry date (-e, -E) and/or the CA (-k) change
+ - add -K option for the CA the MiniCerts to re-sign were issued by
+16oct2026, v1.09
+ - batch mode and -F make user keys with a genmc_keygen (libgenmc
+   genmc_keygen.c): a sieved prime search with its tables and BN_CTX
+   kept per thread, and no second primality test of every key; about
+   2.5 times the keys per second of RSA_generate_key()/RSA_check_key()
+16oct2026, v1.10
+ - add -D option to run as a daemon on a Unix socket: the CA key is
+   loaded once, and issue, verify and re-sign requests, framed like the
+   -f records, are served on the -j threads for any number of clients.
+   User keys are made ahead and kept in memory, the memory is locked
+   and no core file is written. mc-client.c is a client for it
+ - the framed records are built and taken apart by libgenmc
+   (genmc_frame.c)
+16oct2026, v1.11
+ - add --stats=json: batch mode and the daemon write their counters,
+   failures by reason and the latency percentiles and histogram of each
+   phase to stderr as a line of JSON when they finish, and the daemon
+   whenever it gets SIGUSR1 (libgenmc genmc_stats.c)
+ - add --trace=<file> for a Chrome trace event per phase of every record
+   or request, batch and daemon mode
+ - the DEBUG build no longer prints the CA's and the users' private
+   exponents
+16oct2026, v1.12
+ - a roster record may have the phone's MAC address after the expiry
+ - add -X option to write a Linksys|Sipura XML provisioning profile,
+   spa<mac>.xml, for every phone in the roster, with its display name,
+   user id, MiniCert and SRTP key in it. Each one is written by the
+   output stage as soon as it is issued, to a temporary name and renamed,
+   so a TFTP or HTTP server can serve the directory during the run
+ - add -T option for a profile with the site's settings every phone gets
+16oct2026, v1.13
+ - add --replay=<seed> to a build with -DGENMC_REPLAY (gen-mc-replay.make):
+   every random byte comes from the seed, so the same roster, -e date and
+   CA give the same MiniCerts and keys on every run and with any number
+   of threads (libgenmc genmc_replay.c). replay-mc.sh checks a new build
+   against the output and time of an old one with it
+16oct2026, v1.14
+ - the -S store is synced every 256 records of a batch or a re-sign, not
+   only when it is closed: a crash loses at most the last 255
+ - the daemon syncs the -S store before it answers "ok" to an issue
+   request, and its key maker reads the stop flag under the lock
+ - a -X profile's temporary name has the pid in it, two runs writing the
+   same MAC to one directory no longer share it
+ - a roster line too long to read is refused with its line number, it
+   was read as two records; -v with -b only shows the stage times,
+   -v -v the users as well
+ - the pack and the output thread of a batch count their failures
+   apart, they are added up once the pipeline has finished
+ - the daemon's key maker waits after a failed key, 1 second and twice
+   as long each time after up to a minute, it went round at full speed
+ - -L refuses a store record with a broken expiry date, as issuing does,
+   instead of writing it out with whatever the date came to
+ - the key pool only makes keys, -F was its one user and never passed
+   it a spool to take from
 
 To do:
  - check possible getopt() differences on different platforms
@@ -45,17 +155,259 @@ To do:
   #include <unix.h>
 #endif
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <openssl/ssl.h>
+#include <openssl/err.h>
 #include <time.h>
+#include "genmc.h"
+
+#ifdef GENMC_REPLAY
+  #define REPLAY_HELP \
+		"Replay build:\n" \
+		"  --replay=<seed>   - Take every random byte from <seed>, so the same roster,\n" \
+		"                      -e date and CA give the same output every time, for\n" \
+		"                      checking a build against another. Not with -s, -F or\n" \
+		"                      -D. The keys are known to anyone with the seed\n"
+#else
+  #define REPLAY_HELP ""
+#endif
+
+/* a checked roster record on its way through the pipeline */
+typedef struct roster_rec
+{
+	char display_name[80], user_id[80], expiry_date[80];
+	char mac[13];         /* 12 lower case hex digits, "" for none */
+	struct tm expiry_tm;
+	int line_no;
+} roster_rec;
+
+/* user keys made ahead by the worker threads, for filling the spool */
+typedef struct key_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+	RSA **keys;           /* ring of finished keys, NULL for a failed one */
+	int size, head, count;
+	int to_make;          /* keys not yet claimed by a worker */
+	pthread_t *threads;
+	int n_threads;
+} key_pool;
+
+/* the longest roster line, without its newline */
+#define ROSTER_LINE_MAX 1023
+
+/* a batch's store records lost to a crash at most, one fsync() each */
+#define STORE_SYNC_RECORDS 256
+
+/* where an issued MiniCert and key go, all from the same encoded bytes */
+typedef struct out_sinks
+{
+	unsigned char files;   /* the -o/-p files, or the -O directory */
+	unsigned char admin;   /* stdout, Sipura admin manual format */
+	unsigned char verbose; /* stdout, user info and expiry date */
+	int frame_fd;          /* framed records, -1 for none */
+	genmc_store *store;    /* MiniCert store, NULL for none */
+} out_sinks;
+
+/* MiniCerts being checked by the verify threads */
+typedef struct verify_result
+{
+	int status;
+	char display_name[GENMC_NAME_MAX + 1];
+	char user_id[GENMC_ID_MAX + 1];
+	char expiry_date[GENMC_EXPIRY_LEN + 1];
+} verify_result;
+
+typedef struct verify_job
+{
+	RSA *ca_rsa;
+	time_t now;
+	char **files;
+	int n_files;
+	int next;             /* next file for a worker to take */
+	pthread_mutex_t lock;
+	verify_result *results;
+} verify_job;
+
+/* MiniCerts being signed over again by the re-sign threads */
+typedef struct resign_result
+{
+	int err;
+	char display_name[GENMC_NAME_MAX + 1];
+	char expiry_date[GENMC_EXPIRY_LEN + 1];
+	char mc_b64[GENMC_MC_B64_SIZE];
+} resign_result;
+
+typedef struct resign_job
+{
+	RSA *ca_rsa, *old_ca_rsa;
+	char *expiry_date;    /* NULL keeps the old one */
+	char *out_dir;        /* NULL rewrites the files in place */
+	genmc_store *store;   /* re-sign a store, or else the files */
+	char **files;
+	long n_items;
+	long next;            /* next item for a worker to take */
+	pthread_mutex_t lock;
+	resign_result *results;
+} resign_job;
+
+/* a batch run, the source and the sink of the pipeline */
+typedef struct batch_run
+{
+	FILE *fp;
+	int line_no;
+	char *out_dir, *expiry_date, *expiry_days;
+	unsigned char midnight;
+	out_sinks *out;
+	int skipped;          /* bad records, counted by the pack thread */
+	int issued, failed;   /* counted by the output thread */
+	genmc_stats *stats;   /* NULL for none */
+	char *profile_dir;    /* NULL for no provisioning profiles */
+	char *profile;        /* the site profile, split at <flat-profile> */
+	int head_len, tail_len;
+	char *profile_buff;   /* one phone's, built by the output stage */
+	unsigned long long *macs; /* hash set of the MACs seen, MAC + 1 */
+	int macs_size, n_macs;
+} batch_run;
+
+/* a client of the daemon, one request of it is worked on at a time */
+#define SERVE_MAX_CONNS 256
+#define SERVE_REPLY_SIZE ( GENMC_FRAME_MAX + 1 )
+
+/* the key maker's longest wait after a failed key, in seconds */
+#define SERVE_KEYGEN_BACKOFF 60
+
+typedef struct serve_conn
+{
+	int fd;               /* -1 for a free slot */
+	int busy;             /* a request is with the workers */
+	int dead;             /* the reply couldn't be written */
+	int len;              /* bytes in buff */
+	int used;             /* bytes the request being worked on took */
+	double queued;        /* when it was handed to the workers */
+	int n_fields;
+	char *fields[GENMC_FRAME_FIELDS];
+	char buff[GENMC_FRAME_MAX];
+} serve_conn;
+
+/* the daemon, shared by the socket loop, the workers and the key maker */
+typedef struct serve_run
+{
+	RSA *ca_rsa, *old_ca_rsa;
+	char *spool_dir;      /* NULL for none */
+	char *expiry_date, *expiry_days;
+	unsigned char midnight;
+	genmc_store *store;   /* NULL for none */
+	pthread_mutex_t store_lock;
+	serve_conn conns[SERVE_MAX_CONNS];
+	pthread_mutex_t lock;
+	pthread_cond_t have_req, need_keys;
+	int reqs[SERVE_MAX_CONNS]; /* ring of slots with a request waiting */
+	int req_head, req_count;
+	int done[SERVE_MAX_CONNS]; /* slots whose reply has been written */
+	int done_count;
+	int wake[2];          /* a byte in it wakes the socket loop */
+	int stopping;
+	RSA **keys;           /* user keys made ahead */
+	int n_keys, max_keys;
+	long issued, verified, resigned, failed;
+	long n_reqs;          /* requests given to the workers so far */
+	genmc_stats *stats;   /* NULL for none */
+	unsigned char stats_json; /* SIGUSR1 writes the stats out */
+} serve_run;
+
+/* what a daemon worker keeps from one request to the next */
+typedef struct serve_worker
+{
+	serve_run *run;
+	int err;              /* GENMC_OK, or why it couldn't start */
+	genmc_ctx *ctx;
+	genmc_signer *signer;
+	genmc_keygen *keygen;
+	long rec;             /* the request being worked on, from 0 */
+} serve_worker;
 
 /* prototypes */
-void show_cert_info( char *cert_filename, char *userpk_filename );
+char *emit_user( out_sinks *out, char *display_name, char *user_id,
+		char *expiry_date, struct tm *expiry_tm, char *mc_b64, char *pk_b64,
+		char *minicert_filename, char *user_pk_filename );
+char *write_user_files( char *mc_b64, char *pk_b64,
+		char *minicert_filename, char *user_pk_filename );
+char *write_frame( int fd, char *display_name, char *user_id,
+		char *expiry_date, char *mc_b64, char *pk_b64 );
+int  write_all( int fd, char *buff, int len );
+int  lookup_store( char *store_path, char *display_name, char *user_id,
+		char *out_dir, out_sinks *out, char *minicert_filename,
+		char *user_pk_filename );
+int  fill_spool( char *spool_dir, int low, int high, int n_threads );
+int  issue_batch( RSA *ca_rsa, char *roster_filename, char *out_dir,
+		char *expiry_date, char *expiry_days, unsigned char midnight,
+		out_sinks *out, genmc_pipe_conf *conf, unsigned char show_stages,
+		char *profile_dir, char *template_filename );
+int  batch_source( void *arg, genmc_job *job );
+void batch_sink( void *arg, genmc_job *job );
+int  load_profile( batch_run *batch, char *template_filename );
+char *write_profile( batch_run *batch, roster_rec *rec, char *mc_b64,
+		char *pk_b64 );
+int  xml_escape( char *dst, char *src );
+int  parse_mac( char *mac, char *src );
+int  mac_seen( batch_run *batch, char *mac );
+int  key_pool_start( key_pool *pool, int n_keys, int n_threads );
+RSA *key_pool_get( key_pool *pool );
+void key_pool_stop( key_pool *pool );
+void *key_worker( void *arg );
+int  verify_paths( RSA *ca_rsa, char *path, int n_threads );
+void *verify_worker( void *arg );
+int  resign_paths( RSA *ca_rsa, RSA *old_ca_rsa, char *path, char *expiry_date,
+		char *out_dir, int n_threads );
+void *resign_worker( void *arg );
+int  serve( RSA *ca_rsa, RSA *old_ca_rsa, char *socket_path, char *spool_dir,
+		char *expiry_date, char *expiry_days, unsigned char midnight,
+		genmc_store *store, int n_threads, int n_keys, genmc_stats *stats,
+		unsigned char stats_json );
+void serve_signal( int sig );
+void serve_accept( serve_run *run, int lfd );
+void serve_read( serve_run *run, int slot );
+void serve_parse( serve_run *run, int slot );
+void serve_finished( serve_run *run );
+void serve_close( serve_run *run, int slot );
+void *serve_worker_main( void *arg );
+char *serve_request( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len );
+char *serve_issue( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len );
+char *serve_verify( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len );
+char *serve_resign( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len );
+RSA *serve_take_key( serve_run *run );
+void *serve_keymaker( void *arg );
+double serve_span( serve_worker *w, int phase, double start, int err );
+genmc_stats *stats_open( char *trace_path, unsigned char stats_json );
+int  stats_close( genmc_stats *stats, char *mode, char *trace_path,
+		unsigned char stats_json );
+int  replace_file( char *path, char *text );
+int  copy_pkey( char *mc_path, char *new_mc_path );
+int  list_minicerts( char *path, char ***files );
+void run_workers( void *(*worker)( void * ), void *arg, int n_threads,
+		long n_items );
+void clean_field( char *dst, char *src );
+int  compare_names( const void *a, const void *b );
+int  read_roster_record( FILE *fp, int *line_no, char *display_name,
+		char *user_id, char *expiry, char *mac );
+void show_cert_info( char *mc_b64, char *pk_b64 );
 void show_user_info( char *display_name, char *user_id, char *expiry_date,
 		struct tm *expiry_tm );
-int  set_expiry_date (int days_from_now, char *expiry_field,
-		struct tm *expiry_tm, time_t *expiry_t, unsigned char midnight);
 void make_date_string( char *date_string, struct tm *date_tm );
-void make_date_field( char *date_field, struct tm *date_tm );
 void test_dates( void );
 
 
@@ -65,36 +417,37 @@ void test_dates( void );
 
 int main( int argc, char **argv )
 {
-	RSA *ca_rsa, *user_rsa;
-	BIO *b64, *mc_file, *user_pkey_file;
-	EVP_MD_CTX mdctx;
-	EVP_MD *md;
-	unsigned char md_value[EVP_MAX_MD_SIZE];
-	int md_len, len;
-	int i, c, fd;
-	FILE *fp;
+	RSA *ca_rsa;
+	genmc_ctx *ctx;
+	int i, c;
 	struct tm expiry_tm;
 	time_t expiry_t;
 	char minicert_filename[80], ca_keys_filename[80], user_pk_filename[80];
 	char display_name[80], user_id[80], expiry_date[80], expiry_days[80];
-	char date_field[16];
-	char md_algo[16];
-	unsigned char mess[2048];
-	int mess_len;
+	char roster_filename[256], out_dir[256];
+	char spool_dir[256], fill_dir[256], verify_path[256];
+	char store_path[256], lookup_path[256];
+	char resign_path[256], old_ca_filename[256], socket_path[256];
+	char trace_path[256], replay_seed[256];
+	char profile_dir[256], template_filename[256];
+	RSA *old_ca_rsa;
+	genmc_stats *stats;
+	unsigned char stats_json;
+	int n_args;
+	unsigned char out_dir_set = 0;
+	int low_mark, high_mark;
+	char *err;
+	unsigned char user_info[GENMC_USER_INFO_LEN];
+	char mc_b64[GENMC_MC_B64_SIZE], pk_b64[GENMC_PK_B64_SIZE];
 	unsigned char quiet, verbose, midnight;
+	out_sinks out;
 	unsigned char expiry_flag_count = 0;;
-	unsigned char usable_key;
-	unsigned char m[2048];
-	unsigned int m_len;
-	unsigned char sigret[2048];
-	unsigned int siglen=0;
-	unsigned char ca_pb_m[2048];
-	int ca_pb_m_len;
-	unsigned char u_pb_m[2048], u_pr_e[2048];
-	int u_pb_m_len, u_pr_e_len;
+	int n_threads;
+	genmc_pipe_conf pipe_conf;
 	char *help =
 		"\n"
 		"Usage: gen-mc -k <ca_key file> -d <display_name> -u <user_id> [other options]\n"
+		"       gen-mc -k <ca_key file> -b <roster_file> [other options]\n"
 		"Required:\n"
 		"  -k <ca_key_file>  - A file with the CA's 1024-bit RSA key in PEM format\n"
 		"                      To make one use \"openssl genrsa -out cakey.pem 1024\"\n"
@@ -113,25 +466,147 @@ int main( int argc, char **argv )
 		"  -m, --midnight    - When used with -E the MiniCert expires at midnight\n"
 		"  -q. --quiet       - Don't write MiniCert and user's private key to stdout\n"
 		"  -v. --verbose     - Write user name, id, and MiniCert expiry date to stdout\n"
+		"                      With -b the stage times go to stderr, give it twice for\n"
+		"                      every user on stdout too\n"
+		"  -f <fd>           - Also write each MiniCert to the open file descriptor\n"
+		"                      <fd> as one framed record of netstrings:\n"
+		"                        <len>:<display_name>,<len>:<user_id>,\n"
+		"                        <len>:<expiry_date>,<len>:<minicert>,<len>:<userpk>,\\n\n"
+		"  -N                - Don't write the MiniCert and user's private key files\n"
 		"  -h, --help        - Displays this help\n"
+		"Batch mode:\n"
+		"  -b <roster_file>  - Issue a MiniCert for every user in the roster, use - for\n"
+		"                      stdin. Replaces -d, -u, -o and -p. One user per line:\n"
+		"                        display_name,user_id[,expiry[,mac]]\n"
+		"                      where expiry is HHMMSSMMDDYY or +days, if it is left out\n"
+		"                      -e or -E applies. Blank lines and # comments are skipped\n"
+		"  -O <out_dir>      - The directory to write <display_name>.mini_cert and\n"
+		"                      <display_name>.mini_pkey to, it defaults to .\n"
+		"  -j <threads>      - The number of threads making user keys, it defaults to\n"
+		"                      the number of CPUs\n"
+		"  -P <k>,<s>,<e>    - Threads for the key, signing and base64 stages of the\n"
+		"                      batch pipeline, it defaults to <-j>,1,1. With -v the\n"
+		"                      time each stage spent busy and waiting is shown\n"
+		"Provisioning profiles, with -b:\n"
+		"  -X <profile_dir>  - Also write spa<mac>.xml to <profile_dir> for every phone\n"
+		"                      in the roster, a flat-profile with its Display_Name_1_,\n"
+		"                      User_ID_1_, Mini_Certificate and SRTP_Private_Key. Every\n"
+		"                      record needs the MAC address, as 0014bf000001,\n"
+		"                      00:14:bf:00:00:01, 00-14-BF-00-00-01 or 0014.bf00.0001.\n"
+		"                      The profiles hold the keys and are readable by all, for\n"
+		"                      the TFTP server; point -X at its root. Use -N for no\n"
+		"                      other files\n"
+		"  -T <template>     - A flat-profile with the settings of the whole site, each\n"
+		"                      phone's own are added after its <flat-profile> tag\n"
+		"Key spool:\n"
+		"  -s <spool_dir>    - Take user keys from a spool filled by -F, a key is made\n"
+		"                      on the spot only if the spool is empty\n"
+		"  -F <spool_dir>    - Fill the spool with checked user keys and exit, the\n"
+		"                      directory is created with mode 0700. Run it from cron\n"
+		"  -W <low>,<high>   - Spool watermarks for -F: nothing is done until fewer\n"
+		"                      than <low> keys are left, then it is topped up to\n"
+		"                      <high>. It defaults to 256,1024\n"
+		"MiniCert store:\n"
+		"  -S <store>        - Also add every MiniCert and key issued to the store, one\n"
+		"                      file with an index by user id and display name. With -N\n"
+		"                      nothing but the store is written. It is synced every\n"
+		"                      256 records, a crash loses at most the last 255\n"
+		"  -L <store>        - Look up the newest MiniCert for -u <user_id> or\n"
+		"                      -d <display_name> in the store and write it out like a\n"
+		"                      newly issued one. Without -u and -d every user in the\n"
+		"                      store is written to the -O directory\n"
+		"Re-signing:\n"
+		"  -R <path>         - Sign the MiniCerts in a store, a MiniCert file or a\n"
+		"                      directory of *.mini_cert over again with the CA in -k,\n"
+		"                      keeping the user keys. The expiry date is set from -e\n"
+		"                      or -E if given. Files are replaced, or written to -O\n"
+		"                      with their .mini_pkey; a store has the newest MiniCert\n"
+		"                      of every user added to it again. Uses the -j threads\n"
+		"  -K <old_ca_file>  - The CA the MiniCerts were issued by, when moving them to\n"
+		"                      a new one in -k. Its key, public key or certificate\n"
+		"Daemon:\n"
+		"  -D <socket>       - Load the CA in -k once and serve requests on a Unix\n"
+		"                      socket, mode 0600, until SIGTERM. A request is a framed\n"
+		"                      record as for -f, its first field says what to do:\n"
+		"                        issue,<display_name>,<user_id>[,<expiry>]\n"
+		"                        verify,<minicert>\n"
+		"                        resign,<minicert>[,<expiry>]\n"
+		"                      where expiry is HHMMSSMMDDYY or +days, -e or -E if it\n"
+		"                      is left out; re-signing keeps it. The reply is \"ok\" and\n"
+		"                      what gen-mc would write out, or \"error\" and why; see\n"
+		"                      mc-client. Requests are worked on by the -j threads.\n"
+		"                      The <high> -W watermark of user keys is made ahead and\n"
+		"                      kept in locked memory, then -s and -S are used as usual;\n"
+		"                      an issue is in the -S store, synced, before its \"ok\"\n"
+		"Checking:\n"
+		"  -V <path>         - Check the MiniCert file, or every *.mini_cert in the\n"
+		"                      directory, against the CA in -k, which may also be its\n"
+		"                      public key or certificate. Writes one line per MiniCert:\n"
+		"                        valid|expired|wrong_ca|corrupt<TAB>file<TAB>\n"
+		"                        display_name<TAB>user_id<TAB>expiry_date\n"
+		"                      Uses the -j threads\n"
+		"Statistics, with -b and -D:\n"
+		"  --stats=json      - Write the counts issued, failed by reason and so on,\n"
+		"                      and the latency percentiles and histogram of every\n"
+		"                      phase to stderr as one line of JSON at the end. The\n"
+		"                      daemon also writes one on SIGUSR1\n"
+		"  --trace=<file>    - Write a Chrome trace event for every phase of every\n"
+		"                      record or request to <file>, for chrome://tracing or\n"
+		"                      Perfetto. Neither has any keys, names or user ids\n"
+		REPLAY_HELP
 		"Examples:\n"
 		"  gen-mc -k cakey.pem -d \"My Name\" -u 1234567 -e 000000010138\n"
 		"  gen-mc -k cakey.pem -d \"My Name\" -u 1234567 -E 365 -m\n"
+		"  gen-mc -k cakey.pem -b roster.csv -O private/linksys -E 3650 -q\n"
+		"  gen-mc -k cakey.pem -b phones.csv -X /srv/tftp -T site.xml -N -q\n"
+		"  gen-mc -F private/keyspool -W 1000,5000\n"
+		"  gen-mc -k cakey.pem -s private/keyspool -d \"My Name\" -u 1234567\n"
+		"  gen-mc -k CA_cert.pem -V private/linksys > audit.tsv\n"
+		"  gen-mc -k cakey.pem -b roster.csv -S private/linksys.mcs -N -q\n"
+		"  gen-mc -L private/linksys.mcs -u 1234567 -o my.mini_cert -p my.mini_pkey\n"
+		"  gen-mc -k new_CA_key.pem -K CA_cert.pem -R private/linksys -E 3650\n"
+		"  gen-mc -k cakey.pem -D /var/run/gen-mc.sock -s private/keyspool -E 3650\n"
+		"  gen-mc -k cakey.pem -b roster.csv -q --stats=json --trace=batch.trace\n"
 		"Notes:\n"
 		"  This tool attempts to mimic the Linksys|Sipura gen_mc utility.\n"
 		"  Use the same <ca_key_file> for all users who will use sRTP together.\n"
 		"\n";
 
 	/* command line defaults */
+	strcpy( ca_keys_filename, "" );
 	strcpy( minicert_filename, "mini_cert.b64" );
 	strcpy( user_pk_filename, "user_pk.b64" );
 	strcpy( display_name, "" );
 	strcpy( user_id, "" );
 	strcpy( expiry_date, "000000010138" ); /* default - midnight, Jan 1, 2038 */
 	strcpy( expiry_days, "" );
+	strcpy( roster_filename, "" );
+	strcpy( out_dir, "." );
+	strcpy( spool_dir, "" );
+	strcpy( fill_dir, "" );
+	strcpy( verify_path, "" );
+	strcpy( store_path, "" );
+	strcpy( lookup_path, "" );
+	strcpy( resign_path, "" );
+	strcpy( old_ca_filename, "" );
+	strcpy( socket_path, "" );
+	strcpy( trace_path, "" );
+	strcpy( replay_seed, "" );
+	strcpy( profile_dir, "" );
+	strcpy( template_filename, "" );
+	stats_json = 0;
+	low_mark = 256;
+	high_mark = 1024;
 	quiet = 0;
 	verbose = 0;
 	midnight= 0;
+	out.files = 1;
+	out.frame_fd = -1;
+	out.store = NULL;
+	n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+	memset( &pipe_conf, 0, sizeof( pipe_conf ) );
+	pipe_conf.sign_workers = 1;
+	pipe_conf.encode_workers = 1;
 
 	#ifdef TESTDATES
 	/* test dates only and exit */
@@ -139,6 +614,34 @@ int main( int argc, char **argv )
 	exit( EXIT_SUCCESS );
 	#endif
 
+	/* the long options with a value, taken out before getopt() sees them */
+	for ( i = 1, n_args = 1; i < argc; ++i )
+	{
+		if ( !strncmp( argv[i], "--stats=", 8 ) )
+		{
+			if ( strcmp( argv[i] + 8, "json" ) )
+			{
+				fprintf(stderr, "Error: --stats can only be json.\n");
+				exit( EXIT_FAILURE );
+			}
+			stats_json = 1;
+		}
+		else if ( !strncmp( argv[i], "--trace=", 8 ) )
+		{
+			if ( !argv[i][8] ) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+			strncpy( trace_path, argv[i] + 8, sizeof( trace_path ) - 1 );
+		}
+		else if ( !strncmp( argv[i], "--replay=", 9 ) )
+		{
+			if ( !argv[i][9] ) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+			strncpy( replay_seed, argv[i] + 9, sizeof( replay_seed ) - 1 );
+		}
+		else
+			argv[n_args++] = argv[i];
+	}
+	argc = n_args;
+	argv[argc] = NULL;
+
 	/* bail out if user didn't specify anything */
 	if( argc <= 1 )
 	{
@@ -157,13 +660,15 @@ int main( int argc, char **argv )
 		else if ( !strcmp( argv[i], "-q" ) || !strcmp( argv[i], "--quiet" ) )
 			quiet = 1;
 		else if ( !strcmp( argv[i], "-v" ) || !strcmp( argv[i], "--verbose" ) )
-			verbose = 1;
+			verbose++;
 		else if ( !strcmp( argv[i], "-m" ) || !strcmp( argv[i], "--midnight" ) )
 			midnight = 1;
+		else if ( !strcmp( argv[i], "-N" ) )
+			out.files = 0;
 	}
 
 	/* grab all the command line args that have values */
-	while( -1 != ( c = getopt( argc, argv, "-qvmhk:o:d:u:e:E:p:" ) ) )
+	while( -1 != ( c = getopt( argc, argv, "-qvmhNk:o:d:u:e:E:p:b:O:j:s:F:W:f:V:P:S:L:R:K:D:X:T:" ) ) )
 	{
 		switch( c )
 		{
@@ -199,522 +704,2644 @@ int main( int argc, char **argv )
 				strcpy( expiry_days, optarg );
 				expiry_flag_count++;
 				break;
+			case 'b': /* roster file, a lone '-' is stdin */
+				if ('-' == optarg[0] && optarg[1]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( roster_filename, optarg, sizeof( roster_filename ) - 1 );
+				break;
+			case 'O': /* directory for the batch output */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( out_dir, optarg, sizeof( out_dir ) - 1 );
+				out_dir_set = 1;
+				break;
+			case 'X': /* directory for the provisioning profiles */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( profile_dir, optarg, sizeof( profile_dir ) - 1 );
+				break;
+			case 'T': /* site profile template */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( template_filename, optarg, sizeof( template_filename ) - 1 );
+				break;
+			case 'j': /* number of key generation threads */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				n_threads = atoi( optarg );
+				if ( n_threads < 1 )
+				{
+					fprintf(stderr, "Error: number of threads must be at least 1.\n");
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'P': /* pipeline stage workers */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				if ( 3 != sscanf( optarg, "%d,%d,%d", &pipe_conf.keygen_workers,
+						&pipe_conf.sign_workers, &pipe_conf.encode_workers ) ||
+						pipe_conf.keygen_workers < 1 || pipe_conf.sign_workers < 1 ||
+						pipe_conf.encode_workers < 1 )
+				{
+					fprintf(stderr, "Error: stage threads must be <keygen>,<sign>,<encode>, each at least 1.\n");
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 's': /* key spool to take user keys from */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( spool_dir, optarg, sizeof( spool_dir ) - 1 );
+				break;
+			case 'F': /* key spool to fill */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( fill_dir, optarg, sizeof( fill_dir ) - 1 );
+				break;
+			case 'W': /* spool low and high watermarks */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				if ( 2 != sscanf( optarg, "%d,%d", &low_mark, &high_mark ) ||
+						low_mark < 1 || high_mark < low_mark )
+				{
+					fprintf(stderr, "Error: watermarks must be <low>,<high> with 1 <= low <= high.\n");
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'S': /* MiniCert store to add to */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( store_path, optarg, sizeof( store_path ) - 1 );
+				break;
+			case 'L': /* MiniCert store to look up in */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( lookup_path, optarg, sizeof( lookup_path ) - 1 );
+				break;
+			case 'R': /* MiniCerts to sign over again */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( resign_path, optarg, sizeof( resign_path ) - 1 );
+				break;
+			case 'K': /* the CA the MiniCerts to re-sign came from */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( old_ca_filename, optarg, sizeof( old_ca_filename ) - 1 );
+				break;
+			case 'D': /* socket to serve requests on */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( socket_path, optarg, sizeof( socket_path ) - 1 );
+				break;
+			case 'V': /* MiniCert file or directory to check */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				strncpy( verify_path, optarg, sizeof( verify_path ) - 1 );
+				break;
+			case 'f': /* file descriptor for framed records */
+				if ('-' == optarg[0]) { fprintf( stderr, help ); exit( EXIT_FAILURE ); }
+				out.frame_fd = atoi( optarg );
+				if ( out.frame_fd < 0 || -1 == fcntl( out.frame_fd, F_GETFL ) )
+				{
+					fprintf(stderr, "Error: file descriptor %s is not open.\n", optarg);
+					exit( EXIT_FAILURE );
+				}
+				break;
 		}
 	}
 
-	/* Validate the user parameters */
+	/* framed records on stdout would get mixed up with the admin format */
+	out.admin = !quiet && 1 != out.frame_fd;
+	/* in batch mode one -v is the stage times on stderr, the users are -v -v */
+	out.verbose = verbose > ( strlen( roster_filename ) ? 1 : 0 ) && 1 != out.frame_fd;
 
-	/* zero the mess out first */
-	memset( mess, 0, sizeof( mess ) );
-
-	/* check the display name */
-	len = strlen( display_name );
-	if ( len < 1 )
-	{
-		fprintf(stderr, "Error: display name is missing, use -d.\n");
-		exit( EXIT_FAILURE );
-	}
-	if ( len > 32)
+	/* bail if the user picked more than one CA expiry option */
+	if ( expiry_flag_count > 1 )
 	{
-		fprintf(stderr, "Error: display name can't be more than 32 characters.\n");
+		fprintf(stderr, "Error: more than one expiry option specified.\n");
 		exit( EXIT_FAILURE );
 	}
-	memcpy( mess, display_name, len ); /* display name looks ok */
 
-	/* check the user id */
-	len = strlen( user_id );
-	if ( len < 1 )
+	/* a profile needs the MAC, only the roster has it */
+	if ( ( strlen( profile_dir ) > 0 || strlen( template_filename ) > 0 ) &&
+			0 == strlen( roster_filename ) )
 	{
-		fprintf(stderr, "Error: user id is missing, use -u.\n");
+		fprintf(stderr, "Error: -X and -T need a roster, -b.\n");
 		exit( EXIT_FAILURE );
 	}
-	if ( len > 16 )
+	if ( strlen( template_filename ) > 0 && 0 == strlen( profile_dir ) )
 	{
-		fprintf(stderr, "Error: user id can't be more than 16 characters.\n");
+		fprintf(stderr, "Error: -T needs -X.\n");
 		exit( EXIT_FAILURE );
 	}
-	memcpy( mess+32, user_id, len ); /* user id looks ok */
-
 
-	/* check the expiry date */
+	/* replay: the spool and the daemon's keys are made outside any run */
+	if ( strlen( replay_seed ) > 0 )
+	{
+		if ( strlen( spool_dir ) > 0 || strlen( fill_dir ) > 0 ||
+				strlen( socket_path ) > 0 )
+		{
+			fprintf(stderr, "Error: --replay can't be used with -s, -F or -D.\n");
+			exit( EXIT_FAILURE );
+		}
+		if ( GENMC_OK != ( c = genmc_replay_start( replay_seed ) ) )
+		{
+			fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
+			exit( EXIT_FAILURE );
+		}
+		fprintf( stderr, "Warning: replay run, every key comes from the seed.\n" );
+	}
 
-	/* bail if the user picked more than one CA expiry option */
-	if ( expiry_flag_count > 1 )
+	/* spool mode: make keys ahead of time, no CA needed */
+	if ( strlen( fill_dir ) > 0 )
 	{
-		fprintf(stderr, "Error: more than one expiry option specified.\n");
-		exit( EXIT_FAILURE );
+		umask( 077 );
+		genmc_thread_setup();
+		c = fill_spool( fill_dir, low_mark, high_mark, n_threads );
+		genmc_thread_cleanup();
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
 	}
 
-	/* check to see if we should be using expiry days instead of full date */
-	len = strlen( expiry_days );
-	if (len > 0)
+	/* verify mode: only the public half of the CA is needed */
+	if ( strlen( verify_path ) > 0 )
 	{
-		/* user specified expiry in days */
-		i = atoi( expiry_days );
-		if ( i < 1 )
+		if ( GENMC_OK != ( c = genmc_load_ca_pubkey( ca_keys_filename, &ca_rsa ) ) )
 		{
-			fprintf(stderr, "Error: expiry days must be at least 1.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+					ca_keys_filename );
 			exit( EXIT_FAILURE );
 		}
-		if ( !set_expiry_date( i, expiry_date, &expiry_tm, &expiry_t, midnight ) )
+		genmc_thread_setup();
+		c = verify_paths( ca_rsa, verify_path, n_threads );
+		genmc_thread_cleanup();
+		RSA_free( ca_rsa );
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
+	}
+
+	/* re-sign mode: no new user keys, just new signatures */
+	if ( strlen( resign_path ) > 0 )
+	{
+		/* the new expiry is worked out once for all of them */
+		c = GENMC_OK;
+		if ( strlen( expiry_days ) > 0 )
+		{
+			if ( ( i = atoi( expiry_days ) ) < 1 )
+				c = GENMC_ERR_DAYS;
+			else if ( !genmc_set_expiry_date( i, expiry_date, &expiry_tm,
+					&expiry_t, midnight ) )
+				c = GENMC_ERR_DAYS_RANGE;
+		}
+		if ( GENMC_OK == c && expiry_flag_count > 0 &&
+				GENMC_OK == ( c = genmc_check_expiry_date( expiry_date,
+					&expiry_tm, &expiry_t ) ) && expiry_t < time( NULL ) )
+			c = GENMC_ERR_DATE_PAST;
+		if ( GENMC_OK != c )
 		{
-			fprintf( stderr, "Error: expiry date is out of range.\n" );
+			fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
 			exit( EXIT_FAILURE );
 		}
-	}
-	else
-	{
-		/* user specified an complete expiry date */
-		len = strlen( expiry_date );
-		if ( len < 1 )
+		if ( GENMC_OK != ( c = genmc_load_ca_key( ca_keys_filename, &ca_rsa ) ) ||
+				GENMC_OK != ( c = genmc_check_ca_key( ca_rsa ) ) )
 		{
-			fprintf(stderr, "Error: expiry date is missing, use -e.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+					ca_keys_filename );
 			exit( EXIT_FAILURE );
 		}
-		if ( len != 12 )
+		if ( strlen( old_ca_filename ) > 0 &&
+				GENMC_OK != ( c = genmc_load_ca_pubkey( old_ca_filename,
+					&old_ca_rsa ) ) )
 		{
-			fprintf(stderr, "Error: expiry date must be 12 characters.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+					old_ca_filename );
 			exit( EXIT_FAILURE );
 		}
-		for ( i = 0; i < len; ++i )
-			if ( !isdigit( expiry_date[i] ) )
-			{
-				fprintf(stderr, "Error: expiry date contains non-digits.\n");
-				exit( EXIT_FAILURE );
-			}
+		if ( 0 == strlen( old_ca_filename ) )
+			old_ca_rsa = RSAPublicKey_dup( ca_rsa );
+
+		umask( 077 );
+		genmc_thread_setup();
+		c = resign_paths( ca_rsa, old_ca_rsa, resign_path,
+				expiry_flag_count > 0 ? expiry_date : NULL,
+				out_dir_set ? out_dir : NULL, n_threads );
+		genmc_thread_cleanup();
+		RSA_free( old_ca_rsa );
+		RSA_free( ca_rsa );
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
+	}
 
-		/* check the individual expiry date fields */
-		memset( date_field, 0, sizeof( date_field ) );
-		memset( &expiry_tm, 0, sizeof( struct tm ) );
-		/* hour */
-		date_field[0] = expiry_date[0];
-		date_field[1] = expiry_date[1];
-		i = atoi ( date_field );
-		expiry_tm.tm_hour = i;
-		if ( i < 0 || i > 23 )
-		{
-			fprintf(stderr, "Error: hour in expiry date must be in 00-23 range.\n");
-			exit( EXIT_FAILURE );
+	/* daemon mode: the CA is loaded once and serves every request */
+	if ( strlen( socket_path ) > 0 )
+	{
+		/* the default expiry is checked now, "+days" counts from each
+		   request */
+		c = GENMC_OK;
+		if ( strlen( expiry_days ) > 0 )
+		{
+			if ( atoi( expiry_days ) < 1 )
+				c = GENMC_ERR_DAYS;
 		}
-		/* minute */
-		date_field[0] = expiry_date[2];
-		date_field[1] = expiry_date[3];
-		i = atoi ( date_field );
-		expiry_tm.tm_min = i;
-		if ( i < 0 || i > 59 )
+		else if ( GENMC_OK == ( c = genmc_check_expiry_date( expiry_date,
+				&expiry_tm, &expiry_t ) ) && expiry_t < time( NULL ) )
+			c = GENMC_ERR_DATE_PAST;
+		if ( GENMC_OK != c )
 		{
-			fprintf(stderr, "Error: minute in expiry date must be in 00-59 range.\n");
+			fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
 			exit( EXIT_FAILURE );
 		}
-		/* second */
-		date_field[0] = expiry_date[4];
-		date_field[1] = expiry_date[5];
-		i = atoi ( date_field );
-		expiry_tm.tm_sec = i;
-		if ( i < 0 || i > 59 )
+		if ( GENMC_OK != ( c = genmc_load_ca_key( ca_keys_filename, &ca_rsa ) ) ||
+				GENMC_OK != ( c = genmc_check_ca_key( ca_rsa ) ) )
 		{
-			fprintf(stderr, "Error: second in expiry date must be in 00-59 range.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+					ca_keys_filename );
 			exit( EXIT_FAILURE );
 		}
-		/* month */
-		date_field[0] = expiry_date[6];
-		date_field[1] = expiry_date[7];
-		i = atoi ( date_field );
-		expiry_tm.tm_mon = i - 1; /* 0-11 */
-		if ( i < 1 || i > 12 )
+		if ( strlen( old_ca_filename ) > 0 &&
+				GENMC_OK != ( c = genmc_load_ca_pubkey( old_ca_filename,
+					&old_ca_rsa ) ) )
 		{
-			fprintf(stderr, "Error: month in expiry date must be in 01-12 range.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+					old_ca_filename );
 			exit( EXIT_FAILURE );
 		}
-		/* day */
-		date_field[0] = expiry_date[8];
-		date_field[1] = expiry_date[9];
-		i = atoi ( date_field );
-		expiry_tm.tm_mday = i;
-		if ( i < 1 || i > 31 )
+		if ( 0 == strlen( old_ca_filename ) )
+			old_ca_rsa = RSAPublicKey_dup( ca_rsa );
+		if ( strlen( spool_dir ) > 0 &&
+				GENMC_OK != ( c = genmc_spool_check( spool_dir, 0 ) ) )
 		{
-			fprintf(stderr, "Error: day in expiry date must be in 01-31 range.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), spool_dir );
 			exit( EXIT_FAILURE );
 		}
-		/* year */
-		date_field[0] = expiry_date[10];
-		date_field[1] = expiry_date[11];
-		i = atoi ( date_field );
-		expiry_tm.tm_year = i + 100; /* year since 1900 */
-		/* make sure the year isn't past 2038 */
-		if ( i < 0 || i > 38 )
+		if ( strlen( store_path ) > 0 &&
+				GENMC_OK != ( c = genmc_store_open( &out.store, store_path, 1 ) ) )
 		{
-			fprintf(stderr, "Error: year in expiry date must be in 00-38 range.\n");
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), store_path );
 			exit( EXIT_FAILURE );
 		}
-
-		/* save the time_t value of the expiry date */
-		expiry_t = mktime( &expiry_tm );
+		/* a client told "ok" has its record on disk */
+		if ( NULL != out.store )
+			genmc_store_sync_every( out.store, 1 );
+
+		umask( 077 );
+		stats = stats_open( trace_path, stats_json );
+		genmc_thread_setup();
+		c = serve( ca_rsa, old_ca_rsa, socket_path,
+				strlen( spool_dir ) ? spool_dir : NULL, expiry_date, expiry_days,
+				midnight, out.store, n_threads, high_mark, stats, stats_json );
+		genmc_thread_cleanup();
+		if ( stats_close( stats, "daemon", trace_path, stats_json ) )
+			c = 1;
+		RSA_free( old_ca_rsa );
+		RSA_free( ca_rsa );
+		if ( GENMC_OK != ( i = genmc_store_close( out.store ) ) )
+		{
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( i ), store_path );
+			c = 1;
+		}
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
 	}
 
-	/* do a current time/date check here and make sure they didn't pick an expiry
-	date in the past */
-	if ( expiry_t < time( NULL ) )
+	/* store mode: hand out what was issued before, no CA needed */
+	if ( strlen( lookup_path ) > 0 )
 	{
-		fprintf( stderr, "Error: expiry date is in the past.\n" );
-		exit( EXIT_FAILURE );
+		c = lookup_store( lookup_path, display_name, user_id, out_dir, &out,
+				minicert_filename, user_pk_filename );
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
 	}
 
-	/* expiry date looks ok */
-	memcpy( mess+48, expiry_date, 12 );
-	mess_len = 60;
-
-	#ifdef DEBUG
-	/* dump the 60 byte user info to a file */
-	if ( NULL != ( fp = fopen( "user_info.dat", "wb" ) ) )
+	if ( strlen( spool_dir ) > 0 &&
+			GENMC_OK != ( c = genmc_spool_check( spool_dir, 0 ) ) )
 	{
-		fwrite( mess, 60, 1, fp );
-		fclose( fp );
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), spool_dir );
+		exit( EXIT_FAILURE );
 	}
-	#endif
-
-	/* Generate user's keys */
 
-	/* try more than once if neccessary */
-	#ifdef DEBUG
-	fprintf( stderr, "Debug: generating user RSA key");
-	#endif
-	for ( usable_key = 0, i = 0; i < 16; ++i )
+	/* Validate the user parameters, unless it's a batch */
+	if ( 0 == strlen( roster_filename ) )
 	{
-		user_rsa = RSA_generate_key( 512, RSA_F4, NULL, NULL );
-		if( NULL == user_rsa)
+		c = genmc_pack_user_info( user_info, display_name, user_id,
+				expiry_date, expiry_days, midnight, &expiry_tm );
+		if ( GENMC_OK != c )
 		{
-			fprintf( stderr, "Error: RSA_generate_key() failed.\n");
+			fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
 			exit( EXIT_FAILURE );
 		}
 
-		c = RSA_check_key( user_rsa );
-		if( !c )
-		{
-			RSA_free( user_rsa );
-			#ifdef DEBUG
-			fprintf( stderr, ".");
-			#endif
-		} else {
-			#ifdef DEBUG
-			fprintf( stderr, "\nDebug: user's RSA keys usable\n");
-			fprintf( stderr, "n==%s\n", BN_bn2hex( user_rsa->n ) );
-			fprintf( stderr, "e==%s\n", BN_bn2dec( user_rsa->e ) );
-			fprintf( stderr, "d==%s\n", BN_bn2hex( user_rsa->d ) );
-			#endif
-			usable_key = 1;
-			break;
+		#ifdef DEBUG
+		{
+			/* dump the 60 byte user info to a file */
+			FILE *fp;
+			if ( NULL != ( fp = fopen( "user_info.dat", "wb" ) ) )
+			{
+				fwrite( user_info, GENMC_USER_INFO_LEN, 1, fp );
+				fclose( fp );
+			}
 		}
+		#endif
 	}
 
-	/* make sure we got one */
-	if ( !usable_key )
+	/* read CA's keys from a *.PEM file and check them, only then get the
+	   user's keys so a spooled key isn't thrown away for nothing */
+	if ( GENMC_OK != ( c = genmc_load_ca_key( ca_keys_filename, &ca_rsa ) ) )
 	{
-		fprintf( stderr, "Error: couldn't generate a usable user key.\n");
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ),
+				ca_keys_filename );
 		exit( EXIT_FAILURE );
 	}
-
-	memset( u_pr_e,  0, sizeof( u_pr_e ) );
-	u_pb_m_len = BN_bn2bin( user_rsa->n, u_pb_m ); /* public modulus   */
-	memcpy( mess+mess_len, u_pb_m, u_pb_m_len );
-	mess_len += u_pb_m_len;
-	u_pr_e_len = BN_bn2bin( user_rsa->d, u_pr_e ); /* private exponent */
-
-	/* read CA's keys from a *.PEM file, create an RSA object */
-	fp = fopen( ca_keys_filename, "rb" );
-	if( NULL == fp )
+	c = genmc_init( &ctx, ca_rsa );
+	if ( GENMC_OK != c )
 	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		fprintf( stderr, "Error: CA keys file %s not found.\n", ca_keys_filename );
+		fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
 		exit( EXIT_FAILURE );
 	}
-
-	SSL_load_error_strings();
-	OpenSSL_add_ssl_algorithms();
-
-	ca_rsa = PEM_read_RSAPrivateKey( fp, NULL, NULL, NULL );
-	if( NULL == ca_rsa )
+	if ( strlen( spool_dir ) > 0 )
+		genmc_set_spool( ctx, spool_dir );
+	if ( strlen( store_path ) > 0 &&
+			GENMC_OK != ( c = genmc_store_open( &out.store, store_path, 1 ) ) )
 	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		fprintf( stderr, "Error: reading PEM failed\n" );
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), store_path );
 		exit( EXIT_FAILURE );
 	}
-	fclose( fp );
+	if ( NULL != out.store )
+		genmc_store_sync_every( out.store, STORE_SYNC_RECORDS );
 
-	/* check the key length here and make sure it's 1024 */
-	if( 1024 != RSA_size( ca_rsa ) * 8 )
+	/* batch mode: the CA is read and checked once for the whole roster */
+	if ( strlen( roster_filename ) > 0 )
 	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
+		genmc_free( ctx );
+		if ( 0 == pipe_conf.keygen_workers )
+			pipe_conf.keygen_workers = n_threads;
+		pipe_conf.spool_dir = strlen( spool_dir ) ? spool_dir : NULL;
+		pipe_conf.stats = stats = stats_open( trace_path, stats_json );
+		genmc_thread_setup();
+		c = issue_batch( ca_rsa, roster_filename, out_dir, expiry_date,
+				expiry_days, midnight, &out, &pipe_conf, verbose,
+				strlen( profile_dir ) ? profile_dir : NULL, template_filename );
+		genmc_thread_cleanup();
+		if ( stats_close( stats, "batch", trace_path, stats_json ) )
+			c = 1;
 		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: wrong CA key size, should be 1024 bits\n" );
-		exit( EXIT_FAILURE );
+		if ( GENMC_OK != ( i = genmc_store_close( out.store ) ) )
+		{
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( i ), store_path );
+			c = 1;
+		}
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
 	}
+	RSA_free( ca_rsa ); /* ctx keeps its own reference */
 
-	#ifdef DEBUG
-	fprintf( stderr, "Debug: CApubmod==%s\n",  BN_bn2hex( ca_rsa->n ) );
-	fprintf( stderr, "Debug: CApubexp==%s\n",  BN_bn2dec( ca_rsa->e ) );
-	fprintf( stderr, "Debug: CAprivexp==%s\n", BN_bn2hex( ca_rsa->d ) );
-	#endif
-
-	c = RSA_check_key( ca_rsa ); /* re-check CA keys */
-	if( c )
+	c = genmc_issue( ctx, user_info, NULL, mc_b64, sizeof( mc_b64 ),
+			pk_b64, sizeof( pk_b64 ) );
+	genmc_free( ctx );
+	if ( GENMC_OK != c )
 	{
-		#ifdef DEBUG
-		fprintf( stderr, "Debug: the CA key is valid.\n");
-		#endif
-	} else {
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: the CA key is broken.\n");
+		memset( pk_b64, 0, sizeof( pk_b64 ) );
+		fprintf( stderr, "Error: %s\n", genmc_strerror( c ) );
 		exit( EXIT_FAILURE );
 	}
 
-	OpenSSL_add_all_digests();
-	strcpy( md_algo, "sha1" );
-	md = (EVP_MD *)EVP_get_digestbyname( md_algo );
-	if( !md )
-	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: unknown digest.\n");
-		exit( EXIT_FAILURE );
-	}
+	err = emit_user( &out, display_name, user_id, expiry_date, &expiry_tm,
+			mc_b64, pk_b64, minicert_filename, user_pk_filename );
+	if ( NULL == err && GENMC_OK != ( c = genmc_store_close( out.store ) ) )
+		err = (char *)genmc_strerror( c );
 
-	EVP_MD_CTX_init( &mdctx );
-	c = EVP_DigestInit_ex( &mdctx, md, NULL );
-	if( !c )
-	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: EVP_DigestInit_ex() failed.\n" );
-		exit( EXIT_FAILURE );
-	}
-	c = EVP_DigestUpdate( &mdctx, mess, mess_len );
-	if( !c )
-	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: EVP_DigestUpdate() failed.\n" );
-		exit( EXIT_FAILURE );
-	}
-	c = EVP_DigestFinal_ex( &mdctx, m, &m_len );
-	if( !c )
+	/* wipe mem */
+	memset( pk_b64, 0, sizeof( pk_b64 ) );
+
+	if ( NULL != err )
 	{
-		memset( u_pr_e,  0, sizeof( u_pr_e ) );
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: EVP_DigestFinal_ex() failed.\n" );
+		fprintf( stderr, "Error: %s\n", err );
 		exit( EXIT_FAILURE );
 	}
-	EVP_MD_CTX_cleanup( &mdctx );
-
-	#ifdef DEBUG
-	fprintf( stderr, "Debug: %s==", md_algo );
-	for( c = 0; c < m_len; c++)
-		fprintf( stderr, "%02x", m[c]);
-	fprintf( stderr, ", m_len==%d\n", m_len);
-	#endif
 
-	siglen = RSA_private_encrypt( m_len, m, sigret, ca_rsa, RSA_PKCS1_PADDING );
-	#ifdef DEBUG
-	fprintf( stderr, "Debug: siglen==%d\n", siglen );
-	#endif
-	if( siglen )
-	{
-		mc_file = BIO_new_file( minicert_filename, "wb" );
-		if( mc_file )
-		{
-			b64 = BIO_new( BIO_f_base64() );
-			BIO_set_flags( b64, BIO_FLAGS_BASE64_NO_NL );
-			mc_file = BIO_push( b64, mc_file );
+	return( EXIT_SUCCESS );
+}
 
-			memcpy( mess+mess_len, sigret, siglen );
-			mess_len += siglen;
+/*********
+ emit_user--
+ *********/
 
-			ca_pb_m_len = BN_bn2bin( ca_rsa->n, ca_pb_m ); /* CA public mod */
-			memcpy( mess+mess_len, ca_pb_m, ca_pb_m_len );
-			mess_len += ca_pb_m_len;
+char *emit_user( out_sinks *out, char *display_name, char *user_id,
+		char *expiry_date, struct tm *expiry_tm, char *mc_b64, char *pk_b64,
+		char *minicert_filename, char *user_pk_filename )
+{
+	/* Sends one issued MiniCert and key to every output asked for */
+	char *err;
+	int c;
 
-			BIO_write( mc_file, mess, mess_len );
-			BIO_flush( mc_file );
-			BIO_free_all( mc_file );
+	if ( out->files &&
+			NULL != ( err = write_user_files( mc_b64, pk_b64,
+				minicert_filename, user_pk_filename ) ) )
+		return err;
 
-			user_pkey_file = BIO_new_file( user_pk_filename, "wb" );
-			if( user_pkey_file )
-			{
-				b64 = BIO_new( BIO_f_base64() );
-				BIO_set_flags( b64, BIO_FLAGS_BASE64_NO_NL );
-				user_pkey_file = BIO_push( b64, user_pkey_file );
-
-				BIO_write( user_pkey_file, u_pr_e, u_pr_e_len );
-				BIO_flush( user_pkey_file );
-				BIO_free_all( user_pkey_file );
-
-				#ifdef DEBUG
-				fprintf( stderr, "Debug: Done.\n" );
-				#endif
-			} else {
-				/* creating the private key failed */
-				remove( minicert_filename );/* certificate useless, delete it */
-				RSA_free( user_rsa );
-				RSA_free( ca_rsa );
-				fprintf( stderr, "Error: creating user PK %s failed.\n", user_pk_filename );
-				exit( EXIT_FAILURE );
-			}
-		}
-	} else {
-		RSA_free( user_rsa );
-		RSA_free( ca_rsa );
-		fprintf( stderr, "Error: RSA_private_encrypt failed.\n" );
-		exit( EXIT_FAILURE );
-	}
+	if ( out->frame_fd >= 0 &&
+			NULL != ( err = write_frame( out->frame_fd, display_name, user_id,
+				expiry_date, mc_b64, pk_b64 ) ) )
+		return err;
 
-	/* wipe mem and cleanup */
-	memset( u_pr_e,  0, sizeof( u_pr_e ) );
-	RSA_free( user_rsa );
-	RSA_free( ca_rsa );
+	if ( NULL != out->store &&
+			GENMC_OK != ( c = genmc_store_append( out->store, display_name,
+				user_id, expiry_date, mc_b64, pk_b64 ) ) )
+		return (char *)genmc_strerror( c );
 
 	/* show the minicert and users private key if they want */
-	if ( !quiet )
+	if ( out->admin )
+		show_cert_info( mc_b64, pk_b64 );
+
+	/* show the user info and CA expiry if they want */
+	if ( out->verbose )
+		show_user_info( display_name, user_id, expiry_date, expiry_tm );
+
+	return NULL;
+}
+
+/****************
+ write_user_files--
+ ****************/
+
+char *write_user_files( char *mc_b64, char *pk_b64,
+		char *minicert_filename, char *user_pk_filename )
+{
+	static char err[320];
+	FILE *mc_file, *user_pkey_file;
+	int ok;
+
+	mc_file = fopen( minicert_filename, "wb" );
+	if( NULL == mc_file )
+	{
+		snprintf( err, sizeof( err ), "creating MiniCert %s failed.",
+				minicert_filename );
+		return err;
+	}
+	ok = fputs( mc_b64, mc_file ) >= 0;
+	ok = ( 0 == fclose( mc_file ) ) && ok;
+	if( !ok )
 	{
-		show_cert_info( minicert_filename, user_pk_filename );
+		remove( minicert_filename );
+		snprintf( err, sizeof( err ), "writing MiniCert %s failed.",
+				minicert_filename );
+		return err;
 	}
 
-	/* show the user info and CA expiry if they want */
-	if ( verbose )
+	user_pkey_file = fopen( user_pk_filename, "wb" );
+	if( NULL != user_pkey_file )
+	{
+		ok = fputs( pk_b64, user_pkey_file ) >= 0;
+		ok = ( 0 == fclose( user_pkey_file ) ) && ok;
+	}
+	if( NULL == user_pkey_file || !ok )
 	{
-		show_user_info( display_name, user_id, expiry_date, &expiry_tm );
+		/* creating the private key failed */
+		remove( minicert_filename );/* certificate useless, delete it */
+		snprintf( err, sizeof( err ), "creating user PK %s failed.",
+				user_pk_filename );
+		return err;
 	}
 
-	return( EXIT_SUCCESS );
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: Done.\n" );
+	#endif
+
+	return NULL;
 }
 
-/**************
- show_cert_info--
- **************/
+/************
+ lookup_store--
+ ************/
 
-void show_cert_info (char *cert_filename, char *userpk_filename)
+int lookup_store( char *store_path, char *display_name, char *user_id,
+		char *out_dir, out_sinks *out, char *minicert_filename,
+		char *user_pk_filename )
 {
-	FILE *fp;
-	unsigned char buff[2048];
+	/* Writes out the newest MiniCert of the user, or of every user to
+	   out_dir if neither a user id nor a display name is given. Returns
+	   the number that couldn't be written. */
+	genmc_store *store;
+	genmc_store_entry entry;
+	struct tm expiry_tm;
+	time_t expiry_t;
+	char mcfile[512], pkfile[512];
+	char *err;
+	long n, first, last;
+	int export_all, c, failed = 0;
 
-	/* this format is what the example in the Sipura admin manual prints out */
+	if ( GENMC_OK != ( c = genmc_store_open( &store, store_path, 0 ) ) )
+	{
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), store_path );
+		return 1;
+	}
 
-	/* print out the MC */
-	memset ( buff, 0, sizeof( buff ) );
-	if ( NULL != ( fp = fopen( cert_filename, "r" ) ) )
+	export_all = 0 == strlen( user_id ) && 0 == strlen( display_name );
+	first = 0;
+	last = genmc_store_count( store ) - 1;
+	if ( !export_all )
 	{
-		fread( buff, 2048, 1, fp );
-		fclose( fp );
+		first = last = strlen( user_id ) > 0 ?
+			genmc_store_find( store, GENMC_STORE_BY_ID, user_id ) :
+			genmc_store_find( store, GENMC_STORE_BY_NAME, display_name );
+		if ( first < 0 )
+		{
+			fprintf( stderr, "Error: %s (%s)\n",
+					genmc_strerror( GENMC_ERR_STORE_NOT_FOUND ),
+					strlen( user_id ) > 0 ? user_id : display_name );
+			genmc_store_close( store );
+			return 1;
+		}
 	}
-	else return;
-	fprintf( stdout, "\n<Mini Certificate>\n%s\n", buff);
 
-	/* print out the user PK */
-	memset ( buff, 0, sizeof( buff ) );
-	if ( NULL != ( fp = fopen( userpk_filename, "r" ) ) )
+	/* in store order, so a user issued twice ends up with the newest */
+	for ( n = first; n <= last; ++n )
 	{
-		fread( buff, 2048, 1, fp );
-		fclose( fp );
+		if ( GENMC_OK != ( c = genmc_store_get( store, n, &entry ) ) )
+			err = (char *)genmc_strerror( c );
+		else if ( export_all && strchr( entry.display_name, '/' ) )
+			err = "display name can't contain '/' in batch mode.";
+		else if ( GENMC_OK != ( c = genmc_check_expiry_date( entry.expiry_date,
+				&expiry_tm, &expiry_t ) ) )
+			err = (char *)genmc_strerror( c );
+		else
+		{
+			snprintf( mcfile, sizeof( mcfile ), "%s/%s.mini_cert", out_dir,
+					entry.display_name );
+			snprintf( pkfile, sizeof( pkfile ), "%s/%s.mini_pkey", out_dir,
+					entry.display_name );
+			err = emit_user( out, entry.display_name, entry.user_id,
+					entry.expiry_date, &expiry_tm, entry.mc_b64, entry.pk_b64,
+					export_all ? mcfile : minicert_filename,
+					export_all ? pkfile : user_pk_filename );
+		}
+		memset( entry.pk_b64, 0, sizeof( entry.pk_b64 ) );
+		if ( NULL != err )
+		{
+			fprintf( stderr, "Error: store record %ld: %s\n", n, err );
+			++failed;
+		}
 	}
-	else return;
-	fprintf( stdout, "\n<SRTP Private Key>\n%s\n\n", buff);
 
-	return;
+	genmc_store_close( store );
+	return failed;
 }
 
-/**************
- show_user_info--
- **************/
+/***********
+ write_frame--
+ ***********/
 
-void show_user_info( char *display_name, char *user_id, char *expiry_date,
-	   struct tm *expiry_tm )
+char *write_frame( int fd, char *display_name, char *user_id,
+		char *expiry_date, char *mc_b64, char *pk_b64 )
 {
-	char nice_time_str[80];
-	make_date_string( nice_time_str, expiry_tm);
-	fprintf( stdout, "<Encoded User Info>\n" );
-	fprintf( stdout, "User display name..: %s\n", display_name );
-	fprintf( stdout, "User id............: %s\n", user_id );
-	fprintf( stdout, "Expiry date........: %s\n\n", expiry_date );
-	fprintf( stdout, "This certificate expires on %s\n\n", nice_time_str );
-	return;
+	/* One record is a line of netstrings, written with a single write()
+	   so records from concurrent writers to a pipe don't interleave */
+	const char *fields[5];
+	char frame[1024];
+	int len, ok;
+
+	fields[0] = display_name;
+	fields[1] = user_id;
+	fields[2] = expiry_date;
+	fields[3] = mc_b64;
+	fields[4] = pk_b64;
+	if ( GENMC_OK != genmc_frame_put( frame, sizeof( frame ), fields, 5, &len ) )
+		return "framed record too long.";
+
+	ok = write_all( fd, frame, len );
+	memset( frame, 0, sizeof( frame ) );
+	return ok ? NULL : "writing framed record failed.";
 }
 
-/***************
- set_expiry_date--
- ***************/
+/*********
+ write_all--
+ *********/
 
-int set_expiry_date (int days_from_now, char *expiry_field,
-		struct tm *expiry_tm, time_t *expiry_t, unsigned char midnight)
+int write_all( int fd, char *buff, int len )
 {
-	time_t now, expire_time;
-	struct tm *local_expire_time;
-	char nice_time_str[80];
+	/* Returns 0 if not all of it could be written */
+	int n, w;
+
+	for ( n = 0; n < len; )
+	{
+		w = write( fd, buff + n, len - n );
+		if ( w < 0 && EINTR == errno )
+			continue;
+		if ( w <= 0 )
+			return 0;
+		n += w;
+	}
+	return 1;
+}
 
-	/* get the current time */
-	now = time( NULL );
+/**********
+ fill_spool--
+ **********/
 
-	/* Note: 12000 is just an arbitrary value that will always be past 2038.
-	   And if the user specifies something in the 40000+ range the
-	   following long int date calculation will actually roll over into
-	   a value in the early 1900s, so prevent this.
+int fill_spool( char *spool_dir, int low, int high, int n_threads )
+{
+	/* Tops the spool up to the high watermark once it has dropped below
+	   the low one. Meant to be run from cron in quiet hours.
+	   Returns the number of keys that couldn't be made or stored.
 	 */
-	if ( days_from_now > 12000 )
+	key_pool pool;
+	RSA *user_rsa;
+	int count, to_make, i, c, made = 0, failed = 0;
+
+	if ( GENMC_OK != ( c = genmc_spool_check( spool_dir, 1 ) ) )
 	{
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), spool_dir );
+		return 1;
+	}
+	if ( ( count = genmc_spool_count( spool_dir, 1 ) ) < 0 )
+	{
+		fprintf( stderr, "Error: reading key spool %s failed.\n", spool_dir );
+		return 1;
+	}
+	if ( count >= low )
+	{
+		fprintf( stderr, "Spool: %d keys ready, low watermark is %d.\n",
+				count, low );
 		return 0;
 	}
 
-	/* calculate expiry time */
-	/* posix time_t's are calulated as (long int) seconds past the 1970 epoch */
-	*expiry_t = now + (time_t)((long)days_from_now * 24 * 60 * 60);
-
-	/* watchout for date rollover after Jan 18 2038 */
-	if ( *expiry_t < 0 )
+	to_make = high - count;
+	if ( !key_pool_start( &pool, to_make, n_threads ) )
 	{
-		return 0;
+		fprintf( stderr, "Error: couldn't start the key generation threads.\n" );
+		return to_make;
+	}
+	for ( i = 0; i < to_make; ++i )
+	{
+		if ( NULL == ( user_rsa = key_pool_get( &pool ) ) )
+		{
+			++failed;
+			continue;
+		}
+		c = genmc_spool_put( spool_dir, user_rsa );
+		RSA_free( user_rsa );
+		if ( GENMC_OK != c )
+		{
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), spool_dir );
+			++failed;
+			continue;
+		}
+		++made;
 	}
+	key_pool_stop( &pool );
 
-	/* Note: the conversion to future localtime() will take daylight savings
-	   time into account -- if applicable. That means (in some places
-	   in North America for instance) a certificate generated in January,
-	   set to expire in June of the same or some following year will
-	   gain an hour, and vice versa. Not a real problem, but it may
-	   cause some confusion when for example a certificate generated
-	   at 11:30pm in January expires at 12:30am on a day in June -- one
-	   day of the month later than the user expected.
-	 */
+	fprintf( stderr, "Spool: %d keys added, %d failed, %d keys ready.\n",
+			made, failed, count + made );
+	return failed;
+}
 
-	/* convert expiry time to local time */
-	local_expire_time = localtime( expiry_t );
+/***********
+ issue_batch--
+ ***********/
 
-	/* clone local_expire_time since it points to C runtime mem and
-	   since we may need to change it if the user wants midnight.
+int issue_batch( RSA *ca_rsa, char *roster_filename, char *out_dir,
+		char *expiry_date, char *expiry_days, unsigned char midnight,
+		out_sinks *out, genmc_pipe_conf *conf, unsigned char show_stages,
+		char *profile_dir, char *template_filename )
+{
+	/* Issues a MiniCert and private key for every record in the roster on
+	   the issuing pipeline: the roster is read and packed on one thread,
+	   the keys, signatures and base64 are done by the workers of each
+	   stage, and this thread writes them out in roster order, with the
+	   phone's provisioning profile if there is a profile_dir. A record
+	   that fails is reported with its line number and skipped.
+	   Returns the number of failed records.
 	 */
-	memcpy( expiry_tm, local_expire_time, sizeof( struct tm ) );
+	batch_run batch;
+	genmc_pipe_stats stats;
+	genmc_stage_stats *ss;
+	int c, s;
 
-	/* override time values if midnight requested */
-	if (midnight)
+	memset( &batch, 0, sizeof( batch ) );
+	if ( NULL != profile_dir )
 	{
-		expiry_tm->tm_hour = 0;
-		expiry_tm->tm_min  = 0;
-		expiry_tm->tm_sec  = 0;
+		batch.profile_dir = profile_dir;
+		if ( !load_profile( &batch, template_filename ) )
+			return 1;
+	}
+	if ( !strcmp( roster_filename, "-" ) )
+		batch.fp = stdin;
+	else if ( NULL == ( batch.fp = fopen( roster_filename, "r" ) ) )
+	{
+		fprintf( stderr, "Error: roster file %s not found.\n", roster_filename );
+		free( batch.profile );
+		free( batch.profile_buff );
+		return 1;
+	}
+	batch.out_dir = out_dir;
+	batch.expiry_date = expiry_date;
+	batch.expiry_days = expiry_days;
+	batch.midnight = midnight;
+	batch.out = out;
+	batch.stats = conf->stats;
+
+	c = genmc_pipe_run( ca_rsa, conf, batch_source, &batch, batch_sink, &batch,
+			&stats );
+	batch.failed += batch.skipped; /* the threads are joined */
+	if ( batch.fp != stdin )
+		fclose( batch.fp );
+	free( batch.profile );
+	free( batch.profile_buff );
+	free( batch.macs );
+	if ( GENMC_OK != c )
+	{
+		fprintf( stderr, "Error: couldn't start the issuing threads: %s\n",
+				genmc_strerror( c ) );
+		return batch.failed + 1;
 	}
 
-	/* make the expiry date field for the MC */
-	make_date_field( expiry_field, expiry_tm);
-
-	/* no problems */
-	return 1;
-}
+	fprintf( stderr, "Batch: %d issued, %d failed.\n", batch.issued,
+			batch.failed );
 
-/****************
+	/* the stage that hardly ever waits is the one holding the others up */
+	if ( show_stages && stats.wall > 0 )
+	{
+		fprintf( stderr, "Stage    workers     jobs   busy%%  wait_in%%  wait_out%%\n" );
+		for ( s = 0; s < GENMC_STAGE_COUNT; ++s )
+		{
+			ss = &stats.stage[s];
+			fprintf( stderr, "%-8s %7d %8ld %7.1f %9.1f %10.1f\n", ss->name,
+					ss->workers, ss->jobs,
+					100 * ss->busy / ( ss->workers * stats.wall ),
+					100 * ss->wait_in / ( ss->workers * stats.wall ),
+					100 * ss->wait_out / ( ss->workers * stats.wall ) );
+		}
+		fprintf( stderr, "Elapsed: %.2fs\n", stats.wall );
+	}
+	return batch.failed;
+}
+
+/************
+ batch_source--
+ ************/
+
+int batch_source( void *arg, genmc_job *job )
+{
+	/* The pack stage: reads the roster up to the next good record and
+	   packs its user info. Bad records are reported and skipped here. */
+	batch_run *batch = arg;
+	roster_rec *rec;
+	char expiry[80], mac[80];
+	char *err;
+	int c;
+
+	if ( NULL == ( rec = malloc( sizeof( roster_rec ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory reading the roster.\n" );
+		return 0;
+	}
+	for ( ;; )
+	{
+		c = read_roster_record( batch->fp, &batch->line_no, rec->display_name,
+				rec->user_id, expiry, mac );
+		if ( 0 == c )
+		{
+			free( rec );
+			return 0;
+		}
+		if ( -2 == c )
+		{
+			fprintf( stderr, "Error: roster line %d: longer than %d characters, skipped.\n",
+					batch->line_no, ROSTER_LINE_MAX );
+			++batch->skipped;
+			genmc_stats_failed( batch->stats, "roster line too long." );
+			continue;
+		}
+		if ( c < 0 )
+		{
+			fprintf( stderr, "Error: roster line %d: malformed record, skipped.\n",
+					batch->line_no );
+			++batch->skipped;
+			genmc_stats_failed( batch->stats, "malformed roster record." );
+			continue;
+		}
+		rec->line_no = batch->line_no;
+
+		/* a per-record expiry overrides the command line one */
+		strcpy( rec->expiry_date, batch->expiry_date );
+		if ( '+' == expiry[0] )
+		{
+			c = genmc_pack_user_info( job->user_info, rec->display_name,
+					rec->user_id, rec->expiry_date, expiry+1, batch->midnight,
+					&rec->expiry_tm );
+		}
+		else
+		{
+			if ( expiry[0] )
+				strcpy( rec->expiry_date, expiry );
+			c = genmc_pack_user_info( job->user_info, rec->display_name,
+					rec->user_id, rec->expiry_date,
+					expiry[0] ? "" : batch->expiry_days, batch->midnight,
+					&rec->expiry_tm );
+		}
+		err = GENMC_OK != c ? (char *)genmc_strerror( c ) : NULL;
+		if ( NULL == err && strchr( rec->display_name, '/' ) )
+			err = "display name can't contain '/' in batch mode.";
+
+		/* a second profile for a MAC would overwrite the first */
+		rec->mac[0] = '\0';
+		if ( NULL == err && mac[0] && !parse_mac( rec->mac, mac ) )
+			err = "malformed MAC address.";
+		if ( NULL == err && NULL != batch->profile_dir )
+		{
+			if ( !rec->mac[0] )
+				err = "no MAC address for the profile.";
+			else if ( 0 != ( c = mac_seen( batch, rec->mac ) ) )
+				err = c < 0 ? "out of memory." : "the MAC address is in the roster twice.";
+		}
+		if ( NULL != err )
+		{
+			fprintf( stderr, "Error: roster line %d (%s): %s\n",
+					rec->line_no, rec->display_name, err );
+			++batch->skipped;
+			genmc_stats_failed( batch->stats, err );
+			continue;
+		}
+
+		job->rec = rec;
+		return 1;
+	}
+}
+
+/**********
+ batch_sink--
+ **********/
+
+void batch_sink( void *arg, genmc_job *job )
+{
+	/* The output stage, called in roster order */
+	batch_run *batch = arg;
+	roster_rec *rec = job->rec;
+	char minicert_filename[512], user_pk_filename[512];
+	char *err;
+
+	snprintf( minicert_filename, sizeof( minicert_filename ),
+			"%s/%s.mini_cert", batch->out_dir, rec->display_name );
+	snprintf( user_pk_filename, sizeof( user_pk_filename ),
+			"%s/%s.mini_pkey", batch->out_dir, rec->display_name );
+
+	err = GENMC_OK != job->err ? (char *)genmc_strerror( job->err ) :
+		emit_user( batch->out, rec->display_name, rec->user_id,
+				rec->expiry_date, &rec->expiry_tm, job->mc_b64, job->pk_b64,
+				minicert_filename, user_pk_filename );
+	if ( NULL == err && NULL != batch->profile_dir )
+		err = write_profile( batch, rec, job->mc_b64, job->pk_b64 );
+	memset( job->pk_b64, 0, sizeof( job->pk_b64 ) );
+	if ( NULL != err )
+	{
+		fprintf( stderr, "Error: roster line %d (%s): %s\n",
+				rec->line_no, rec->display_name, err );
+		++batch->failed;
+		/* the output errors name the file, they are counted as one */
+		genmc_stats_failed( batch->stats, GENMC_OK != job->err ?
+				genmc_strerror( job->err ) : "writing the MiniCert out failed." );
+	}
+	else
+	{
+		++batch->issued;
+		genmc_stats_count( batch->stats, GENMC_COUNT_ISSUED, 1 );
+	}
+	free( rec );
+	return;
+}
+
+/************
+ load_profile--
+ ************/
+
+int load_profile( batch_run *batch, char *template_filename )
+{
+	/* Reads the site profile and finds where each phone's settings go,
+	   right after its <flat-profile> tag. Without one the profile is
+	   just the phone's own. The buffer a phone's profile is built in is
+	   made big enough for any of them now. Returns 1, or 0 on error. */
+	static char bare[] = "<flat-profile>\n</flat-profile>\n";
+	FILE *fp;
+	char *tag, *end;
+	long len;
+
+	if ( !strlen( template_filename ) )
+	{
+		len = strlen( bare );
+		batch->profile = strdup( bare );
+	}
+	else
+	{
+		if ( NULL == ( fp = fopen( template_filename, "rb" ) ) )
+		{
+			fprintf( stderr, "Error: profile template %s not found.\n",
+					template_filename );
+			return 0;
+		}
+		fseek( fp, 0, SEEK_END );
+		len = ftell( fp );
+		rewind( fp );
+		if ( len < 0 || NULL == ( batch->profile = malloc( len + 1 ) ) ||
+				(size_t)len != fread( batch->profile, 1, len, fp ) )
+		{
+			fprintf( stderr, "Error: reading profile template %s failed.\n",
+					template_filename );
+			fclose( fp );
+			return 0;
+		}
+		fclose( fp );
+		batch->profile[len] = '\0';
+	}
+	if ( NULL == batch->profile )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+
+	/* <flat-profile> may have attributes, the phone's settings start on
+	   a line of their own */
+	if ( NULL == ( tag = strstr( batch->profile, "<flat-profile" ) ) ||
+			NULL == ( end = strchr( tag, '>' ) ) || '/' == end[-1] )
+	{
+		fprintf( stderr, "Error: profile template %s has no <flat-profile>.\n",
+				template_filename );
+		return 0;
+	}
+	if ( '\n' == *++end )
+		++end;
+	else if ( '\r' == end[0] && '\n' == end[1] )
+		end += 2;
+	batch->head_len = end - batch->profile;
+	batch->tail_len = len - batch->head_len;
+
+	/* the four settings with the tags and the name and id escaped */
+	if ( NULL == ( batch->profile_buff = malloc( len + 1 + 256 +
+			6 * 80 * 2 + GENMC_MC_B64_SIZE + GENMC_PK_B64_SIZE ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	return 1;
+}
+
+/*************
+ write_profile--
+ *************/
+
+char *write_profile( batch_run *batch, roster_rec *rec, char *mc_b64,
+		char *pk_b64 )
+{
+	/* Writes the phone's spa<mac>.xml. It is built in one buffer and
+	   written with one write() to a temporary name, then renamed, so
+	   a phone never gets half a profile, and the key is wiped after.
+	   The temporary name has the pid in it, another run writing the
+	   same MAC to the same directory has its own. */
+	static char err[560];
+	char path[512], tmp_path[512];
+	char *s;
+	int fd, ok;
+
+	s = batch->profile_buff;
+	memcpy( s, batch->profile, batch->head_len );
+	s += batch->head_len;
+	s += sprintf( s, "<Display_Name_1_>" );
+	s += xml_escape( s, rec->display_name );
+	s += sprintf( s, "</Display_Name_1_>\n<User_ID_1_>" );
+	s += xml_escape( s, rec->user_id );
+	s += sprintf( s, "</User_ID_1_>\n<Mini_Certificate>%s</Mini_Certificate>\n"
+			"<SRTP_Private_Key>%s</SRTP_Private_Key>\n", mc_b64, pk_b64 );
+	memcpy( s, batch->profile + batch->head_len, batch->tail_len );
+	s += batch->tail_len;
+
+	snprintf( path, sizeof( path ), "%s/spa%s.xml", batch->profile_dir,
+			rec->mac );
+	snprintf( tmp_path, sizeof( tmp_path ), "%s/.spa%s.xml.tmp-%ld",
+			batch->profile_dir, rec->mac, (long)getpid() );
+	ok = -1 != ( fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) );
+	if ( ok )
+	{
+		ok = write_all( fd, batch->profile_buff, s - batch->profile_buff );
+		ok = ( 0 == close( fd ) ) && ok;
+		ok = ok && 0 == rename( tmp_path, path );
+		if ( !ok )
+			remove( tmp_path );
+	}
+	memset( batch->profile_buff, 0, s - batch->profile_buff );
+	if ( !ok )
+	{
+		snprintf( err, sizeof( err ), "writing profile %s failed.", path );
+		return err;
+	}
+	return NULL;
+}
+
+/**********
+ xml_escape--
+ **********/
+
+int xml_escape( char *dst, char *src )
+{
+	/* Copies src with the XML specials escaped, dst has room for six
+	   times its length. Returns the length written. */
+	char *d = dst;
+
+	for ( ; *src; ++src )
+	{
+		switch ( *src )
+		{
+			case '&': d += sprintf( d, "&amp;" ); break;
+			case '<': d += sprintf( d, "&lt;" ); break;
+			case '>': d += sprintf( d, "&gt;" ); break;
+			case '"': d += sprintf( d, "&quot;" ); break;
+			case '\'': d += sprintf( d, "&apos;" ); break;
+			default: *d++ = *src;
+		}
+	}
+	*d = '\0';
+	return d - dst;
+}
+
+/*********
+ parse_mac--
+ *********/
+
+int parse_mac( char *mac, char *src )
+{
+	/* Takes the 12 hex digits of a MAC address written with or without
+	   ':', '-' or '.' between them, into mac as the phone names its
+	   profile: lower case, no separators. Returns 1, or 0 if it isn't
+	   one. */
+	int n = 0;
+
+	for ( ; *src; ++src )
+	{
+		if ( ':' == *src || '-' == *src || '.' == *src )
+			continue;
+		if ( !isxdigit( (unsigned char)*src ) || 12 == n )
+			return 0;
+		mac[n++] = tolower( (unsigned char)*src );
+	}
+	mac[n] = '\0';
+	return 12 == n;
+}
+
+/********
+ mac_seen--
+ ********/
+
+int mac_seen( batch_run *batch, char *mac )
+{
+	/* Adds the MAC to the set of them the roster has had, open addressed
+	   and grown at half full, 0 is a free slot.
+	   Returns 1 if it was there already, 0 if not, -1 out of memory. */
+	unsigned long long key, *old;
+	long i, j, old_size;
+
+	if ( 2 * ( batch->n_macs + 1 ) > batch->macs_size )
+	{
+		old = batch->macs;
+		old_size = batch->macs_size;
+		batch->macs_size = old_size ? 2 * old_size : 1024;
+		if ( NULL == ( batch->macs = calloc( batch->macs_size,
+				sizeof( unsigned long long ) ) ) )
+		{
+			batch->macs = old;
+			batch->macs_size = old_size;
+			return -1;
+		}
+		for ( i = 0; i < old_size; ++i )
+		{
+			if ( 0 == old[i] )
+				continue;
+			for ( j = old[i] & ( batch->macs_size - 1 ); batch->macs[j];
+					j = ( j + 1 ) & ( batch->macs_size - 1 ) )
+				;
+			batch->macs[j] = old[i];
+		}
+		free( old );
+	}
+
+	key = strtoull( mac, NULL, 16 ) + 1;
+	for ( j = key & ( batch->macs_size - 1 ); batch->macs[j];
+			j = ( j + 1 ) & ( batch->macs_size - 1 ) )
+		if ( key == batch->macs[j] )
+			return 1;
+	batch->macs[j] = key;
+	++batch->n_macs;
+	return 0;
+}
+
+/**************
+ key_pool_start--
+ **************/
+
+int key_pool_start( key_pool *pool, int n_keys, int n_threads )
+{
+	/* Starts n_threads workers that make n_keys user keys between them.
+	   At most two keys per worker wait in the pool, so the workers stay
+	   just ahead of the signing. Returns 0 if no thread could be started.
+	 */
+	int i;
+
+	if ( n_threads < 1 )
+		n_threads = 1;
+	if ( n_threads > n_keys )
+		n_threads = n_keys;
+
+	memset( pool, 0, sizeof( key_pool ) );
+	pool->size = n_threads * 2;
+	pool->keys = calloc( pool->size, sizeof( RSA * ) );
+	pool->threads = calloc( n_threads, sizeof( pthread_t ) );
+	if ( NULL == pool->keys || NULL == pool->threads )
+	{
+		free( pool->keys );
+		free( pool->threads );
+		return 0;
+	}
+	pool->to_make = n_keys;
+	pthread_mutex_init( &pool->lock, NULL );
+	pthread_cond_init( &pool->not_empty, NULL );
+	pthread_cond_init( &pool->not_full, NULL );
+
+	for ( i = 0; i < n_threads; ++i )
+	{
+		if ( pthread_create( &pool->threads[i], NULL, key_worker, pool ) )
+			break;
+		pool->n_threads++;
+	}
+	if ( 0 == pool->n_threads )
+	{
+		key_pool_stop( pool );
+		return 0;
+	}
+
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: %d key generation threads started\n",
+			pool->n_threads );
+	#endif
+	return 1;
+}
+
+/************
+ key_pool_get--
+ ************/
+
+RSA *key_pool_get( key_pool *pool )
+{
+	/* Waits for the next finished key. NULL means a worker gave up on one. */
+	RSA *user_rsa;
+
+	pthread_mutex_lock( &pool->lock );
+	while ( 0 == pool->count )
+		pthread_cond_wait( &pool->not_empty, &pool->lock );
+	user_rsa = pool->keys[pool->head];
+	pool->head = ( pool->head + 1 ) % pool->size;
+	pool->count--;
+	pthread_cond_signal( &pool->not_full );
+	pthread_mutex_unlock( &pool->lock );
+
+	return user_rsa;
+}
+
+/*************
+ key_pool_stop--
+ *************/
+
+void key_pool_stop( key_pool *pool )
+{
+	/* Joins the workers and frees any keys nobody picked up. */
+	int i;
+
+	for ( i = 0; i < pool->n_threads; ++i )
+		pthread_join( pool->threads[i], NULL );
+	for ( i = 0; i < pool->count; ++i )
+		if ( pool->keys[( pool->head + i ) % pool->size] )
+			RSA_free( pool->keys[( pool->head + i ) % pool->size] );
+
+	pthread_cond_destroy( &pool->not_full );
+	pthread_cond_destroy( &pool->not_empty );
+	pthread_mutex_destroy( &pool->lock );
+	free( pool->keys );
+	free( pool->threads );
+	return;
+}
+
+/**********
+ key_worker--
+ **********/
+
+void *key_worker( void *arg )
+{
+	key_pool *pool = arg;
+	genmc_keygen *keygen;
+	RSA *user_rsa;
+
+	if ( GENMC_OK != genmc_keygen_new( &keygen ) )
+		keygen = NULL;
+
+	for ( ;; )
+	{
+		/* claim one of the keys still to be made */
+		pthread_mutex_lock( &pool->lock );
+		if ( 0 == pool->to_make )
+		{
+			pthread_mutex_unlock( &pool->lock );
+			break;
+		}
+		pool->to_make--;
+		pthread_mutex_unlock( &pool->lock );
+
+		if ( GENMC_OK != ( NULL != keygen ? genmc_keygen_make( keygen, &user_rsa ) :
+				genmc_gen_user_key( &user_rsa ) ) )
+			user_rsa = NULL; /* the consumer reports it against its record */
+
+		pthread_mutex_lock( &pool->lock );
+		while ( pool->count == pool->size )
+			pthread_cond_wait( &pool->not_full, &pool->lock );
+		pool->keys[( pool->head + pool->count ) % pool->size] = user_rsa;
+		pool->count++;
+		pthread_cond_signal( &pool->not_empty );
+		pthread_mutex_unlock( &pool->lock );
+	}
+
+	genmc_keygen_free( keygen );
+	/* OpenSSL keeps a per-thread error queue */
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/************
+ verify_paths--
+ ************/
+
+int verify_paths( RSA *ca_rsa, char *path, int n_threads )
+{
+	/* Checks the MiniCert in path, or every *.mini_cert in it if it is a
+	   directory, on n_threads threads. Writes one tab separated line per
+	   MiniCert to stdout, in name order:
+	     <status> <file> <display_name> <user_id> <expiry_date>
+	   Returns the number that aren't valid.
+	 */
+	verify_job job;
+	verify_result *res;
+	int count[GENMC_MC_COUNT];
+	int i;
+
+	memset( &job, 0, sizeof( job ) );
+	memset( count, 0, sizeof( count ) );
+	job.ca_rsa = ca_rsa;
+	job.now = time( NULL );
+
+	if ( ( job.n_files = list_minicerts( path, &job.files ) ) < 0 )
+		return 1;
+	if ( NULL == ( job.results = calloc( job.n_files + 1, sizeof( verify_result ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 1;
+	}
+	pthread_mutex_init( &job.lock, NULL );
+	run_workers( verify_worker, &job, n_threads, job.n_files );
+	pthread_mutex_destroy( &job.lock );
+
+	for ( i = 0; i < job.n_files; ++i )
+	{
+		res = &job.results[i];
+		count[res->status]++;
+		fprintf( stdout, "%s\t%s\t%s\t%s\t%s\n", genmc_mc_status( res->status ),
+				job.files[i], res->display_name, res->user_id,
+				res->expiry_date );
+		free( job.files[i] );
+	}
+	free( job.files );
+	free( job.results );
+
+	fprintf( stderr, "Verify: %d valid, %d expired, %d wrong_ca, %d corrupt.\n",
+			count[GENMC_MC_VALID], count[GENMC_MC_EXPIRED],
+			count[GENMC_MC_WRONG_CA], count[GENMC_MC_CORRUPT] );
+	return job.n_files - count[GENMC_MC_VALID];
+}
+
+/************
+ resign_paths--
+ ************/
+
+int resign_paths( RSA *ca_rsa, RSA *old_ca_rsa, char *path, char *expiry_date,
+		char *out_dir, int n_threads )
+{
+	/* Signs the MiniCerts in path over again with ca_rsa, keeping the user
+	   keys. path is a MiniCert store, a MiniCert file or a directory of
+	   *.mini_cert files. Files are rewritten in place, or written to
+	   out_dir along with their .mini_pkey if that isn't NULL. A store gets
+	   the re-signed MiniCerts appended, for the newest record of every
+	   user. expiry_date NULL keeps every MiniCert's own expiry date.
+	   Returns the number that couldn't be re-signed.
+	 */
+	resign_job job;
+	resign_result *res;
+	genmc_store_entry entry;
+	long i;
+	int resigned = 0, failed = 0, c;
+
+	memset( &job, 0, sizeof( job ) );
+	job.ca_rsa = ca_rsa;
+	job.old_ca_rsa = old_ca_rsa;
+	job.expiry_date = expiry_date;
+	job.out_dir = out_dir;
+
+	/* a store is re-signed into itself, anything else is files */
+	if ( GENMC_OK == genmc_store_open( &job.store, path, 0 ) )
+	{
+		genmc_store_close( job.store );
+		if ( GENMC_OK != ( c = genmc_store_open( &job.store, path, 1 ) ) )
+		{
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), path );
+			return 1;
+		}
+		job.n_items = genmc_store_count( job.store );
+		genmc_store_sync_every( job.store, STORE_SYNC_RECORDS );
+	}
+	else if ( ( job.n_items = list_minicerts( path, &job.files ) ) < 0 )
+		return 1;
+
+	if ( NULL == ( job.results = calloc( job.n_items + 1, sizeof( resign_result ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		genmc_store_close( job.store );
+		return 1;
+	}
+	pthread_mutex_init( &job.lock, NULL );
+	run_workers( resign_worker, &job, n_threads, job.n_items );
+	pthread_mutex_destroy( &job.lock );
+
+	for ( i = 0; i < job.n_items; ++i )
+	{
+		res = &job.results[i];
+		if ( GENMC_OK == res->err && NULL != job.store )
+		{
+			/* the key is the same, it goes into the new record as it was */
+			if ( GENMC_OK == ( res->err = genmc_store_get( job.store, i, &entry ) ) )
+				res->err = genmc_store_append( job.store, entry.display_name,
+						entry.user_id, res->expiry_date, res->mc_b64, entry.pk_b64 );
+			memset( entry.pk_b64, 0, sizeof( entry.pk_b64 ) );
+		}
+		if ( GENMC_OK == res->err )
+			++resigned;
+		else if ( GENMC_ERR_STORE_NOT_FOUND != res->err )
+		{
+			if ( NULL != job.store )
+				fprintf( stderr, "Error: store record %ld (%s): %s\n", i,
+						res->display_name, genmc_strerror( res->err ) );
+			else
+				fprintf( stderr, "Error: %s: %s\n", job.files[i],
+						genmc_strerror( res->err ) );
+			++failed;
+		}
+		if ( NULL != job.files )
+			free( job.files[i] );
+	}
+	free( job.files );
+	free( job.results );
+
+	if ( NULL != job.store && GENMC_OK != ( c = genmc_store_close( job.store ) ) )
+	{
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), path );
+		++failed;
+	}
+	fprintf( stderr, "Re-sign: %d re-signed, %d failed.\n", resigned, failed );
+	return failed;
+}
+
+/*************
+ resign_worker--
+ *************/
+
+void *resign_worker( void *arg )
+{
+	resign_job *job = arg;
+	resign_result *res;
+	genmc_signer *signer;
+	genmc_store_entry entry;
+	genmc_mc_info info;
+	char buff[1024], path[1024], *name;
+	long i;
+	int err, len, fd;
+
+	/* each worker signs with its own signer, made in this thread */
+	err = genmc_signer_new( &signer, job->ca_rsa );
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &job->lock );
+		i = job->next++;
+		pthread_mutex_unlock( &job->lock );
+		if ( i >= job->n_items )
+			break;
+		res = &job->results[i];
+		if ( GENMC_OK != ( res->err = err ) )
+			continue;
+
+		if ( NULL != job->store )
+		{
+			/* only the newest record of a user counts */
+			if ( GENMC_OK != ( res->err = genmc_store_get( job->store, i, &entry ) ) )
+				continue;
+			memset( entry.pk_b64, 0, sizeof( entry.pk_b64 ) );
+			strcpy( res->display_name, entry.display_name );
+			if ( i != genmc_store_find( job->store, GENMC_STORE_BY_ID, entry.user_id ) )
+			{
+				res->err = GENMC_ERR_STORE_NOT_FOUND;
+				continue;
+			}
+			strcpy( buff, entry.mc_b64 );
+			len = strlen( buff );
+		}
+		else
+		{
+			len = -1;
+			if ( ( fd = open( job->files[i], O_RDONLY ) ) >= 0 )
+			{
+				len = read( fd, buff, sizeof( buff ) );
+				close( fd );
+			}
+			if ( len <= 0 || len == sizeof( buff ) )
+			{
+				res->err = len < 0 ? GENMC_ERR_MC_READ : GENMC_ERR_MC_CORRUPT;
+				continue;
+			}
+		}
+
+		res->err = genmc_signer_resign( signer, job->old_ca_rsa, buff, len,
+				job->expiry_date, res->mc_b64, sizeof( res->mc_b64 ), &info );
+		if ( GENMC_OK != res->err )
+			continue;
+		strcpy( res->expiry_date, info.expiry_date );
+
+		if ( NULL == job->store )
+		{
+			name = strrchr( job->files[i], '/' );
+			name = name ? name + 1 : job->files[i];
+			if ( NULL != job->out_dir )
+				snprintf( path, sizeof( path ), "%s/%s", job->out_dir, name );
+			else
+				snprintf( path, sizeof( path ), "%s", job->files[i] );
+			res->err = replace_file( path, res->mc_b64 );
+			if ( GENMC_OK == res->err && NULL != job->out_dir )
+				res->err = copy_pkey( job->files[i], path );
+		}
+	}
+
+	genmc_signer_free( signer );
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/************
+ replace_file--
+ ************/
+
+int replace_file( char *path, char *text )
+{
+	/* written next to it and renamed over it, a crash leaves either the
+	   old or the new one */
+	char tmp[1100];
+	FILE *fp;
+	int ok;
+
+	snprintf( tmp, sizeof( tmp ), "%s.tmp-%ld", path, (long)getpid() );
+	if ( NULL == ( fp = fopen( tmp, "wb" ) ) )
+		return GENMC_ERR_MC_WRITE;
+	ok = fputs( text, fp ) >= 0;
+	ok = ( 0 == fclose( fp ) ) && ok;
+	if ( !ok || 0 != rename( tmp, path ) )
+	{
+		unlink( tmp );
+		return GENMC_ERR_MC_WRITE;
+	}
+	return GENMC_OK;
+}
+
+/*********
+ copy_pkey--
+ *********/
+
+int copy_pkey( char *mc_path, char *new_mc_path )
+{
+	/* the .mini_pkey that goes with a .mini_cert, unchanged */
+	char from[1024], to[1024], pk_b64[1024];
+	int len, fd, err;
+
+	snprintf( from, sizeof( from ), "%.*s.mini_pkey",
+			(int)strlen( mc_path ) - 10, mc_path );
+	snprintf( to, sizeof( to ), "%.*s.mini_pkey",
+			(int)strlen( new_mc_path ) - 10, new_mc_path );
+	if ( ( fd = open( from, O_RDONLY ) ) < 0 )
+		return GENMC_OK; /* the keys may well be kept elsewhere */
+	len = read( fd, pk_b64, sizeof( pk_b64 ) - 1 );
+	close( fd );
+	if ( len < 0 || len == sizeof( pk_b64 ) - 1 )
+		return GENMC_ERR_MC_WRITE;
+	pk_b64[len] = '\0';
+	err = replace_file( to, pk_b64 );
+	memset( pk_b64, 0, sizeof( pk_b64 ) );
+	return err;
+}
+
+/**************
+ list_minicerts--
+ **************/
+
+int list_minicerts( char *path, char ***files )
+{
+	/* path itself if it's a file, or every *.mini_cert in it in name
+	   order. Returns how many, or -1 after saying what went wrong. */
+	struct stat st;
+	DIR *dir;
+	struct dirent *de;
+	char file[1024], **more;
+	int n_files = 0, max_files = 0, len;
+
+	*files = NULL;
+	if ( 0 != stat( path, &st ) )
+	{
+		fprintf( stderr, "Error: %s not found.\n", path );
+		return -1;
+	}
+	if ( !S_ISDIR( st.st_mode ) )
+	{
+		if ( NULL == ( *files = malloc( sizeof( char * ) ) ) ||
+				NULL == ( (*files)[0] = strdup( path ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			free( *files );
+			return -1;
+		}
+		return 1;
+	}
+
+	if ( NULL == ( dir = opendir( path ) ) )
+	{
+		fprintf( stderr, "Error: reading directory %s failed.\n", path );
+		return -1;
+	}
+	while ( NULL != ( de = readdir( dir ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len <= 10 || strcmp( de->d_name + len - 10, ".mini_cert" ) )
+			continue;
+		if ( n_files == max_files )
+		{
+			max_files = max_files ? max_files * 2 : 1024;
+			more = realloc( *files, max_files * sizeof( char * ) );
+			if ( NULL == more )
+				break;
+			*files = more;
+		}
+		snprintf( file, sizeof( file ), "%s/%s", path, de->d_name );
+		if ( NULL == ( (*files)[n_files] = strdup( file ) ) )
+			break;
+		n_files++;
+	}
+	closedir( dir );
+	if ( NULL != de )
+	{
+		fprintf( stderr, "Error: out of memory reading %s.\n", path );
+		while ( n_files > 0 )
+			free( (*files)[--n_files] );
+		free( *files );
+		return -1;
+	}
+	qsort( *files, n_files, sizeof( char * ), compare_names );
+	return n_files;
+}
+
+/***********
+ run_workers--
+ ***********/
+
+void run_workers( void *(*worker)( void * ), void *arg, int n_threads,
+		long n_items )
+{
+	/* Runs worker on up to n_threads threads, no more than there are
+	   items, and waits for them. This thread does the work itself if no
+	   other can be started. */
+	pthread_t *threads;
+	int n, i;
+
+	if ( n_threads > n_items )
+		n_threads = n_items;
+	if ( n_threads < 1 )
+		n_threads = 1;
+	if ( NULL == ( threads = calloc( n_threads, sizeof( pthread_t ) ) ) )
+		n_threads = 0;
+	for ( n = 0; n < n_threads; ++n )
+		if ( pthread_create( &threads[n], NULL, worker, arg ) )
+			break;
+	if ( 0 == n )
+		worker( arg );
+	for ( i = 0; i < n; ++i )
+		pthread_join( threads[i], NULL );
+	free( threads );
+	return;
+}
+
+/*************
+ verify_worker--
+ *************/
+
+void *verify_worker( void *arg )
+{
+	verify_job *job = arg;
+	verify_result *res;
+	genmc_mc_info info;
+	char buff[1024];
+	int i, fd, len;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &job->lock );
+		i = job->next++;
+		pthread_mutex_unlock( &job->lock );
+		if ( i >= job->n_files )
+			break;
+		res = &job->results[i];
+
+		len = -1;
+		if ( ( fd = open( job->files[i], O_RDONLY ) ) >= 0 )
+		{
+			len = read( fd, buff, sizeof( buff ) );
+			close( fd );
+		}
+		if ( len <= 0 || len == sizeof( buff ) )
+		{
+			res->status = GENMC_MC_CORRUPT;
+			continue;
+		}
+
+		res->status = genmc_verify_mc( job->ca_rsa, buff, len, job->now, &info );
+		clean_field( res->display_name, info.display_name );
+		clean_field( res->user_id, info.user_id );
+		clean_field( res->expiry_date, info.expiry_date );
+	}
+
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/*****
+ serve--
+ *****/
+
+static volatile sig_atomic_t serve_stop, serve_dump;
+static int serve_wake_fd = -1;
+
+int serve( RSA *ca_rsa, RSA *old_ca_rsa, char *socket_path, char *spool_dir,
+		char *expiry_date, char *expiry_days, unsigned char midnight,
+		genmc_store *store, int n_threads, int n_keys, genmc_stats *stats,
+		unsigned char stats_json )
+{
+	/* Serves issue, verify and re-sign requests on a Unix socket until
+	   SIGTERM or SIGINT. This thread reads the requests from every client
+	   and hands each whole one to the n_threads workers, which write the
+	   reply themselves. A client's next request isn't read before the
+	   reply to the last one is out, so the replies come in order. Another
+	   thread keeps n_keys user keys made ahead. SIGUSR1 writes the stats
+	   out and flushes the trace, if there are any.
+	   Returns 0 after a clean shutdown, 1 if it couldn't start.
+	 */
+	serve_run *run;
+	serve_conn *conn;
+	serve_worker *workers;
+	struct sockaddr_un sun;
+	struct pollfd pfd[SERVE_MAX_CONNS + 2];
+	int pslot[SERVE_MAX_CONNS + 2];
+	struct sigaction sa;
+	struct rlimit rl;
+	struct stat st;
+	pthread_t *threads, keymaker;
+	pthread_attr_t attr;
+	int lfd, n, i, n_open, n_workers = 0, have_keymaker = 0;
+
+	if ( strlen( socket_path ) >= sizeof( sun.sun_path ) )
+	{
+		fprintf( stderr, "Error: socket path %s is too long.\n", socket_path );
+		return 1;
+	}
+	run = calloc( 1, sizeof( serve_run ) );
+	workers = calloc( n_threads, sizeof( serve_worker ) );
+	threads = calloc( n_threads, sizeof( pthread_t ) );
+	if ( NULL == run || NULL == workers || NULL == threads ||
+			( n_keys > 0 && NULL == ( run->keys = calloc( n_keys, sizeof( RSA * ) ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		free( run );
+		free( workers );
+		free( threads );
+		return 1;
+	}
+	run->ca_rsa = ca_rsa;
+	run->old_ca_rsa = old_ca_rsa;
+	run->spool_dir = spool_dir;
+	run->expiry_date = expiry_date;
+	run->expiry_days = expiry_days;
+	run->midnight = midnight;
+	run->store = store;
+	run->max_keys = n_keys;
+	run->stats = stats;
+	run->stats_json = stats_json;
+	for ( i = 0; i < SERVE_MAX_CONNS; ++i )
+		run->conns[i].fd = -1;
+
+	/* a stale socket of a daemon that died is replaced, a live one isn't */
+	memset( &sun, 0, sizeof( sun ) );
+	sun.sun_family = AF_UNIX;
+	strcpy( sun.sun_path, socket_path );
+	if ( ( lfd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+	{
+		fprintf( stderr, "Error: socket() failed: %s.\n", strerror( errno ) );
+		free( run->keys );
+		free( run );
+		free( workers );
+		free( threads );
+		return 1;
+	}
+	if ( 0 == lstat( socket_path, &st ) && S_ISSOCK( st.st_mode ) &&
+			0 != connect( lfd, (struct sockaddr *)&sun, sizeof( sun ) ) )
+		unlink( socket_path );
+	close( lfd );
+	if ( ( lfd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 ||
+			0 != bind( lfd, (struct sockaddr *)&sun, sizeof( sun ) ) ||
+			0 != listen( lfd, SOMAXCONN ) || 0 != pipe( run->wake ) )
+	{
+		fprintf( stderr, "Error: can't listen on %s: %s.\n", socket_path,
+				strerror( errno ) );
+		if ( lfd >= 0 )
+			close( lfd );
+		free( run->keys );
+		free( run );
+		free( workers );
+		free( threads );
+		return 1;
+	}
+	fcntl( lfd, F_SETFL, fcntl( lfd, F_GETFL ) | O_NONBLOCK );
+	fcntl( run->wake[0], F_SETFL, fcntl( run->wake[0], F_GETFL ) | O_NONBLOCK );
+	fcntl( run->wake[1], F_SETFL, fcntl( run->wake[1], F_GETFL ) | O_NONBLOCK );
+
+	/* a client that goes away mid reply mustn't take the daemon with it */
+	memset( &sa, 0, sizeof( sa ) );
+	sa.sa_handler = SIG_IGN;
+	sigaction( SIGPIPE, &sa, NULL );
+	serve_stop = serve_dump = 0;
+	serve_wake_fd = run->wake[1];
+	sa.sa_handler = serve_signal;
+	sigaction( SIGTERM, &sa, NULL );
+	sigaction( SIGINT, &sa, NULL );
+	if ( NULL != stats )
+		sigaction( SIGUSR1, &sa, NULL );
+
+	/* the CA key and the keys made ahead stay out of swap and core files,
+	   the threads get small stacks so the locked memory stays small */
+	rl.rlim_cur = rl.rlim_max = 0;
+	setrlimit( RLIMIT_CORE, &rl );
+	if ( 0 != mlockall( MCL_CURRENT | MCL_FUTURE ) )
+		fprintf( stderr, "Warning: memory not locked: %s.\n", strerror( errno ) );
+	pthread_attr_init( &attr );
+	pthread_attr_setstacksize( &attr, 256 * 1024 );
+
+	pthread_mutex_init( &run->lock, NULL );
+	pthread_mutex_init( &run->store_lock, NULL );
+	pthread_cond_init( &run->have_req, NULL );
+	pthread_cond_init( &run->need_keys, NULL );
+	for ( i = 0; i < n_threads; ++i )
+	{
+		workers[i].run = run;
+		if ( pthread_create( &threads[i], &attr, serve_worker_main, &workers[i] ) )
+			break;
+		n_workers++;
+	}
+	if ( n_keys > 0 && 0 == pthread_create( &keymaker, &attr, serve_keymaker, run ) )
+		have_keymaker = 1;
+	pthread_attr_destroy( &attr );
+
+	if ( n_workers > 0 )
+		fprintf( stderr, "Daemon: pid %ld serving on %s, %d workers.\n",
+				(long)getpid(), socket_path, n_workers );
+	else
+	{
+		fprintf( stderr, "Error: couldn't start the worker threads.\n" );
+		serve_stop = 1;
+	}
+
+	genmc_stats_thread( stats, "socket" );
+	while ( !serve_stop )
+	{
+		if ( serve_dump )
+		{
+			serve_dump = 0;
+			if ( stats_json )
+				genmc_stats_json( stats, stderr, "daemon" );
+			genmc_stats_flush( stats );
+		}
+
+		/* a client with a request at the workers isn't listened to */
+		pfd[0].fd = run->wake[0];
+		pfd[0].events = POLLIN;
+		n = 1;
+		for ( i = 0, n_open = 0; i < SERVE_MAX_CONNS; ++i )
+		{
+			conn = &run->conns[i];
+			if ( conn->fd < 0 )
+				continue;
+			n_open++;
+			if ( conn->busy )
+				continue;
+			pfd[n].fd = conn->fd;
+			pfd[n].events = POLLIN;
+			pslot[n++] = i;
+		}
+		if ( n_open < SERVE_MAX_CONNS )
+		{
+			pfd[n].fd = lfd;
+			pfd[n].events = POLLIN;
+			pslot[n++] = -1;
+		}
+
+		if ( poll( pfd, n, -1 ) < 0 )
+		{
+			if ( EINTR == errno )
+				continue;
+			fprintf( stderr, "Error: poll() failed: %s.\n", strerror( errno ) );
+			break;
+		}
+		if ( pfd[0].revents )
+			serve_finished( run );
+		for ( i = 1; i < n; ++i )
+		{
+			if ( 0 == pfd[i].revents )
+				continue;
+			if ( pslot[i] < 0 )
+				serve_accept( run, lfd );
+			else
+				serve_read( run, pslot[i] );
+		}
+	}
+
+	/* the workers finish what they were given, then everything goes */
+	pthread_mutex_lock( &run->lock );
+	run->stopping = 1;
+	pthread_cond_broadcast( &run->have_req );
+	pthread_cond_broadcast( &run->need_keys );
+	pthread_mutex_unlock( &run->lock );
+	for ( i = 0; i < n_workers; ++i )
+		pthread_join( threads[i], NULL );
+	if ( have_keymaker )
+		pthread_join( keymaker, NULL );
+	serve_wake_fd = -1;
+
+	for ( i = 0; i < SERVE_MAX_CONNS; ++i )
+		if ( run->conns[i].fd >= 0 )
+			serve_close( run, i );
+	close( lfd );
+	unlink( socket_path );
+	close( run->wake[0] );
+	close( run->wake[1] );
+	for ( i = 0; i < run->n_keys; ++i )
+		RSA_free( run->keys[i] );
+
+	fprintf( stderr, "Daemon: %ld issued, %ld verified, %ld re-signed, %ld failed.\n",
+			run->issued, run->verified, run->resigned, run->failed );
+	pthread_cond_destroy( &run->need_keys );
+	pthread_cond_destroy( &run->have_req );
+	pthread_mutex_destroy( &run->store_lock );
+	pthread_mutex_destroy( &run->lock );
+	free( run->keys );
+	free( run );
+	free( workers );
+	free( threads );
+	return 0 == n_workers;
+}
+
+/************
+ serve_signal--
+ ************/
+
+void serve_signal( int sig )
+{
+	int saved = errno;
+
+	if ( SIGUSR1 == sig )
+		serve_dump = 1;
+	else
+		serve_stop = 1;
+	if ( serve_wake_fd >= 0 )
+		write( serve_wake_fd, "s", 1 );
+	errno = saved;
+	return;
+}
+
+/************
+ serve_accept--
+ ************/
+
+void serve_accept( serve_run *run, int lfd )
+{
+	/* Takes in every client waiting, as long as there are free slots */
+	serve_conn *conn;
+	struct timeval tv;
+	int fd, i;
+
+	for ( i = 0; i < SERVE_MAX_CONNS; ++i )
+	{
+		conn = &run->conns[i];
+		if ( conn->fd >= 0 )
+			continue;
+		if ( ( fd = accept( lfd, NULL, NULL ) ) < 0 )
+			return;
+
+		/* read only when poll() says so, the workers' writes block but a
+		   client that doesn't read its replies is given up on */
+		fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+		tv.tv_sec = 5;
+		tv.tv_usec = 0;
+		setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+		conn->fd = fd;
+		conn->busy = conn->dead = 0;
+		conn->len = conn->used = 0;
+	}
+	return;
+}
+
+/**********
+ serve_read--
+ **********/
+
+void serve_read( serve_run *run, int slot )
+{
+	serve_conn *conn = &run->conns[slot];
+	int n;
+
+	n = read( conn->fd, conn->buff + conn->len, sizeof( conn->buff ) - conn->len );
+	if ( n < 0 && ( EINTR == errno || EAGAIN == errno ) )
+		return;
+	if ( n <= 0 )
+	{
+		serve_close( run, slot );
+		return;
+	}
+	conn->len += n;
+	serve_parse( run, slot );
+	return;
+}
+
+/***********
+ serve_parse--
+ ***********/
+
+void serve_parse( serve_run *run, int slot )
+{
+	/* Hands the client's next request to the workers once it is all in.
+	   A client that sends a broken one is told so and dropped, there is
+	   no telling where its next request would start. */
+	serve_conn *conn = &run->conns[slot];
+	const char *fields[2];
+	char reply[128];
+	int c, len;
+
+	c = genmc_frame_get( conn->buff, conn->len, conn->fields, &conn->n_fields,
+			&conn->used );
+	if ( GENMC_OK != c )
+	{
+		fields[0] = "error";
+		fields[1] = genmc_strerror( c );
+		if ( GENMC_OK == genmc_frame_put( reply, sizeof( reply ), fields, 2, &len ) )
+			write_all( conn->fd, reply, len );
+		serve_close( run, slot );
+		genmc_stats_failed( run->stats, genmc_strerror( c ) );
+		return;
+	}
+	if ( 0 == conn->used )
+		return;
+
+	conn->busy = 1;
+	if ( NULL != run->stats )
+		conn->queued = genmc_stats_now();
+	pthread_mutex_lock( &run->lock );
+	run->reqs[( run->req_head + run->req_count ) % SERVE_MAX_CONNS] = slot;
+	run->req_count++;
+	pthread_cond_signal( &run->have_req );
+	pthread_mutex_unlock( &run->lock );
+	return;
+}
+
+/**************
+ serve_finished--
+ **************/
+
+void serve_finished( serve_run *run )
+{
+	/* The clients whose replies the workers have written may go on */
+	int done[SERVE_MAX_CONNS];
+	char buff[64];
+	serve_conn *conn;
+	int n, i;
+
+	while ( read( run->wake[0], buff, sizeof( buff ) ) > 0 )
+		;
+	pthread_mutex_lock( &run->lock );
+	n = run->done_count;
+	memcpy( done, run->done, n * sizeof( int ) );
+	run->done_count = 0;
+	pthread_mutex_unlock( &run->lock );
+
+	for ( i = 0; i < n; ++i )
+	{
+		conn = &run->conns[done[i]];
+		conn->busy = 0;
+		if ( conn->dead )
+		{
+			serve_close( run, done[i] );
+			continue;
+		}
+
+		/* the client may have sent its next request already */
+		conn->len -= conn->used;
+		memmove( conn->buff, conn->buff + conn->used, conn->len );
+		conn->used = 0;
+		if ( conn->len > 0 )
+			serve_parse( run, done[i] );
+	}
+	return;
+}
+
+/***********
+ serve_close--
+ ***********/
+
+void serve_close( serve_run *run, int slot )
+{
+	serve_conn *conn = &run->conns[slot];
+
+	close( conn->fd );
+	memset( conn->buff, 0, conn->len );
+	conn->fd = -1;
+	conn->len = 0;
+	return;
+}
+
+/*****************
+ serve_worker_main--
+ *****************/
+
+void *serve_worker_main( void *arg )
+{
+	serve_worker *w = arg;
+	serve_run *run = w->run;
+	serve_conn *conn;
+	char reply[SERVE_REPLY_SIZE], *err;
+	const char *fields[2];
+	int slot, len;
+	double queued;
+
+	/* each worker signs with its own context and signer, made in this
+	   thread, and makes its own keys when none are ready */
+	w->err = genmc_init( &w->ctx, run->ca_rsa );
+	if ( GENMC_OK == w->err )
+		w->err = genmc_signer_new( &w->signer, run->ca_rsa );
+	if ( GENMC_OK != genmc_keygen_new( &w->keygen ) )
+		w->keygen = NULL;
+	genmc_stats_thread( run->stats, "worker" );
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &run->lock );
+		while ( 0 == run->req_count && !run->stopping )
+			pthread_cond_wait( &run->have_req, &run->lock );
+		if ( 0 == run->req_count )
+		{
+			pthread_mutex_unlock( &run->lock );
+			break;
+		}
+		slot = run->reqs[run->req_head];
+		run->req_head = ( run->req_head + 1 ) % SERVE_MAX_CONNS;
+		run->req_count--;
+		w->rec = run->n_reqs++;
+		pthread_mutex_unlock( &run->lock );
+		conn = &run->conns[slot];
+		queued = conn->queued;
+
+		err = GENMC_OK != w->err ? (char *)genmc_strerror( w->err ) :
+			serve_request( w, conn->fields, conn->n_fields, reply, &len );
+		if ( NULL != err )
+		{
+			fields[0] = "error";
+			fields[1] = err;
+			genmc_frame_put( reply, sizeof( reply ), fields, 2, &len );
+		}
+		conn->dead = !write_all( conn->fd, reply, len );
+		memset( reply, 0, sizeof( reply ) );
+		if ( NULL != run->stats )
+			genmc_stats_span( run->stats, GENMC_PHASE_REQUEST, w->rec, queued,
+					genmc_stats_now(), err );
+		if ( NULL != err )
+			genmc_stats_failed( run->stats, err );
+
+		pthread_mutex_lock( &run->lock );
+		if ( NULL != err )
+			run->failed++;
+		run->done[run->done_count++] = slot;
+		pthread_mutex_unlock( &run->lock );
+		write( run->wake[1], "r", 1 );
+	}
+
+	genmc_keygen_free( w->keygen );
+	genmc_signer_free( w->signer );
+	genmc_free( w->ctx );
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/*************
+ serve_request--
+ *************/
+
+char *serve_request( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len )
+{
+	/* Works out one request, the reply is a framed record starting with
+	   "ok". Returns why it failed, or NULL. */
+	if ( !strcmp( fields[0], "issue" ) )
+		return serve_issue( w, fields, n_fields, reply, reply_len );
+	if ( !strcmp( fields[0], "verify" ) )
+		return serve_verify( w, fields, n_fields, reply, reply_len );
+	if ( !strcmp( fields[0], "resign" ) )
+		return serve_resign( w, fields, n_fields, reply, reply_len );
+	return "unknown request, it must be issue, verify or resign.";
+}
+
+/***********
+ serve_issue--
+ ***********/
+
+char *serve_issue( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len )
+{
+	/* issue,<display_name>,<user_id>[,<expiry>] gets
+	   ok,<display_name>,<user_id>,<expiry_date>,<minicert>,<userpk> */
+	serve_run *run = w->run;
+	unsigned char user_info[GENMC_USER_INFO_LEN];
+	char mc_b64[GENMC_MC_B64_SIZE], pk_b64[GENMC_PK_B64_SIZE];
+	char expiry_date[80], *expiry;
+	const char *out[6];
+	struct tm expiry_tm;
+	RSA *user_rsa;
+	double t;
+	int c, counter;
+
+	if ( n_fields < 3 || n_fields > 4 )
+		return "issue takes a display name, a user id and maybe an expiry.";
+	expiry = n_fields > 3 ? fields[3] : "";
+	if ( strlen( expiry ) >= sizeof( expiry_date ) )
+		return (char *)genmc_strerror( GENMC_ERR_DATE_LEN );
+
+	/* the same rules as for a roster record */
+	t = genmc_stats_now();
+	strcpy( expiry_date, run->expiry_date );
+	if ( '+' == expiry[0] )
+		c = genmc_pack_user_info( user_info, fields[1], fields[2],
+				expiry_date, expiry+1, run->midnight, &expiry_tm );
+	else
+	{
+		if ( expiry[0] )
+			strcpy( expiry_date, expiry );
+		c = genmc_pack_user_info( user_info, fields[1], fields[2],
+				expiry_date, expiry[0] ? "" : run->expiry_days, run->midnight,
+				&expiry_tm );
+	}
+	t = serve_span( w, GENMC_PHASE_PACK, t, c );
+	if ( GENMC_OK != c )
+		return (char *)genmc_strerror( c );
+
+	/* a key made ahead, from the spool, or made here and now */
+	counter = GENMC_COUNT_KEYS_READY;
+	user_rsa = serve_take_key( run );
+	if ( NULL == user_rsa && NULL != run->spool_dir )
+	{
+		counter = GENMC_COUNT_KEYS_SPOOL;
+		user_rsa = genmc_spool_take( run->spool_dir );
+	}
+	if ( NULL == user_rsa )
+	{
+		counter = GENMC_COUNT_KEYS_MADE;
+		c = NULL != w->keygen ? genmc_keygen_make( w->keygen, &user_rsa ) :
+			genmc_gen_user_key( &user_rsa );
+		if ( NULL != w->keygen )
+			genmc_stats_count( run->stats, GENMC_COUNT_KEYGEN_RETRIES,
+					genmc_keygen_retries( w->keygen ) );
+	}
+	t = serve_span( w, GENMC_PHASE_KEYGEN, t, c );
+	if ( GENMC_OK != c )
+		return (char *)genmc_strerror( c );
+	genmc_stats_count( run->stats, counter, 1 );
+
+	/* genmc_issue() does the base64 too */
+	c = genmc_issue( w->ctx, user_info, user_rsa, mc_b64, sizeof( mc_b64 ),
+			pk_b64, sizeof( pk_b64 ) );
+	RSA_free( user_rsa );
+	t = serve_span( w, GENMC_PHASE_SIGN, t, c );
+	if ( GENMC_OK == c )
+	{
+		if ( NULL != run->store )
+		{
+			pthread_mutex_lock( &run->store_lock );
+			c = genmc_store_append( run->store, fields[1], fields[2],
+					expiry_date, mc_b64, pk_b64 );
+			pthread_mutex_unlock( &run->store_lock );
+		}
+		if ( GENMC_OK == c )
+		{
+			out[0] = "ok";
+			out[1] = fields[1];
+			out[2] = fields[2];
+			out[3] = expiry_date;
+			out[4] = mc_b64;
+			out[5] = pk_b64;
+			c = genmc_frame_put( reply, SERVE_REPLY_SIZE, out, 6, reply_len );
+		}
+		serve_span( w, GENMC_PHASE_OUTPUT, t, c );
+	}
+	memset( pk_b64, 0, sizeof( pk_b64 ) );
+	if ( GENMC_OK != c )
+		return (char *)genmc_strerror( c );
+
+	pthread_mutex_lock( &run->lock );
+	run->issued++;
+	pthread_mutex_unlock( &run->lock );
+	genmc_stats_count( run->stats, GENMC_COUNT_ISSUED, 1 );
+	return NULL;
+}
+
+/************
+ serve_verify--
+ ************/
+
+char *serve_verify( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len )
+{
+	/* verify,<minicert> gets
+	   ok,valid|expired|wrong_ca|corrupt,<display_name>,<user_id>,<expiry_date> */
+	serve_run *run = w->run;
+	genmc_mc_info info;
+	char display_name[GENMC_NAME_MAX + 1], user_id[GENMC_ID_MAX + 1];
+	char expiry_date[GENMC_EXPIRY_LEN + 1];
+	const char *out[5];
+	double t;
+	int status, c;
+
+	if ( 2 != n_fields )
+		return "verify takes a MiniCert.";
+	t = genmc_stats_now();
+	status = genmc_verify_mc( run->ca_rsa, fields[1], strlen( fields[1] ),
+			time( NULL ), &info );
+	serve_span( w, GENMC_PHASE_VERIFY, t, GENMC_OK );
+	clean_field( display_name, info.display_name );
+	clean_field( user_id, info.user_id );
+	clean_field( expiry_date, info.expiry_date );
+
+	out[0] = "ok";
+	out[1] = genmc_mc_status( status );
+	out[2] = display_name;
+	out[3] = user_id;
+	out[4] = expiry_date;
+	if ( GENMC_OK != ( c = genmc_frame_put( reply, SERVE_REPLY_SIZE, out, 5,
+			reply_len ) ) )
+		return (char *)genmc_strerror( c );
+
+	pthread_mutex_lock( &run->lock );
+	run->verified++;
+	pthread_mutex_unlock( &run->lock );
+	genmc_stats_count( run->stats, GENMC_COUNT_VERIFIED, 1 );
+	return NULL;
+}
+
+/************
+ serve_resign--
+ ************/
+
+char *serve_resign( serve_worker *w, char **fields, int n_fields,
+		char *reply, int *reply_len )
+{
+	/* resign,<minicert>[,<expiry>] gets ok,<minicert>,<expiry_date>; the
+	   MiniCert has to be from the -K CA, or -k without it */
+	serve_run *run = w->run;
+	genmc_mc_info info;
+	char mc_b64[GENMC_MC_B64_SIZE], expiry_date[80], *expiry, *new_expiry;
+	const char *out[3];
+	struct tm expiry_tm;
+	time_t expiry_t;
+	double t;
+	int days, c;
+
+	if ( n_fields < 2 || n_fields > 3 )
+		return "resign takes a MiniCert and maybe an expiry.";
+	expiry = n_fields > 2 ? fields[2] : "";
+	if ( strlen( expiry ) >= sizeof( expiry_date ) )
+		return (char *)genmc_strerror( GENMC_ERR_DATE_LEN );
+
+	new_expiry = NULL;
+	if ( '+' == expiry[0] )
+	{
+		if ( ( days = atoi( expiry + 1 ) ) < 1 )
+			return (char *)genmc_strerror( GENMC_ERR_DAYS );
+		if ( !genmc_set_expiry_date( days, expiry_date, &expiry_tm, &expiry_t,
+				run->midnight ) )
+			return (char *)genmc_strerror( GENMC_ERR_DAYS_RANGE );
+		new_expiry = expiry_date;
+	}
+	else if ( expiry[0] )
+	{
+		strcpy( expiry_date, expiry );
+		if ( GENMC_OK != ( c = genmc_check_expiry_date( expiry_date, &expiry_tm,
+				&expiry_t ) ) )
+			return (char *)genmc_strerror( c );
+		if ( expiry_t < time( NULL ) )
+			return (char *)genmc_strerror( GENMC_ERR_DATE_PAST );
+		new_expiry = expiry_date;
+	}
+
+	t = genmc_stats_now();
+	c = genmc_signer_resign( w->signer, run->old_ca_rsa, fields[1],
+			strlen( fields[1] ), new_expiry, mc_b64, sizeof( mc_b64 ), &info );
+	serve_span( w, GENMC_PHASE_RESIGN, t, c );
+	if ( GENMC_OK != c )
+		return (char *)genmc_strerror( c );
+
+	out[0] = "ok";
+	out[1] = mc_b64;
+	out[2] = info.expiry_date;
+	if ( GENMC_OK != ( c = genmc_frame_put( reply, SERVE_REPLY_SIZE, out, 3,
+			reply_len ) ) )
+		return (char *)genmc_strerror( c );
+
+	pthread_mutex_lock( &run->lock );
+	run->resigned++;
+	pthread_mutex_unlock( &run->lock );
+	genmc_stats_count( run->stats, GENMC_COUNT_RESIGNED, 1 );
+	return NULL;
+}
+
+/**************
+ serve_take_key--
+ **************/
+
+RSA *serve_take_key( serve_run *run )
+{
+	/* One of the keys made ahead, or NULL if there are none ready */
+	RSA *user_rsa = NULL;
+
+	pthread_mutex_lock( &run->lock );
+	if ( run->n_keys > 0 )
+	{
+		user_rsa = run->keys[--run->n_keys];
+		pthread_cond_signal( &run->need_keys );
+	}
+	pthread_mutex_unlock( &run->lock );
+	return user_rsa;
+}
+
+/**********
+ serve_span--
+ **********/
+
+double serve_span( serve_worker *w, int phase, double start, int err )
+{
+	/* The phase of the request being worked on took from start to now,
+	   which is returned for the start of the next one */
+	double now = genmc_stats_now();
+
+	genmc_stats_span( w->run->stats, phase, w->rec, start, now,
+			GENMC_OK != err ? genmc_strerror( err ) : NULL );
+	return now;
+}
+
+/**************
+ serve_keymaker--
+ **************/
+
+void *serve_keymaker( void *arg )
+{
+	/* Keeps the daemon's ready keys topped up, so issuing is down to the
+	   signature whenever the requests come slower than keys are made */
+	serve_run *run = arg;
+	genmc_keygen *keygen;
+	RSA *user_rsa;
+	struct timespec wake;
+	double t;
+	int c, stopping, backoff = 0;
+
+	if ( GENMC_OK != genmc_keygen_new( &keygen ) )
+		keygen = NULL;
+	genmc_stats_thread( run->stats, "keymaker" );
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &run->lock );
+		while ( run->n_keys == run->max_keys && !run->stopping )
+			pthread_cond_wait( &run->need_keys, &run->lock );
+		stopping = run->stopping;
+		pthread_mutex_unlock( &run->lock );
+		if ( stopping )
+			break;
+
+		t = genmc_stats_now();
+		c = NULL != keygen ? genmc_keygen_make( keygen, &user_rsa ) :
+			genmc_gen_user_key( &user_rsa );
+		if ( NULL != keygen )
+			genmc_stats_count( run->stats, GENMC_COUNT_KEYGEN_RETRIES,
+					genmc_keygen_retries( keygen ) );
+		genmc_stats_span( run->stats, GENMC_PHASE_PREGEN, -1, t,
+				genmc_stats_now(), GENMC_OK != c ? genmc_strerror( c ) : NULL );
+		if ( GENMC_OK != c )
+		{
+			/* The workers make their own. What failed once is likely to
+			   again, so wait before the next, longer each time */
+			backoff = 0 == backoff ? 1 : backoff * 2;
+			if ( backoff > SERVE_KEYGEN_BACKOFF )
+				backoff = SERVE_KEYGEN_BACKOFF;
+			wake.tv_sec = time( NULL ) + backoff;
+			wake.tv_nsec = 0;
+			pthread_mutex_lock( &run->lock );
+			while ( !run->stopping &&
+					0 == pthread_cond_timedwait( &run->need_keys, &run->lock, &wake ) )
+				;
+			pthread_mutex_unlock( &run->lock );
+			continue;
+		}
+		backoff = 0;
+		pthread_mutex_lock( &run->lock );
+		run->keys[run->n_keys++] = user_rsa;
+		pthread_mutex_unlock( &run->lock );
+	}
+
+	genmc_keygen_free( keygen );
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/**********
+ stats_open--
+ **********/
+
+genmc_stats *stats_open( char *trace_path, unsigned char stats_json )
+{
+	/* The stats for --stats and --trace, NULL if neither was given */
+	genmc_stats *stats;
+	int c;
+
+	if ( !stats_json && 0 == strlen( trace_path ) )
+		return NULL;
+	c = genmc_stats_new( &stats, strlen( trace_path ) ? trace_path : NULL );
+	if ( GENMC_OK != c )
+	{
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), trace_path );
+		exit( EXIT_FAILURE );
+	}
+	return stats;
+}
+
+/***********
+ stats_close--
+ ***********/
+
+int stats_close( genmc_stats *stats, char *mode, char *trace_path,
+		unsigned char stats_json )
+{
+	/* Writes the stats to stderr for --stats=json and finishes the trace.
+	   Returns 1 if the trace couldn't be written. */
+	int c;
+
+	if ( stats_json )
+		genmc_stats_json( stats, stderr, mode );
+	if ( GENMC_OK != ( c = genmc_stats_free( stats ) ) )
+	{
+		fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( c ), trace_path );
+		return 1;
+	}
+	return 0;
+}
+
+/***********
+ clean_field--
+ ***********/
+
+void clean_field( char *dst, char *src )
+{
+	/* keeps tabs and newlines in a corrupt MiniCert out of the report */
+	for ( ; *src; ++src, ++dst )
+		*dst = ( (unsigned char)*src < ' ' || 0x7f == *src ) ? '?' : *src;
+	*dst = '\0';
+	return;
+}
+
+/*************
+ compare_names--
+ *************/
+
+int compare_names( const void *a, const void *b )
+{
+	return strcmp( *(char **)a, *(char **)b );
+}
+
+/******************
+ read_roster_record--
+ ******************/
+
+int read_roster_record( FILE *fp, int *line_no, char *display_name,
+		char *user_id, char *expiry, char *mac )
+{
+	/* Reads the next display_name,user_id[,expiry[,mac]] record. A field
+	   may be double quoted to keep a comma in it. Blank lines and lines
+	   starting with # are skipped. The fields are cut to 79 characters, long values
+	   are caught later by pack_user_info().
+	   Returns 1 for a record, -1 for a malformed one, -2 for a line
+	   longer than ROSTER_LINE_MAX, which is skipped whole, 0 at end of file.
+	 */
+	char line[ROSTER_LINE_MAX + 1];
+	char *field[4];
+	char *s, *d;
+	int n, quoted, ch;
+
+	while ( NULL != fgets( line, sizeof( line ), fp ) )
+	{
+		++*line_no;
+
+		/* a line fgets() couldn't hold would come back as two records */
+		if ( NULL == strchr( line, '\n' ) && EOF != ( ch = getc( fp ) ) )
+		{
+			if ( '\n' != ch )
+			{
+				while ( EOF != ch && '\n' != ch )
+					ch = getc( fp );
+				return -2;
+			}
+		}
+
+		/* skip leading blanks, blank lines and comments */
+		for ( s = line; ' ' == *s || '\t' == *s; ++s )
+			;
+		if ( '\0' == *s || '\n' == *s || '\r' == *s || '#' == *s )
+			continue;
+
+		/* split into fields in place, dropping quotes and outer blanks */
+		field[0] = field[1] = field[2] = field[3] = "";
+		for ( n = 0; n < 4; ++n )
+		{
+			while ( ' ' == *s || '\t' == *s )
+				++s;
+			field[n] = d = s;
+			quoted = 0;
+			for ( ; *s && '\n' != *s && '\r' != *s; ++s )
+			{
+				if ( '"' == *s )
+					quoted = !quoted;
+				else if ( ',' == *s && !quoted )
+					break;
+				else
+					*d++ = *s;
+			}
+			while ( d > field[n] && ( ' ' == d[-1] || '\t' == d[-1] ) )
+				--d;
+			if ( ',' != *s )
+			{
+				*d = '\0';
+				break;
+			}
+			*d = '\0';
+			++s;
+		}
+		if ( n == 4 || quoted )
+			return -1; /* too many fields or an unterminated quote */
+
+		strncpy( display_name, field[0], 79 );
+		display_name[79] = '\0';
+		strncpy( user_id, field[1], 79 );
+		user_id[79] = '\0';
+		strncpy( expiry, field[2], 79 );
+		expiry[79] = '\0';
+		strncpy( mac, field[3], 79 );
+		mac[79] = '\0';
+		return 1;
+	}
+
+	return 0;
+}
+
+/**************
+ show_cert_info--
+ **************/
+
+void show_cert_info (char *mc_b64, char *pk_b64)
+{
+	/* this format is what the example in the Sipura admin manual prints out */
+	fprintf( stdout, "\n<Mini Certificate>\n%s\n", mc_b64);
+	fprintf( stdout, "\n<SRTP Private Key>\n%s\n\n", pk_b64);
+	return;
+}
+
+/**************
+ show_user_info--
+ **************/
+
+void show_user_info( char *display_name, char *user_id, char *expiry_date,
+	   struct tm *expiry_tm )
+{
+	char nice_time_str[80];
+	make_date_string( nice_time_str, expiry_tm);
+	fprintf( stdout, "<Encoded User Info>\n" );
+	fprintf( stdout, "User display name..: %s\n", display_name );
+	fprintf( stdout, "User id............: %s\n", user_id );
+	fprintf( stdout, "Expiry date........: %s\n\n", expiry_date );
+	fprintf( stdout, "This certificate expires on %s\n\n", nice_time_str );
+	return;
+}
+
+/****************
  make_date_string--
  ****************/
 
@@ -737,23 +3364,6 @@ void make_date_string (char *date_str, struct tm *date_tm)
 	return;
 }
 
-/***************
- make_date_field--
- ***************/
-
-void make_date_field (char *date_field, struct tm *date_tm)
-{
-	/* HHMMSSMMDDYY */
-	sprintf ( date_field, "%02d%02d%02d%02d%02d%02d",
-		date_tm->tm_hour,
-		date_tm->tm_min,
-		date_tm->tm_sec,
-		date_tm->tm_mon + 1,
-		date_tm->tm_mday,
-		date_tm->tm_year - 100 );
-	return;
-}
-
 #ifdef TESTDATES
 /**********
  test_dates--
@@ -769,7 +3379,7 @@ void test_dates ()
 	unsigned char midnight = 0; /* set to 1 to test midnight */
 	for ( i = 1; i < 12000; ++i )
 	{
-		if ( !set_expiry_date( i, expiry_field, &expiry_tm, &expiry_t, midnight ) )
+		if ( !genmc_set_expiry_date( i, expiry_field, &expiry_tm, &expiry_t, midnight ) )
 		{
 			printf("Done.");
 			break;
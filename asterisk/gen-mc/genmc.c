@@ -0,0 +1,607 @@
+/*
+libgenmc - the MiniCert issuing core of gen-mc
+
+This is what used to be the body of gen-mc's main(): the user info
+checks and packing, the user key generation, the CA signature and the
+base64 encoding. See genmc.h for the MiniCert layout and the API.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "genmc.h"
+
+struct genmc_ctx
+{
+	RSA *ca_rsa;
+	genmc_signer *signer; /* every genmc_issue() signs through this */
+	char *spool_dir;      /* take user keys from here first, may be NULL */
+};
+
+static char *genmc_errors[GENMC_ERR_COUNT] =
+{
+	"no error.",
+	"display name is missing.",
+	"display name can't be more than 32 characters.",
+	"user id is missing.",
+	"user id can't be more than 16 characters.",
+	"expiry days must be at least 1.",
+	"expiry date is out of range.",
+	"expiry date is missing.",
+	"expiry date must be 12 characters.",
+	"expiry date contains non-digits.",
+	"hour in expiry date must be in 00-23 range.",
+	"minute in expiry date must be in 00-59 range.",
+	"second in expiry date must be in 00-59 range.",
+	"month in expiry date must be in 01-12 range.",
+	"day in expiry date must be in 01-31 range.",
+	"year in expiry date must be in 00-38 range.",
+	"expiry date is in the past.",
+	"RSA_generate_key() failed.",
+	"couldn't generate a usable user key.",
+	"wrong user key size, should be 512 bits.",
+	"CA keys file not found.",
+	"reading PEM failed.",
+	"wrong CA key size, should be 1024 bits.",
+	"the CA key is broken.",
+	"unknown digest.",
+	"RSA_private_encrypt failed.",
+	"output buffer too small.",
+	"out of memory.",
+	"key spool not found.",
+	"key spool must not be open to group or others.",
+	"reading the key spool failed.",
+	"writing to the key spool failed.",
+	"MiniCert is corrupt.",
+	"MiniCert wasn't issued by this CA.",
+	"reading the MiniCert failed.",
+	"writing the MiniCert failed.",
+	"opening the MiniCert store failed.",
+	"reading the MiniCert store failed.",
+	"writing to the MiniCert store failed.",
+	"not a MiniCert store, or a damaged one.",
+	"not found in the MiniCert store.",
+	"base64 code not known or not supported by this CPU.",
+	"malformed framed record.",
+	"can't write the trace file.",
+	"not a replay build, see GENMC_REPLAY."
+};
+
+static pthread_mutex_t *ssl_locks;
+
+static unsigned long thread_id_callback( void );
+static void thread_lock_callback( int mode, int n, const char *file, int line );
+
+
+/**********
+ genmc_init--
+ **********/
+
+int genmc_init( genmc_ctx **ctx, RSA *ca_rsa )
+{
+	/* Checks the CA key once and keeps a reference to it, the caller may
+	   RSA_free() its own copy whenever it likes */
+	int err;
+
+	*ctx = NULL;
+	if ( GENMC_OK != ( err = genmc_check_ca_key( ca_rsa ) ) )
+		return err;
+
+	OpenSSL_add_all_digests();
+
+	if ( NULL == ( *ctx = calloc( 1, sizeof( genmc_ctx ) ) ) )
+		return GENMC_ERR_NOMEM;
+	if ( GENMC_OK != ( err = genmc_signer_new( &(*ctx)->signer, ca_rsa ) ) )
+	{
+		free( *ctx );
+		*ctx = NULL;
+		return err;
+	}
+	RSA_up_ref( ca_rsa );
+	(*ctx)->ca_rsa = ca_rsa;
+
+	return GENMC_OK;
+}
+
+/***************
+ genmc_set_spool--
+ ***************/
+
+void genmc_set_spool( genmc_ctx *ctx, const char *spool_dir )
+{
+	free( ctx->spool_dir );
+	ctx->spool_dir = spool_dir ? strdup( spool_dir ) : NULL;
+	return;
+}
+
+/***********
+ genmc_issue--
+ ***********/
+
+int genmc_issue( genmc_ctx *ctx, const unsigned char *user_info,
+		RSA *user_rsa, char *mc_b64, size_t mc_size,
+		char *pk_b64, size_t pk_size )
+{
+	/* Issues one MiniCert for the packed user info. user_rsa is the user's
+	   key, or NULL to take one from the spool or make one. The MiniCert
+	   and the user's private exponent come back base64 encoded on a single
+	   line and NUL terminated.
+	 */
+	unsigned char mess[GENMC_MC_LEN];
+	unsigned char u_pr_e[GENMC_USER_MOD_LEN * 2];
+	RSA *own_rsa = NULL;
+	int mess_len, u_pr_e_len;
+	int err;
+
+	if ( NULL == user_rsa )
+	{
+		if ( GENMC_OK != ( err = genmc_get_user_key( ctx->spool_dir, &own_rsa ) ) )
+			return err;
+		user_rsa = own_rsa;
+	}
+	else if ( GENMC_USER_BITS != RSA_size( user_rsa ) * 8 )
+		return GENMC_ERR_USER_SIZE;
+
+	memcpy( mess, user_info, GENMC_USER_INFO_LEN );
+	mess_len = GENMC_USER_INFO_LEN;
+	mess_len += BN_bn2bin( user_rsa->n, mess + mess_len ); /* public modulus */
+	err = genmc_signer_sign( ctx->signer, mess, &mess_len );
+	if ( GENMC_OK == err )
+		err = genmc_b64_encode( mess, mess_len, mc_b64, mc_size );
+	if ( GENMC_OK == err )
+	{
+		u_pr_e_len = BN_bn2bin( user_rsa->d, u_pr_e ); /* private exponent */
+		err = genmc_b64_encode( u_pr_e, u_pr_e_len, pk_b64, pk_size );
+		memset( u_pr_e, 0, sizeof( u_pr_e ) );
+	}
+
+	if ( NULL != own_rsa )
+		RSA_free( own_rsa );
+	return err;
+}
+
+/**********
+ genmc_free--
+ **********/
+
+void genmc_free( genmc_ctx *ctx )
+{
+	if ( NULL == ctx )
+		return;
+	genmc_signer_free( ctx->signer );
+	RSA_free( ctx->ca_rsa );
+	free( ctx->spool_dir );
+	free( ctx );
+	return;
+}
+
+/**************
+ genmc_strerror--
+ **************/
+
+const char *genmc_strerror( int err )
+{
+	if ( err < 0 || err >= GENMC_ERR_COUNT )
+		return "unknown error.";
+	return genmc_errors[err];
+}
+
+/********************
+ genmc_pack_user_info--
+ ********************/
+
+int genmc_pack_user_info( unsigned char *user_info, const char *display_name,
+		const char *user_id, char *expiry_date, const char *expiry_days,
+		int midnight, struct tm *expiry_tm )
+{
+	/* Fills in the 60 byte user info. With expiry_days set (not NULL or
+	   empty) expiry_date gets the HHMMSSMMDDYY field worked out from it,
+	   so it must have room for 13 chars.
+	 */
+	int i, len, err;
+	time_t expiry_t;
+
+	memset( user_info, 0, GENMC_USER_INFO_LEN );
+
+	/* check the display name */
+	len = strlen( display_name );
+	if ( len < 1 )
+		return GENMC_ERR_NAME_MISSING;
+	if ( len > GENMC_NAME_MAX )
+		return GENMC_ERR_NAME_LONG;
+	memcpy( user_info + GENMC_NAME_OFF, display_name, len );
+
+	/* check the user id */
+	len = strlen( user_id );
+	if ( len < 1 )
+		return GENMC_ERR_ID_MISSING;
+	if ( len > GENMC_ID_MAX )
+		return GENMC_ERR_ID_LONG;
+	memcpy( user_info + GENMC_ID_OFF, user_id, len );
+
+	/* check the expiry date */
+	if ( NULL != expiry_days && strlen( expiry_days ) > 0 )
+	{
+		/* user specified expiry in days */
+		i = atoi( expiry_days );
+		if ( i < 1 )
+			return GENMC_ERR_DAYS;
+		if ( !genmc_set_expiry_date( i, expiry_date, expiry_tm, &expiry_t,
+				midnight ) )
+			return GENMC_ERR_DAYS_RANGE;
+	}
+	else
+	{
+		/* user specified an complete expiry date */
+		err = genmc_check_expiry_date( expiry_date, expiry_tm, &expiry_t );
+		if ( GENMC_OK != err )
+			return err;
+	}
+
+	/* make sure they didn't pick an expiry date in the past */
+	if ( expiry_t < time( NULL ) )
+		return GENMC_ERR_DATE_PAST;
+
+	memcpy( user_info + GENMC_EXPIRY_OFF, expiry_date, GENMC_EXPIRY_LEN );
+
+	return GENMC_OK;
+}
+
+/***********************
+ genmc_check_expiry_date--
+ ***********************/
+
+int genmc_check_expiry_date( const char *expiry_date, struct tm *expiry_tm,
+		time_t *expiry_t )
+{
+	int i, len;
+	char date_field[16];
+
+	len = strlen( expiry_date );
+	if ( len < 1 )
+		return GENMC_ERR_DATE_MISSING;
+	if ( len != GENMC_EXPIRY_LEN )
+		return GENMC_ERR_DATE_LEN;
+	for ( i = 0; i < len; ++i )
+		if ( !isdigit( (unsigned char)expiry_date[i] ) )
+			return GENMC_ERR_DATE_DIGITS;
+
+	/* check the individual expiry date fields */
+	memset( date_field, 0, sizeof( date_field ) );
+	memset( expiry_tm, 0, sizeof( struct tm ) );
+	/* hour */
+	date_field[0] = expiry_date[0];
+	date_field[1] = expiry_date[1];
+	i = atoi ( date_field );
+	expiry_tm->tm_hour = i;
+	if ( i < 0 || i > 23 )
+		return GENMC_ERR_DATE_HOUR;
+	/* minute */
+	date_field[0] = expiry_date[2];
+	date_field[1] = expiry_date[3];
+	i = atoi ( date_field );
+	expiry_tm->tm_min = i;
+	if ( i < 0 || i > 59 )
+		return GENMC_ERR_DATE_MINUTE;
+	/* second */
+	date_field[0] = expiry_date[4];
+	date_field[1] = expiry_date[5];
+	i = atoi ( date_field );
+	expiry_tm->tm_sec = i;
+	if ( i < 0 || i > 59 )
+		return GENMC_ERR_DATE_SECOND;
+	/* month */
+	date_field[0] = expiry_date[6];
+	date_field[1] = expiry_date[7];
+	i = atoi ( date_field );
+	expiry_tm->tm_mon = i - 1; /* 0-11 */
+	if ( i < 1 || i > 12 )
+		return GENMC_ERR_DATE_MONTH;
+	/* day */
+	date_field[0] = expiry_date[8];
+	date_field[1] = expiry_date[9];
+	i = atoi ( date_field );
+	expiry_tm->tm_mday = i;
+	if ( i < 1 || i > 31 )
+		return GENMC_ERR_DATE_DAY;
+	/* year */
+	date_field[0] = expiry_date[10];
+	date_field[1] = expiry_date[11];
+	i = atoi ( date_field );
+	expiry_tm->tm_year = i + 100; /* year since 1900 */
+	/* make sure the year isn't past 2038 */
+	if ( i < 0 || i > 38 )
+		return GENMC_ERR_DATE_YEAR;
+
+	/* save the time_t value of the expiry date */
+	*expiry_t = mktime( expiry_tm );
+
+	return GENMC_OK;
+}
+
+/*********************
+ genmc_set_expiry_date--
+ *********************/
+
+int genmc_set_expiry_date( int days_from_now, char *expiry_field,
+		struct tm *expiry_tm, time_t *expiry_t, int midnight )
+{
+	time_t now;
+
+	/* get the current time */
+	now = time( NULL );
+
+	/* Note: 12000 is just an arbitrary value that will always be past 2038.
+	   And if the user specifies something in the 40000+ range the
+	   following long int date calculation will actually roll over into
+	   a value in the early 1900s, so prevent this.
+	 */
+	if ( days_from_now > 12000 )
+	{
+		return 0;
+	}
+
+	/* calculate expiry time */
+	/* posix time_t's are calulated as (long int) seconds past the 1970 epoch */
+	*expiry_t = now + (time_t)((long)days_from_now * 24 * 60 * 60);
+
+	/* watchout for date rollover after Jan 18 2038 */
+	if ( *expiry_t < 0 )
+	{
+		return 0;
+	}
+
+	/* Note: the conversion to future localtime() will take daylight savings
+	   time into account -- if applicable. That means (in some places
+	   in North America for instance) a certificate generated in January,
+	   set to expire in June of the same or some following year will
+	   gain an hour, and vice versa. Not a real problem, but it may
+	   cause some confusion when for example a certificate generated
+	   at 11:30pm in January expires at 12:30am on a day in June -- one
+	   day of the month later than the user expected.
+	 */
+
+	/* convert expiry time to local time, the _r flavour since a library
+	   can't tell who else is calling localtime() */
+	localtime_r( expiry_t, expiry_tm );
+
+	/* override time values if midnight requested */
+	if (midnight)
+	{
+		expiry_tm->tm_hour = 0;
+		expiry_tm->tm_min  = 0;
+		expiry_tm->tm_sec  = 0;
+	}
+
+	/* make the expiry date field for the MC */
+	genmc_make_date_field( expiry_field, expiry_tm);
+
+	/* no problems */
+	return 1;
+}
+
+/*********************
+ genmc_make_date_field--
+ *********************/
+
+void genmc_make_date_field (char *date_field, struct tm *date_tm)
+{
+	/* HHMMSSMMDDYY */
+	sprintf ( date_field, "%02d%02d%02d%02d%02d%02d",
+		date_tm->tm_hour,
+		date_tm->tm_min,
+		date_tm->tm_sec,
+		date_tm->tm_mon + 1,
+		date_tm->tm_mday,
+		date_tm->tm_year - 100 );
+	return;
+}
+
+/*****************
+ genmc_load_ca_key--
+ *****************/
+
+int genmc_load_ca_key( const char *ca_keys_filename, RSA **ca_rsa )
+{
+	/* read CA's keys from a *.PEM file, create an RSA object */
+	FILE *fp;
+
+	*ca_rsa = NULL;
+	fp = fopen( ca_keys_filename, "rb" );
+	if( NULL == fp )
+		return GENMC_ERR_CA_FILE;
+
+	SSL_load_error_strings();
+	OpenSSL_add_ssl_algorithms();
+
+	*ca_rsa = PEM_read_RSAPrivateKey( fp, NULL, NULL, NULL );
+	fclose( fp );
+	if( NULL == *ca_rsa )
+		return GENMC_ERR_CA_PEM;
+
+	return GENMC_OK;
+}
+
+/******************
+ genmc_check_ca_key--
+ ******************/
+
+int genmc_check_ca_key( RSA *ca_rsa )
+{
+	/* check the key length here and make sure it's 1024 */
+	if( GENMC_CA_BITS != RSA_size( ca_rsa ) * 8 )
+		return GENMC_ERR_CA_SIZE;
+
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: CApubmod==%s\n",  BN_bn2hex( ca_rsa->n ) );
+	fprintf( stderr, "Debug: CApubexp==%s\n",  BN_bn2dec( ca_rsa->e ) );
+	#endif
+
+	if( !RSA_check_key( ca_rsa ) ) /* re-check CA keys */
+		return GENMC_ERR_CA_BROKEN;
+
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: the CA key is valid.\n");
+	#endif
+	return GENMC_OK;
+}
+
+/******************
+ genmc_gen_user_key--
+ ******************/
+
+int genmc_gen_user_key( RSA **user_rsa )
+{
+	int i;
+
+	/* try more than once if neccessary */
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: generating user RSA key");
+	#endif
+	for ( i = 0; i < 16; ++i )
+	{
+		*user_rsa = RSA_generate_key( GENMC_USER_BITS, RSA_F4, NULL, NULL );
+		if( NULL == *user_rsa )
+			return GENMC_ERR_KEYGEN;
+
+		if( !RSA_check_key( *user_rsa ) )
+		{
+			RSA_free( *user_rsa );
+			#ifdef DEBUG
+			fprintf( stderr, ".");
+			#endif
+		} else {
+			#ifdef DEBUG
+			fprintf( stderr, "\nDebug: user's RSA keys usable\n");
+			fprintf( stderr, "n==%s\n", BN_bn2hex( (*user_rsa)->n ) );
+			fprintf( stderr, "e==%s\n", BN_bn2dec( (*user_rsa)->e ) );
+			#endif
+			return GENMC_OK;
+		}
+	}
+
+	/* we didn't get one */
+	*user_rsa = NULL;
+	return GENMC_ERR_NO_USABLE_KEY;
+}
+
+/******************
+ genmc_get_user_key--
+ ******************/
+
+int genmc_get_user_key( const char *spool_dir, RSA **user_rsa )
+{
+	/* Takes a ready made key out of the spool if there is one, otherwise
+	   makes a new one here and now */
+	if ( NULL != spool_dir &&
+			NULL != ( *user_rsa = genmc_spool_take( spool_dir ) ) )
+		return GENMC_OK;
+	return genmc_gen_user_key( user_rsa );
+}
+
+/********************
+ genmc_sign_user_info--
+ ********************/
+
+int genmc_sign_user_info( RSA *ca_rsa, const EVP_MD *md, RSA *user_rsa,
+		unsigned char *mess, int *mess_len )
+{
+	/* Appends the user's public modulus to the 60 byte user info in mess,
+	   signs the lot with the CA key, then appends the signature and the
+	   CA's public modulus. *mess_len is 60 on the way in and the whole
+	   MiniCert length on the way out. md may be NULL for sha1.
+	 */
+	EVP_MD_CTX mdctx;
+	unsigned char m[EVP_MAX_MD_SIZE];
+	unsigned int m_len;
+	unsigned char sigret[GENMC_SIG_LEN];
+	int siglen;
+	int c;
+
+	*mess_len += BN_bn2bin( user_rsa->n, mess+*mess_len ); /* public modulus */
+
+	if( NULL == md && NULL == ( md = EVP_get_digestbyname( "sha1" ) ) )
+		return GENMC_ERR_DIGEST;
+
+	EVP_MD_CTX_init( &mdctx );
+	c = EVP_DigestInit_ex( &mdctx, md, NULL )
+		&& EVP_DigestUpdate( &mdctx, mess, *mess_len )
+		&& EVP_DigestFinal_ex( &mdctx, m, &m_len );
+	EVP_MD_CTX_cleanup( &mdctx );
+	if( !c )
+		return GENMC_ERR_DIGEST;
+
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: sha1==" );
+	for( c = 0; c < m_len; c++)
+		fprintf( stderr, "%02x", m[c]);
+	fprintf( stderr, ", m_len==%d\n", m_len);
+	#endif
+
+	siglen = RSA_private_encrypt( m_len, m, sigret, ca_rsa, RSA_PKCS1_PADDING );
+	#ifdef DEBUG
+	fprintf( stderr, "Debug: siglen==%d\n", siglen );
+	#endif
+	if( siglen <= 0 )
+		return GENMC_ERR_SIGN;
+
+	memcpy( mess+*mess_len, sigret, siglen );
+	*mess_len += siglen;
+
+	*mess_len += BN_bn2bin( ca_rsa->n, mess+*mess_len ); /* CA public mod */
+
+	return GENMC_OK;
+}
+
+/******************
+ genmc_thread_setup--
+ ******************/
+
+void genmc_thread_setup( void )
+{
+	/* OpenSSL before 1.1 needs the application to hand it mutexes and a
+	   thread id before it is safe to use from more than one thread */
+	int i;
+
+	ssl_locks = OPENSSL_malloc( CRYPTO_num_locks() * sizeof( pthread_mutex_t ) );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_init( &ssl_locks[i], NULL );
+	CRYPTO_set_id_callback( thread_id_callback );
+	CRYPTO_set_locking_callback( thread_lock_callback );
+	return;
+}
+
+/********************
+ genmc_thread_cleanup--
+ ********************/
+
+void genmc_thread_cleanup( void )
+{
+	int i;
+
+	CRYPTO_set_locking_callback( NULL );
+	CRYPTO_set_id_callback( NULL );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_destroy( &ssl_locks[i] );
+	OPENSSL_free( ssl_locks );
+	return;
+}
+
+static unsigned long thread_id_callback( void )
+{
+	return (unsigned long)pthread_self();
+}
+
+static void thread_lock_callback( int mode, int n, const char *file, int line )
+{
+	if ( mode & CRYPTO_LOCK )
+		pthread_mutex_lock( &ssl_locks[n] );
+	else
+		pthread_mutex_unlock( &ssl_locks[n] );
+	return;
+}
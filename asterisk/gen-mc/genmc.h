@@ -0,0 +1,341 @@
+/*
+libgenmc - the MiniCert issuing core of gen-mc
+
+A MiniCert is the 60 byte user info, the user's 512-bit public modulus,
+the CA's PKCS#1 signature over those two, and the CA's 1024-bit public
+modulus. The user info is the display name at 0, the user id at 32 and
+the HHMMSSMMDDYY expiry date at 48, zero padded.
+
+Nothing in the library prints or exits. Every call returns GENMC_OK or
+one of the GENMC_ERR_ codes below, genmc_strerror() has the text.
+
+Typical use:
+
+	RSA *ca_rsa;
+	genmc_ctx *ctx;
+	unsigned char user_info[GENMC_USER_INFO_LEN];
+	char mc[GENMC_MC_B64_SIZE], pk[GENMC_PK_B64_SIZE];
+
+	genmc_load_ca_key( "cakey.pem", &ca_rsa );
+	genmc_init( &ctx, ca_rsa );
+	genmc_pack_user_info( user_info, "My Name", "1234567", date, "365",
+			0, &expiry_tm );
+	genmc_issue( ctx, user_info, NULL, mc, sizeof( mc ), pk, sizeof( pk ) );
+	genmc_free( ctx );
+	RSA_free( ca_rsa );
+*/
+
+#ifndef GENMC_H
+#define GENMC_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <openssl/rsa.h>
+#include <openssl/evp.h>
+
+/* MiniCert layout */
+#define GENMC_NAME_OFF       0
+#define GENMC_NAME_MAX       32
+#define GENMC_ID_OFF         32
+#define GENMC_ID_MAX         16
+#define GENMC_EXPIRY_OFF     48
+#define GENMC_EXPIRY_LEN     12
+#define GENMC_USER_INFO_LEN  60
+#define GENMC_USER_BITS      512
+#define GENMC_CA_BITS        1024
+#define GENMC_USER_MOD_LEN   ( GENMC_USER_BITS / 8 )
+#define GENMC_SIG_LEN        ( GENMC_CA_BITS / 8 )
+#define GENMC_CA_MOD_LEN     ( GENMC_CA_BITS / 8 )
+#define GENMC_MC_LEN         ( GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN + \
+                               GENMC_SIG_LEN + GENMC_CA_MOD_LEN )
+
+/* buffer sizes for the single line base64 output, NUL included */
+#define GENMC_MC_B64_SIZE    ( ( GENMC_MC_LEN + 2 ) / 3 * 4 + 1 )
+#define GENMC_PK_B64_SIZE    ( ( GENMC_USER_MOD_LEN + 2 ) / 3 * 4 + 1 )
+
+/* error codes */
+enum
+{
+	GENMC_OK = 0,
+	GENMC_ERR_NAME_MISSING,
+	GENMC_ERR_NAME_LONG,
+	GENMC_ERR_ID_MISSING,
+	GENMC_ERR_ID_LONG,
+	GENMC_ERR_DAYS,
+	GENMC_ERR_DAYS_RANGE,
+	GENMC_ERR_DATE_MISSING,
+	GENMC_ERR_DATE_LEN,
+	GENMC_ERR_DATE_DIGITS,
+	GENMC_ERR_DATE_HOUR,
+	GENMC_ERR_DATE_MINUTE,
+	GENMC_ERR_DATE_SECOND,
+	GENMC_ERR_DATE_MONTH,
+	GENMC_ERR_DATE_DAY,
+	GENMC_ERR_DATE_YEAR,
+	GENMC_ERR_DATE_PAST,
+	GENMC_ERR_KEYGEN,
+	GENMC_ERR_NO_USABLE_KEY,
+	GENMC_ERR_USER_SIZE,
+	GENMC_ERR_CA_FILE,
+	GENMC_ERR_CA_PEM,
+	GENMC_ERR_CA_SIZE,
+	GENMC_ERR_CA_BROKEN,
+	GENMC_ERR_DIGEST,
+	GENMC_ERR_SIGN,
+	GENMC_ERR_BUFFER,
+	GENMC_ERR_NOMEM,
+	GENMC_ERR_SPOOL_MISSING,
+	GENMC_ERR_SPOOL_MODE,
+	GENMC_ERR_SPOOL_READ,
+	GENMC_ERR_SPOOL_WRITE,
+	GENMC_ERR_MC_CORRUPT,
+	GENMC_ERR_MC_WRONG_CA,
+	GENMC_ERR_MC_READ,
+	GENMC_ERR_MC_WRITE,
+	GENMC_ERR_STORE_OPEN,
+	GENMC_ERR_STORE_READ,
+	GENMC_ERR_STORE_WRITE,
+	GENMC_ERR_STORE_FORMAT,
+	GENMC_ERR_STORE_NOT_FOUND,
+	GENMC_ERR_B64_IMPL,
+	GENMC_ERR_FRAME,
+	GENMC_ERR_TRACE,
+	GENMC_ERR_REPLAY,
+	GENMC_ERR_COUNT        /* keep last */
+};
+
+/* MiniCert check results, see genmc_verify_mc() */
+enum
+{
+	GENMC_MC_VALID = 0,
+	GENMC_MC_EXPIRED,
+	GENMC_MC_WRONG_CA,
+	GENMC_MC_CORRUPT,
+	GENMC_MC_COUNT         /* keep last */
+};
+
+typedef struct genmc_ctx genmc_ctx;
+typedef struct genmc_signer genmc_signer;
+typedef struct genmc_store genmc_store;
+typedef struct genmc_keygen genmc_keygen;
+
+/* a MiniCert taken apart */
+typedef struct genmc_mc_info
+{
+	char display_name[GENMC_NAME_MAX + 1];
+	char user_id[GENMC_ID_MAX + 1];
+	char expiry_date[GENMC_EXPIRY_LEN + 1];
+	time_t expiry_t;
+	unsigned char user_mod[GENMC_USER_MOD_LEN];
+	unsigned char sig[GENMC_SIG_LEN];
+	unsigned char ca_mod[GENMC_CA_MOD_LEN];
+} genmc_mc_info;
+
+/* issuing context */
+int  genmc_init( genmc_ctx **ctx, RSA *ca_rsa );
+void genmc_set_spool( genmc_ctx *ctx, const char *spool_dir );
+int  genmc_issue( genmc_ctx *ctx, const unsigned char *user_info,
+		RSA *user_rsa, char *mc_b64, size_t mc_size,
+		char *pk_b64, size_t pk_size );
+void genmc_free( genmc_ctx *ctx );
+const char *genmc_strerror( int err );
+
+/* building blocks */
+int  genmc_pack_user_info( unsigned char *user_info, const char *display_name,
+		const char *user_id, char *expiry_date, const char *expiry_days,
+		int midnight, struct tm *expiry_tm );
+int  genmc_check_expiry_date( const char *expiry_date, struct tm *expiry_tm,
+		time_t *expiry_t );
+int  genmc_set_expiry_date( int days_from_now, char *expiry_field,
+		struct tm *expiry_tm, time_t *expiry_t, int midnight );
+void genmc_make_date_field( char *date_field, struct tm *date_tm );
+int  genmc_load_ca_key( const char *ca_keys_filename, RSA **ca_rsa );
+int  genmc_check_ca_key( RSA *ca_rsa );
+int  genmc_gen_user_key( RSA **user_rsa );
+int  genmc_get_user_key( const char *spool_dir, RSA **user_rsa );
+int  genmc_sign_user_info( RSA *ca_rsa, const EVP_MD *md, RSA *user_rsa,
+		unsigned char *mess, int *mess_len );
+
+/* the CA made ready for many signatures, see genmc_signer.c */
+int  genmc_signer_new( genmc_signer **signer, RSA *ca_rsa );
+int  genmc_signer_sign( genmc_signer *signer, unsigned char *mess,
+		int *mess_len );
+int  genmc_signer_resign( genmc_signer *signer, RSA *old_ca_rsa,
+		const char *mc_b64, int b64_len, const char *expiry_date,
+		char *out_b64, size_t out_size, genmc_mc_info *info );
+void genmc_signer_free( genmc_signer *signer );
+
+/* user keys in bulk, one generator per thread, see genmc_keygen.c */
+int  genmc_keygen_new( genmc_keygen **keygen );
+int  genmc_keygen_make( genmc_keygen *keygen, RSA **user_rsa );
+long genmc_keygen_retries( genmc_keygen *keygen );
+void genmc_keygen_free( genmc_keygen *keygen );
+
+/* key spool, see genmc_spool.c */
+int  genmc_spool_check( const char *spool_dir, int create );
+int  genmc_spool_count( const char *spool_dir, int sweep );
+int  genmc_spool_put( const char *spool_dir, RSA *user_rsa );
+RSA *genmc_spool_take( const char *spool_dir );
+
+/* base64, SIMD where the CPU has it, see genmc_b64.c */
+int  genmc_b64_encode( const unsigned char *in, int in_len,
+		char *out, size_t out_size );
+int  genmc_b64_decode( const char *in, int in_len, unsigned char *out,
+		size_t out_size, int *out_len );
+int  genmc_b64_use( const char *name );
+const char *genmc_b64_impl( void );
+
+/* reading MiniCerts back, see genmc_verify.c */
+int  genmc_parse_mc( const unsigned char *mc, int mc_len, genmc_mc_info *info );
+int  genmc_verify_mc( RSA *ca_rsa, const char *mc_b64, int b64_len,
+		time_t now, genmc_mc_info *info );
+const char *genmc_mc_status( int status );
+int  genmc_load_ca_pubkey( const char *ca_keys_filename, RSA **ca_rsa );
+
+/* framed records, see genmc_frame.c */
+#define GENMC_FRAME_MAX      4096
+#define GENMC_FRAME_FIELDS   8
+
+int  genmc_frame_put( char *frame, size_t size, const char **fields,
+		int n_fields, int *frame_len );
+int  genmc_frame_get( char *frame, int len, char **fields, int *n_fields,
+		int *used );
+
+/* single file MiniCert store, see genmc_store.c */
+#define GENMC_STORE_BY_ID    0
+#define GENMC_STORE_BY_NAME  1
+
+typedef struct genmc_store_entry
+{
+	char display_name[GENMC_NAME_MAX + 1];
+	char user_id[GENMC_ID_MAX + 1];
+	char expiry_date[GENMC_EXPIRY_LEN + 1];
+	char mc_b64[GENMC_MC_B64_SIZE];
+	char pk_b64[GENMC_PK_B64_SIZE];
+} genmc_store_entry;
+
+int  genmc_store_open( genmc_store **store, const char *path, int writable );
+int  genmc_store_append( genmc_store *store, const char *display_name,
+		const char *user_id, const char *expiry_date,
+		const char *mc_b64, const char *pk_b64 );
+int  genmc_store_sync( genmc_store *store );
+void genmc_store_sync_every( genmc_store *store, long n );
+long genmc_store_count( genmc_store *store );
+int  genmc_store_get( genmc_store *store, long n, genmc_store_entry *entry );
+long genmc_store_find( genmc_store *store, int by, const char *key );
+int  genmc_store_close( genmc_store *store );
+
+/* counters, latency histograms and trace events of a run, see
+   genmc_stats.c */
+enum
+{
+	GENMC_PHASE_PACK = 0,  /* the first five are the pipeline stages */
+	GENMC_PHASE_KEYGEN,
+	GENMC_PHASE_SIGN,
+	GENMC_PHASE_ENCODE,
+	GENMC_PHASE_OUTPUT,
+	GENMC_PHASE_VERIFY,
+	GENMC_PHASE_RESIGN,
+	GENMC_PHASE_PREGEN,    /* keys made ahead, not for any one record */
+	GENMC_PHASE_REQUEST,   /* a daemon request from start to reply */
+	GENMC_PHASE_COUNT      /* keep last */
+};
+
+enum
+{
+	GENMC_COUNT_ISSUED = 0,
+	GENMC_COUNT_VERIFIED,
+	GENMC_COUNT_RESIGNED,
+	GENMC_COUNT_FAILED,    /* by genmc_stats_failed() only */
+	GENMC_COUNT_KEYS_READY,
+	GENMC_COUNT_KEYS_SPOOL,
+	GENMC_COUNT_KEYS_MADE,
+	GENMC_COUNT_KEYGEN_RETRIES,
+	GENMC_COUNT_COUNT      /* keep last */
+};
+
+typedef struct genmc_stats genmc_stats;
+
+int  genmc_stats_new( genmc_stats **stats, const char *trace_path );
+void genmc_stats_thread( genmc_stats *stats, const char *name );
+void genmc_stats_span( genmc_stats *stats, int phase, long rec,
+		double start, double end, const char *err );
+void genmc_stats_count( genmc_stats *stats, int counter, long n );
+void genmc_stats_failed( genmc_stats *stats, const char *reason );
+int  genmc_stats_json( genmc_stats *stats, FILE *fp, const char *mode );
+int  genmc_stats_flush( genmc_stats *stats );
+int  genmc_stats_free( genmc_stats *stats );
+double genmc_stats_now( void );
+
+/* the issuing pipeline, see genmc_pipe.c */
+enum
+{
+	GENMC_STAGE_PACK = 0,
+	GENMC_STAGE_KEYGEN,
+	GENMC_STAGE_SIGN,
+	GENMC_STAGE_ENCODE,
+	GENMC_STAGE_OUTPUT,
+	GENMC_STAGE_COUNT      /* keep last */
+};
+
+/* one MiniCert on its way through the pipeline */
+typedef struct genmc_job
+{
+	long seq;              /* the order the source gave it in */
+	int err;               /* GENMC_OK, or why it wasn't issued */
+	void *rec;             /* the caller's, passed on to the sink */
+	unsigned char user_info[GENMC_USER_INFO_LEN];
+	RSA *user_rsa;
+	unsigned char mc[GENMC_MC_LEN];
+	char mc_b64[GENMC_MC_B64_SIZE];
+	char pk_b64[GENMC_PK_B64_SIZE];
+} genmc_job;
+
+/* Fills in user_info and rec of the next job, returns 0 when there are
+   no more. The sink gets every job back, issued or not, and frees rec. */
+typedef int  (*genmc_pipe_source)( void *arg, genmc_job *job );
+typedef void (*genmc_pipe_sink)( void *arg, genmc_job *job );
+
+typedef struct genmc_pipe_conf
+{
+	int keygen_workers;
+	int sign_workers;
+	int encode_workers;
+	int queue_len;         /* jobs per queue, 0 for twice the most workers */
+	const char *spool_dir; /* take user keys from here first, may be NULL */
+	genmc_stats *stats;    /* a span per job and stage, may be NULL */
+} genmc_pipe_conf;
+
+/* where the time went, in seconds summed over a stage's workers */
+typedef struct genmc_stage_stats
+{
+	const char *name;
+	int workers;
+	long jobs;
+	double busy;           /* working on a job */
+	double wait_in;        /* waiting for a job from the stage before */
+	double wait_out;       /* waiting for room in the next queue */
+} genmc_stage_stats;
+
+typedef struct genmc_pipe_stats
+{
+	double wall;
+	genmc_stage_stats stage[GENMC_STAGE_COUNT];
+} genmc_pipe_stats;
+
+int  genmc_pipe_run( RSA *ca_rsa, const genmc_pipe_conf *conf,
+		genmc_pipe_source source, void *source_arg,
+		genmc_pipe_sink sink, void *sink_arg, genmc_pipe_stats *stats );
+const char *genmc_stage_name( int stage );
+
+/* the same random bytes on every run, for checking a build against the
+   output of another; only with -DGENMC_REPLAY, see genmc_replay.c */
+int  genmc_replay_start( const char *seed );
+void genmc_replay_stream( int stage, long seq );
+
+/* OpenSSL before 1.1 needs these before it is used from several threads */
+void genmc_thread_setup( void );
+void genmc_thread_cleanup( void );
+
+#endif /* GENMC_H */
@@ -0,0 +1,455 @@
+/*
+libgenmc - base64 for MiniCerts and user keys
+
+Single line base64 with '=' padding, the bytes EVP_EncodeBlock() writes.
+Besides the table driven code there are SSE4.1 and AVX2 versions that
+do 12 or 24 bytes at a time, after W. Mula and D. Lemire, "Faster Base64
+Encoding and Decoding using AVX2 Instructions": the 6-bit groups are
+pulled apart with multiplies and turned into characters with byte
+shuffles, and the other way round, checking 16 or 32 characters at once
+on the way in. Whatever the SIMD code leaves over, the table driven code
+finishes, so every path writes the same bytes.
+
+Which one runs is decided once, on the first call, from what the CPU
+has; genmc_b64_use() forces one, for benchmarks and comparisons. Built
+with anything but GCC or clang for x86 there is only the table driven
+code.
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include "genmc.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define GENMC_B64_SIMD
+#include <immintrin.h>
+#endif
+
+enum
+{
+	B64_SCALAR = 0,
+	B64_SSE4,
+	B64_AVX2,
+	B64_COUNT              /* keep last */
+};
+
+static const char *b64_impl_names[B64_COUNT] =
+{
+	"scalar",
+	"sse4",
+	"avx2"
+};
+
+static const char b64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static unsigned char b64_values[256]; /* 0xff for not base64 */
+static int b64_impl = B64_SCALAR;
+static pthread_once_t b64_once = PTHREAD_ONCE_INIT;
+
+static void b64_setup( void );
+static int  b64_supported( int impl );
+static void enc_scalar( const unsigned char *in, int in_len, char *out );
+static int  dec_scalar( const char *in, int in_len, unsigned char *out );
+#ifdef GENMC_B64_SIMD
+static int  enc_sse4( const unsigned char *in, int in_len, char *out );
+static int  enc_avx2( const unsigned char *in, int in_len, char *out );
+static int  dec_sse4( const char *in, int in_len, unsigned char *out,
+		int out_room );
+static int  dec_avx2( const char *in, int in_len, unsigned char *out,
+		int out_room );
+#endif
+
+
+/****************
+ genmc_b64_encode--
+ ****************/
+
+int genmc_b64_encode( const unsigned char *in, int in_len,
+		char *out, size_t out_size )
+{
+	/* single line base64, the same bytes BIO_f_base64 with
+	   BIO_FLAGS_BASE64_NO_NL used to write to the files */
+	int done = 0;
+
+	if ( out_size < (size_t)( ( in_len + 2 ) / 3 * 4 + 1 ) )
+		return GENMC_ERR_BUFFER;
+	pthread_once( &b64_once, b64_setup );
+
+	#ifdef GENMC_B64_SIMD
+	if ( B64_AVX2 == b64_impl )
+		done = enc_avx2( in, in_len, out );
+	else if ( B64_SSE4 == b64_impl )
+		done = enc_sse4( in, in_len, out );
+	#endif
+	enc_scalar( in + done, in_len - done, out + done / 3 * 4 );
+	return GENMC_OK;
+}
+
+/****************
+ genmc_b64_decode--
+ ****************/
+
+int genmc_b64_decode( const char *in, int in_len, unsigned char *out,
+		size_t out_size, int *out_len )
+{
+	/* Single line base64, trailing blanks and newlines are ignored. '='
+	   is only allowed as the padding at the end. */
+	int done = 0, n;
+
+	while ( in_len > 0 && ( ' ' == in[in_len-1] || '\t' == in[in_len-1] ||
+			'\n' == in[in_len-1] || '\r' == in[in_len-1] ) )
+		--in_len;
+	if ( 0 == in_len || 0 != in_len % 4 )
+		return GENMC_ERR_MC_CORRUPT;
+	if ( out_size < (size_t)( in_len / 4 * 3 ) )
+		return GENMC_ERR_BUFFER;
+	pthread_once( &b64_once, b64_setup );
+
+	/* the SIMD code stays clear of the last four, they may be padding */
+	#ifdef GENMC_B64_SIMD
+	if ( B64_AVX2 == b64_impl )
+		done = dec_avx2( in, in_len - 4, out, (int)out_size );
+	else if ( B64_SSE4 == b64_impl )
+		done = dec_sse4( in, in_len - 4, out, (int)out_size );
+	if ( done < 0 )
+		return GENMC_ERR_MC_CORRUPT;
+	#endif
+	if ( ( n = dec_scalar( in + done, in_len - done, out + done / 4 * 3 ) ) < 0 )
+		return GENMC_ERR_MC_CORRUPT;
+	*out_len = done / 4 * 3 + n;
+	return GENMC_OK;
+}
+
+/**************
+ genmc_b64_use--
+ **************/
+
+int genmc_b64_use( const char *name )
+{
+	/* Forces one of the encoders, "scalar", "sse4" or "avx2", or with NULL
+	   the best one the CPU has */
+	int i;
+
+	pthread_once( &b64_once, b64_setup );
+	if ( NULL == name )
+	{
+		for ( i = B64_COUNT - 1; !b64_supported( i ); --i )
+			;
+		b64_impl = i;
+		return GENMC_OK;
+	}
+	for ( i = 0; i < B64_COUNT; ++i )
+	{
+		if ( 0 == strcmp( name, b64_impl_names[i] ) )
+		{
+			if ( !b64_supported( i ) )
+				return GENMC_ERR_B64_IMPL;
+			b64_impl = i;
+			return GENMC_OK;
+		}
+	}
+	return GENMC_ERR_B64_IMPL;
+}
+
+/***************
+ genmc_b64_impl--
+ ***************/
+
+const char *genmc_b64_impl( void )
+{
+	pthread_once( &b64_once, b64_setup );
+	return b64_impl_names[b64_impl];
+}
+
+/*********
+ b64_setup--
+ *********/
+
+static void b64_setup( void )
+{
+	int i;
+
+	memset( b64_values, 0xff, sizeof( b64_values ) );
+	for ( i = 0; i < 64; ++i )
+		b64_values[(unsigned char)b64_chars[i]] = i;
+
+	#ifdef GENMC_B64_SIMD
+	__builtin_cpu_init();
+	#endif
+	for ( i = B64_COUNT - 1; !b64_supported( i ); --i )
+		;
+	b64_impl = i;
+	return;
+}
+
+/*************
+ b64_supported--
+ *************/
+
+static int b64_supported( int impl )
+{
+	switch ( impl )
+	{
+		case B64_SCALAR:
+			return 1;
+	#ifdef GENMC_B64_SIMD
+		case B64_SSE4:
+			return __builtin_cpu_supports( "sse4.1" );
+		case B64_AVX2:
+			return __builtin_cpu_supports( "avx2" );
+	#endif
+	}
+	return 0;
+}
+
+/**********
+ enc_scalar--
+ **********/
+
+static void enc_scalar( const unsigned char *in, int in_len, char *out )
+{
+	unsigned long v;
+
+	for ( ; in_len >= 3; in += 3, in_len -= 3 )
+	{
+		v = (unsigned long)in[0] << 16 | in[1] << 8 | in[2];
+		*out++ = b64_chars[v >> 18];
+		*out++ = b64_chars[v >> 12 & 0x3f];
+		*out++ = b64_chars[v >> 6 & 0x3f];
+		*out++ = b64_chars[v & 0x3f];
+	}
+	if ( in_len > 0 )
+	{
+		v = (unsigned long)in[0] << 16 | ( 2 == in_len ? in[1] << 8 : 0 );
+		*out++ = b64_chars[v >> 18];
+		*out++ = b64_chars[v >> 12 & 0x3f];
+		*out++ = 2 == in_len ? b64_chars[v >> 6 & 0x3f] : '=';
+		*out++ = '=';
+	}
+	*out = '\0';
+	return;
+}
+
+/**********
+ dec_scalar--
+ **********/
+
+static int dec_scalar( const char *in, int in_len, unsigned char *out )
+{
+	/* in_len is a multiple of 4, returns the bytes written or -1 */
+	const unsigned char *s = (const unsigned char *)in;
+	unsigned char a, b, c, d;
+	int n = 0, pad;
+
+	for ( ; in_len > 0; s += 4, in_len -= 4 )
+	{
+		pad = 0;
+		if ( 4 == in_len && '=' == s[3] )
+			pad = '=' == s[2] ? 2 : 1;
+		a = b64_values[s[0]];
+		b = b64_values[s[1]];
+		c = pad > 1 ? 0 : b64_values[s[2]];
+		d = pad > 0 ? 0 : b64_values[s[3]];
+		if ( ( a | b | c | d ) & 0x80 )
+			return -1;
+		out[n++] = a << 2 | b >> 4;
+		if ( pad < 2 )
+			out[n++] = b << 4 | c >> 2;
+		if ( pad < 1 )
+			out[n++] = c << 6 | d;
+	}
+	return n;
+}
+
+#ifdef GENMC_B64_SIMD
+
+/* The 6-bit groups of three bytes, one per byte: the bytes go 1,0,2,1
+   into each 32 bits, where one multiply pair shifts the first and third
+   group and the other the second and fourth into their bytes. */
+#define ENC_SPLIT( P, W, in ) \
+	do { \
+		in = P##_shuffle_epi8( in, P##_set_epi8( ENC_SHUF ) ); \
+		in = P##_or_si##W( \
+			P##_mulhi_epu16( \
+				P##_and_si##W( in, P##_set1_epi32( 0x0fc0fc00 ) ), \
+				P##_set1_epi32( 0x04000040 ) ), \
+			P##_mullo_epi16( \
+				P##_and_si##W( in, P##_set1_epi32( 0x003f03f0 ) ), \
+				P##_set1_epi32( 0x01000010 ) ) ); \
+	} while ( 0 )
+
+/* Group values to characters: 0-25 pick 'A', 26-51 'a' - 26, 52-61
+   '0' - 52, 62 and 63 their own, as offsets to add. */
+#define ENC_CHARS( P, W, idx ) \
+	P##_add_epi8( idx, P##_shuffle_epi8( \
+		P##_setr_epi8( ENC_OFFSETS ), \
+		P##_or_si##W( \
+			P##_subs_epu8( idx, P##_set1_epi8( 51 ) ), \
+			P##_and_si##W( \
+				P##_cmpgt_epi8( P##_set1_epi8( 26 ), idx ), \
+				P##_set1_epi8( 13 ) ) ) ) )
+
+#define ENC_SHUF_128 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1
+#define ENC_OFFSETS_128 \
+	'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+	'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, \
+	'/' - 63, 'A', 0, 0
+
+/* Characters to group values. For a low nibble the mask has the bits
+   of the high nibbles that make a base64 character with it, so
+   0x30 '0', 0x50 'P' and 0x70 'p' for 0; the high nibble picks the
+   offset to add, '/' is the one that doesn't go by its high nibble. */
+#define DEC_MASKS_128 \
+	0xa8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, \
+	0xf8, 0xf8, 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54
+#define DEC_BITS_128 \
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, \
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+#define DEC_OFFSETS_128 \
+	0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+
+/* Four group values back to three bytes in each 32 bits, then the
+   bytes of every 32 bits packed to the bottom 12 of each 128. */
+#define DEC_PACK_128 \
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/********
+ enc_sse4--
+ ********/
+
+__attribute__(( target( "sse4.1" ) ))
+static int enc_sse4( const unsigned char *in, int in_len, char *out )
+{
+	/* 12 bytes a round, each load reads 16 */
+	#define ENC_SHUF ENC_SHUF_128
+	#define ENC_OFFSETS ENC_OFFSETS_128
+	__m128i v;
+	int done = 0;
+
+	for ( ; in_len - done >= 16; done += 12, out += 16 )
+	{
+		v = _mm_loadu_si128( (const __m128i *)( in + done ) );
+		ENC_SPLIT( _mm, 128, v );
+		_mm_storeu_si128( (__m128i *)out, ENC_CHARS( _mm, 128, v ) );
+	}
+	#undef ENC_SHUF
+	#undef ENC_OFFSETS
+	return done;
+}
+
+/********
+ enc_avx2--
+ ********/
+
+__attribute__(( target( "avx2" ) ))
+static int enc_avx2( const unsigned char *in, int in_len, char *out )
+{
+	/* 24 bytes a round, 12 in each half, the second load reads up to
+	   in + 28 */
+	#define ENC_SHUF ENC_SHUF_128, ENC_SHUF_128
+	#define ENC_OFFSETS ENC_OFFSETS_128, ENC_OFFSETS_128
+	__m256i v;
+	int done = 0;
+
+	for ( ; in_len - done >= 28; done += 24, out += 32 )
+	{
+		v = _mm256_inserti128_si256( _mm256_castsi128_si256(
+			_mm_loadu_si128( (const __m128i *)( in + done ) ) ),
+			_mm_loadu_si128( (const __m128i *)( in + done + 12 ) ), 1 );
+		ENC_SPLIT( _mm256, 256, v );
+		_mm256_storeu_si256( (__m256i *)out, ENC_CHARS( _mm256, 256, v ) );
+	}
+	#undef ENC_SHUF
+	#undef ENC_OFFSETS
+	/* enc_sse4() isn't VEX encoded, with the upper halves left dirty
+	   every SSE instruction in it would pay for the switch */
+	_mm256_zeroupper();
+	return done + enc_sse4( in + done, in_len - done, out );
+}
+
+/********
+ dec_sse4--
+ ********/
+
+__attribute__(( target( "sse4.1" ) ))
+static int dec_sse4( const char *in, int in_len, unsigned char *out,
+		int out_room )
+{
+	/* 16 characters a round, 12 bytes out but each store writes 16.
+	   Returns the characters done or -1 for one that isn't base64. */
+	__m128i v, hi, lo, ok;
+	int done = 0;
+
+	for ( ; in_len - done >= 16 && out_room >= 16;
+			done += 16, out += 12, out_room -= 12 )
+	{
+		v = _mm_loadu_si128( (const __m128i *)( in + done ) );
+		hi = _mm_and_si128( _mm_srli_epi32( v, 4 ), _mm_set1_epi8( 0x0f ) );
+		lo = _mm_and_si128( v, _mm_set1_epi8( 0x0f ) );
+		ok = _mm_and_si128( _mm_shuffle_epi8( _mm_setr_epi8( DEC_MASKS_128 ), lo ),
+				_mm_shuffle_epi8( _mm_setr_epi8( DEC_BITS_128 ), hi ) );
+		if ( !_mm_testz_si128( _mm_cmpeq_epi8( ok, _mm_setzero_si128() ),
+				_mm_set1_epi8( -1 ) ) )
+			return -1;
+		v = _mm_add_epi8( v, _mm_blendv_epi8(
+				_mm_shuffle_epi8( _mm_setr_epi8( DEC_OFFSETS_128 ), hi ),
+				_mm_set1_epi8( 16 ),
+				_mm_cmpeq_epi8( v, _mm_set1_epi8( '/' ) ) ) );
+		v = _mm_madd_epi16( _mm_maddubs_epi16( v, _mm_set1_epi32( 0x01400140 ) ),
+				_mm_set1_epi32( 0x00011000 ) );
+		_mm_storeu_si128( (__m128i *)out,
+				_mm_shuffle_epi8( v, _mm_setr_epi8( DEC_PACK_128 ) ) );
+	}
+	return done;
+}
+
+/********
+ dec_avx2--
+ ********/
+
+__attribute__(( target( "avx2" ) ))
+static int dec_avx2( const char *in, int in_len, unsigned char *out,
+		int out_room )
+{
+	/* 32 characters a round, 24 bytes out; the store of the second half
+	   writes up to out + 28 */
+	__m256i v, hi, lo, ok;
+	int done = 0, n;
+
+	for ( ; in_len - done >= 32 && out_room >= 28;
+			done += 32, out += 24, out_room -= 24 )
+	{
+		v = _mm256_loadu_si256( (const __m256i *)( in + done ) );
+		hi = _mm256_and_si256( _mm256_srli_epi32( v, 4 ),
+				_mm256_set1_epi8( 0x0f ) );
+		lo = _mm256_and_si256( v, _mm256_set1_epi8( 0x0f ) );
+		ok = _mm256_and_si256(
+				_mm256_shuffle_epi8( _mm256_setr_epi8( DEC_MASKS_128,
+					DEC_MASKS_128 ), lo ),
+				_mm256_shuffle_epi8( _mm256_setr_epi8( DEC_BITS_128,
+					DEC_BITS_128 ), hi ) );
+		if ( _mm256_movemask_epi8( _mm256_cmpeq_epi8( ok,
+				_mm256_setzero_si256() ) ) )
+			return -1;
+		v = _mm256_add_epi8( v, _mm256_blendv_epi8(
+				_mm256_shuffle_epi8( _mm256_setr_epi8( DEC_OFFSETS_128,
+					DEC_OFFSETS_128 ), hi ),
+				_mm256_set1_epi8( 16 ),
+				_mm256_cmpeq_epi8( v, _mm256_set1_epi8( '/' ) ) ) );
+		v = _mm256_madd_epi16( _mm256_maddubs_epi16( v,
+				_mm256_set1_epi32( 0x01400140 ) ),
+				_mm256_set1_epi32( 0x00011000 ) );
+		v = _mm256_shuffle_epi8( v, _mm256_setr_epi8( DEC_PACK_128,
+				DEC_PACK_128 ) );
+		_mm_storeu_si128( (__m128i *)out, _mm256_castsi256_si128( v ) );
+		_mm_storeu_si128( (__m128i *)( out + 12 ),
+				_mm256_extracti128_si256( v, 1 ) );
+	}
+	_mm256_zeroupper();
+	if ( ( n = dec_sse4( in + done, in_len - done, out, out_room ) ) < 0 )
+		return -1;
+	return done + n;
+}
+
+#endif /* GENMC_B64_SIMD */
@@ -0,0 +1,105 @@
+/*
+libgenmc - framed records
+
+A record is a line of netstrings, the same one gen-mc -f writes:
+
+	<len>:<field>,<len>:<field>,...\n
+
+len is the field's length in bytes, in decimal, so a field may hold
+commas, colons or newlines. A record is at most GENMC_FRAME_MAX bytes
+and has at most GENMC_FRAME_FIELDS fields. Nothing here does any I/O,
+the caller reads and writes the bytes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "genmc.h"
+
+
+/***************
+ genmc_frame_put--
+ ***************/
+
+int genmc_frame_put( char *frame, size_t size, const char **fields,
+		int n_fields, int *frame_len )
+{
+	/* Writes the fields as one record, NUL terminated */
+	size_t len = 0, flen;
+	int i, n;
+
+	if ( n_fields < 1 || n_fields > GENMC_FRAME_FIELDS )
+		return GENMC_ERR_FRAME;
+	for ( i = 0; i < n_fields; ++i )
+	{
+		flen = strlen( fields[i] );
+		n = snprintf( frame + len, size - len, "%d:", (int)flen );
+		if ( n < 0 || len + n + flen + 2 >= size )
+			return GENMC_ERR_BUFFER;
+		len += n;
+		memcpy( frame + len, fields[i], flen );
+		len += flen;
+		frame[len++] = ',';
+	}
+	frame[len++] = '\n';
+	frame[len] = '\0';
+	if ( len > GENMC_FRAME_MAX )
+		return GENMC_ERR_BUFFER;
+	*frame_len = len;
+	return GENMC_OK;
+}
+
+/***************
+ genmc_frame_get--
+ ***************/
+
+int genmc_frame_get( char *frame, int len, char **fields, int *n_fields,
+		int *used )
+{
+	/* Takes the first record apart in place, each field is NUL terminated
+	   where its comma was. *used is how many bytes the record took, or 0
+	   if it isn't all there yet. A record can't be told apart from a
+	   broken one until it is complete, so more than GENMC_FRAME_MAX bytes
+	   without one is an error too.
+	 */
+	int lens[GENMC_FRAME_FIELDS];
+	int pos = 0, flen, n = 0, i, digits;
+
+	*n_fields = 0;
+	*used = 0;
+	while ( pos < len )
+	{
+		if ( '\n' == frame[pos] )
+		{
+			if ( 0 == n )
+				return GENMC_ERR_FRAME;
+			for ( i = 0; i < n; ++i )
+				fields[i][lens[i]] = '\0';
+			*n_fields = n;
+			*used = pos + 1;
+			return GENMC_OK;
+		}
+		if ( GENMC_FRAME_FIELDS == n )
+			return GENMC_ERR_FRAME;
+
+		for ( flen = 0, digits = 0; pos < len && frame[pos] >= '0' &&
+				frame[pos] <= '9'; ++pos, ++digits )
+		{
+			flen = flen * 10 + frame[pos] - '0';
+			if ( flen > GENMC_FRAME_MAX )
+				return GENMC_ERR_FRAME;
+		}
+		if ( pos >= len )
+			break;
+		if ( 0 == digits || ':' != frame[pos] )
+			return GENMC_ERR_FRAME;
+		if ( ++pos + flen >= len )
+			break;
+		if ( ',' != frame[pos + flen] )
+			return GENMC_ERR_FRAME;
+		lens[n] = flen;
+		fields[n++] = frame + pos;
+		pos += flen + 1;
+	}
+
+	return len >= GENMC_FRAME_MAX ? GENMC_ERR_FRAME : GENMC_OK;
+}
@@ -0,0 +1,267 @@
+/*
+libgenmc - the bulk user key generator
+
+RSA_generate_key() followed by RSA_check_key() does every prime search
+from scratch: the small-prime table, the BN_CTX and the trial division
+are set up per call, and RSA_check_key() then runs the whole primality
+test on p and q a second time. A generator keeps all of that from one
+key to the next.
+
+Each prime is searched for from its own random start, drawn from the
+same RAND_bytes() pool as RSA_generate_key(). A window of odd numbers
+after it is sieved at once against the first 2048 odd primes, and
+against 1 mod 65537 so that p-1 and e are coprime, and only the
+survivors go to Miller-Rabin with the rounds OpenSSL picks for the size.
+The first survivor that passes is the prime, as in OpenSSL's own search,
+and the rest of the window is thrown away. Windows are never shared
+between primes: two keys with primes close together would let anyone
+holding one of the private keys factor the other.
+
+The key is put together the way rsa_builtin_keygen() does it, p > q,
+d = e^-1 mod (p-1)(q-1), and the CRT values. As there, the inverses
+and the reductions of d see (p-1)(q-1), d and p with BN_FLG_CONSTTIME,
+so their timing tells nothing of the primes. Its internal consistency
+is checked, the primality isn't checked twice; test-keygen puts keys
+through RSA_check_key() too.
+
+A generator is not thread safe, make one per thread.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/bn.h>
+#include <openssl/rsa.h>
+#include "genmc.h"
+
+#define SIEVE_PRIMES   2048
+#define SIEVE_WINDOW   2048   /* odd numbers looked at per random start */
+
+struct genmc_keygen
+{
+	BN_CTX *ctx;
+	BIGNUM *e;
+	long retries;         /* searches started over, see genmc_keygen_retries() */
+	unsigned char sieve[SIEVE_WINDOW];
+};
+
+static unsigned int small_primes[SIEVE_PRIMES];
+static pthread_once_t small_primes_once = PTHREAD_ONCE_INIT;
+
+static void make_small_primes( void );
+static int  find_prime( genmc_keygen *kg, BIGNUM *p, int bits );
+
+
+/****************
+ genmc_keygen_new--
+ ****************/
+
+int genmc_keygen_new( genmc_keygen **keygen )
+{
+	genmc_keygen *kg;
+
+	*keygen = NULL;
+	pthread_once( &small_primes_once, make_small_primes );
+	if ( NULL == ( kg = calloc( 1, sizeof( genmc_keygen ) ) ) )
+		return GENMC_ERR_NOMEM;
+	kg->ctx = BN_CTX_new();
+	kg->e = BN_new();
+	if ( NULL == kg->ctx || NULL == kg->e || !BN_set_word( kg->e, RSA_F4 ) )
+	{
+		genmc_keygen_free( kg );
+		return GENMC_ERR_NOMEM;
+	}
+	*keygen = kg;
+	return GENMC_OK;
+}
+
+/*****************
+ genmc_keygen_make--
+ *****************/
+
+int genmc_keygen_make( genmc_keygen *kg, RSA **user_rsa )
+{
+	/* A GENMC_USER_BITS key with e = 65537 */
+	BN_CTX *ctx = kg->ctx;
+	BIGNUM *p1, *q1, *phi, *r;
+	BIGNUM ct_phi, ct_d, ct_p;  /* constant time views, BN_with_flags() */
+	RSA *rsa;
+	int ok = 0;
+
+	*user_rsa = NULL;
+	if ( NULL == ( rsa = RSA_new() ) )
+		return GENMC_ERR_NOMEM;
+	BN_CTX_start( ctx );
+	p1 = BN_CTX_get( ctx );
+	q1 = BN_CTX_get( ctx );
+	phi = BN_CTX_get( ctx );
+	r = BN_CTX_get( ctx );
+	rsa->n = BN_new();
+	rsa->e = BN_dup( kg->e );
+	rsa->d = BN_new();
+	rsa->p = BN_new();
+	rsa->q = BN_new();
+	rsa->dmp1 = BN_new();
+	rsa->dmq1 = BN_new();
+	rsa->iqmp = BN_new();
+	if ( NULL == r || NULL == rsa->n || NULL == rsa->e || NULL == rsa->d ||
+			NULL == rsa->p || NULL == rsa->q || NULL == rsa->dmp1 ||
+			NULL == rsa->dmq1 || NULL == rsa->iqmp )
+		goto done;
+
+	/* two top bits set in each prime, so n has all its bits */
+	if ( !find_prime( kg, rsa->p, GENMC_USER_BITS / 2 ) )
+		goto done;
+	for ( ;; )
+	{
+		if ( !find_prime( kg, rsa->q, GENMC_USER_BITS / 2 ) )
+			goto done;
+		if ( 0 != BN_cmp( rsa->p, rsa->q ) )
+			break;
+		kg->retries++;
+	}
+	if ( BN_cmp( rsa->p, rsa->q ) < 0 )
+		BN_swap( rsa->p, rsa->q );
+
+	ok = BN_mul( rsa->n, rsa->p, rsa->q, ctx )
+		&& GENMC_USER_BITS == BN_num_bits( rsa->n )
+		&& BN_sub( p1, rsa->p, BN_value_one() )
+		&& BN_sub( q1, rsa->q, BN_value_one() )
+		&& BN_mul( phi, p1, q1, ctx );
+	if ( ok )
+	{
+		BN_with_flags( &ct_phi, phi, BN_FLG_CONSTTIME );
+		ok = NULL != BN_mod_inverse( rsa->d, rsa->e, &ct_phi, ctx );
+	}
+	if ( ok )
+	{
+		BN_with_flags( &ct_d, rsa->d, BN_FLG_CONSTTIME );
+		BN_with_flags( &ct_p, rsa->p, BN_FLG_CONSTTIME );
+		ok = BN_mod( rsa->dmp1, &ct_d, p1, ctx )
+			&& BN_mod( rsa->dmq1, &ct_d, q1, ctx )
+			&& NULL != BN_mod_inverse( rsa->iqmp, rsa->q, &ct_p, ctx );
+	}
+
+	/* e*d = 1 mod p-1 and mod q-1, which is what RSA_check_key() wants
+	   besides the primes */
+	ok = ok && BN_mod_mul( r, rsa->e, rsa->dmp1, p1, ctx ) && BN_is_one( r )
+		&& BN_mod_mul( r, rsa->e, rsa->dmq1, q1, ctx ) && BN_is_one( r );
+
+done:
+	BN_CTX_end( ctx );
+	if ( !ok )
+	{
+		RSA_free( rsa );
+		return GENMC_ERR_KEYGEN;
+	}
+	*user_rsa = rsa;
+	return GENMC_OK;
+}
+
+/********************
+ genmc_keygen_retries--
+ ********************/
+
+long genmc_keygen_retries( genmc_keygen *kg )
+{
+	/* How many times a prime search started over from a new random
+	   number, because the window had no prime or p came out equal to q,
+	   since the last call. Almost always 0, a run of them means the
+	   sieve or the random numbers have gone wrong. */
+	long n = kg->retries;
+
+	kg->retries = 0;
+	return n;
+}
+
+/*****************
+ genmc_keygen_free--
+ *****************/
+
+void genmc_keygen_free( genmc_keygen *kg )
+{
+	if ( NULL == kg )
+		return;
+	BN_CTX_free( kg->ctx );
+	BN_free( kg->e );
+	free( kg );
+	return;
+}
+
+/**********
+ find_prime--
+ **********/
+
+static int find_prime( genmc_keygen *kg, BIGNUM *p, int bits )
+{
+	/* A random prime of exactly bits bits with p-1 coprime to 65537 */
+	unsigned char *sieve = kg->sieve;
+	unsigned long r, k;
+	unsigned int sp;
+	int i, c;
+
+	for ( ;; )
+	{
+		if ( !BN_rand( p, bits, 1, 1 ) )
+			return 0;
+
+		/* cross out p + 2k divisible by a small prime: 2k = -r mod sp,
+		   and k = (sp - r) * (sp + 1) / 2 mod sp since 2 * (sp + 1) / 2
+		   is 1 mod sp */
+		memset( sieve, 0, SIEVE_WINDOW );
+		for ( i = 0; i < SIEVE_PRIMES; ++i )
+		{
+			sp = small_primes[i];
+			if ( (BN_ULONG)-1 == ( r = BN_mod_word( p, sp ) ) )
+				return 0;
+			k = ( ( sp - r ) % sp ) * ( ( sp + 1 ) / 2 ) % sp;
+			for ( ; k < SIEVE_WINDOW; k += sp )
+				sieve[k] = 1;
+		}
+
+		/* and p + 2k = 1 mod 65537, gcd( p-1, e ) wouldn't be 1 */
+		if ( (BN_ULONG)-1 == ( r = BN_mod_word( p, RSA_F4 ) ) )
+			return 0;
+		k = ( ( RSA_F4 + 1 - r ) % RSA_F4 ) * ( ( RSA_F4 + 1 ) / 2 ) % RSA_F4;
+		if ( k < SIEVE_WINDOW )
+			sieve[k] = 1;
+
+		for ( k = 0; k < SIEVE_WINDOW; ++k )
+		{
+			if ( sieve[k] )
+				continue;
+			if ( k > 0 && !BN_add_word( p, 2 * k ) )
+				return 0;
+			if ( BN_num_bits( p ) != bits )
+				break; /* ran off the top, start over */
+			c = BN_is_prime_fasttest_ex( p, BN_prime_checks, kg->ctx, 0, NULL );
+			if ( c < 0 )
+				return 0;
+			if ( c )
+				return 1;
+			if ( !BN_sub_word( p, 2 * k ) )
+				return 0;
+		}
+		kg->retries++; /* no prime in the window, or ran off the top */
+	}
+}
+
+/****************
+ make_small_primes--
+ ****************/
+
+static void make_small_primes( void )
+{
+	/* the odd primes from 3 up, 2048 of them end at 17863 */
+	unsigned int n, d;
+	int i = 0;
+
+	for ( n = 3; i < SIEVE_PRIMES; n += 2 )
+	{
+		for ( d = 3; d * d <= n && n % d; d += 2 )
+			;
+		if ( d * d > n )
+			small_primes[i++] = n;
+	}
+	return;
+}
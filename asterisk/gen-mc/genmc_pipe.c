@@ -0,0 +1,554 @@
+/*
+libgenmc - the issuing pipeline
+
+A run is split into stages, each with its own workers, joined by bounded
+queues:
+
+	pack -> keygen -> sign -> encode -> output
+
+The pack stage is one thread that calls the caller's source for the next
+packed user info. keygen makes the user keys or takes them from the
+spool, sign has a genmc_signer per worker, encode does the base64, and
+output is the calling thread, which hands the results to the caller's
+sink. A full queue stops the stage in front of it, so a slow stage holds
+the others back instead of letting the work pile up in memory. In a
+replay build the keygen and sign stages start each job on a random
+stream of its own, see genmc_replay.c.
+
+Jobs finish out of order when a stage has more than one worker. Every job
+carries its sequence number, the output stage holds back the early ones
+and the sink always sees them in the order the source gave them.
+
+At most a fixed number of jobs are in flight, they are allocated once
+and go round and round. Each stage keeps the time its workers spent
+working, waiting for input and waiting for room in the next queue; the
+stage with the least waiting is the one holding the run back. With a
+genmc_stats in the conf every stage also records a span per job, its
+phase is the stage and its record number the job's sequence number.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <openssl/rsa.h>
+#include <openssl/err.h>
+#include "genmc.h"
+
+/* a bounded ring of jobs between two stages */
+typedef struct pipe_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+	genmc_job **jobs;
+	int size, head, count;
+	int producers;        /* still running, the queue is done at 0 */
+	int aborted;
+} pipe_queue;
+
+typedef struct pipe_run pipe_run;
+
+/* one stage and the queue it takes its jobs from */
+typedef struct pipe_stage
+{
+	pipe_run *run;
+	int stage;
+	pipe_queue *in, *out;
+	pthread_t *threads;
+	int n_threads;
+	pthread_mutex_t stats_lock;
+} pipe_stage;
+
+struct pipe_run
+{
+	RSA *ca_rsa;
+	const char *spool_dir;
+	genmc_pipe_source source;
+	void *source_arg;
+	pipe_queue free_jobs, after_pack, after_keygen, after_sign, after_encode;
+	pipe_stage stages[GENMC_STAGE_COUNT];
+	genmc_pipe_stats *stats;
+	genmc_stats *run_stats; /* spans and key counts, may be NULL */
+};
+
+static const char *stage_names[GENMC_STAGE_COUNT] =
+{
+	"pack",
+	"keygen",
+	"sign",
+	"encode",
+	"output"
+};
+
+static int  queue_init( pipe_queue *q, int size, int producers );
+static void queue_free( pipe_queue *q );
+static int  queue_push( pipe_queue *q, genmc_job *job, double *waited );
+static genmc_job *queue_pop( pipe_queue *q, double *waited );
+static void queue_done( pipe_queue *q );
+static void queue_abort( pipe_queue *q );
+static void *stage_worker( void *arg );
+static void stage_work( pipe_stage *st, genmc_job *job, genmc_signer *signer,
+		genmc_keygen *keygen );
+static double now_seconds( void );
+
+
+/**************
+ genmc_pipe_run--
+ **************/
+
+int genmc_pipe_run( RSA *ca_rsa, const genmc_pipe_conf *conf,
+		genmc_pipe_source source, void *source_arg,
+		genmc_pipe_sink sink, void *sink_arg, genmc_pipe_stats *stats )
+{
+	/* Runs the pipeline until the source has no more jobs. The sink is
+	   called from this thread, in source order, with every job whether it
+	   was issued or not. Returns GENMC_OK, or an error if the stages
+	   couldn't be set up, in which case nothing may have been issued.
+	 */
+	pipe_run run;
+	pipe_stage *st;
+	genmc_job *jobs, **window, *job;
+	int workers[GENMC_STAGE_COUNT];
+	int queue_len, n_jobs, s, i;
+	long next = 0;
+	double t0, waited = 0, busy = 0, t, t_end, spare = 0;
+	int err = GENMC_OK;
+
+	workers[GENMC_STAGE_PACK] = 1;
+	workers[GENMC_STAGE_KEYGEN] = conf->keygen_workers > 0 ? conf->keygen_workers : 1;
+	workers[GENMC_STAGE_SIGN] = conf->sign_workers > 0 ? conf->sign_workers : 1;
+	workers[GENMC_STAGE_ENCODE] = conf->encode_workers > 0 ? conf->encode_workers : 1;
+	workers[GENMC_STAGE_OUTPUT] = 1;
+
+	/* every queue holds twice as many jobs as the busiest stage has
+	   workers, and there are enough jobs to fill them all */
+	queue_len = conf->queue_len;
+	if ( queue_len < 1 )
+		for ( s = 0, queue_len = 2; s < GENMC_STAGE_COUNT; ++s )
+			if ( 2 * workers[s] > queue_len )
+				queue_len = 2 * workers[s];
+	n_jobs = 4 * queue_len + 1;
+	for ( s = 0; s < GENMC_STAGE_COUNT; ++s )
+		n_jobs += workers[s];
+
+	memset( &run, 0, sizeof( run ) );
+	memset( stats, 0, sizeof( genmc_pipe_stats ) );
+	run.ca_rsa = ca_rsa;
+	run.spool_dir = conf->spool_dir;
+	run.source = source;
+	run.source_arg = source_arg;
+	run.stats = stats;
+	run.run_stats = conf->stats;
+
+	jobs = calloc( n_jobs, sizeof( genmc_job ) );
+	window = calloc( n_jobs, sizeof( genmc_job * ) );
+	if ( NULL == jobs || NULL == window ||
+			!queue_init( &run.free_jobs, n_jobs, 1 ) ||
+			!queue_init( &run.after_pack, queue_len, workers[GENMC_STAGE_PACK] ) ||
+			!queue_init( &run.after_keygen, queue_len, workers[GENMC_STAGE_KEYGEN] ) ||
+			!queue_init( &run.after_sign, queue_len, workers[GENMC_STAGE_SIGN] ) ||
+			!queue_init( &run.after_encode, queue_len, workers[GENMC_STAGE_ENCODE] ) )
+	{
+		free( jobs );
+		free( window );
+		queue_free( &run.free_jobs );
+		queue_free( &run.after_pack );
+		queue_free( &run.after_keygen );
+		queue_free( &run.after_sign );
+		queue_free( &run.after_encode );
+		return GENMC_ERR_NOMEM;
+	}
+	for ( i = 0; i < n_jobs; ++i )
+		queue_push( &run.free_jobs, &jobs[i], &spare );
+
+	run.stages[GENMC_STAGE_PACK].in = &run.free_jobs;
+	run.stages[GENMC_STAGE_PACK].out = &run.after_pack;
+	run.stages[GENMC_STAGE_KEYGEN].in = &run.after_pack;
+	run.stages[GENMC_STAGE_KEYGEN].out = &run.after_keygen;
+	run.stages[GENMC_STAGE_SIGN].in = &run.after_keygen;
+	run.stages[GENMC_STAGE_SIGN].out = &run.after_sign;
+	run.stages[GENMC_STAGE_ENCODE].in = &run.after_sign;
+	run.stages[GENMC_STAGE_ENCODE].out = &run.after_encode;
+	run.stages[GENMC_STAGE_OUTPUT].in = &run.after_encode;
+	run.stages[GENMC_STAGE_OUTPUT].out = &run.free_jobs;
+	for ( s = 0; s < GENMC_STAGE_COUNT; ++s )
+	{
+		st = &run.stages[s];
+		st->run = &run;
+		st->stage = s;
+		pthread_mutex_init( &st->stats_lock, NULL );
+		stats->stage[s].name = stage_names[s];
+	}
+
+	/* start the workers, output is this thread */
+	t0 = now_seconds();
+	genmc_stats_thread( run.run_stats, stage_names[GENMC_STAGE_OUTPUT] );
+	for ( s = 0; s < GENMC_STAGE_OUTPUT && GENMC_OK == err; ++s )
+	{
+		st = &run.stages[s];
+		if ( NULL == ( st->threads = calloc( workers[s], sizeof( pthread_t ) ) ) )
+			err = GENMC_ERR_NOMEM;
+		for ( i = 0; GENMC_OK == err && i < workers[s]; ++i )
+		{
+			if ( pthread_create( &st->threads[i], NULL, stage_worker, st ) )
+				break;
+			st->n_threads++;
+		}
+		if ( 0 == st->n_threads )
+			err = GENMC_ERR_NOMEM;
+		else
+			while ( i++ < workers[s] )
+				queue_done( st->out ); /* for the ones that didn't start */
+		stats->stage[s].workers = st->n_threads;
+	}
+	stats->stage[GENMC_STAGE_OUTPUT].workers = 1;
+
+	if ( GENMC_OK != err )
+	{
+		/* wake everybody up and let them go */
+		queue_abort( &run.free_jobs );
+		queue_abort( &run.after_pack );
+		queue_abort( &run.after_keygen );
+		queue_abort( &run.after_sign );
+		queue_abort( &run.after_encode );
+	}
+	else
+	{
+		/* the output stage, jobs that finish early wait in the window
+		   until the ones before them are out */
+		while ( NULL != ( job = queue_pop( &run.after_encode, &waited ) ) )
+		{
+			window[job->seq % n_jobs] = job;
+			while ( NULL != ( job = window[next % n_jobs] ) && job->seq == next )
+			{
+				t = now_seconds();
+				window[next % n_jobs] = NULL;
+				sink( sink_arg, job );
+				if ( NULL != job->user_rsa )
+					RSA_free( job->user_rsa );
+				memset( job, 0, sizeof( genmc_job ) );
+				stats->stage[GENMC_STAGE_OUTPUT].jobs++;
+				t_end = now_seconds();
+				busy += t_end - t;
+				genmc_stats_span( run.run_stats, GENMC_PHASE_OUTPUT, next, t,
+						t_end, NULL );
+				++next;
+				queue_push( &run.free_jobs, job, &spare );
+			}
+		}
+		stats->stage[GENMC_STAGE_OUTPUT].busy = busy;
+		stats->stage[GENMC_STAGE_OUTPUT].wait_in = waited;
+		queue_abort( &run.free_jobs ); /* the pack stage may be waiting */
+	}
+
+	for ( s = 0; s < GENMC_STAGE_OUTPUT; ++s )
+	{
+		st = &run.stages[s];
+		for ( i = 0; i < st->n_threads; ++i )
+			pthread_join( st->threads[i], NULL );
+		free( st->threads );
+	}
+	for ( s = 0; s < GENMC_STAGE_COUNT; ++s )
+		pthread_mutex_destroy( &run.stages[s].stats_lock );
+	stats->wall = now_seconds() - t0;
+
+	/* jobs left over after an abort still hold their keys */
+	for ( i = 0; i < n_jobs; ++i )
+		if ( NULL != jobs[i].user_rsa )
+			RSA_free( jobs[i].user_rsa );
+	memset( jobs, 0, n_jobs * sizeof( genmc_job ) );
+	free( jobs );
+	free( window );
+	queue_free( &run.free_jobs );
+	queue_free( &run.after_pack );
+	queue_free( &run.after_keygen );
+	queue_free( &run.after_sign );
+	queue_free( &run.after_encode );
+	return err;
+}
+
+/***************
+ genmc_stage_name--
+ ***************/
+
+const char *genmc_stage_name( int stage )
+{
+	if ( stage < 0 || stage >= GENMC_STAGE_COUNT )
+		return "unknown";
+	return stage_names[stage];
+}
+
+/************
+ stage_worker--
+ ************/
+
+static void *stage_worker( void *arg )
+{
+	pipe_stage *st = arg;
+	pipe_run *run = st->run;
+	genmc_stage_stats *ss = &run->stats->stage[st->stage];
+	genmc_signer *signer = NULL;
+	genmc_keygen *keygen = NULL;
+	genmc_job *job;
+	double wait_in = 0, wait_out = 0, busy = 0, t, t_end;
+	long n = 0, seq = 0;
+	int signer_err = GENMC_OK, err_in;
+
+	/* a signer per sign worker, made here so its blinding is this
+	   thread's own */
+	genmc_replay_stream( st->stage, -1 );
+	if ( GENMC_STAGE_SIGN == st->stage )
+		signer_err = genmc_signer_new( &signer, run->ca_rsa );
+	/* and a key generator per keygen worker, without one it falls back
+	   to genmc_gen_user_key() */
+	if ( GENMC_STAGE_KEYGEN == st->stage &&
+			GENMC_OK != genmc_keygen_new( &keygen ) )
+		keygen = NULL;
+	genmc_stats_thread( run->run_stats, stage_names[st->stage] );
+
+	while ( NULL != ( job = queue_pop( st->in, &wait_in ) ) )
+	{
+		t = now_seconds();
+		err_in = job->err;
+		if ( GENMC_STAGE_PACK == st->stage )
+		{
+			/* only the one pack thread hands out sequence numbers */
+			if ( !run->source( run->source_arg, job ) )
+			{
+				queue_push( run->stages[GENMC_STAGE_OUTPUT].out, job, &wait_out );
+				break;
+			}
+			job->seq = seq++;
+		}
+		else if ( GENMC_STAGE_SIGN == st->stage && GENMC_OK != signer_err )
+		{
+			if ( GENMC_OK == job->err )
+				job->err = signer_err;
+		}
+		else
+			stage_work( st, job, signer, keygen );
+		t_end = now_seconds();
+		busy += t_end - t;
+		++n;
+
+		/* a job that failed before just went past, there's no span */
+		if ( GENMC_OK == err_in || GENMC_STAGE_PACK == st->stage )
+			genmc_stats_span( run->run_stats, st->stage, job->seq, t, t_end,
+					GENMC_OK != job->err ? genmc_strerror( job->err ) : NULL );
+
+		if ( !queue_push( st->out, job, &wait_out ) )
+			break;
+	}
+	queue_done( st->out );
+
+	pthread_mutex_lock( &st->stats_lock );
+	ss->jobs += n;
+	ss->busy += busy;
+	ss->wait_in += wait_in;
+	ss->wait_out += wait_out;
+	pthread_mutex_unlock( &st->stats_lock );
+
+	genmc_signer_free( signer );
+	genmc_keygen_free( keygen );
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/**********
+ stage_work--
+ **********/
+
+static void stage_work( pipe_stage *st, genmc_job *job, genmc_signer *signer,
+		genmc_keygen *keygen )
+{
+	/* a job that has failed already just passes through to the sink */
+	unsigned char u_pr_e[GENMC_USER_MOD_LEN * 2];
+	int len;
+
+	if ( GENMC_OK != job->err )
+		return;
+
+	switch ( st->stage )
+	{
+		case GENMC_STAGE_KEYGEN:
+			genmc_replay_stream( GENMC_STAGE_KEYGEN, job->seq );
+			if ( NULL != st->run->spool_dir && NULL !=
+					( job->user_rsa = genmc_spool_take( st->run->spool_dir ) ) )
+			{
+				genmc_stats_count( st->run->run_stats, GENMC_COUNT_KEYS_SPOOL, 1 );
+				break;
+			}
+			if ( NULL != keygen )
+			{
+				job->err = genmc_keygen_make( keygen, &job->user_rsa );
+				genmc_stats_count( st->run->run_stats, GENMC_COUNT_KEYGEN_RETRIES,
+						genmc_keygen_retries( keygen ) );
+			}
+			else
+				job->err = genmc_gen_user_key( &job->user_rsa );
+			if ( GENMC_OK == job->err )
+				genmc_stats_count( st->run->run_stats, GENMC_COUNT_KEYS_MADE, 1 );
+			break;
+
+		case GENMC_STAGE_SIGN:
+			if ( GENMC_USER_BITS != RSA_size( job->user_rsa ) * 8 )
+			{
+				job->err = GENMC_ERR_USER_SIZE;
+				break;
+			}
+			genmc_replay_stream( GENMC_STAGE_SIGN, job->seq );
+			memcpy( job->mc, job->user_info, GENMC_USER_INFO_LEN );
+			len = GENMC_USER_INFO_LEN;
+			len += BN_bn2bin( job->user_rsa->n, job->mc + len );
+			job->err = genmc_signer_sign( signer, job->mc, &len );
+			break;
+
+		case GENMC_STAGE_ENCODE:
+			job->err = genmc_b64_encode( job->mc, GENMC_MC_LEN, job->mc_b64,
+					sizeof( job->mc_b64 ) );
+			if ( GENMC_OK != job->err )
+				break;
+			len = BN_bn2bin( job->user_rsa->d, u_pr_e ); /* private exponent */
+			job->err = genmc_b64_encode( u_pr_e, len, job->pk_b64,
+					sizeof( job->pk_b64 ) );
+			memset( u_pr_e, 0, sizeof( u_pr_e ) );
+			/* the key isn't needed any more, don't carry it around */
+			RSA_free( job->user_rsa );
+			job->user_rsa = NULL;
+			break;
+	}
+	return;
+}
+
+/**********
+ queue_init--
+ **********/
+
+static int queue_init( pipe_queue *q, int size, int producers )
+{
+	memset( q, 0, sizeof( pipe_queue ) );
+	if ( NULL == ( q->jobs = calloc( size, sizeof( genmc_job * ) ) ) )
+		return 0;
+	q->size = size;
+	q->producers = producers;
+	pthread_mutex_init( &q->lock, NULL );
+	pthread_cond_init( &q->not_empty, NULL );
+	pthread_cond_init( &q->not_full, NULL );
+	return 1;
+}
+
+/**********
+ queue_free--
+ **********/
+
+static void queue_free( pipe_queue *q )
+{
+	if ( NULL == q->jobs )
+		return;
+	pthread_cond_destroy( &q->not_full );
+	pthread_cond_destroy( &q->not_empty );
+	pthread_mutex_destroy( &q->lock );
+	free( q->jobs );
+	q->jobs = NULL;
+	return;
+}
+
+/**********
+ queue_push--
+ **********/
+
+static int queue_push( pipe_queue *q, genmc_job *job, double *waited )
+{
+	/* Waits for room, the time spent waiting is added to *waited.
+	   Returns 0 if the run was aborted. */
+	double t = 0;
+
+	pthread_mutex_lock( &q->lock );
+	if ( q->count == q->size && !q->aborted )
+	{
+		t = now_seconds();
+		while ( q->count == q->size && !q->aborted )
+			pthread_cond_wait( &q->not_full, &q->lock );
+		*waited += now_seconds() - t;
+	}
+	if ( q->aborted )
+	{
+		pthread_mutex_unlock( &q->lock );
+		return 0;
+	}
+	q->jobs[( q->head + q->count ) % q->size] = job;
+	q->count++;
+	pthread_cond_signal( &q->not_empty );
+	pthread_mutex_unlock( &q->lock );
+	return 1;
+}
+
+/*********
+ queue_pop--
+ *********/
+
+static genmc_job *queue_pop( pipe_queue *q, double *waited )
+{
+	/* Waits for a job. Returns NULL once every producer is done and the
+	   queue is empty, or the run was aborted. */
+	genmc_job *job = NULL;
+	double t;
+
+	pthread_mutex_lock( &q->lock );
+	if ( 0 == q->count && q->producers > 0 && !q->aborted )
+	{
+		t = now_seconds();
+		while ( 0 == q->count && q->producers > 0 && !q->aborted )
+			pthread_cond_wait( &q->not_empty, &q->lock );
+		*waited += now_seconds() - t;
+	}
+	if ( q->count > 0 && !q->aborted )
+	{
+		job = q->jobs[q->head];
+		q->head = ( q->head + 1 ) % q->size;
+		q->count--;
+		pthread_cond_signal( &q->not_full );
+	}
+	pthread_mutex_unlock( &q->lock );
+	return job;
+}
+
+/**********
+ queue_done--
+ **********/
+
+static void queue_done( pipe_queue *q )
+{
+	/* one producer less, the last one wakes up all the consumers */
+	pthread_mutex_lock( &q->lock );
+	if ( q->producers > 0 && 0 == --q->producers )
+		pthread_cond_broadcast( &q->not_empty );
+	pthread_mutex_unlock( &q->lock );
+	return;
+}
+
+/***********
+ queue_abort--
+ ***********/
+
+static void queue_abort( pipe_queue *q )
+{
+	pthread_mutex_lock( &q->lock );
+	q->aborted = 1;
+	pthread_cond_broadcast( &q->not_empty );
+	pthread_cond_broadcast( &q->not_full );
+	pthread_mutex_unlock( &q->lock );
+	return;
+}
+
+/***********
+ now_seconds--
+ ***********/
+
+static double now_seconds( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
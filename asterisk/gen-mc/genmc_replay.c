@@ -0,0 +1,237 @@
+/*
+libgenmc - the replay random number generator
+
+A build with -DGENMC_REPLAY can replace OpenSSL's random number
+generator with a deterministic one, so a run with the same seed, roster,
+expiry date and CA writes the same MiniCerts and keys byte for byte. A
+faster base64, signer or key generator can then be checked against the
+output of the old one. It is for that only: anyone with the seed has
+every key. A normal build has genmc_replay_start() fail and
+genmc_replay_stream() do nothing.
+
+The bytes are SHA-256 over the seed, a stream number and a counter.
+RSA_generate_key(), the key generator, the Miller-Rabin bases and the
+RSA blinding all draw from RAND_bytes() or RAND_pseudo_bytes(), and each
+thread has its own stream. The pipeline starts a new stream for every
+job in the keygen and sign stages, named by the stage and the job's
+sequence number, so which worker picks a job up makes no difference. A
+thread that never started one draws from stream -1, -1 of its own.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "genmc.h"
+
+#ifdef GENMC_REPLAY
+
+#include <pthread.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+/* a thread's stream */
+typedef struct replay_state
+{
+	unsigned char key[SHA256_DIGEST_LENGTH];   /* seed, stage and sequence */
+	unsigned long counter;
+	unsigned char block[SHA256_DIGEST_LENGTH];
+	int used;             /* bytes of block handed out */
+} replay_state;
+
+static unsigned char replay_seed[SHA256_DIGEST_LENGTH];
+static pthread_key_t replay_key;
+
+static replay_state *replay_get( void );
+static void replay_set( replay_state *st, int stage, long seq );
+static int  replay_bytes( unsigned char *buf, int num );
+static void replay_seed_cb( const void *buf, int num );
+static void replay_add( const void *buf, int num, double entropy );
+static void replay_cleanup( void );
+static int  replay_status( void );
+
+static RAND_METHOD replay_method =
+{
+	replay_seed_cb,
+	replay_bytes,
+	replay_cleanup,
+	replay_add,
+	replay_bytes,         /* pseudorand */
+	replay_status
+};
+
+
+/******************
+ genmc_replay_start--
+ ******************/
+
+int genmc_replay_start( const char *seed )
+{
+	/* Makes every random byte OpenSSL hands out from now on come from
+	   the seed. Call it before any threads are started. */
+	SHA256( (const unsigned char *)seed, strlen( seed ), replay_seed );
+	if ( 0 != pthread_key_create( &replay_key, free ) )
+		return GENMC_ERR_NOMEM;
+	if ( NULL == replay_get() || !RAND_set_rand_method( &replay_method ) )
+		return GENMC_ERR_NOMEM;
+	return GENMC_OK;
+}
+
+/*******************
+ genmc_replay_stream--
+ *******************/
+
+void genmc_replay_stream( int stage, long seq )
+{
+	/* The calling thread's bytes come from this stream from now on,
+	   from its start */
+	replay_state *st;
+
+	if ( RAND_get_rand_method() != &replay_method ||
+			NULL == ( st = replay_get() ) )
+		return;
+	replay_set( st, stage, seq );
+	return;
+}
+
+/**********
+ replay_get--
+ **********/
+
+static replay_state *replay_get( void )
+{
+	replay_state *st;
+
+	if ( NULL != ( st = pthread_getspecific( replay_key ) ) )
+		return st;
+	if ( NULL == ( st = malloc( sizeof( replay_state ) ) ) )
+		return NULL;
+	replay_set( st, -1, -1 );
+	if ( 0 != pthread_setspecific( replay_key, st ) )
+	{
+		free( st );
+		return NULL;
+	}
+	return st;
+}
+
+/**********
+ replay_set--
+ **********/
+
+static void replay_set( replay_state *st, int stage, long seq )
+{
+	SHA256_CTX sha;
+	unsigned char n[12];
+	int i;
+
+	/* the numbers in a fixed byte order, so the streams are the same on
+	   any host */
+	for ( i = 0; i < 4; ++i )
+		n[i] = (unsigned char)( (unsigned long)stage >> ( 24 - 8 * i ) );
+	for ( i = 0; i < 8; ++i )
+		n[4 + i] = (unsigned char)( (unsigned long long)seq >> ( 56 - 8 * i ) );
+	SHA256_Init( &sha );
+	SHA256_Update( &sha, replay_seed, sizeof( replay_seed ) );
+	SHA256_Update( &sha, n, sizeof( n ) );
+	SHA256_Final( st->key, &sha );
+	st->counter = 0;
+	st->used = sizeof( st->block );
+	return;
+}
+
+/************
+ replay_bytes--
+ ************/
+
+static int replay_bytes( unsigned char *buf, int num )
+{
+	replay_state *st = replay_get();
+	SHA256_CTX sha;
+	unsigned char c[4];
+	int n;
+
+	if ( NULL == st )
+		return 0;
+	while ( num > 0 )
+	{
+		if ( st->used == sizeof( st->block ) )
+		{
+			c[0] = (unsigned char)( st->counter >> 24 );
+			c[1] = (unsigned char)( st->counter >> 16 );
+			c[2] = (unsigned char)( st->counter >> 8 );
+			c[3] = (unsigned char)st->counter;
+			++st->counter;
+			SHA256_Init( &sha );
+			SHA256_Update( &sha, st->key, sizeof( st->key ) );
+			SHA256_Update( &sha, c, sizeof( c ) );
+			SHA256_Final( st->block, &sha );
+			st->used = 0;
+		}
+		n = sizeof( st->block ) - st->used;
+		if ( n > num )
+			n = num;
+		memcpy( buf, st->block + st->used, n );
+		st->used += n;
+		buf += n;
+		num -= n;
+	}
+	return 1;
+}
+
+/**************
+ replay_seed_cb--
+ **************/
+
+static void replay_seed_cb( const void *buf, int num )
+{
+	/* outside seeding would make it random again */
+	return;
+}
+
+/**********
+ replay_add--
+ **********/
+
+static void replay_add( const void *buf, int num, double entropy )
+{
+	return;
+}
+
+/**************
+ replay_cleanup--
+ **************/
+
+static void replay_cleanup( void )
+{
+	return;
+}
+
+/*************
+ replay_status--
+ *************/
+
+static int replay_status( void )
+{
+	return 1;
+}
+
+#else /* GENMC_REPLAY */
+
+/******************
+ genmc_replay_start--
+ ******************/
+
+int genmc_replay_start( const char *seed )
+{
+	return GENMC_ERR_REPLAY;
+}
+
+/*******************
+ genmc_replay_stream--
+ *******************/
+
+void genmc_replay_stream( int stage, long seq )
+{
+	return;
+}
+
+#endif /* GENMC_REPLAY */
@@ -0,0 +1,182 @@
+/*
+libgenmc - the CA signer
+
+A signer is a CA key made ready for many signatures in a row. It gets
+its own copy of the key, so the Montgomery contexts for n, p and q and
+the blinding are set up once, in genmc_signer_new(), and belong to this
+signer alone. The SHA-1 context is kept and reused, and the CA modulus
+is kept in the MiniCert's byte order so it is only copied per signature.
+
+A signer may be shared by several threads, only the short digest step is
+under its lock. For the most throughput make one per thread from the
+same CA key, in the thread that will use it: OpenSSL ties the blinding
+to the thread that set it up, and the others have to take turns on a
+shared one.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/rsa.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include "genmc.h"
+
+struct genmc_signer
+{
+	RSA *ca_rsa;          /* this signer's own copy */
+	const EVP_MD *md;
+	EVP_MD_CTX mdctx;
+	pthread_mutex_t md_lock;
+	unsigned char ca_mod[GENMC_CA_MOD_LEN];
+};
+
+
+/****************
+ genmc_signer_new--
+ ****************/
+
+int genmc_signer_new( genmc_signer **signer, RSA *ca_rsa )
+{
+	/* The key is expected to be checked already, see genmc_check_ca_key() */
+	genmc_signer *s;
+	unsigned char m[SHA_DIGEST_LENGTH];
+	unsigned char sig[GENMC_SIG_LEN];
+
+	*signer = NULL;
+	if ( GENMC_CA_BITS != RSA_size( ca_rsa ) * 8 )
+		return GENMC_ERR_CA_SIZE;
+	if ( NULL == ( s = calloc( 1, sizeof( genmc_signer ) ) ) )
+		return GENMC_ERR_NOMEM;
+
+	if ( NULL == ( s->md = EVP_get_digestbyname( "sha1" ) ) )
+	{
+		free( s );
+		return GENMC_ERR_DIGEST;
+	}
+	if ( NULL == ( s->ca_rsa = RSAPrivateKey_dup( ca_rsa ) ) )
+	{
+		free( s );
+		return GENMC_ERR_NOMEM;
+	}
+	BN_bn2bin( s->ca_rsa->n, s->ca_mod );
+	EVP_MD_CTX_init( &s->mdctx );
+	pthread_mutex_init( &s->md_lock, NULL );
+
+	/* one throwaway signature sets up the blinding and the Montgomery
+	   contexts, RSA_FLAG_CACHE_PRIVATE keeps them with the key */
+	memset( m, 0, sizeof( m ) );
+	if ( !RSA_blinding_on( s->ca_rsa, NULL ) || GENMC_SIG_LEN !=
+			RSA_private_encrypt( sizeof( m ), m, sig, s->ca_rsa, RSA_PKCS1_PADDING ) )
+	{
+		genmc_signer_free( s );
+		return GENMC_ERR_SIGN;
+	}
+
+	*signer = s;
+	return GENMC_OK;
+}
+
+/*****************
+ genmc_signer_sign--
+ *****************/
+
+int genmc_signer_sign( genmc_signer *s, unsigned char *mess, int *mess_len )
+{
+	/* mess holds the user info and the user's public modulus, the
+	   signature and the CA's public modulus are appended. *mess_len is the
+	   length of the two on the way in and the whole MiniCert length on
+	   the way out. */
+	unsigned char m[EVP_MAX_MD_SIZE];
+	unsigned int m_len;
+	int siglen;
+	int c;
+
+	if ( GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN != *mess_len )
+		return GENMC_ERR_USER_SIZE;
+
+	pthread_mutex_lock( &s->md_lock );
+	c = EVP_DigestInit_ex( &s->mdctx, s->md, NULL )
+		&& EVP_DigestUpdate( &s->mdctx, mess, *mess_len )
+		&& EVP_DigestFinal_ex( &s->mdctx, m, &m_len );
+	pthread_mutex_unlock( &s->md_lock );
+	if ( !c )
+		return GENMC_ERR_DIGEST;
+
+	siglen = RSA_private_encrypt( m_len, m, mess + *mess_len, s->ca_rsa,
+			RSA_PKCS1_PADDING );
+	if ( GENMC_SIG_LEN != siglen )
+		return GENMC_ERR_SIGN;
+	*mess_len += siglen;
+
+	memcpy( mess + *mess_len, s->ca_mod, GENMC_CA_MOD_LEN );
+	*mess_len += GENMC_CA_MOD_LEN;
+	return GENMC_OK;
+}
+
+/*******************
+ genmc_signer_resign--
+ *******************/
+
+int genmc_signer_resign( genmc_signer *s, RSA *old_ca_rsa, const char *mc_b64,
+		int b64_len, const char *expiry_date, char *out_b64, size_t out_size,
+		genmc_mc_info *info )
+{
+	/* Signs an issued MiniCert over again, keeping the user's modulus so
+	   the phone keeps its private key. It has to check out against
+	   old_ca_rsa first, expired or not. With expiry_date NULL the old
+	   expiry date is kept, otherwise it is replaced; either way the new
+	   signature and CA modulus are this signer's. info comes back with
+	   the new MiniCert's contents.
+	 */
+	unsigned char mc[GENMC_MC_LEN];
+	struct tm expiry_tm;
+	int len, err;
+
+	/* an expiry of time 0 lets expired MiniCerts through */
+	switch ( genmc_verify_mc( old_ca_rsa, mc_b64, b64_len, 0, info ) )
+	{
+		case GENMC_MC_VALID:
+			break;
+		case GENMC_MC_WRONG_CA:
+			return GENMC_ERR_MC_WRONG_CA;
+		default:
+			return GENMC_ERR_MC_CORRUPT;
+	}
+	if ( NULL != expiry_date )
+	{
+		err = genmc_check_expiry_date( expiry_date, &expiry_tm, &info->expiry_t );
+		if ( GENMC_OK != err )
+			return err;
+		memcpy( info->expiry_date, expiry_date, GENMC_EXPIRY_LEN );
+	}
+
+	/* the name and id go back byte for byte, padding and all */
+	memset( mc, 0, sizeof( mc ) );
+	memcpy( mc + GENMC_NAME_OFF, info->display_name, GENMC_NAME_MAX );
+	memcpy( mc + GENMC_ID_OFF, info->user_id, GENMC_ID_MAX );
+	memcpy( mc + GENMC_EXPIRY_OFF, info->expiry_date, GENMC_EXPIRY_LEN );
+	memcpy( mc + GENMC_USER_INFO_LEN, info->user_mod, GENMC_USER_MOD_LEN );
+	len = GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN;
+	if ( GENMC_OK != ( err = genmc_signer_sign( s, mc, &len ) ) )
+		return err;
+	memcpy( info->sig, mc + GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN,
+			GENMC_SIG_LEN );
+	memcpy( info->ca_mod, s->ca_mod, GENMC_CA_MOD_LEN );
+	return genmc_b64_encode( mc, len, out_b64, out_size );
+}
+
+/*****************
+ genmc_signer_free--
+ *****************/
+
+void genmc_signer_free( genmc_signer *s )
+{
+	if ( NULL == s )
+		return;
+	EVP_MD_CTX_cleanup( &s->mdctx );
+	pthread_mutex_destroy( &s->md_lock );
+	RSA_free( s->ca_rsa );
+	free( s );
+	return;
+}
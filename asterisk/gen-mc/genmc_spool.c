@@ -0,0 +1,178 @@
+/*
+libgenmc - the user key spool
+
+Keys are made ahead of time by "gen-mc -F" and kept one per file as
+k<time>-<pid>-<seq>.pem in a directory only the owner can get at. A key
+is published by renaming it into place once it is on disk, and claimed
+by renaming it out of the k*.pem namespace, so it is handed out at most
+once however many issuers share the spool.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <openssl/pem.h>
+#include "genmc.h"
+
+static int spool_key_name( const char *name );
+
+
+/*****************
+ genmc_spool_check--
+ *****************/
+
+int genmc_spool_check( const char *spool_dir, int create )
+{
+	/* The spool is full of private keys, only the owner may get at it */
+	struct stat st;
+
+	if ( create )
+		mkdir( spool_dir, 0700 );
+	if ( 0 != stat( spool_dir, &st ) || !S_ISDIR( st.st_mode ) )
+		return GENMC_ERR_SPOOL_MISSING;
+	if ( st.st_mode & 077 )
+		return GENMC_ERR_SPOOL_MODE;
+	return GENMC_OK;
+}
+
+/*****************
+ genmc_spool_count--
+ *****************/
+
+int genmc_spool_count( const char *spool_dir, int sweep )
+{
+	/* Counts the keys ready in the spool. With sweep set, temp files left
+	   behind by a crashed filler or issuer that are over an hour old are
+	   removed as well. Returns -1 if the spool can't be read.
+	 */
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	char path[1024];
+	time_t stale;
+	int count = 0;
+
+	if ( NULL == ( dir = opendir( spool_dir ) ) )
+		return -1;
+	stale = time( NULL ) - 3600;
+	while ( NULL != ( de = readdir( dir ) ) )
+	{
+		if ( spool_key_name( de->d_name ) )
+			++count;
+		else if ( sweep && ( !strncmp( de->d_name, ".tmp-", 5 ) ||
+				!strncmp( de->d_name, ".taken-", 7 ) ) )
+		{
+			snprintf( path, sizeof( path ), "%s/%s", spool_dir, de->d_name );
+			if ( 0 == stat( path, &st ) && st.st_mtime < stale )
+				unlink( path );
+		}
+	}
+	closedir( dir );
+	return count;
+}
+
+/***************
+ genmc_spool_put--
+ ***************/
+
+int genmc_spool_put( const char *spool_dir, RSA *user_rsa )
+{
+	/* The key is written to a temp name first and renamed when it's
+	   complete, so a taker never sees half a key. Not thread safe, one
+	   writer per process. */
+	static unsigned long seq = 0;
+	char tmp_path[1024], key_path[1024];
+	FILE *fp;
+	int fd, ok;
+
+	++seq;
+	snprintf( tmp_path, sizeof( tmp_path ), "%s/.tmp-%lx-%lx-%lx",
+			spool_dir, (unsigned long)time( NULL ), (unsigned long)getpid(), seq );
+	snprintf( key_path, sizeof( key_path ), "%s/k%lx-%lx-%lx.pem",
+			spool_dir, (unsigned long)time( NULL ), (unsigned long)getpid(), seq );
+
+	fd = open( tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600 );
+	if ( fd < 0 )
+		return GENMC_ERR_SPOOL_WRITE;
+	if ( NULL == ( fp = fdopen( fd, "wb" ) ) )
+	{
+		close( fd );
+		unlink( tmp_path );
+		return GENMC_ERR_SPOOL_WRITE;
+	}
+	ok = PEM_write_RSAPrivateKey( fp, user_rsa, NULL, NULL, 0, NULL, NULL );
+	ok = ok && 0 == fflush( fp ) && 0 == fsync( fd );
+	ok = ( 0 == fclose( fp ) ) && ok;
+	if ( !ok || 0 != rename( tmp_path, key_path ) )
+	{
+		unlink( tmp_path );
+		return GENMC_ERR_SPOOL_WRITE;
+	}
+	return GENMC_OK;
+}
+
+/****************
+ genmc_spool_take--
+ ****************/
+
+RSA *genmc_spool_take( const char *spool_dir )
+{
+	/* Claims a key by renaming it out of the k*.pem namespace. rename() is
+	   atomic, so when several issuers go for the same key only one of them
+	   wins and the others move on to the next. The claimed file is removed
+	   as soon as it's read, a key is never handed out twice.
+	   Returns NULL when the spool is empty.
+	 */
+	DIR *dir;
+	struct dirent *de;
+	char key_path[1024], taken_path[1100];
+	FILE *fp;
+	RSA *user_rsa = NULL;
+
+	if ( NULL == ( dir = opendir( spool_dir ) ) )
+		return NULL;
+	while ( NULL == user_rsa && NULL != ( de = readdir( dir ) ) )
+	{
+		if ( !spool_key_name( de->d_name ) )
+			continue;
+		snprintf( key_path, sizeof( key_path ), "%s/%s", spool_dir, de->d_name );
+		snprintf( taken_path, sizeof( taken_path ), "%s/.taken-%s",
+				spool_dir, de->d_name );
+		if ( 0 != rename( key_path, taken_path ) )
+			continue; /* somebody else got it first */
+
+		if ( NULL != ( fp = fopen( taken_path, "rb" ) ) )
+		{
+			user_rsa = PEM_read_RSAPrivateKey( fp, NULL, NULL, NULL );
+			fclose( fp );
+		}
+		unlink( taken_path );
+		if ( NULL != user_rsa && GENMC_USER_BITS != RSA_size( user_rsa ) * 8 )
+		{
+			RSA_free( user_rsa );
+			user_rsa = NULL;
+		}
+	}
+	closedir( dir );
+
+	#ifdef DEBUG
+	if ( NULL != user_rsa )
+		fprintf( stderr, "Debug: user key taken from the spool\n" );
+	#endif
+	return user_rsa;
+}
+
+/**************
+ spool_key_name--
+ **************/
+
+static int spool_key_name( const char *name )
+{
+	/* ready keys are k<...>.pem, anything else is in flight */
+	int len = strlen( name );
+	return 'k' == name[0] && len > 5 && !strcmp( name + len - 4, ".pem" );
+}
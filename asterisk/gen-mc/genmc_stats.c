@@ -0,0 +1,468 @@
+/*
+libgenmc - counters, latency histograms and trace events of a run
+
+A genmc_stats is shared by every thread of a run. It counts what was
+issued, verified, re-signed and failed, and why, and keeps a histogram
+of the time each phase took per record. With a trace file every phase
+of every record is also written out as a Chrome trace event:
+
+	[
+	{"name":"sign","ph":"X","pid":123,"tid":3,"ts":1520.0,"dur":210.5,"args":{"rec":17}},
+	...
+
+which chrome://tracing and Perfetto load as it is, a file cut short by
+a crash included. Threads are numbered from 1 in the order they first
+record something, genmc_stats_thread() names them.
+
+Only phase names, record numbers, times and the caller's error texts
+are recorded. Never pass a key, a name or an id as an error, nothing
+here knows who a record was for.
+
+A histogram has four buckets per power of two microseconds, so a
+percentile is within 25% of the real one. Recording a span is a
+bucket index and a few adds under a mutex, cheap next to a signature;
+the trace costs a formatted line on top of that.
+
+Every call takes a NULL genmc_stats and does nothing with it, so the
+callers don't have to check whether stats were asked for.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "genmc.h"
+
+#define HIST_BUCKETS   128
+#define FAIL_REASONS   32     /* different reasons kept, the rest are "other" */
+#define TRACE_BUFFER   65536
+
+typedef struct stats_hist
+{
+	long count;
+	double sum, min, max;  /* microseconds */
+	long bucket[HIST_BUCKETS];
+} stats_hist;
+
+struct genmc_stats
+{
+	pthread_mutex_t lock;
+	double t0;
+	long counters[GENMC_COUNT_COUNT];
+	const char *reasons[FAIL_REASONS];
+	long failed[FAIL_REASONS];
+	long other;
+	stats_hist hist[GENMC_PHASE_COUNT];
+	pthread_key_t tid_key;
+	int n_tids;
+	pthread_mutex_t trace_lock;
+	FILE *trace;          /* NULL for none */
+	long pid;
+};
+
+static const char *phase_names[GENMC_PHASE_COUNT] =
+{
+	"pack",
+	"keygen",
+	"sign",
+	"encode",
+	"output",
+	"verify",
+	"resign",
+	"pregen",
+	"request"
+};
+
+static const char *counter_names[GENMC_COUNT_COUNT] =
+{
+	"issued",
+	"verified",
+	"resigned",
+	"failed",
+	"keys_ready",
+	"keys_spool",
+	"keys_made",
+	"keygen_retries"
+};
+
+static int    thread_id( genmc_stats *st );
+static int    hist_bucket( double us );
+static double bucket_top( int b );
+static double hist_percentile( stats_hist *h, double p );
+static void   put_json_string( FILE *fp, const char *s );
+
+
+/***************
+ genmc_stats_new--
+ ***************/
+
+int genmc_stats_new( genmc_stats **stats, const char *trace_path )
+{
+	/* trace_path may be NULL for no trace file */
+	genmc_stats *st;
+	int i;
+
+	*stats = NULL;
+	if ( NULL == ( st = calloc( 1, sizeof( genmc_stats ) ) ) )
+		return GENMC_ERR_NOMEM;
+	if ( 0 != pthread_key_create( &st->tid_key, NULL ) )
+	{
+		free( st );
+		return GENMC_ERR_NOMEM;
+	}
+	if ( NULL != trace_path )
+	{
+		if ( NULL == ( st->trace = fopen( trace_path, "w" ) ) )
+		{
+			pthread_key_delete( st->tid_key );
+			free( st );
+			return GENMC_ERR_TRACE;
+		}
+		setvbuf( st->trace, NULL, _IOFBF, TRACE_BUFFER );
+		fputs( "[\n", st->trace );
+	}
+	pthread_mutex_init( &st->lock, NULL );
+	pthread_mutex_init( &st->trace_lock, NULL );
+	for ( i = 0; i < GENMC_PHASE_COUNT; ++i )
+		st->hist[i].min = -1;
+	st->pid = (long)getpid();
+	st->t0 = genmc_stats_now();
+	*stats = st;
+	return GENMC_OK;
+}
+
+/******************
+ genmc_stats_thread--
+ ******************/
+
+void genmc_stats_thread( genmc_stats *st, const char *name )
+{
+	/* Names the calling thread in the trace, the workers of a stage can
+	   all have the same name */
+	int tid;
+
+	if ( NULL == st )
+		return;
+	tid = thread_id( st );
+	if ( NULL == st->trace )
+		return;
+	pthread_mutex_lock( &st->trace_lock );
+	fprintf( st->trace, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+			"\"tid\":%d,\"args\":{\"name\":", st->pid, tid );
+	put_json_string( st->trace, name );
+	fputs( "}},\n", st->trace );
+	pthread_mutex_unlock( &st->trace_lock );
+	return;
+}
+
+/****************
+ genmc_stats_span--
+ ****************/
+
+void genmc_stats_span( genmc_stats *st, int phase, long rec,
+		double start, double end, const char *err )
+{
+	/* Record rec spent start to end, genmc_stats_now() times, in the
+	   phase. rec is the caller's record number, -1 for none. err is why
+	   the record failed in this phase, or NULL. */
+	stats_hist *h;
+	double us;
+	int tid;
+
+	if ( NULL == st || phase < 0 || phase >= GENMC_PHASE_COUNT )
+		return;
+	us = ( end - start ) * 1e6;
+	if ( us < 0 )
+		us = 0;
+
+	h = &st->hist[phase];
+	pthread_mutex_lock( &st->lock );
+	h->count++;
+	h->sum += us;
+	if ( h->min < 0 || us < h->min )
+		h->min = us;
+	if ( us > h->max )
+		h->max = us;
+	h->bucket[hist_bucket( us )]++;
+	pthread_mutex_unlock( &st->lock );
+
+	if ( NULL == st->trace )
+		return;
+	tid = thread_id( st );
+	pthread_mutex_lock( &st->trace_lock );
+	fprintf( st->trace, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%d,"
+			"\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"rec\":%ld", phase_names[phase],
+			st->pid, tid, ( start - st->t0 ) * 1e6, us, rec );
+	if ( NULL != err )
+	{
+		fputs( ",\"err\":", st->trace );
+		put_json_string( st->trace, err );
+	}
+	fputs( "}},\n", st->trace );
+	pthread_mutex_unlock( &st->trace_lock );
+	return;
+}
+
+/*****************
+ genmc_stats_count--
+ *****************/
+
+void genmc_stats_count( genmc_stats *st, int counter, long n )
+{
+	if ( NULL == st || 0 == n || counter < 0 || counter >= GENMC_COUNT_COUNT )
+		return;
+	pthread_mutex_lock( &st->lock );
+	st->counters[counter] += n;
+	pthread_mutex_unlock( &st->lock );
+	return;
+}
+
+/******************
+ genmc_stats_failed--
+ ******************/
+
+void genmc_stats_failed( genmc_stats *st, const char *reason )
+{
+	/* A record failed, reason has to stay put for the life of the stats,
+	   genmc_strerror() and string constants do */
+	int i;
+
+	if ( NULL == st )
+		return;
+	pthread_mutex_lock( &st->lock );
+	st->counters[GENMC_COUNT_FAILED]++;
+	for ( i = 0; i < FAIL_REASONS && NULL != st->reasons[i]; ++i )
+		if ( st->reasons[i] == reason || !strcmp( st->reasons[i], reason ) )
+			break;
+	if ( i == FAIL_REASONS )
+		st->other++;
+	else
+	{
+		st->reasons[i] = reason;
+		st->failed[i]++;
+	}
+	pthread_mutex_unlock( &st->lock );
+	return;
+}
+
+/****************
+ genmc_stats_json--
+ ****************/
+
+int genmc_stats_json( genmc_stats *st, FILE *fp, const char *mode )
+{
+	/* Writes everything so far as one line of JSON:
+
+		{"mode":"batch","elapsed_s":1.52,
+		 "counters":{"issued":1000,...},
+		 "failed":{"expiry date is in the past.":2},
+		 "phases":{"keygen":{"count":1000,"mean_us":..,"min_us":..,
+		   "p50_us":..,"p90_us":..,"p99_us":..,"max_us":..,
+		   "hist":[[<upto_us>,<count>],...]},...}}
+
+	   Phases nothing was recorded for are left out, a hist bucket is the
+	   count of spans shorter than its upto_us and not in the one before.
+	 */
+	stats_hist *h;
+	int i, b, n, m;
+
+	if ( NULL == st )
+		return GENMC_OK;
+	pthread_mutex_lock( &st->lock );
+	fputs( "{\"mode\":", fp );
+	put_json_string( fp, mode );
+	fprintf( fp, ",\"elapsed_s\":%.3f,\"counters\":{",
+			genmc_stats_now() - st->t0 );
+	for ( i = 0; i < GENMC_COUNT_COUNT; ++i )
+		fprintf( fp, "%s\"%s\":%ld", i ? "," : "", counter_names[i],
+				st->counters[i] );
+
+	fputs( "},\"failed\":{", fp );
+	for ( i = 0; i < FAIL_REASONS && NULL != st->reasons[i]; ++i )
+	{
+		if ( i )
+			fputc( ',', fp );
+		put_json_string( fp, st->reasons[i] );
+		fprintf( fp, ":%ld", st->failed[i] );
+	}
+	if ( st->other > 0 )
+		fprintf( fp, "%s\"other\":%ld", i ? "," : "", st->other );
+
+	fputs( "},\"phases\":{", fp );
+	for ( i = 0, n = 0; i < GENMC_PHASE_COUNT; ++i )
+	{
+		h = &st->hist[i];
+		if ( 0 == h->count )
+			continue;
+		fprintf( fp, "%s\"%s\":{\"count\":%ld,\"mean_us\":%.1f,\"min_us\":%.1f,"
+				"\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+				"\"hist\":[", n++ ? "," : "", phase_names[i], h->count,
+				h->sum / h->count, h->min, hist_percentile( h, 0.50 ),
+				hist_percentile( h, 0.90 ), hist_percentile( h, 0.99 ), h->max );
+		for ( b = 0, m = 0; b < HIST_BUCKETS; ++b )
+			if ( h->bucket[b] )
+				fprintf( fp, "%s[%.0f,%ld]", m++ ? "," : "", bucket_top( b ),
+						h->bucket[b] );
+		fputs( "]}", fp );
+	}
+	fputs( "}}\n", fp );
+	pthread_mutex_unlock( &st->lock );
+	fflush( fp );
+	return ferror( fp ) ? GENMC_ERR_BUFFER : GENMC_OK;
+}
+
+/*****************
+ genmc_stats_flush--
+ *****************/
+
+int genmc_stats_flush( genmc_stats *st )
+{
+	/* Pushes the trace out to the file, for a look at a daemon's while it
+	   is running */
+	int err = GENMC_OK;
+
+	if ( NULL == st || NULL == st->trace )
+		return GENMC_OK;
+	pthread_mutex_lock( &st->trace_lock );
+	if ( 0 != fflush( st->trace ) )
+		err = GENMC_ERR_TRACE;
+	pthread_mutex_unlock( &st->trace_lock );
+	return err;
+}
+
+/****************
+ genmc_stats_free--
+ ****************/
+
+int genmc_stats_free( genmc_stats *st )
+{
+	/* Closes the trace, GENMC_ERR_TRACE if any of it couldn't be written.
+	   Nothing may record to st any more. */
+	int err = GENMC_OK;
+
+	if ( NULL == st )
+		return GENMC_OK;
+	if ( NULL != st->trace )
+	{
+		/* a last event so the array ends without a trailing comma */
+		fprintf( st->trace, "{\"name\":\"process_name\",\"ph\":\"M\","
+				"\"pid\":%ld,\"args\":{\"name\":\"gen-mc\"}}\n]\n", st->pid );
+		if ( ferror( st->trace ) )
+			err = GENMC_ERR_TRACE;
+		if ( 0 != fclose( st->trace ) )
+			err = GENMC_ERR_TRACE;
+	}
+	pthread_key_delete( st->tid_key );
+	pthread_mutex_destroy( &st->trace_lock );
+	pthread_mutex_destroy( &st->lock );
+	free( st );
+	return err;
+}
+
+/***************
+ genmc_stats_now--
+ ***************/
+
+double genmc_stats_now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*********
+ thread_id--
+ *********/
+
+static int thread_id( genmc_stats *st )
+{
+	/* the calling thread's number, given out the first time it asks */
+	void *p;
+	int tid;
+
+	if ( NULL != ( p = pthread_getspecific( st->tid_key ) ) )
+		return (int)(long)p;
+	pthread_mutex_lock( &st->lock );
+	tid = ++st->n_tids;
+	pthread_mutex_unlock( &st->lock );
+	pthread_setspecific( st->tid_key, (void *)(long)tid );
+	return tid;
+}
+
+/***********
+ hist_bucket--
+ ***********/
+
+static int hist_bucket( double us )
+{
+	/* 0-3 hold 0, 1, 2 and 3us, after that every power of two is split
+	   in four: 4, 5, 6, 7, then 8-9, 10-11, 12-13, 14-15 and so on */
+	unsigned long v;
+	int e, b;
+
+	if ( us >= 1e15 )
+		return HIST_BUCKETS - 1;
+	v = (unsigned long)us;
+	if ( v < 4 )
+		return (int)v;
+	for ( e = 2; v >> ( e + 1 ); ++e )
+		;
+	b = 4 + ( e - 2 ) * 4 + (int)( ( v >> ( e - 2 ) ) & 3 );
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+/**********
+ bucket_top--
+ **********/
+
+static double bucket_top( int b )
+{
+	/* where bucket b ends, in microseconds */
+	if ( b < 4 )
+		return b + 1;
+	return (double)( 4 + ( b & 3 ) + 1 ) * (double)( 1UL << ( ( b - 4 ) / 4 ) );
+}
+
+/***************
+ hist_percentile--
+ ***************/
+
+static double hist_percentile( stats_hist *h, double p )
+{
+	/* the end of the bucket the p'th span is in, no more than the max */
+	long want, seen = 0;
+	int b;
+
+	want = (long)( p * h->count + 0.5 );
+	if ( want < 1 )
+		want = 1;
+	for ( b = 0; b < HIST_BUCKETS; ++b )
+		if ( ( seen += h->bucket[b] ) >= want )
+			break;
+	if ( b == HIST_BUCKETS || bucket_top( b ) > h->max )
+		return h->max;
+	return bucket_top( b );
+}
+
+/***************
+ put_json_string--
+ ***************/
+
+static void put_json_string( FILE *fp, const char *s )
+{
+	fputc( '"', fp );
+	for ( ; *s; ++s )
+	{
+		if ( '"' == *s || '\\' == *s )
+			fprintf( fp, "\\%c", *s );
+		else if ( (unsigned char)*s < 0x20 )
+			fprintf( fp, "\\u%04x", (unsigned char)*s );
+		else
+			fputc( *s, fp );
+	}
+	fputc( '"', fp );
+	return;
+}
@@ -0,0 +1,564 @@
+/*
+libgenmc - the MiniCert store
+
+One file holds any number of issued MiniCerts and their private keys, in
+place of a .mini_cert and a .mini_pkey file per user. It is a 64 byte
+header and then fixed size records, appended only, so record n is always
+at the same offset and the file can be read or mapped as an array:
+
+	 0  "MCR1"
+	 4  MiniCert base64 length, 2 bytes big endian
+	 6  private key base64 length, 2 bytes
+	 8  display name, 32 bytes, zero padded
+	40  user id, 16 bytes, zero padded
+	56  expiry date, 12 bytes
+	68  reserved, 4 bytes
+	72  MiniCert base64, 512 bytes, zero padded
+	584 private key base64, 96 bytes, zero padded
+	680 reserved, 84 bytes
+	764 CRC-32 of bytes 0-763, 4 bytes big endian
+
+The offsets are in genmc_store_fmt.h, for the tools that read a store
+without the library.
+
+A record is written with one write() at the end of the file. After a
+crash the last records may be torn or missing, their CRC doesn't match
+and the store ends at the last good record; whatever was synced before
+is never touched. Only one writer at a time, it holds a lock on the file.
+
+A record is on disk for good once genmc_store_sync() has returned. With
+genmc_store_sync_every( n ) the store syncs itself after every n
+records, so a crash loses at most the n - 1 appended since; without it
+only genmc_store_sync() and genmc_store_close() do, and everything since
+the open can be lost. gen-mc syncs a batch every so many records and at
+the end, and the daemon every record before it answers.
+
+<store>.idx has two sorted arrays of (key, record number), one by user id
+and one by display name, so a user is found by binary search in the
+mapped file. It is written to a temp file and renamed when the writer
+closes the store. Records appended after the index was written are
+looked through one by one, newest first, so a stale index is slower but
+never wrong. When a user
+was issued more than once, the newest record is the one found.
+
+The file holds private keys, it is created mode 0600.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "genmc.h"
+#include "genmc_store_fmt.h"
+
+#define INDEX_MAGIC      "MCIX0001"
+#define INDEX_HDR_LEN    16
+#define INDEX_KEY_LEN    36
+#define INDEX_ENTRY_LEN  ( INDEX_KEY_LEN + 4 )
+
+struct genmc_store
+{
+	int fd;
+	int writable;
+	long count;            /* good records */
+	char *index_path;
+	unsigned char *index;  /* mapped <store>.idx, NULL if there is none */
+	size_t index_size;
+	long indexed;          /* records the index covers */
+	long sync_every;       /* genmc_store_sync_every(), 0 for none */
+	long unsynced;         /* appended since the last fsync() */
+};
+
+/* an index entry while the index is being built */
+typedef struct index_entry
+{
+	char key[INDEX_KEY_LEN];
+	unsigned long rec;
+} index_entry;
+
+static void store_discard( genmc_store *st );
+static int  store_read_rec( genmc_store *st, long n, unsigned char *rec );
+static int  store_rec_ok( const unsigned char *rec );
+static void store_map_index( genmc_store *st );
+static int  store_write_index( genmc_store *st );
+static long index_search( const unsigned char *entries, long n, const char *key );
+static int  compare_entries( const void *a, const void *b );
+static void put16( unsigned char *p, unsigned int v );
+static void put32( unsigned char *p, unsigned long v );
+static unsigned int get16( const unsigned char *p );
+static unsigned long get32( const unsigned char *p );
+
+
+/****************
+ genmc_store_open--
+ ****************/
+
+int genmc_store_open( genmc_store **store, const char *path, int writable )
+{
+	/* Opens the store, creating it when writable. A writer waits for any
+	   other writer to close first, and cuts off a torn tail. */
+	genmc_store *st;
+	unsigned char hdr[STORE_HDR_LEN];
+	unsigned char rec[STORE_REC_LEN];
+	struct flock fl;
+	struct stat sb;
+	long n;
+
+	*store = NULL;
+	if ( NULL == ( st = calloc( 1, sizeof( genmc_store ) ) ) )
+		return GENMC_ERR_NOMEM;
+	st->writable = writable;
+	if ( NULL == ( st->index_path = malloc( strlen( path ) + 5 ) ) )
+	{
+		free( st );
+		return GENMC_ERR_NOMEM;
+	}
+	sprintf( st->index_path, "%s.idx", path );
+
+	st->fd = writable ? open( path, O_RDWR | O_CREAT, 0600 ) : open( path, O_RDONLY );
+	if ( st->fd < 0 )
+	{
+		store_discard( st );
+		return GENMC_ERR_STORE_OPEN;
+	}
+	if ( writable )
+	{
+		memset( &fl, 0, sizeof( fl ) );
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		while ( -1 == fcntl( st->fd, F_SETLKW, &fl ) )
+			if ( EINTR != errno )
+			{
+				store_discard( st );
+				return GENMC_ERR_STORE_OPEN;
+			}
+	}
+
+	if ( 0 != fstat( st->fd, &sb ) )
+	{
+		store_discard( st );
+		return GENMC_ERR_STORE_READ;
+	}
+	if ( 0 == sb.st_size && writable )
+	{
+		memset( hdr, 0, sizeof( hdr ) );
+		memcpy( hdr, STORE_MAGIC, 8 );
+		put32( hdr + 8, STORE_REC_LEN );
+		if ( sizeof( hdr ) != pwrite( st->fd, hdr, sizeof( hdr ), 0 ) ||
+				0 != fsync( st->fd ) )
+		{
+			store_discard( st );
+			return GENMC_ERR_STORE_WRITE;
+		}
+		sb.st_size = sizeof( hdr );
+	}
+	if ( sizeof( hdr ) != pread( st->fd, hdr, sizeof( hdr ), 0 ) ||
+			memcmp( hdr, STORE_MAGIC, 8 ) || STORE_REC_LEN != get32( hdr + 8 ) )
+	{
+		store_discard( st );
+		return GENMC_ERR_STORE_FORMAT;
+	}
+
+	/* a crash can only have hurt the end, look back to the last good one */
+	n = ( sb.st_size - STORE_HDR_LEN ) / STORE_REC_LEN;
+	while ( n > 0 && ( !store_read_rec( st, n - 1, rec ) || !store_rec_ok( rec ) ) )
+		--n;
+	st->count = n;
+	if ( writable && sb.st_size != STORE_HDR_LEN + (off_t)n * STORE_REC_LEN &&
+			0 != ftruncate( st->fd, STORE_HDR_LEN + (off_t)n * STORE_REC_LEN ) )
+	{
+		store_discard( st );
+		return GENMC_ERR_STORE_WRITE;
+	}
+
+	store_map_index( st );
+	*store = st;
+	return GENMC_OK;
+}
+
+/******************
+ genmc_store_append--
+ ******************/
+
+int genmc_store_append( genmc_store *st, const char *display_name,
+		const char *user_id, const char *expiry_date,
+		const char *mc_b64, const char *pk_b64 )
+{
+	/* Adds a record, it is on disk for good after genmc_store_sync(),
+	   or now if it is the one genmc_store_sync_every() was waiting for */
+	unsigned char rec[STORE_REC_LEN];
+	size_t mc_len = strlen( mc_b64 ), pk_len = strlen( pk_b64 );
+	off_t off;
+
+	if ( !st->writable )
+		return GENMC_ERR_STORE_WRITE;
+	if ( mc_len > REC_MC_MAX || pk_len > REC_PK_MAX ||
+			strlen( display_name ) > GENMC_NAME_MAX ||
+			strlen( user_id ) > GENMC_ID_MAX ||
+			strlen( expiry_date ) > GENMC_EXPIRY_LEN )
+		return GENMC_ERR_BUFFER;
+
+	memset( rec, 0, sizeof( rec ) );
+	memcpy( rec, REC_MAGIC, 4 );
+	put16( rec + REC_MC_LEN_OFF, mc_len );
+	put16( rec + REC_PK_LEN_OFF, pk_len );
+	memcpy( rec + REC_NAME_OFF, display_name, strlen( display_name ) );
+	memcpy( rec + REC_ID_OFF, user_id, strlen( user_id ) );
+	memcpy( rec + REC_EXPIRY_OFF, expiry_date, strlen( expiry_date ) );
+	memcpy( rec + REC_MC_OFF, mc_b64, mc_len );
+	memcpy( rec + REC_PK_OFF, pk_b64, pk_len );
+	put32( rec + REC_CRC_OFF, crc32( 0, rec, REC_CRC_OFF ) );
+
+	off = STORE_HDR_LEN + (off_t)st->count * STORE_REC_LEN;
+	if ( sizeof( rec ) != pwrite( st->fd, rec, sizeof( rec ), off ) )
+	{
+		memset( rec, 0, sizeof( rec ) );
+		return GENMC_ERR_STORE_WRITE;
+	}
+	memset( rec, 0, sizeof( rec ) );
+	st->count++;
+	if ( st->sync_every > 0 && ++st->unsynced >= st->sync_every )
+		return genmc_store_sync( st );
+	return GENMC_OK;
+}
+
+/****************
+ genmc_store_sync--
+ ****************/
+
+int genmc_store_sync( genmc_store *st )
+{
+	if ( st->writable && 0 != fsync( st->fd ) )
+		return GENMC_ERR_STORE_WRITE;
+	st->unsynced = 0;
+	return GENMC_OK;
+}
+
+/**********************
+ genmc_store_sync_every--
+ **********************/
+
+void genmc_store_sync_every( genmc_store *st, long n )
+{
+	/* Syncs after every n records appended, 1 for every one, 0 only
+	   when told to */
+	st->sync_every = n > 0 ? n : 0;
+	return;
+}
+
+/*****************
+ genmc_store_count--
+ *****************/
+
+long genmc_store_count( genmc_store *st )
+{
+	return st->count;
+}
+
+/***************
+ genmc_store_get--
+ ***************/
+
+int genmc_store_get( genmc_store *st, long n, genmc_store_entry *entry )
+{
+	/* Record n, straight from its offset */
+	unsigned char rec[STORE_REC_LEN];
+	unsigned int mc_len, pk_len;
+
+	memset( entry, 0, sizeof( genmc_store_entry ) );
+	if ( n < 0 || n >= st->count )
+		return GENMC_ERR_STORE_NOT_FOUND;
+	if ( !store_read_rec( st, n, rec ) )
+		return GENMC_ERR_STORE_READ;
+	mc_len = get16( rec + REC_MC_LEN_OFF );
+	pk_len = get16( rec + REC_PK_LEN_OFF );
+	if ( !store_rec_ok( rec ) || mc_len >= sizeof( entry->mc_b64 ) ||
+			pk_len >= sizeof( entry->pk_b64 ) )
+	{
+		memset( rec, 0, sizeof( rec ) );
+		return GENMC_ERR_STORE_FORMAT;
+	}
+
+	memcpy( entry->display_name, rec + REC_NAME_OFF, GENMC_NAME_MAX );
+	memcpy( entry->user_id, rec + REC_ID_OFF, GENMC_ID_MAX );
+	memcpy( entry->expiry_date, rec + REC_EXPIRY_OFF, GENMC_EXPIRY_LEN );
+	memcpy( entry->mc_b64, rec + REC_MC_OFF, mc_len );
+	memcpy( entry->pk_b64, rec + REC_PK_OFF, pk_len );
+	memset( rec, 0, sizeof( rec ) );
+	return GENMC_OK;
+}
+
+/****************
+ genmc_store_find--
+ ****************/
+
+long genmc_store_find( genmc_store *st, int by, const char *key )
+{
+	/* The newest record for the user id or display name, -1 if there is
+	   none. by is GENMC_STORE_BY_ID or GENMC_STORE_BY_NAME. */
+	unsigned char rec[STORE_REC_LEN];
+	char k[INDEX_KEY_LEN];
+	int off = GENMC_STORE_BY_ID == by ? REC_ID_OFF : REC_NAME_OFF;
+	int len = GENMC_STORE_BY_ID == by ? GENMC_ID_MAX : GENMC_NAME_MAX;
+	long n;
+
+	if ( strlen( key ) > (size_t)len )
+		return -1;
+	memset( k, 0, sizeof( k ) );
+	memcpy( k, key, strlen( key ) );
+
+	/* whatever came after the index, newest first */
+	for ( n = st->count - 1; n >= st->indexed; --n )
+		if ( store_read_rec( st, n, rec ) && !memcmp( rec + off, k, len ) )
+			return n;
+
+	if ( NULL == st->index )
+		return -1;
+	return index_search( st->index + INDEX_HDR_LEN +
+			( GENMC_STORE_BY_ID == by ? 0 : st->indexed * INDEX_ENTRY_LEN ),
+			st->indexed, k );
+}
+
+/*****************
+ genmc_store_close--
+ *****************/
+
+int genmc_store_close( genmc_store *st )
+{
+	/* A writer syncs the records and brings the index up to date */
+	int err = GENMC_OK;
+
+	if ( NULL == st )
+		return GENMC_OK;
+	if ( st->writable )
+	{
+		err = genmc_store_sync( st );
+		if ( GENMC_OK == err && st->indexed != st->count )
+			err = store_write_index( st );
+	}
+	store_discard( st );
+	return err;
+}
+
+/*************
+ store_discard--
+ *************/
+
+static void store_discard( genmc_store *st )
+{
+	if ( NULL != st->index )
+		munmap( st->index, st->index_size );
+	if ( st->fd >= 0 )
+		close( st->fd ); /* lets go of the lock too */
+	free( st->index_path );
+	free( st );
+	return;
+}
+
+/**************
+ store_read_rec--
+ **************/
+
+static int store_read_rec( genmc_store *st, long n, unsigned char *rec )
+{
+	return STORE_REC_LEN == pread( st->fd, rec, STORE_REC_LEN,
+			STORE_HDR_LEN + (off_t)n * STORE_REC_LEN );
+}
+
+/************
+ store_rec_ok--
+ ************/
+
+static int store_rec_ok( const unsigned char *rec )
+{
+	return !memcmp( rec, REC_MAGIC, 4 ) &&
+		get32( rec + REC_CRC_OFF ) == crc32( 0, rec, REC_CRC_OFF );
+}
+
+/***************
+ store_map_index--
+ ***************/
+
+static void store_map_index( genmc_store *st )
+{
+	/* A missing or unusable index only makes finding slower */
+	struct stat sb;
+	unsigned char *map;
+	unsigned char rec[STORE_REC_LEN];
+	unsigned long indexed;
+	int fd;
+
+	st->index = NULL;
+	st->indexed = 0;
+	if ( ( fd = open( st->index_path, O_RDONLY ) ) < 0 )
+		return;
+	if ( 0 != fstat( fd, &sb ) || sb.st_size < INDEX_HDR_LEN )
+	{
+		close( fd );
+		return;
+	}
+	map = mmap( NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( MAP_FAILED == map )
+		return;
+
+	/* the header has the CRC of the last record indexed, in case the
+	   store was cut back after a crash and has grown again since */
+	indexed = get32( map + 8 );
+	if ( memcmp( map, INDEX_MAGIC, 8 ) || indexed > (unsigned long)st->count ||
+			(off_t)( INDEX_HDR_LEN + 2 * indexed * INDEX_ENTRY_LEN ) != sb.st_size ||
+			( indexed > 0 && ( !store_read_rec( st, indexed - 1, rec ) ||
+			get32( rec + REC_CRC_OFF ) != get32( map + 12 ) ) ) )
+	{
+		munmap( map, sb.st_size );
+		return;
+	}
+	st->index = map;
+	st->index_size = sb.st_size;
+	st->indexed = indexed;
+	return;
+}
+
+/*****************
+ store_write_index--
+ *****************/
+
+static int store_write_index( genmc_store *st )
+{
+	unsigned char rec[STORE_REC_LEN];
+	unsigned char hdr[INDEX_HDR_LEN];
+	unsigned char out[INDEX_ENTRY_LEN];
+	index_entry *by_id, *by_name;
+	char tmp_path[1100];
+	FILE *fp = NULL;
+	long n, i;
+	int fd, ok = 1;
+
+	by_id = calloc( st->count + 1, sizeof( index_entry ) );
+	by_name = calloc( st->count + 1, sizeof( index_entry ) );
+	if ( NULL == by_id || NULL == by_name )
+	{
+		free( by_id );
+		free( by_name );
+		return GENMC_ERR_NOMEM;
+	}
+	for ( n = 0; n < st->count && ok; ++n )
+	{
+		ok = store_read_rec( st, n, rec );
+		memcpy( by_id[n].key, rec + REC_ID_OFF, GENMC_ID_MAX );
+		memcpy( by_name[n].key, rec + REC_NAME_OFF, GENMC_NAME_MAX );
+		by_id[n].rec = by_name[n].rec = n;
+	}
+	qsort( by_id, st->count, sizeof( index_entry ), compare_entries );
+	qsort( by_name, st->count, sizeof( index_entry ), compare_entries );
+
+	snprintf( tmp_path, sizeof( tmp_path ), "%s.tmp-%ld", st->index_path,
+			(long)getpid() );
+	fd = ok ? open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600 ) : -1;
+	if ( fd >= 0 && NULL == ( fp = fdopen( fd, "wb" ) ) )
+		close( fd );
+	if ( fd >= 0 && NULL != fp )
+	{
+		memcpy( hdr, INDEX_MAGIC, 8 );
+		put32( hdr + 8, st->count );
+		put32( hdr + 12, st->count ? get32( rec + REC_CRC_OFF ) : 0 );
+		ok = 1 == fwrite( hdr, sizeof( hdr ), 1, fp );
+		for ( i = 0; i < 2 * st->count && ok; ++i )
+		{
+			index_entry *e = i < st->count ? &by_id[i] : &by_name[i - st->count];
+			memcpy( out, e->key, INDEX_KEY_LEN );
+			put32( out + INDEX_KEY_LEN, e->rec );
+			ok = 1 == fwrite( out, sizeof( out ), 1, fp );
+		}
+		ok = ok && 0 == fflush( fp ) && 0 == fsync( fileno( fp ) );
+		ok = ( 0 == fclose( fp ) ) && ok;
+		ok = ok && 0 == rename( tmp_path, st->index_path );
+		if ( !ok )
+			unlink( tmp_path );
+	}
+	else
+		ok = 0;
+
+	memset( rec, 0, sizeof( rec ) );
+	free( by_id );
+	free( by_name );
+	if ( !ok )
+		return GENMC_ERR_STORE_WRITE;
+
+	if ( NULL != st->index )
+		munmap( st->index, st->index_size );
+	store_map_index( st );
+	return GENMC_OK;
+}
+
+/************
+ index_search--
+ ************/
+
+static long index_search( const unsigned char *entries, long n, const char *key )
+{
+	/* entries are sorted by key and then newest first, the first match is
+	   the one wanted */
+	long lo = 0, hi = n;
+	long mid;
+
+	while ( lo < hi )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		if ( memcmp( entries + mid * INDEX_ENTRY_LEN, key, INDEX_KEY_LEN ) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ( lo < n && !memcmp( entries + lo * INDEX_ENTRY_LEN, key, INDEX_KEY_LEN ) )
+		return get32( entries + lo * INDEX_ENTRY_LEN + INDEX_KEY_LEN );
+	return -1;
+}
+
+/***************
+ compare_entries--
+ ***************/
+
+static int compare_entries( const void *a, const void *b )
+{
+	const index_entry *x = a, *y = b;
+	int c = memcmp( x->key, y->key, INDEX_KEY_LEN );
+
+	if ( c )
+		return c;
+	return x->rec < y->rec ? 1 : ( x->rec > y->rec ? -1 : 0 );
+}
+
+/*******************
+ big endian helpers--
+ *******************/
+
+static void put16( unsigned char *p, unsigned int v )
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put32( unsigned char *p, unsigned long v )
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static unsigned int get16( const unsigned char *p )
+{
+	return ( p[0] << 8 ) | p[1];
+}
+
+static unsigned long get32( const unsigned char *p )
+{
+	return ( (unsigned long)p[0] << 24 ) | ( (unsigned long)p[1] << 16 ) |
+		( (unsigned long)p[2] << 8 ) | p[3];
+}
@@ -0,0 +1,26 @@
+/*
+libgenmc - the layout of a MiniCert store, see genmc_store.c
+
+Only the constants, so that a tool can read a store without linking
+the library: ../../expiry does. A change here is a new STORE_MAGIC.
+*/
+
+#ifndef GENMC_STORE_FMT_H
+#define GENMC_STORE_FMT_H
+
+#define STORE_MAGIC      "GENMCST1"
+#define STORE_HDR_LEN    64
+#define STORE_REC_LEN    768
+#define REC_MAGIC        "MCR1"
+#define REC_MC_LEN_OFF   4
+#define REC_PK_LEN_OFF   6
+#define REC_NAME_OFF     8
+#define REC_ID_OFF       40
+#define REC_EXPIRY_OFF   56
+#define REC_MC_OFF       72
+#define REC_MC_MAX       512
+#define REC_PK_OFF       584
+#define REC_PK_MAX       96
+#define REC_CRC_OFF      ( STORE_REC_LEN - 4 )
+
+#endif /* GENMC_STORE_FMT_H */
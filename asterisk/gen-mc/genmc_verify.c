@@ -0,0 +1,166 @@
+/*
+libgenmc - reading MiniCerts back
+
+Decodes a base64 MiniCert, splits it into its parts and checks it
+against a CA: the CA modulus embedded at the end must be the CA's, the
+PKCS#1 signature must hold the SHA-1 of the user info and user modulus,
+and the expiry date must be a real date that hasn't passed yet. Only the
+public half of the CA key is used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+#include "genmc.h"
+
+static char *genmc_mc_statuses[GENMC_MC_COUNT] =
+{
+	"valid",
+	"expired",
+	"wrong_ca",
+	"corrupt"
+};
+
+
+/**************
+ genmc_parse_mc--
+ **************/
+
+int genmc_parse_mc( const unsigned char *mc, int mc_len, genmc_mc_info *info )
+{
+	/* Splits a decoded MiniCert into its parts. The strings come out NUL
+	   terminated, the expiry date is checked to be a real date. */
+	struct tm expiry_tm;
+	int err;
+
+	memset( info, 0, sizeof( genmc_mc_info ) );
+	if ( GENMC_MC_LEN != mc_len )
+		return GENMC_ERR_MC_CORRUPT;
+
+	memcpy( info->display_name, mc + GENMC_NAME_OFF, GENMC_NAME_MAX );
+	memcpy( info->user_id, mc + GENMC_ID_OFF, GENMC_ID_MAX );
+	memcpy( info->expiry_date, mc + GENMC_EXPIRY_OFF, GENMC_EXPIRY_LEN );
+	mc += GENMC_USER_INFO_LEN;
+	memcpy( info->user_mod, mc, GENMC_USER_MOD_LEN );
+	mc += GENMC_USER_MOD_LEN;
+	memcpy( info->sig, mc, GENMC_SIG_LEN );
+	mc += GENMC_SIG_LEN;
+	memcpy( info->ca_mod, mc, GENMC_CA_MOD_LEN );
+
+	err = genmc_check_expiry_date( info->expiry_date, &expiry_tm,
+			&info->expiry_t );
+	if ( GENMC_OK != err || 0 == info->display_name[0] || 0 == info->user_id[0] )
+		return GENMC_ERR_MC_CORRUPT;
+	return GENMC_OK;
+}
+
+/***************
+ genmc_verify_mc--
+ ***************/
+
+int genmc_verify_mc( RSA *ca_rsa, const char *mc_b64, int b64_len,
+		time_t now, genmc_mc_info *info )
+{
+	/* Checks one base64 MiniCert against the CA's public key.
+	   Returns one of the GENMC_MC_ results, info is filled in as far as
+	   the MiniCert could be read. */
+	unsigned char mc[GENMC_MC_LEN + 4];
+	unsigned char ca_mod[GENMC_CA_MOD_LEN];
+	unsigned char m[SHA_DIGEST_LENGTH];
+	unsigned char em[GENMC_SIG_LEN];
+	int mc_len, em_len;
+
+	memset( info, 0, sizeof( genmc_mc_info ) );
+	if ( GENMC_OK != genmc_b64_decode( mc_b64, b64_len, mc, sizeof( mc ),
+			&mc_len ) )
+		return GENMC_MC_CORRUPT;
+	if ( GENMC_OK != genmc_parse_mc( mc, mc_len, info ) )
+		return GENMC_MC_CORRUPT;
+
+	/* is it ours at all */
+	if ( GENMC_CA_MOD_LEN != BN_num_bytes( ca_rsa->n ) )
+		return GENMC_MC_WRONG_CA;
+	BN_bn2bin( ca_rsa->n, ca_mod );
+	if ( memcmp( ca_mod, info->ca_mod, GENMC_CA_MOD_LEN ) )
+		return GENMC_MC_WRONG_CA;
+
+	/* the signature covers the user info and the user modulus */
+	SHA1( mc, GENMC_USER_INFO_LEN + GENMC_USER_MOD_LEN, m );
+	em_len = RSA_public_decrypt( GENMC_SIG_LEN, info->sig, em, ca_rsa,
+			RSA_PKCS1_PADDING );
+	if ( SHA_DIGEST_LENGTH != em_len || memcmp( em, m, SHA_DIGEST_LENGTH ) )
+		return GENMC_MC_CORRUPT;
+
+	if ( info->expiry_t < now )
+		return GENMC_MC_EXPIRED;
+	return GENMC_MC_VALID;
+}
+
+/***************
+ genmc_mc_status--
+ ***************/
+
+const char *genmc_mc_status( int status )
+{
+	if ( status < 0 || status >= GENMC_MC_COUNT )
+		return "unknown";
+	return genmc_mc_statuses[status];
+}
+
+/*******************
+ genmc_load_ca_pubkey--
+ *******************/
+
+int genmc_load_ca_pubkey( const char *ca_keys_filename, RSA **ca_rsa )
+{
+	/* Checking needs only the public half, so besides the CA's key pair
+	   a PEM public key or the CA certificate will do as well. */
+	FILE *fp;
+	X509 *x509;
+	EVP_PKEY *pkey;
+
+	*ca_rsa = NULL;
+	if ( NULL == ( fp = fopen( ca_keys_filename, "rb" ) ) )
+		return GENMC_ERR_CA_FILE;
+
+	if ( NULL == ( *ca_rsa = PEM_read_RSAPrivateKey( fp, NULL, NULL, NULL ) ) )
+	{
+		rewind( fp );
+		*ca_rsa = PEM_read_RSA_PUBKEY( fp, NULL, NULL, NULL );
+	}
+	if ( NULL == *ca_rsa )
+	{
+		rewind( fp );
+		*ca_rsa = PEM_read_RSAPublicKey( fp, NULL, NULL, NULL );
+	}
+	if ( NULL == *ca_rsa )
+	{
+		rewind( fp );
+		if ( NULL != ( x509 = PEM_read_X509( fp, NULL, NULL, NULL ) ) )
+		{
+			if ( NULL != ( pkey = X509_get_pubkey( x509 ) ) )
+			{
+				*ca_rsa = EVP_PKEY_get1_RSA( pkey );
+				EVP_PKEY_free( pkey );
+			}
+			X509_free( x509 );
+		}
+	}
+	fclose( fp );
+	ERR_clear_error();
+
+	if ( NULL == *ca_rsa )
+		return GENMC_ERR_CA_PEM;
+	if ( GENMC_CA_BITS != RSA_size( *ca_rsa ) * 8 )
+	{
+		RSA_free( *ca_rsa );
+		*ca_rsa = NULL;
+		return GENMC_ERR_CA_SIZE;
+	}
+	return GENMC_OK;
+}
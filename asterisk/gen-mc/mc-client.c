@@ -0,0 +1,432 @@
+/*
+mc-client - sends requests to a gen-mc -D daemon
+
+Sends one issue, verify or resign request over the daemon's Unix socket
+and writes the reply out the way gen-mc itself would have. With -n the
+request is sent that many times over -c connections at once, each on
+its own thread, and the latency is reported instead of the results.
+
+16oct2026, v0.1
+ - first version
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "genmc.h"
+
+/* one connection's share of a -n run */
+typedef struct load_job
+{
+	char *socket_path;
+	const char **fields;
+	int n_fields;
+	int count;
+	double *us;            /* latency of every request */
+	int failed;
+} load_job;
+
+int  connect_daemon( char *socket_path );
+int  request( int fd, const char **fields, int n_fields, char *reply,
+		char **reply_fields, int *n_reply );
+void *load_worker( void *arg );
+int  load_test( char *socket_path, const char **fields, int n_fields,
+		int count, int n_conns );
+int  compare_doubles( const void *a, const void *b );
+int  read_minicert( char *path, char *mc_b64, size_t size );
+int  write_text( char *path, char *text );
+double now_us( void );
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char help[] =
+		"mc-client - sends requests to a gen-mc -D daemon\n"
+		"Usage: mc-client -D <socket> [options] issue <display_name> <user_id> [<expiry>]\n"
+		"       mc-client -D <socket> [options] verify <minicert_file>\n"
+		"       mc-client -D <socket> [options] resign <minicert_file> [<expiry>]\n"
+		"  expiry is HHMMSSMMDDYY or +days, the daemon's -e or -E by default\n"
+		"  -o <file>   - write the MiniCert here, issue and resign\n"
+		"  -p <file>   - write the user's private key here, issue\n"
+		"                without -o and -p they go to stdout\n"
+		"  -n <count>  - send the request count times and report the latency\n"
+		"  -c <conns>  - connections at once for -n, default 1\n"
+		"  -h          - this help\n";
+	char socket_path[256], mc_path[256], pk_path[256];
+	char mc_b64[GENMC_MC_B64_SIZE], reply[GENMC_FRAME_MAX + 1];
+	char *reply_fields[GENMC_FRAME_FIELDS];
+	const char *fields[4];
+	int count = 0, n_conns = 1, n_fields, n_reply, fd, c, err;
+
+	strcpy( socket_path, "" );
+	strcpy( mc_path, "" );
+	strcpy( pk_path, "" );
+	while ( -1 != ( c = getopt( argc, argv, "hD:o:p:n:c:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'D':
+				strncpy( socket_path, optarg, sizeof( socket_path ) - 1 );
+				break;
+			case 'o':
+				strncpy( mc_path, optarg, sizeof( mc_path ) - 1 );
+				break;
+			case 'p':
+				strncpy( pk_path, optarg, sizeof( pk_path ) - 1 );
+				break;
+			case 'n':
+				count = atoi( optarg );
+				break;
+			case 'c':
+				n_conns = atoi( optarg );
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE );
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if ( 0 == strlen( socket_path ) || argc < 1 || n_conns < 1 || count < 0 )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+
+	/* the request, a MiniCert to send is read from its file */
+	fields[0] = argv[0];
+	if ( !strcmp( argv[0], "issue" ) && ( 3 == argc || 4 == argc ) )
+	{
+		fields[1] = argv[1];
+		fields[2] = argv[2];
+		fields[3] = 4 == argc ? argv[3] : "";
+		n_fields = 4;
+	}
+	else if ( ( !strcmp( argv[0], "verify" ) && 2 == argc ) ||
+			( !strcmp( argv[0], "resign" ) && ( 2 == argc || 3 == argc ) ) )
+	{
+		if ( GENMC_OK != ( err = read_minicert( argv[1], mc_b64, sizeof( mc_b64 ) ) ) )
+		{
+			fprintf( stderr, "Error: %s (%s)\n", genmc_strerror( err ), argv[1] );
+			exit( EXIT_FAILURE );
+		}
+		fields[1] = mc_b64;
+		fields[2] = 3 == argc ? argv[2] : "";
+		n_fields = 3 == argc ? 3 : 2;
+	}
+	else
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+
+	if ( count > 0 )
+	{
+		c = load_test( socket_path, fields, n_fields, count, n_conns );
+		return( c ? EXIT_FAILURE : EXIT_SUCCESS );
+	}
+
+	if ( ( fd = connect_daemon( socket_path ) ) < 0 )
+		exit( EXIT_FAILURE );
+	c = request( fd, fields, n_fields, reply, reply_fields, &n_reply );
+	close( fd );
+	if ( !c )
+		exit( EXIT_FAILURE );
+	if ( strcmp( reply_fields[0], "ok" ) )
+	{
+		fprintf( stderr, "Error: %s\n", n_reply > 1 ? reply_fields[1] :
+				"the daemon gave no reason." );
+		exit( EXIT_FAILURE );
+	}
+
+	/* the same outputs as gen-mc */
+	c = 1;
+	if ( !strcmp( argv[0], "issue" ) && 6 == n_reply )
+	{
+		if ( 0 == strlen( mc_path ) && 0 == strlen( pk_path ) )
+		{
+			fprintf( stdout, "\n<Mini Certificate>\n%s\n", reply_fields[4] );
+			fprintf( stdout, "\n<SRTP Private Key>\n%s\n\n", reply_fields[5] );
+		}
+		else
+			c = write_text( strlen( mc_path ) ? mc_path : "mini_cert.b64",
+					reply_fields[4] ) &&
+				write_text( strlen( pk_path ) ? pk_path : "user_pk.b64",
+					reply_fields[5] );
+	}
+	else if ( !strcmp( argv[0], "verify" ) && 5 == n_reply )
+	{
+		fprintf( stdout, "%s\t%s\t%s\t%s\t%s\n", reply_fields[1], argv[1],
+				reply_fields[2], reply_fields[3], reply_fields[4] );
+		c = !strcmp( reply_fields[1], "valid" );
+	}
+	else if ( !strcmp( argv[0], "resign" ) && 3 == n_reply )
+	{
+		if ( strlen( mc_path ) )
+			c = write_text( mc_path, reply_fields[1] );
+		else
+			fprintf( stdout, "%s\n", reply_fields[1] );
+	}
+	else
+	{
+		fprintf( stderr, "Error: unexpected reply from the daemon.\n" );
+		c = 0;
+	}
+	memset( reply, 0, sizeof( reply ) );
+	return( c ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/**************
+ connect_daemon--
+ **************/
+
+int connect_daemon( char *socket_path )
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset( &sun, 0, sizeof( sun ) );
+	sun.sun_family = AF_UNIX;
+	strncpy( sun.sun_path, socket_path, sizeof( sun.sun_path ) - 1 );
+	if ( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 ||
+			0 != connect( fd, (struct sockaddr *)&sun, sizeof( sun ) ) )
+	{
+		fprintf( stderr, "Error: can't connect to %s: %s.\n", socket_path,
+				strerror( errno ) );
+		if ( fd >= 0 )
+			close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+/*******
+ request--
+ *******/
+
+int request( int fd, const char **fields, int n_fields, char *reply,
+		char **reply_fields, int *n_reply )
+{
+	/* Sends one request and reads the reply into reply, which must have
+	   room for GENMC_FRAME_MAX + 1. Returns 0 after saying what went
+	   wrong. */
+	int len, n, w, used, err;
+
+	if ( GENMC_OK != ( err = genmc_frame_put( reply, GENMC_FRAME_MAX + 1,
+			fields, n_fields, &len ) ) )
+	{
+		fprintf( stderr, "Error: %s\n", genmc_strerror( err ) );
+		return 0;
+	}
+	for ( n = 0; n < len; n += w )
+	{
+		if ( ( w = write( fd, reply + n, len - n ) ) < 0 && EINTR == errno )
+			w = 0;
+		else if ( w <= 0 )
+		{
+			fprintf( stderr, "Error: sending the request failed.\n" );
+			return 0;
+		}
+	}
+
+	for ( len = 0; ; len += n )
+	{
+		err = genmc_frame_get( reply, len, reply_fields, n_reply, &used );
+		if ( GENMC_OK != err )
+		{
+			fprintf( stderr, "Error: reply: %s\n", genmc_strerror( err ) );
+			return 0;
+		}
+		if ( used > 0 )
+			return 1;
+		if ( ( n = read( fd, reply + len, GENMC_FRAME_MAX - len ) ) < 0 &&
+				EINTR == errno )
+			n = 0;
+		else if ( n <= 0 )
+		{
+			fprintf( stderr, "Error: the daemon closed the connection.\n" );
+			return 0;
+		}
+	}
+}
+
+/*********
+ load_test--
+ *********/
+
+int load_test( char *socket_path, const char **fields, int n_fields,
+		int count, int n_conns )
+{
+	/* Sends the request count times over n_conns connections and reports
+	   the requests per second and the latency. Returns the number of
+	   requests that failed. */
+	load_job *jobs;
+	pthread_t *threads;
+	double *us, t0, wall;
+	int i, n, started, failed = 0;
+
+	if ( n_conns > count )
+		n_conns = count;
+	jobs = calloc( n_conns, sizeof( load_job ) );
+	threads = calloc( n_conns, sizeof( pthread_t ) );
+	us = calloc( count, sizeof( double ) );
+	if ( NULL == jobs || NULL == threads || NULL == us )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return count;
+	}
+
+	t0 = now_us();
+	for ( i = 0, n = 0; i < n_conns; ++i )
+	{
+		jobs[i].socket_path = socket_path;
+		jobs[i].fields = fields;
+		jobs[i].n_fields = n_fields;
+		jobs[i].count = count / n_conns + ( i < count % n_conns );
+		jobs[i].us = us + n;
+		n += jobs[i].count;
+	}
+	for ( started = 0; started < n_conns; ++started )
+		if ( pthread_create( &threads[started], NULL, load_worker, &jobs[started] ) )
+			break;
+	for ( i = 0; i < started; ++i )
+		pthread_join( threads[i], NULL );
+	wall = ( now_us() - t0 ) / 1e6;
+	for ( i = 0; i < n_conns; ++i )
+		failed += i < started ? jobs[i].failed : jobs[i].count;
+
+	/* the failed ones are left at 0 and sort to the front */
+	qsort( us, count, sizeof( double ), compare_doubles );
+	n = count - failed;
+	fprintf( stdout, "requests  conns        ok    failed    req/s   p50_us   p99_us   max_us\n" );
+	fprintf( stdout, "%8d %6d %9d %9d %8.1f %8.1f %8.1f %8.1f\n", count,
+			started, n, failed, wall > 0 ? n / wall : 0,
+			n > 0 ? us[failed + n / 2] : 0,
+			n > 0 ? us[failed + (int)( n * 0.99 )] : 0,
+			n > 0 ? us[count - 1] : 0 );
+
+	free( us );
+	free( threads );
+	free( jobs );
+	return failed;
+}
+
+/***********
+ load_worker--
+ ***********/
+
+void *load_worker( void *arg )
+{
+	load_job *job = arg;
+	char reply[GENMC_FRAME_MAX + 1];
+	char *reply_fields[GENMC_FRAME_FIELDS];
+	double t0;
+	int fd, i, n_reply;
+
+	if ( ( fd = connect_daemon( job->socket_path ) ) < 0 )
+	{
+		job->failed = job->count;
+		return NULL;
+	}
+	for ( i = 0; i < job->count; ++i )
+	{
+		t0 = now_us();
+		if ( !request( fd, job->fields, job->n_fields, reply, reply_fields,
+				&n_reply ) )
+		{
+			job->failed += job->count - i;
+			break;
+		}
+		if ( strcmp( reply_fields[0], "ok" ) )
+		{
+			if ( 0 == job->failed )
+				fprintf( stderr, "Error: %s\n", n_reply > 1 ? reply_fields[1] :
+						"the daemon gave no reason." );
+			job->failed++;
+			continue;
+		}
+		job->us[i] = now_us() - t0;
+	}
+	memset( reply, 0, sizeof( reply ) );
+	close( fd );
+	return NULL;
+}
+
+/*************
+ read_minicert--
+ *************/
+
+int read_minicert( char *path, char *mc_b64, size_t size )
+{
+	/* the one line of base64 in a .mini_cert file */
+	FILE *fp;
+	int len;
+
+	if ( NULL == ( fp = fopen( path, "r" ) ) )
+		return GENMC_ERR_MC_READ;
+	if ( NULL == fgets( mc_b64, size, fp ) )
+		mc_b64[0] = '\0';
+	fclose( fp );
+	len = strlen( mc_b64 );
+	while ( len > 0 && ( '\n' == mc_b64[len-1] || '\r' == mc_b64[len-1] ||
+			' ' == mc_b64[len-1] || '\t' == mc_b64[len-1] ) )
+		mc_b64[--len] = '\0';
+	return len > 0 ? GENMC_OK : GENMC_ERR_MC_CORRUPT;
+}
+
+/**********
+ write_text--
+ **********/
+
+int write_text( char *path, char *text )
+{
+	FILE *fp;
+	int ok;
+
+	if ( NULL == ( fp = fopen( path, "wb" ) ) )
+	{
+		fprintf( stderr, "Error: creating %s failed.\n", path );
+		return 0;
+	}
+	ok = fputs( text, fp ) >= 0;
+	ok = ( 0 == fclose( fp ) ) && ok;
+	if ( !ok )
+	{
+		remove( path );
+		fprintf( stderr, "Error: writing %s failed.\n", path );
+	}
+	return ok;
+}
+
+/***************
+ compare_doubles--
+ ***************/
+
+int compare_doubles( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/******
+ now_us--
+ ******/
+
+double now_us( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
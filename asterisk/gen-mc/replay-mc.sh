@@ -0,0 +1,114 @@
+#!/bin/bash
+
+# Checks a gen-mc build against the output and the time of another, both
+# made with gen-mc-replay.make so every key comes from the --replay seed.
+#
+#   ./replay-mc.sh record <baseline_dir> [gen-mc-replay] [users]
+#   ./replay-mc.sh check <baseline_dir> [gen-mc-replay]
+#
+# record makes a throwaway CA and a roster of <users> (1000 by default),
+# issues it with the old build and keeps the MiniCerts, keys, profiles,
+# framed records and the best of RUNS times in <baseline_dir>. check
+# issues the same roster with the new build under every -P layout in
+# LAYOUTS, fails if a single byte differs, and shows the time against
+# the baseline.
+
+MODE=$1
+BASE=$2
+GEN_MC=${3:-./gen-mc-replay}
+USERS=${4:-1000}
+SEED=replay-mc
+EXPIRY=000000010138
+RUNS=3
+LAYOUTS="1,1,1 4,2,2 2,1,3"
+
+if [ "${MODE}" != "record" ] && [ "${MODE}" != "check" ] || [ -z "${BASE}" ]
+    then
+        echo "Usage: $0 record|check <baseline_dir> [gen-mc-replay] [users]" >&2
+        exit 1
+fi
+
+# issue the roster once into $1, the wall time in seconds on stdout
+run()
+{
+    mkdir -p $1/out $1/profiles
+    START=`date +%s.%N`
+    ${GEN_MC} -k ${BASE}/ca.pem -b ${BASE}/roster.csv -e ${EXPIRY} -O $1/out \
+        -X $1/profiles -f 3 -P $2 -q --replay=${SEED} 3> $1/frames 2> $1/log || return 1
+    END=`date +%s.%N`
+    echo "${START} ${END}" | awk '{ printf "%.3f\n", $2 - $1 }'
+}
+
+# the best of RUNS, so a busy moment doesn't count as a regression
+best()
+{
+    BEST=
+    for i in `seq ${RUNS}`
+    do
+        rm -rf $1
+        T=`run $1 $2` || { cat $1/log >&2; return 1; }
+        BEST=`echo "${T} ${BEST}" | awk '{ print ( $2 == "" || $1 < $2 ) ? $1 : $2 }'`
+    done
+    echo ${BEST}
+}
+
+if [ "${MODE}" = "record" ]
+    then
+        mkdir -p ${BASE} || exit 1
+        openssl genrsa -out ${BASE}/ca.pem 1024 2> /dev/null || exit 1
+
+        # quoted names, commas, XML specials and expiries of their own,
+        # with fixed dates: "+days" would change from day to day
+        awk -v n=${USERS} 'BEGIN {
+            for ( i = 0; i < n; ++i )
+            {
+                if ( 0 == i % 7 )
+                    name = sprintf( "\"User %d, R&D <lab>\"", i );
+                else
+                    name = sprintf( "user%d", i );
+                expiry = 0 == i % 5 ? sprintf( "1200%02d%02d%02d30", i % 60, 1 + i % 12, 1 + i % 28 ) : "";
+                printf "%s,%d,%s,00:15:%02x:%02x:%02x:%02x\n", name, 10000 + i, expiry,
+                    int( i / 16777216 ) % 256, int( i / 65536 ) % 256, int( i / 256 ) % 256, i % 256;
+            }
+        }' > ${BASE}/roster.csv
+
+        T=`best ${BASE}/golden 1,1,1` || exit 1
+        echo ${T} > ${BASE}/time
+        echo "Recorded ${USERS} users in ${BASE}, ${T}s."
+        exit 0
+fi
+
+if [ ! -f ${BASE}/time ]
+    then
+        echo "Error: no baseline in ${BASE}, run \"$0 record ${BASE}\" first." >&2
+        exit 1
+fi
+
+WORK=`mktemp -d /tmp/replay-mc.XXXXXX` || exit 1
+FAILED=0
+for P in ${LAYOUTS}
+do
+    rm -rf ${WORK}/run
+    run ${WORK}/run ${P} > /dev/null || { cat ${WORK}/run/log >&2; exit 1; }
+    for F in out profiles frames
+    do
+        if ! diff -r -q ${BASE}/golden/${F} ${WORK}/run/${F} > ${WORK}/diff
+            then
+                echo "Mismatch with -P ${P}: `wc -l < ${WORK}/diff` in ${F}, e.g. `head -1 ${WORK}/diff`"
+                FAILED=1
+        fi
+    done
+done
+
+T=`best ${WORK}/run 1,1,1` || exit 1
+rm -rf ${WORK}
+echo "${T} `cat ${BASE}/time`" | awk '{
+    printf "Time: %.3fs, baseline %.3fs, %+.1f%%\n", $1, $2, 100 * ( $1 - $2 ) / $2 }'
+
+if [ ${FAILED} = 1 ]
+    then
+        echo "Output differs from the baseline."
+        exit 1
+fi
+echo "Output matches the baseline."
+exit 0
@@ -0,0 +1,166 @@
+/*
+test-keygen - puts the keys of a genmc_keygen through RSA_check_key()
+
+genmc_keygen_make() puts the key together itself and only checks that
+e*d is 1 mod p-1 and q-1. This makes -n keys with it, on -j threads each
+with its own generator as batch mode has them, and checks every one
+with RSA_check_key(), the size of n and e = 65537. It prints the first
+key that fails in PEM and exits 1, or 0 when they all pass.
+
+Run it after a change to genmc_keygen.c, and on a new OpenSSL.
+
+16oct2026, v0.1
+ - first version
+
+17oct2026, v0.2
+ - the OpenSSL error text goes to a buffer of the thread's own
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+#include "genmc.h"
+
+/* one thread's share */
+typedef struct keygen_test
+{
+	int n_keys;
+	int failed;
+	pthread_t thread;
+} keygen_test;
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *test_worker( void *arg );
+int  check_key( RSA *rsa );
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char help[] =
+		"test-keygen - checks the keys of a genmc_keygen with RSA_check_key()\n"
+		"Usage: test-keygen [-n keys] [-j threads]\n"
+		"  -n <count>  - keys to make and check, default 1000\n"
+		"  -j <count>  - threads, each with its own generator, default 1\n"
+		"  -h          - this help\n";
+	keygen_test *tests;
+	int n_keys = 1000, n_threads = 1, failed = 0, i, c;
+
+	while ( -1 != ( c = getopt( argc, argv, "hn:j:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'n':
+				n_keys = atoi( optarg );
+				break;
+			case 'j':
+				n_threads = atoi( optarg );
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE );
+		}
+	}
+	if ( n_keys < 1 || n_threads < 1 || n_threads > n_keys )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	ERR_load_crypto_strings();
+	genmc_thread_setup();
+
+	if ( NULL == ( tests = calloc( n_threads, sizeof( keygen_test ) ) ) )
+	{
+		fprintf( stderr, "Error: %s\n", genmc_strerror( GENMC_ERR_NOMEM ) );
+		exit( EXIT_FAILURE );
+	}
+	for ( i = 0; i < n_threads; ++i )
+	{
+		tests[i].n_keys = n_keys / n_threads + ( i < n_keys % n_threads );
+		if ( 0 != pthread_create( &tests[i].thread, NULL, test_worker, &tests[i] ) )
+		{
+			fprintf( stderr, "Error: can't start thread %d\n", i );
+			exit( EXIT_FAILURE );
+		}
+	}
+	for ( i = 0; i < n_threads; ++i )
+	{
+		pthread_join( tests[i].thread, NULL );
+		failed += tests[i].failed;
+	}
+	free( tests );
+	genmc_thread_cleanup();
+
+	fprintf( stdout, "test-keygen: %d keys, %d failed\n", n_keys, failed );
+	return( failed ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+/***********
+ test_worker--
+ ***********/
+
+void *test_worker( void *arg )
+{
+	keygen_test *t = arg;
+	genmc_keygen *keygen;
+	RSA *rsa;
+	int err, i;
+
+	if ( GENMC_OK != ( err = genmc_keygen_new( &keygen ) ) )
+	{
+		fprintf( stderr, "Error: genmc_keygen_new(): %s\n", genmc_strerror( err ) );
+		t->failed = t->n_keys;
+		return NULL;
+	}
+	for ( i = 0; i < t->n_keys; ++i )
+	{
+		if ( GENMC_OK != ( err = genmc_keygen_make( keygen, &rsa ) ) )
+		{
+			fprintf( stderr, "Error: genmc_keygen_make(): %s\n", genmc_strerror( err ) );
+			++t->failed;
+			continue;
+		}
+		if ( !check_key( rsa ) )
+		{
+			/* the first one is enough to go on */
+			pthread_mutex_lock( &report_lock );
+			if ( 0 == t->failed )
+				PEM_write_RSAPrivateKey( stderr, rsa, NULL, NULL, 0, NULL, NULL );
+			pthread_mutex_unlock( &report_lock );
+			++t->failed;
+		}
+		RSA_free( rsa );
+	}
+	genmc_keygen_free( keygen );
+	return NULL;
+}
+
+/*********
+ check_key--
+ *********/
+
+int check_key( RSA *rsa )
+{
+	char err[256];
+
+	if ( GENMC_USER_BITS != BN_num_bits( rsa->n ) || !BN_is_word( rsa->e, RSA_F4 ) )
+	{
+		fprintf( stderr, "Error: the key is %d bits, e %lu\n", BN_num_bits( rsa->n ),
+				BN_get_word( rsa->e ) );
+		return 0;
+	}
+	if ( 1 != RSA_check_key( rsa ) )
+	{
+		ERR_error_string_n( ERR_get_error(), err, sizeof( err ) );
+		fprintf( stderr, "Error: RSA_check_key(): %s\n", err );
+		return 0;
+	}
+	return 1;
+}
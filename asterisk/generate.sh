@@ -15,6 +15,29 @@ export O="Paranoid Inc."
 export OU="Security"
 export CN=${HOSTNAME}
 #--------------------------------------------------------
+# ../ca-db hands out the serials and keeps the index, see ../ca-db
+if [ -x ../ca-db/ca-db ]
+    then CA_DB=../ca-db/ca-db
+fi
+
+# the next serial for openssl x509 -set_serial
+next_serial() {
+    if [ -n "${CA_DB}" ]
+        then
+            SERIAL=0x`${CA_DB} serial` || exit 1
+        else
+            SERIAL=0x`cat private/serial`
+            printf "%02X\n" $((${SERIAL} + 1)) > private/serial || exit 1
+    fi
+}
+
+# the certificate in private/index, as openssl ca would have it
+record_cert() {
+    if [ -n "${CA_DB}" ]
+        then ${CA_DB} add $1 || exit 1
+    fi
+}
+#--------------------------------------------------------
 _dirs="private private/crl private/certdb private/linksys private/keys private/req private/certs private/arc"
 
 for dir in $_dirs
@@ -49,7 +72,9 @@ if test -f private/CA_key.pem && \
 		export CN=$1
                 openssl genrsa -out private/keys/$1.key ${KEY_SIZE} || exit 1
                 openssl req -config openssl.conf -new -nodes -keyout private/keys/$1.key -out private/req/$1.csr -newkey rsa:${KEY_SIZE} || exit 1
-                openssl x509 -req -days ${DAYS} -in private/req/$1.csr -CA private/CA_cert.pem -CAkey private/CA_key.pem -set_serial 01 -out private/certs/$1.cert || exit 1
+                next_serial
+                openssl x509 -req -days ${DAYS} -in private/req/$1.csr -CA private/CA_cert.pem -CAkey private/CA_key.pem -set_serial ${SERIAL} -out private/certs/$1.cert || exit 1
+                record_cert private/certs/$1.cert
                 echo "\n\tCombining key and crt into $1.pem"
                 cat private/keys/$1.key > private/keys/$1.pem || exit 1
                 cat private/certs/$1.cert >> private/keys/$1.pem || exit 1
@@ -67,7 +92,9 @@ if test -f private/CA_key.pem && \
 
         openssl genrsa -out private/keys/${HOSTNAME}.key ${KEY_SIZE} || exit 1
         openssl req -config openssl.conf -new -nodes -keyout private/keys/${HOSTNAME}.key -out private/req/${HOSTNAME}.csr -newkey rsa:${KEY_SIZE} || exit 1
-        openssl x509 -req -days ${DAYS} -in private/req/${HOSTNAME}.csr -CA private/CA_cert.pem -CAkey private/CA_key.pem -set_serial 01 -out private/certs/${HOSTNAME}.cert || exit 1
+        next_serial
+        openssl x509 -req -days ${DAYS} -in private/req/${HOSTNAME}.csr -CA private/CA_cert.pem -CAkey private/CA_key.pem -set_serial ${SERIAL} -out private/certs/${HOSTNAME}.cert || exit 1
+        record_cert private/certs/${HOSTNAME}.cert
         echo "\n\tCombining key and crt into ${HOASTNAME}.pem"
         cat private/keys/${HOSTNAME}.key > private/keys/${HOSTNAME}.pem || exit 1
         cat private/certs/${HOSTNAME}.cert >> private/keys/${HOSTNAME}.pem || exit 1
@@ -6,5 +6,29 @@ USER_ID=$2
 EXPIRY=3650
 WRITE_CERT=private/linksys/${DISPLAY_NAME}.mini_cert
 WRITE_PK=private/linksys/${DISPLAY_NAME}.mini_pkey
+KEY_SPOOL=private/keyspool
 
-${GEN_MC} -k private/CA_key.pem -d ${DISPLAY_NAME} -u ${USER_ID} -E ${EXPIRY} -o "${WRITE_CERT}" -p "${WRITE_PK}" -v
+# use the keys made ahead by "gen-mc -F private/keyspool" if there are any
+if test -d ${KEY_SPOOL}
+    then SPOOL="-s ${KEY_SPOOL}"
+fi
+
+# "./linksys.sh -b roster.csv" issues every user of the roster in one run
+if [ "$1" = "-b" ]
+    then
+        ${GEN_MC} -k private/CA_key.pem -b "$2" -E ${EXPIRY} -O private/linksys ${SPOOL} -q -v
+        exit $?
+fi
+
+# "./linksys.sh -X phones.csv /srv/tftp [site.xml]" writes spa<mac>.xml for
+# every phone of the roster straight into the TFTP root
+if [ "$1" = "-X" ]
+    then
+        if test -n "$4"
+            then TEMPLATE="-T $4"
+        fi
+        ${GEN_MC} -k private/CA_key.pem -b "$2" -E ${EXPIRY} -X "$3" ${TEMPLATE} -O private/linksys ${SPOOL} -q
+        exit $?
+fi
+
+${GEN_MC} -k private/CA_key.pem -d ${DISPLAY_NAME} -u ${USER_ID} -E ${EXPIRY} -o "${WRITE_CERT}" -p "${WRITE_PK}" ${SPOOL} -v
@@ -0,0 +1,894 @@
+/*
+ca-db - the serial numbers and index of a CA, for several issuers
+
+openvpn, www and asterisk keep their CA in plain files, private/serial
+and private/index, that openssl ca rewrites with nothing to stop two
+of them doing it at once. generate.sh's reverse() puts .old back by
+hand when something fails, and asterisk gives every certificate serial
+01. ca-db makes the files safe to share:
+
+	ca-db serial [-n count]
+	    takes count serial numbers, prints the first in hex
+	ca-db add cert ...
+	    puts certificates made without openssl ca, openssl x509 -req
+	    in asterisk, in the index, and a copy in new_certs_dir
+	ca-db drop serial ...
+	    takes a certificate out of the index again, what reverse()
+	    needs instead of putting back index.old
+	ca-db run command ...
+	    runs openssl ca, or anything, with the files locked
+	ca-db check [-f]
+	    looks for what a crash or an issuer without the lock leaves,
+	    -f puts right what can be
+
+Every one of them, ovpn-bundle, ovpn-crl and www-issue too, holds
+flock() on <database>.lock while it reads and writes the files, and a
+file is replaced by writing <file>.new, linking the old one to
+<file>.old and renaming the new one over it, so it is never missing or
+half written. A serial is taken before its certificate is signed, a
+crash in between leaves a number unused and never one used twice.
+ovpn-bundle and www-issue sign with the lock let go, the serials they
+take are in the index meanwhile as lines with the file pending.<pid>,
+and check finds the ones whose run is gone.
+
+Hosts that issue offline get a lease, a range of serials of their own:
+
+	ca-db lease -n count [-H host]
+	    takes count serials here, writes them to <dir>/leases and
+	    prints "first last"
+	ca-db accept first last
+	    on the offline host, its serial file starts at first and
+	    serial.limit stops everything that takes serials after last
+	ca-db merge index ...
+	    back here, adds the offline hosts' records to the index. Every
+	    new serial has to be in a lease, the index comes out in serial
+	    order whatever order the files are given in, and a record that
+	    is in more than one of them only once; a V and an R of the same
+	    certificate give the R. Anything else with the same serial
+	    stops it before anything is written.
+
+The files are the ones [ CA_default ] of openssl.conf names, -c for
+another one.
+
+16oct2026, v0.1
+ - first version
+
+16oct2026, v0.2
+ - merge refuses every offline serial when there is no leases file,
+   not only the ones outside the leases
+ - read_file() and rotate() are ../openvpn/ovpn_ca.c's
+
+16oct2026, v0.3
+ - check finds the reservations ovpn-bundle and www-issue left in a
+   crash, -f takes them out; merge refuses them
+
+17oct2026, v0.4
+ - the lock, the serials and the files of the CA are ovpn_ca.c's
+   ca_lock(), take_serial() and ca_conf, not copies of them
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <openssl/conf.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include "ovpn_ca.h"
+
+#define INDEX_FIELDS   6
+
+/* a line of the index:
+   status<TAB>expiry<TAB>revoked<TAB>serial<TAB>file<TAB>subject */
+typedef struct record
+{
+	char *line;           /* without the newline */
+	char *field[INDEX_FIELDS];
+	BIGNUM *serial;
+	int from;             /* 0 for the index, or the merged file */
+} record;
+
+/* prototypes */
+int  db_load( ca_conf *db, char *conf_file );
+int  add( ca_conf *db, char **certs, int n_certs );
+int  drop( ca_conf *db, char **serials, int n_serials );
+int  run( ca_conf *db, char **command );
+int  lease( ca_conf *db, long n, char *host );
+int  accept_lease( ca_conf *db, char *first, char *last );
+int  merge( ca_conf *db, char **files, int n_files );
+int  check( ca_conf *db, int fix );
+int  read_index( char *path, int from, record **recs, int *n_recs );
+int  parse_record( char *line, record *r );
+void free_records( record *recs, int n_recs );
+int  compare_records( const void *a, const void *b );
+int  write_index( ca_conf *db, record *recs, int n_recs );
+
+static char *help =
+	"\n"
+	"Usage: ca-db [-c conf] serial [-n count]\n"
+	"       ca-db [-c conf] add <cert> [<cert> ...]\n"
+	"       ca-db [-c conf] drop <serial> [<serial> ...]\n"
+	"       ca-db [-c conf] run <command> [<arg> ...]\n"
+	"       ca-db [-c conf] check [-f]\n"
+	"       ca-db [-c conf] lease -n count [-H host]\n"
+	"       ca-db [-c conf] accept <first> <last>\n"
+	"       ca-db [-c conf] merge <index> [<index> ...]\n"
+	"  Shares the serial and index files of a CA between issuers.\n"
+	"Commands:\n"
+	"  serial         - Takes serials, prints the first in hex\n"
+	"  add            - Puts certificates in the index\n"
+	"  drop           - Takes certificates out of the index, by serial\n"
+	"  run            - Runs a command with the CA locked\n"
+	"  check          - Looks for what a crash leaves, -f to put it right\n"
+	"  lease          - Gives a range of serials to an offline host\n"
+	"  accept         - Makes the range the serials of this host\n"
+	"  merge          - Adds the index of an offline host to this one\n"
+	"Options:\n"
+	"  -c <conf>      - The openssl.conf, it defaults to openssl.conf\n"
+	"  -n <count>     - How many serials, it defaults to 1\n"
+	"  -H <host>      - Who a lease is for, it defaults to offline\n"
+	"  -f             - Check puts right what it can\n"
+	"  -h             - Displays this help\n"
+	"\n";
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	ca_conf db;
+	BIGNUM *first;
+	char *conf_file = "openssl.conf", *host = "offline", *cmd, *hex;
+	long n = 1;
+	int fix = 0, ok, c;
+
+	/* "+" stops at the command, run's has options of its own */
+	while ( -1 != ( c = getopt( argc, argv, "+hc:" ) ) )
+	{
+		if ( 'c' != c )
+		{
+			fprintf( stderr, help );
+			exit( EXIT_FAILURE );
+		}
+		conf_file = optarg;
+	}
+	if ( optind == argc )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	cmd = argv[optind];
+	argv += optind;
+	argc -= optind;
+	optind = 1;
+	if ( strcmp( cmd, "run" ) )
+		while ( -1 != ( c = getopt( argc, argv, "hn:H:f" ) ) )
+		{
+			switch ( c )
+			{
+				case 'n':
+					if ( ( n = atol( optarg ) ) < 1 )
+					{
+						fprintf( stderr, "Error: the count must be at least 1.\n" );
+						exit( EXIT_FAILURE );
+					}
+					break;
+				case 'H':
+					host = optarg;
+					break;
+				case 'f':
+					fix = 1;
+					break;
+				default:
+					fprintf( stderr, help );
+					exit( EXIT_FAILURE );
+			}
+		}
+	argv += optind;
+	argc -= optind;
+
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( !db_load( &db, conf_file ) || !ca_lock( &db ) )
+		exit( EXIT_FAILURE );
+
+	if ( !strcmp( cmd, "serial" ) && 0 == argc )
+	{
+		if ( ( ok = take_serial( db.serial_file, n, &first ) ) )
+		{
+			hex = BN_bn2hex( first );
+			printf( "%s%s\n", strlen( hex ) % 2 ? "0" : "", hex );
+			OPENSSL_free( hex );
+			BN_free( first );
+		}
+	}
+	else if ( !strcmp( cmd, "add" ) && argc > 0 )
+		ok = add( &db, argv, argc );
+	else if ( !strcmp( cmd, "drop" ) && argc > 0 )
+		ok = drop( &db, argv, argc );
+	else if ( !strcmp( cmd, "run" ) && argc > 0 )
+		ok = run( &db, argv );
+	else if ( !strcmp( cmd, "check" ) && 0 == argc )
+		ok = check( &db, fix );
+	else if ( !strcmp( cmd, "lease" ) && 0 == argc )
+		ok = lease( &db, n, host );
+	else if ( !strcmp( cmd, "accept" ) && 2 == argc )
+		ok = accept_lease( &db, argv[0], argv[1] );
+	else if ( !strcmp( cmd, "merge" ) && argc > 0 )
+		ok = merge( &db, argv, argc );
+	else
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	NCONF_free( db.conf );
+	return( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/*******
+ db_load--
+ *******/
+
+int db_load( ca_conf *db, char *conf_file )
+{
+	/* The files of [ default_ca ], what ca_load() would set of a ca_conf
+	   for them; not the CA, ca-db signs nothing. generate.sh sets up the
+	   environment [ req ] needs, anyone else needn't for these */
+	static char *env[] = { "C", "ST", "L", "O", "OU", "CN", NULL };
+	char *section, *s;
+	long line = -1;
+	int i;
+
+	memset( db, 0, sizeof( ca_conf ) );
+	db->lock_fd = -1;
+	for ( i = 0; NULL != env[i]; ++i )
+		setenv( env[i], "-", 0 );
+	db->conf = NCONF_new( NULL );
+	if ( !NCONF_load( db->conf, conf_file, &line ) )
+	{
+		if ( line > 0 )
+			fprintf( stderr, "Error: %s line %ld: ", conf_file, line );
+		else
+			fprintf( stderr, "Error: %s: ", conf_file );
+		ERR_print_errors_fp( stderr );
+		return 0;
+	}
+	if ( NULL == ( section = NCONF_get_string( db->conf, "ca", "default_ca" ) ) ||
+			NULL == ( db->dir = NCONF_get_string( db->conf, section, "dir" ) ) ||
+			NULL == ( db->database = NCONF_get_string( db->conf, section, "database" ) ) ||
+			NULL == ( db->serial_file = NCONF_get_string( db->conf, section, "serial" ) ) )
+	{
+		fprintf( stderr, "Error: %s: default_ca, dir, database or serial is missing.\n",
+				conf_file );
+		return 0;
+	}
+	db->new_certs_dir = NCONF_get_string( db->conf, section, "new_certs_dir" );
+	s = NCONF_get_string( db->conf, section, "unique_subject" );
+	db->unique_subject = NULL == s || strchr( "yYtT", s[0] ) || !strcmp( s, "1" );
+	ERR_clear_error();
+	return 1;
+}
+
+/***
+ add--
+ ***/
+
+int add( ca_conf *db, char **certs, int n_certs )
+{
+	/* An index line for each certificate, as openssl ca would write it,
+	   and the same checks: a serial once, and with unique_subject a
+	   subject once among the valid ones */
+	record *recs, *r;
+	X509 *x;
+	ASN1_TIME *not_after;
+	BIGNUM *serial;
+	FILE *fp;
+	char subject[512], line[1024], path[512], *hex, *pem;
+	long len;
+	int n_recs, i, k, ok = 1;
+
+	if ( !read_index( db->database, 0, &recs, &n_recs ) )
+		return 0;
+	for ( i = 0; i < n_certs && ok; ++i )
+	{
+		if ( NULL == ( fp = fopen( certs[i], "r" ) ) ||
+				NULL == ( x = PEM_read_X509( fp, NULL, NULL, NULL ) ) )
+		{
+			fprintf( stderr, "Error: can't read the certificate %s.\n", certs[i] );
+			if ( NULL != fp )
+				fclose( fp );
+			ok = 0;
+			break;
+		}
+		fclose( fp );
+		serial = ASN1_INTEGER_to_BN( X509_get_serialNumber( x ), NULL );
+		hex = BN_bn2hex( serial );
+		not_after = X509_get_notAfter( x );
+		X509_NAME_oneline( X509_get_subject_name( x ), subject, sizeof( subject ) );
+		snprintf( line, sizeof( line ), "V\t%.*s\t\t%s%s\tunknown\t%s",
+				not_after->length, not_after->data, strlen( hex ) % 2 ? "0" : "",
+				hex, subject );
+		X509_free( x );
+		for ( k = 0; k < n_recs; ++k )
+			if ( 0 == BN_cmp( recs[k].serial, serial ) ||
+					( db->unique_subject && 'V' == recs[k].line[0] &&
+					!strcmp( recs[k].field[5], subject ) ) )
+				break;
+		if ( k < n_recs )
+		{
+			fprintf( stderr, "Error: %s: the index has %s already.\n", certs[i],
+					BN_cmp( recs[k].serial, serial ) ? subject : hex );
+			ok = 0;
+		}
+
+		/* and the copy openssl ca keeps */
+		if ( ok && NULL != db->new_certs_dir )
+		{
+			snprintf( path, sizeof( path ), "%s/%s%s.pem", db->new_certs_dir,
+					strlen( hex ) % 2 ? "0" : "", hex );
+			if ( NULL == ( pem = read_file( certs[i], &len ) ) ||
+					!rotate( path, pem, len ) )
+				ok = 0;
+			free( pem );
+		}
+		OPENSSL_free( hex );
+		BN_free( serial );
+		if ( !ok )
+			break;
+
+		if ( NULL == ( r = realloc( recs, ( n_recs + 1 ) * sizeof( record ) ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			ok = 0;
+			break;
+		}
+		recs = r;
+		if ( !parse_record( line, &recs[n_recs] ) )
+		{
+			ok = 0;
+			break;
+		}
+		n_recs++;
+	}
+
+	/* all of them or none */
+	ok = ok && write_index( db, recs, n_recs );
+	free_records( recs, n_recs );
+	return ok;
+}
+
+/****
+ drop--
+ ****/
+
+int drop( ca_conf *db, char **serials, int n_serials )
+{
+	record *recs;
+	BIGNUM *serial = NULL;
+	int n_recs, i, k, j, ok = 1;
+
+	if ( !read_index( db->database, 0, &recs, &n_recs ) )
+		return 0;
+	for ( i = 0; i < n_serials && ok; ++i )
+	{
+		if ( !BN_hex2bn( &serial, serials[i] ) )
+		{
+			fprintf( stderr, "Error: %s isn't a serial number in hex.\n", serials[i] );
+			ok = 0;
+			break;
+		}
+		for ( k = j = 0; k < n_recs; ++k )
+			if ( 0 == BN_cmp( recs[k].serial, serial ) )
+				free_records( &recs[k], -1 );
+			else
+				recs[j++] = recs[k];
+		if ( j == n_recs )
+		{
+			fprintf( stderr, "Error: %s isn't in the index.\n", serials[i] );
+			ok = 0;
+		}
+		n_recs = j;
+	}
+	BN_free( serial );
+	ok = ok && write_index( db, recs, n_recs );
+	free_records( recs, n_recs );
+	return ok;
+}
+
+/***
+ run--
+ ***/
+
+int run( ca_conf *db, char **command )
+{
+	/* The lock is held by this process while the command runs, the
+	   command doesn't get it */
+	pid_t pid;
+	int status;
+
+	fcntl( db->lock_fd, F_SETFD, FD_CLOEXEC );
+	if ( ( pid = fork() ) < 0 )
+	{
+		fprintf( stderr, "Error: can't run %s: %s.\n", command[0], strerror( errno ) );
+		return 0;
+	}
+	if ( 0 == pid )
+	{
+		execvp( command[0], command );
+		fprintf( stderr, "Error: can't run %s: %s.\n", command[0], strerror( errno ) );
+		_exit( 127 );
+	}
+	while ( waitpid( pid, &status, 0 ) < 0 && EINTR == errno )
+		;
+	/* the command's exit status is ca-db's */
+	exit( WIFEXITED( status ) ? WEXITSTATUS( status ) : EXIT_FAILURE );
+}
+
+/*****
+ lease--
+ *****/
+
+int lease( ca_conf *db, long n, char *host )
+{
+	/* <dir>/leases: first<TAB>last<TAB>host<TAB>date, a line a lease */
+	BIGNUM *first, *last;
+	char path[512], line[512], date[32], *old, *data, *fh, *lh;
+	struct stat st;
+	time_t t = time( NULL );
+	long len = 0;
+	int ok;
+
+	if ( strchr( host, '\t' ) || strchr( host, '\n' ) )
+	{
+		fprintf( stderr, "Error: a host can't have tabs or newlines.\n" );
+		return 0;
+	}
+	snprintf( path, sizeof( path ), "%s/leases", db->dir );
+	if ( 0 == stat( path, &st ) )
+	{
+		if ( NULL == ( old = read_file( path, &len ) ) )
+			return 0;
+	}
+	else
+		old = strdup( "" );
+	if ( !take_serial( db->serial_file, n, &first ) )
+	{
+		free( old );
+		return 0;
+	}
+	last = BN_dup( first );
+	BN_add_word( last, n - 1 );
+	fh = BN_bn2hex( first );
+	lh = BN_bn2hex( last );
+	strftime( date, sizeof( date ), "%y%m%d%H%M%SZ", gmtime( &t ) );
+	snprintf( line, sizeof( line ), "%s%s\t%s%s\t%s\t%s\n",
+			strlen( fh ) % 2 ? "0" : "", fh, strlen( lh ) % 2 ? "0" : "", lh, host,
+			date );
+	if ( NULL == old || NULL == ( data = malloc( len + strlen( line ) + 1 ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		ok = 0;
+	}
+	else
+	{
+		memcpy( data, old, len );
+		strcpy( data + len, line );
+		ok = rotate( path, data, len + strlen( line ) );
+		free( data );
+	}
+	if ( ok )
+		printf( "%s%s %s%s\n", strlen( fh ) % 2 ? "0" : "", fh,
+				strlen( lh ) % 2 ? "0" : "", lh );
+	OPENSSL_free( fh );
+	OPENSSL_free( lh );
+	BN_free( first );
+	BN_free( last );
+	free( old );
+	return ok;
+}
+
+/************
+ accept_lease--
+ ************/
+
+int accept_lease( ca_conf *db, char *first_hex, char *last_hex )
+{
+	/* serial is the first of the lease, serial.limit the one after the
+	   last; what is issued here is kept in it */
+	BIGNUM *first = NULL, *limit = NULL;
+	char path[512];
+	int ok;
+
+	if ( !BN_hex2bn( &first, first_hex ) || !BN_hex2bn( &limit, last_hex ) ||
+			BN_cmp( first, limit ) > 0 )
+	{
+		fprintf( stderr, "Error: a lease is two serials in hex, the first one first.\n" );
+		BN_free( first );
+		BN_free( limit );
+		return 0;
+	}
+	BN_add_word( limit, 1 );
+	snprintf( path, sizeof( path ), "%s.limit", db->serial_file );
+	ok = write_serial( path, limit ) && write_serial( db->serial_file, first );
+	BN_free( first );
+	BN_free( limit );
+	return ok;
+}
+
+/*****
+ merge--
+ *****/
+
+int merge( ca_conf *db, char **files, int n_files )
+{
+	/* The records of all of them in serial order, each certificate once */
+	record *recs = NULL, *more, *a, *b;
+	BIGNUM **lo = NULL, **hi = NULL, *next = NULL;
+	char path[512], *data = NULL, *s, *e, *tab;
+	struct stat st;
+	long len;
+	int n_recs = 0, n_more, n_leases = 0, i, j, k, e_i, added = 0, ok = 1;
+
+	if ( !read_index( db->database, 0, &recs, &n_recs ) )
+		return 0;
+	for ( i = 0; i < n_files && ok; ++i )
+	{
+		if ( !read_index( files[i], i + 1, &more, &n_more ) )
+		{
+			ok = 0;
+			break;
+		}
+		if ( NULL == ( a = realloc( recs, ( n_recs + n_more + 1 ) * sizeof( record ) ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			free_records( more, n_more );
+			ok = 0;
+			break;
+		}
+		recs = a;
+		memcpy( recs + n_recs, more, n_more * sizeof( record ) );
+		n_recs += n_more;
+		free( more );
+	}
+
+	/* the leases given out here */
+	snprintf( path, sizeof( path ), "%s/leases", db->dir );
+	if ( ok && 0 == stat( path, &st ) && NULL == ( data = read_file( path, &len ) ) )
+		ok = 0;
+	else if ( ok && 0 == stat( path, &st ) )
+	{
+		for ( s = data; '\0' != *s; s = '\0' != *e ? e + 1 : e )
+		{
+			e = s + strcspn( s, "\n" );
+			if ( NULL == ( tab = memchr( s, '\t', e - s ) ) )
+				continue;
+			*tab = '\0';
+			lo = realloc( lo, ( n_leases + 1 ) * sizeof( BIGNUM * ) );
+			hi = realloc( hi, ( n_leases + 1 ) * sizeof( BIGNUM * ) );
+			lo[n_leases] = hi[n_leases] = NULL;
+			if ( !BN_hex2bn( &lo[n_leases], s ) || !BN_hex2bn( &hi[n_leases], tab + 1 ) )
+			{
+				fprintf( stderr, "Error: %s has a line that isn't a lease.\n", path );
+				ok = 0;
+				break;
+			}
+			n_leases++;
+		}
+		free( data );
+	}
+
+	/* in serial order, and the same records next to each other */
+	qsort( recs, n_recs, sizeof( record ), compare_records );
+	for ( i = j = 0; i < n_recs; i = e_i )
+	{
+		a = &recs[i];
+		for ( e_i = i + 1; e_i < n_recs &&
+				0 == BN_cmp( recs[e_i].serial, a->serial ); ++e_i )
+			;
+		for ( k = i + 1; ok && k < e_i; ++k )
+		{
+			/* the same certificate in another state is fine, the first
+			   of them wins: R, V, E */
+			b = &recs[k];
+			if ( strcmp( a->field[1], b->field[1] ) ||
+					strcmp( a->field[5], b->field[5] ) )
+			{
+				fprintf( stderr, "Error: serial %s is two certificates:\n  %s\n  %s\n",
+						a->field[3], a->line, b->line );
+				ok = 0;
+			}
+			if ( 0 == b->from )
+				a->from = 0;
+		}
+
+		/* from an offline host, it has to be a serial leased to one,
+		   without a leases file none was, and issued there */
+		if ( ok && 0 != a->from && !strncmp( a->field[4], "pending.", 8 ) )
+		{
+			fprintf( stderr, "Error: %s: serial %s is only reserved, not issued.\n",
+					files[a->from - 1], a->field[3] );
+			ok = 0;
+		}
+		if ( ok && 0 != a->from )
+		{
+			for ( k = 0; k < n_leases; ++k )
+				if ( BN_cmp( a->serial, lo[k] ) >= 0 && BN_cmp( a->serial, hi[k] ) <= 0 )
+					break;
+			if ( k == n_leases )
+			{
+				fprintf( stderr, "Error: %s: serial %s wasn't leased to anyone.\n",
+						files[a->from - 1], a->field[3] );
+				ok = 0;
+			}
+		}
+		added += 0 != a->from;
+		for ( k = i + 1; k < e_i; ++k )
+			free_records( &recs[k], -1 );
+		recs[j++] = *a;
+	}
+	n_recs = j;
+
+	/* the serial file is kept past everything in the index */
+	if ( ok && n_recs > 0 && read_serial( db->serial_file, &next ) &&
+			BN_cmp( next, recs[n_recs - 1].serial ) <= 0 )
+	{
+		BN_copy( next, recs[n_recs - 1].serial );
+		BN_add_word( next, 1 );
+		ok = write_serial( db->serial_file, next );
+	}
+	ok = ok && write_index( db, recs, n_recs );
+	if ( ok )
+		fprintf( stderr, "Merged: %d records added, %d in the index.\n", added, n_recs );
+	for ( k = 0; k < n_leases; ++k )
+	{
+		BN_free( lo[k] );
+		BN_free( hi[k] );
+	}
+	free( lo );
+	free( hi );
+	BN_free( next );
+	free_records( recs, n_recs );
+	return ok;
+}
+
+/*****
+ check--
+ *****/
+
+int check( ca_conf *db, int fix )
+{
+	/* What is left by a crash, or by an issuer that doesn't lock: a
+	   file.new, the serial file behind the index, a serial twice, a
+	   reservation of a run that is gone */
+	static char *files[] = { "", ".attr", NULL };
+	record *recs;
+	BIGNUM *next = NULL;
+	char path[512];
+	struct stat st;
+	int n_recs, problems = 0, fixed = 0, stale = 0, i, j;
+
+	for ( i = 0; NULL != files[i]; ++i )
+	{
+		snprintf( path, sizeof( path ), "%s%s.new", db->database, files[i] );
+		if ( 0 == stat( path, &st ) )
+		{
+			fprintf( stderr, "%s is left from a write that didn't finish.\n", path );
+			++problems;
+			fixed += fix && 0 == unlink( path );
+		}
+	}
+	snprintf( path, sizeof( path ), "%s.new", db->serial_file );
+	if ( 0 == stat( path, &st ) )
+	{
+		fprintf( stderr, "%s is left from a write that didn't finish.\n", path );
+		++problems;
+		fixed += fix && 0 == unlink( path );
+	}
+
+	if ( !read_index( db->database, 0, &recs, &n_recs ) ||
+			!read_serial( db->serial_file, &next ) )
+		return 0;
+	qsort( recs, n_recs, sizeof( record ), compare_records );
+	for ( i = 1; i < n_recs; ++i )
+		if ( 0 == BN_cmp( recs[i - 1].serial, recs[i].serial ) )
+		{
+			fprintf( stderr, "Serial %s is in the index twice.\n", recs[i].field[3] );
+			++problems;
+		}
+
+	/* what ovpn-bundle or www-issue reserved and didn't live to issue */
+	for ( i = j = 0; i < n_recs; ++i )
+		if ( ca_pending( recs[i].field[4] ) < 0 )
+		{
+			fprintf( stderr, "Serial %s is reserved by a run that is gone.\n",
+					recs[i].field[3] );
+			++problems;
+			++stale;
+			if ( fix )
+				free_records( &recs[i], -1 );
+			else
+				recs[j++] = recs[i];
+		}
+		else
+			recs[j++] = recs[i];
+	n_recs = j;
+	if ( fix && stale > 0 && write_index( db, recs, n_recs ) )
+		fixed += stale;
+	if ( n_recs > 0 && BN_cmp( next, recs[n_recs - 1].serial ) <= 0 )
+	{
+		fprintf( stderr, "%s is behind the index, it has serials up to %s.\n",
+				db->serial_file, recs[n_recs - 1].field[3] );
+		++problems;
+		BN_copy( next, recs[n_recs - 1].serial );
+		BN_add_word( next, 1 );
+		fixed += fix && write_serial( db->serial_file, next );
+	}
+	BN_free( next );
+	free_records( recs, n_recs );
+	fprintf( stderr, "Check: %d problems, %d put right.\n", problems, fixed );
+	return problems == fixed;
+}
+
+/**********
+ read_index--
+ **********/
+
+int read_index( char *path, int from, record **recs, int *n_recs )
+{
+	char *data, *s, *e, *next;
+	long len;
+	int size = 0, line = 0;
+
+	*recs = NULL;
+	*n_recs = 0;
+	if ( NULL == ( data = read_file( path, &len ) ) )
+		return 0;
+	for ( s = data; '\0' != *s; s = next )
+	{
+		e = s + strcspn( s, "\n" );
+		next = '\0' != *e ? e + 1 : e;
+		++line;
+		if ( e == s )
+			continue;
+		if ( *n_recs == size )
+		{
+			size = size ? 2 * size : 256;
+			if ( NULL == ( *recs = realloc( *recs, size * sizeof( record ) ) ) )
+			{
+				fprintf( stderr, "Error: out of memory.\n" );
+				free( data );
+				*n_recs = 0;
+				return 0;
+			}
+		}
+		if ( '\n' == *e )
+			*e = '\0';
+		else
+			fprintf( stderr, "Warning: %s line %d has no newline, it may be cut short.\n",
+					path, line );
+		if ( !parse_record( s, &( *recs )[*n_recs] ) )
+		{
+			fprintf( stderr, "Error: %s line %d isn't an index line.\n", path, line );
+			free( data );
+			free_records( *recs, *n_recs );
+			*recs = NULL;
+			*n_recs = 0;
+			return 0;
+		}
+		( *recs )[( *n_recs )++].from = from;
+	}
+	free( data );
+	return 1;
+}
+
+/************
+ parse_record--
+ ************/
+
+int parse_record( char *line, record *r )
+{
+	char *s;
+	int i;
+
+	memset( r, 0, sizeof( record ) );
+	if ( NULL == ( r->line = malloc( 2 * strlen( line ) + 2 ) ) )
+		return 0;
+	strcpy( r->line, line );
+
+	/* the fields, in a copy after the line */
+	s = r->line + strlen( line ) + 1;
+	strcpy( s, line );
+	for ( i = 0; i < INDEX_FIELDS && NULL != s; ++i )
+	{
+		r->field[i] = s;
+		if ( NULL != ( s = strchr( s, '\t' ) ) )
+			*s++ = '\0';
+	}
+	if ( i < INDEX_FIELDS || NULL == strchr( "VRE", r->line[0] ) ||
+			!BN_hex2bn( &r->serial, r->field[3] ) )
+	{
+		free( r->line );
+		BN_free( r->serial );
+		memset( r, 0, sizeof( record ) );
+		return 0;
+	}
+	return 1;
+}
+
+/************
+ free_records--
+ ************/
+
+void free_records( record *recs, int n_recs )
+{
+	/* n_recs -1 is the one record, and not the array */
+	int i;
+
+	for ( i = 0; i < ( n_recs < 0 ? 1 : n_recs ); ++i )
+	{
+		free( recs[i].line );
+		BN_free( recs[i].serial );
+		recs[i].line = NULL;
+		recs[i].serial = NULL;
+	}
+	if ( n_recs >= 0 )
+		free( recs );
+	return;
+}
+
+/***************
+ compare_records--
+ ***************/
+
+int compare_records( const void *a, const void *b )
+{
+	/* by serial, then R before V before E, then the line itself, so the
+	   order doesn't depend on where they came from */
+	const record *ra = a, *rb = b;
+	int c;
+
+	if ( 0 != ( c = BN_cmp( ra->serial, rb->serial ) ) )
+		return c;
+	if ( ra->line[0] != rb->line[0] )
+		return 'R' == ra->line[0] ? -1 : 'R' == rb->line[0] ? 1 :
+			ra->line[0] == 'V' ? -1 : 1;
+	return strcmp( ra->line, rb->line );
+}
+
+/***********
+ write_index--
+ ***********/
+
+int write_index( ca_conf *db, record *recs, int n_recs )
+{
+	char path[512], *data, *attr;
+	long size = 1, len = 0;
+	int i, ok;
+
+	for ( i = 0; i < n_recs; ++i )
+		size += strlen( recs[i].line ) + 1;
+	if ( NULL == ( data = malloc( size ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	for ( i = 0; i < n_recs; ++i )
+		len += sprintf( data + len, "%s\n", recs[i].line );
+	ok = rotate( db->database, data, len );
+	free( data );
+
+	snprintf( path, sizeof( path ), "%s.attr", db->database );
+	attr = db->unique_subject ? "unique_subject = yes\n" : "unique_subject = no\n";
+	return ok && rotate( path, attr, strlen( attr ) );
+}
@@ -0,0 +1,711 @@
+/*
+dh-pool - Diffie-Hellman parameters made ahead of time, for generate.sh
+
+"openssl dhparam 2048" is a search for a safe prime that takes minutes
+on a slow host, and both openvpn/generate.sh and www/generate.sh wait
+for it when they make a CA. dh-pool makes them ahead of time on every
+CPU and keeps them in a directory the environments of a user share, so
+making a CA only has to take one:
+
+	dh-pool fill  [-d dir] [-b bits] [-n count] [-j threads] [-B]
+	    makes parameters until there are count of them ready; every one
+	    is put through DH_check() before it goes in. -B runs it in the
+	    background. Only one fill runs for a size at a time, a second
+	    one finds it locked and leaves it be.
+
+	dh-pool take  [-d dir] [-b bits] -o file [-g | -N] [-F]
+	    moves one of them to file, put through DH_check() and its size
+	    checked again on the way out. With none ready it makes one there
+	    and then, like openssl dhparam, or with -N writes the RFC 7919
+	    group instead, or with -g fails. A fill is started in the
+	    background after, -F is for without.
+
+	dh-pool named [-b bits] -o file
+	    writes the RFC 7919 ffdhe group of that size, 2048, 3072,
+	    4096, 6144 or 8192 bits; nothing is searched for. OpenSSL
+	    before 1.1.1 doesn't have them, they are worked out here from
+	    the formula in the RFC: p = 2^b - 2^(b-64) +
+	    ({2^(b-130) e} + X) * 2^64 - 1 with its X, g = 2.
+
+The directory is $DH_POOL_DIR, or ~/.dh-pool, with a directory per
+size in it. Whoever can write to it decides the parameters of every CA
+made from it, so it and the size directories have to be the caller's
+own and mode 0700, anything else is refused. A parameter file is
+written under a temporary name and renamed, and taken by renaming it,
+so fills and takes can run at the same time from any number of
+processes of that user.
+
+16oct2026, v0.1
+ - first version
+
+17oct2026, v0.2
+ - the pool defaults to ~/.dh-pool, its directories have to be the
+   caller's own and 0700
+ - take checks the file it claims with DH_check() and its size
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <openssl/dh.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+#define POOL_DIR       ".dh-pool"   /* in $HOME */
+#define POOL_COUNT     4
+#define DH_BITS        2048
+
+/* a fill, shared by its threads */
+typedef struct pool_fill
+{
+	char dir[512];        /* of the size */
+	int bits;
+	int wanted;           /* ready and being made */
+	int made, failed;
+	pthread_mutex_t lock;
+} pool_fill;
+
+/* RFC 7919, the X of each size */
+static const struct
+{
+	int bits;
+	unsigned long x;
+} ffdhe[] =
+{
+	{ 2048, 560316 },
+	{ 3072, 2625351 },
+	{ 4096, 5736041 },
+	{ 6144, 15705020 },
+	{ 8192, 10965728 },
+	{ 0, 0 }
+};
+
+/* prototypes */
+int  pool_dir( char *base, int bits, char *dir, int size );
+int  own_dir( char *dir );
+int  count_ready( char *dir );
+int  fill( char *base, int bits, int count, int n_threads, int background );
+void *fill_worker( void *arg );
+int  take( char *base, int bits, char *out, int fallback );
+int  claim( char *dir, int bits, char *out );
+int  check_dh( char *path, int bits );
+int  make_dh( int bits, DH **dh );
+int  named_dh( int bits, DH **dh );
+int  write_dh( DH *dh, char *path );
+int  copy_file( char *from, char *to );
+void thread_setup( void );
+void thread_cleanup( void );
+
+static pthread_mutex_t *ssl_locks;
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char *base = getenv( "DH_POOL_DIR" ), *out = NULL, *cmd;
+	int bits = DH_BITS, count = POOL_COUNT, background = 0, refill = 1;
+	int fallback = 'm', n_threads, c;
+	char home_pool[512];
+	DH *dh;
+	char *help =
+		"\n"
+		"Usage: dh-pool fill  [-d dir] [-b bits] [-n count] [-j threads] [-B]\n"
+		"       dh-pool take  [-d dir] [-b bits] -o file [-g | -N] [-F]\n"
+		"       dh-pool named [-b bits] -o file\n"
+		"  Keeps Diffie-Hellman parameters ready so a new CA doesn't wait for\n"
+		"  openssl dhparam.\n"
+		"Commands:\n"
+		"  fill           - Makes parameters until count of them are ready\n"
+		"  take           - Moves one to file, makes it if there is none ready\n"
+		"  named          - Writes the RFC 7919 ffdhe group of the size\n"
+		"Options:\n"
+		"  -d <dir>       - The pool, it defaults to $DH_POOL_DIR or ~/" POOL_DIR "\n"
+		"  -b <bits>      - The size, it defaults to 2048\n"
+		"  -n <count>     - How many fill keeps ready, it defaults to 4\n"
+		"  -j <threads>   - Made at once, it defaults to the number of CPUs\n"
+		"  -B             - Fill in the background\n"
+		"  -o <file>      - Where take and named write the parameters\n"
+		"  -g             - Take fails if there are none ready\n"
+		"  -N             - Take writes the RFC 7919 group if there are none ready\n"
+		"  -F             - Take doesn't start a fill\n"
+		"  -h             - Displays this help\n"
+		"\n";
+
+	if ( argc < 2 || '-' == argv[1][0] )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	cmd = argv[1];
+	argv++;
+	argc--;
+	if ( NULL == base && NULL != getenv( "HOME" ) )
+	{
+		snprintf( home_pool, sizeof( home_pool ), "%s/" POOL_DIR, getenv( "HOME" ) );
+		base = home_pool;
+	}
+	n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+
+	while ( -1 != ( c = getopt( argc, argv, "hd:b:n:j:Bo:gNF" ) ) )
+	{
+		switch ( c )
+		{
+			case 'd':
+				base = optarg;
+				break;
+			case 'b':
+				if ( ( bits = atoi( optarg ) ) < 512 )
+				{
+					fprintf( stderr, "Error: %s bits is too small.\n", optarg );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'n':
+				if ( ( count = atoi( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: the count must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'j':
+				if ( ( n_threads = atoi( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: number of threads must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'B':
+				background = 1;
+				break;
+			case 'o':
+				out = optarg;
+				break;
+			case 'g':
+			case 'N':
+				fallback = c;
+				break;
+			case 'F':
+				refill = 0;
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( NULL == base && strcmp( cmd, "named" ) )
+	{
+		fprintf( stderr, "Error: no $HOME for the pool, give it with -d.\n" );
+		exit( EXIT_FAILURE );
+	}
+	if ( !strcmp( cmd, "fill" ) )
+		exit( fill( base, bits, count, n_threads, background ) ?
+				EXIT_SUCCESS : EXIT_FAILURE );
+	if ( NULL == out )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	if ( !strcmp( cmd, "take" ) )
+	{
+		if ( !take( base, bits, out, fallback ) )
+			exit( EXIT_FAILURE );
+		/* the pool gets back what was taken, on every CPU */
+		if ( refill )
+			fill( base, bits, count, n_threads, 1 );
+		exit( EXIT_SUCCESS );
+	}
+	if ( !strcmp( cmd, "named" ) )
+	{
+		if ( !named_dh( bits, &dh ) || !write_dh( dh, out ) )
+			exit( EXIT_FAILURE );
+		DH_free( dh );
+		exit( EXIT_SUCCESS );
+	}
+	fprintf( stderr, help );
+	exit( EXIT_FAILURE );
+}
+
+/********
+ pool_dir--
+ ********/
+
+int pool_dir( char *base, int bits, char *dir, int size )
+{
+	/* <base>/<bits>, made if it isn't there */
+	if ( 0 != mkdir( base, 0700 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", base, strerror( errno ) );
+		return 0;
+	}
+	if ( !own_dir( base ) )
+		return 0;
+	snprintf( dir, size, "%s/%d", base, bits );
+	if ( 0 != mkdir( dir, 0700 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", dir, strerror( errno ) );
+		return 0;
+	}
+	return own_dir( dir );
+}
+
+/*******
+ own_dir--
+ *******/
+
+int own_dir( char *dir )
+{
+	/* Anyone else who can write there can hand us parameters of their
+	   choosing, or swap the directory for a link to theirs */
+	struct stat st;
+
+	if ( 0 != lstat( dir, &st ) || !S_ISDIR( st.st_mode ) )
+	{
+		fprintf( stderr, "Error: %s isn't a directory.\n", dir );
+		return 0;
+	}
+	if ( getuid() != st.st_uid || ( st.st_mode & 077 ) )
+	{
+		fprintf( stderr, "Error: %s has to be yours and mode 0700.\n", dir );
+		return 0;
+	}
+	return 1;
+}
+
+/***********
+ count_ready--
+ ***********/
+
+int count_ready( char *dir )
+{
+	struct dirent *de;
+	DIR *d;
+	int n = 0, len;
+
+	if ( NULL == ( d = opendir( dir ) ) )
+		return 0;
+	while ( NULL != ( de = readdir( d ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len > 4 && !strcmp( de->d_name + len - 4, ".pem" ) )
+			++n;
+	}
+	closedir( d );
+	return n;
+}
+
+/****
+ fill--
+ ****/
+
+int fill( char *base, int bits, int count, int n_threads, int background )
+{
+	pool_fill pf;
+	pthread_t *threads;
+	char lock_path[600];
+	int lock_fd, n_started = 0, i;
+
+	if ( !pool_dir( base, bits, pf.dir, sizeof( pf.dir ) ) )
+		return 0;
+	if ( background )
+	{
+		/* away from the terminal and the shell that waits for it */
+		switch ( fork() )
+		{
+			case -1:
+				fprintf( stderr, "Error: can't fork: %s.\n", strerror( errno ) );
+				return 0;
+			case 0:
+				break;
+			default:
+				return 1;
+		}
+		setsid();
+		signal( SIGHUP, SIG_IGN );
+		if ( ( i = open( "/dev/null", O_RDWR ) ) >= 0 )
+		{
+			dup2( i, 0 );
+			dup2( i, 1 );
+			dup2( i, 2 );
+			close( i );
+		}
+	}
+
+	/* one fill per size, the next one has nothing to do */
+	snprintf( lock_path, sizeof( lock_path ), "%s/.fill", pf.dir );
+	if ( ( lock_fd = open( lock_path, O_WRONLY | O_CREAT, 0600 ) ) < 0 )
+	{
+		fprintf( stderr, "Error: can't open %s: %s.\n", lock_path, strerror( errno ) );
+		return 0;
+	}
+	if ( 0 != flock( lock_fd, LOCK_EX | LOCK_NB ) )
+	{
+		close( lock_fd );
+		if ( background )
+			_exit( EXIT_SUCCESS );
+		fprintf( stderr, "%d-bit parameters are being made already.\n", bits );
+		return 1;
+	}
+
+	pf.bits = bits;
+	pf.wanted = count - count_ready( pf.dir );
+	pf.made = pf.failed = 0;
+	pthread_mutex_init( &pf.lock, NULL );
+	if ( n_threads > pf.wanted )
+		n_threads = pf.wanted > 0 ? pf.wanted : 1;
+	thread_setup();
+	if ( pf.wanted > 0 && NULL != ( threads = calloc( n_threads, sizeof( pthread_t ) ) ) )
+	{
+		for ( ; n_started < n_threads; ++n_started )
+			if ( pthread_create( &threads[n_started], NULL, fill_worker, &pf ) )
+				break;
+		if ( 0 == n_started )
+			fill_worker( &pf );
+		for ( i = 0; i < n_started; ++i )
+			pthread_join( threads[i], NULL );
+		free( threads );
+	}
+	thread_cleanup();
+	pthread_mutex_destroy( &pf.lock );
+	close( lock_fd );
+
+	if ( background )
+		_exit( pf.failed ? EXIT_FAILURE : EXIT_SUCCESS );
+	fprintf( stderr, "%d-bit parameters: %d made, %d ready.\n", bits, pf.made,
+			count_ready( pf.dir ) );
+	return 0 == pf.failed;
+}
+
+/***********
+ fill_worker--
+ ***********/
+
+void *fill_worker( void *arg )
+{
+	pool_fill *pf = arg;
+	char tmp[600], path[600];
+	DH *dh;
+	int n, ok;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &pf->lock );
+		n = pf->wanted > 0 ? pf->wanted-- : 0;
+		pthread_mutex_unlock( &pf->lock );
+		if ( 0 == n )
+			break;
+
+		snprintf( tmp, sizeof( tmp ), "%s/.new-%ld-%d", pf->dir, (long)getpid(), n );
+		snprintf( path, sizeof( path ), "%s/%ld-%ld-%d.pem", pf->dir,
+				(long)time( NULL ), (long)getpid(), n );
+		ok = make_dh( pf->bits, &dh ) && write_dh( dh, tmp ) &&
+			0 == rename( tmp, path );
+		if ( !ok )
+			unlink( tmp );
+		DH_free( dh );
+		pthread_mutex_lock( &pf->lock );
+		if ( ok )
+			pf->made++;
+		else
+			pf->failed++;
+		pthread_mutex_unlock( &pf->lock );
+	}
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/****
+ take--
+ ****/
+
+int take( char *base, int bits, char *out, int fallback )
+{
+	char dir[512];
+	DH *dh = NULL;
+	int ok;
+
+	if ( !pool_dir( base, bits, dir, sizeof( dir ) ) )
+		return 0;
+	if ( claim( dir, bits, out ) )
+		return 1;
+
+	switch ( fallback )
+	{
+		case 'g':
+			fprintf( stderr, "Error: no %d-bit parameters ready in %s.\n", bits, dir );
+			return 0;
+		case 'N':
+			ok = named_dh( bits, &dh );
+			break;
+		default:
+			fprintf( stderr, "No %d-bit parameters ready, making one now.\n", bits );
+			ok = make_dh( bits, &dh );
+			break;
+	}
+	ok = ok && write_dh( dh, out );
+	DH_free( dh );
+	return ok;
+}
+
+/*****
+ claim--
+ *****/
+
+int claim( char *dir, int bits, char *out )
+{
+	/* The oldest one that no one else gets first. The rename is what
+	   claims it, whoever loses finds it gone and tries the next. One
+	   that fails check_dh() is thrown away and the next one tried. */
+	struct dirent **names;
+	char path[600], claimed[600];
+	int n, i, len, ok = 0;
+
+	if ( ( n = scandir( dir, &names, NULL, alphasort ) ) < 0 )
+		return 0;
+	for ( i = 0; i < n; ++i )
+	{
+		len = strlen( names[i]->d_name );
+		if ( !ok && len > 4 && !strcmp( names[i]->d_name + len - 4, ".pem" ) )
+		{
+			snprintf( path, sizeof( path ), "%s/%s", dir, names[i]->d_name );
+			snprintf( claimed, sizeof( claimed ), "%s/.taken-%ld", dir, (long)getpid() );
+			if ( 0 != rename( path, claimed ) )
+				;
+			else if ( !check_dh( claimed, bits ) )
+			{
+				fprintf( stderr, "Error: %s isn't %d-bit parameters that pass "
+						"DH_check(), thrown away.\n", path, bits );
+				unlink( claimed );
+			}
+			else
+			{
+				/* out may be on another file system */
+				ok = 0 == rename( claimed, out ) || copy_file( claimed, out );
+				unlink( claimed );
+				if ( !ok )
+					fprintf( stderr, "Error: can't write %s: %s.\n", out,
+							strerror( errno ) );
+				ok = ok ? 1 : -1;
+			}
+		}
+		free( names[i] );
+	}
+	free( names );
+	return 1 == ok;
+}
+
+/********
+ check_dh--
+ ********/
+
+int check_dh( char *path, int bits )
+{
+	/* The file is read back, not trusted for having been in the pool */
+	FILE *fp;
+	DH *dh = NULL;
+	int codes, ok;
+
+	if ( NULL != ( fp = fopen( path, "r" ) ) )
+	{
+		dh = PEM_read_DHparams( fp, NULL, NULL, NULL );
+		fclose( fp );
+	}
+	ok = NULL != dh && bits == BN_num_bits( dh->p ) &&
+		DH_check( dh, &codes ) && 0 == codes;
+	ERR_clear_error();
+	DH_free( dh );
+	return ok;
+}
+
+/*******
+ make_dh--
+ *******/
+
+int make_dh( int bits, DH **dh )
+{
+	/* What openssl dhparam does, generator 2, and checked */
+	int codes;
+
+	if ( NULL == ( *dh = DH_new() ) ||
+			!DH_generate_parameters_ex( *dh, bits, DH_GENERATOR_2, NULL ) ||
+			!DH_check( *dh, &codes ) || 0 != codes )
+	{
+		fprintf( stderr, "Error: making %d-bit parameters failed.\n", bits );
+		ERR_print_errors_fp( stderr );
+		return 0;
+	}
+	return 1;
+}
+
+/********
+ named_dh--
+ ********/
+
+int named_dh( int bits, DH **dh )
+{
+	/* RFC 7919: p = 2^b - 2^(b-64) + ({2^(b-130) e} + X) * 2^64 - 1.
+	   e is sum 1/k!, worked out in fixed point with 64 bits to spare, the
+	   error of a term each is nowhere near them */
+	BN_CTX *ctx = NULL;
+	BIGNUM *p = NULL, *t = NULL, *e = NULL, *one = NULL;
+	int i, k, ok = 0;
+
+	*dh = NULL;
+	for ( i = 0; 0 != ffdhe[i].bits && bits != ffdhe[i].bits; ++i )
+		;
+	if ( 0 == ffdhe[i].bits )
+	{
+		fprintf( stderr, "Error: RFC 7919 has no %d-bit group.\n", bits );
+		return 0;
+	}
+	if ( NULL == ( ctx = BN_CTX_new() ) || NULL == ( p = BN_new() ) ||
+			NULL == ( t = BN_new() ) || NULL == ( e = BN_new() ) ||
+			NULL == ( one = BN_new() ) )
+		goto done;
+
+	/* e * 2^(b-130+64) */
+	if ( !BN_one( t ) || !BN_lshift( t, t, bits - 130 + 64 ) || !BN_copy( e, t ) )
+		goto done;
+	for ( k = 1; !BN_is_zero( t ); ++k )
+		if ( (BN_ULONG)-1 == BN_div_word( t, k ) || !BN_add( e, e, t ) )
+			goto done;
+	if ( !BN_rshift( e, e, 64 ) || !BN_add_word( e, ffdhe[i].x ) ||
+			!BN_lshift( p, e, 64 ) || !BN_one( one ) ||
+			!BN_lshift( t, one, bits ) || !BN_add( p, p, t ) ||
+			!BN_lshift( t, one, bits - 64 ) || !BN_sub( p, p, t ) ||
+			!BN_sub_word( p, 1 ) )
+		goto done;
+
+	if ( NULL == ( *dh = DH_new() ) || NULL == ( ( *dh )->g = BN_new() ) ||
+			!BN_set_word( ( *dh )->g, 2 ) )
+		goto done;
+	/* not put through DH_check(): before 1.1.0 it wants p mod 24 == 11
+	   for g = 2, which these aren't, and says "not a generator" */
+	( *dh )->p = p;
+	p = NULL;
+	ok = 1;
+
+done:
+	if ( !ok )
+	{
+		fprintf( stderr, "Error: working out the %d-bit group failed.\n", bits );
+		DH_free( *dh );
+		*dh = NULL;
+	}
+	BN_free( p );
+	BN_free( t );
+	BN_free( e );
+	BN_free( one );
+	BN_CTX_free( ctx );
+	return ok;
+}
+
+/********
+ write_dh--
+ ********/
+
+int write_dh( DH *dh, char *path )
+{
+	FILE *fp;
+	int ok;
+
+	if ( NULL == ( fp = fopen( path, "w" ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	ok = PEM_write_DHparams( fp, dh );
+	if ( 0 != fclose( fp ) || !ok )
+	{
+		fprintf( stderr, "Error: can't write %s.\n", path );
+		unlink( path );
+		return 0;
+	}
+	return 1;
+}
+
+/*********
+ copy_file--
+ *********/
+
+int copy_file( char *from, char *to )
+{
+	char buf[4096];
+	FILE *in, *out;
+	size_t n;
+	int ok = 1;
+
+	if ( NULL == ( in = fopen( from, "rb" ) ) )
+		return 0;
+	if ( NULL == ( out = fopen( to, "wb" ) ) )
+	{
+		fclose( in );
+		return 0;
+	}
+	while ( ok && 0 < ( n = fread( buf, 1, sizeof( buf ), in ) ) )
+		ok = n == fwrite( buf, 1, n, out );
+	fclose( in );
+	return 0 == fclose( out ) && ok;
+}
+
+/************
+ thread_setup--
+ ************/
+
+static void ssl_lock( int mode, int n, const char *file, int line )
+{
+	if ( mode & CRYPTO_LOCK )
+		pthread_mutex_lock( &ssl_locks[n] );
+	else
+		pthread_mutex_unlock( &ssl_locks[n] );
+}
+
+static unsigned long ssl_thread_id( void )
+{
+	return (unsigned long)pthread_self();
+}
+
+void thread_setup( void )
+{
+	/* OpenSSL before 1.1 needs these before it is used from several
+	   threads */
+	int i;
+
+	ssl_locks = OPENSSL_malloc( CRYPTO_num_locks() * sizeof( pthread_mutex_t ) );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_init( &ssl_locks[i], NULL );
+	CRYPTO_set_id_callback( ssl_thread_id );
+	CRYPTO_set_locking_callback( ssl_lock );
+	return;
+}
+
+/**************
+ thread_cleanup--
+ **************/
+
+void thread_cleanup( void )
+{
+	int i;
+
+	CRYPTO_set_locking_callback( NULL );
+	CRYPTO_set_id_callback( NULL );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_destroy( &ssl_locks[i] );
+	OPENSSL_free( ssl_locks );
+	return;
+}
@@ -0,0 +1,1237 @@
+/*
+expiry - when the certificates and MiniCerts of the CAs run out
+
+The expiry dates are only in what was issued: the notAfter of every
+certificate in private/certdb, the expiry column of private/index, and
+the HHMMSSMMDDYY at offset 48 of every MiniCert, in its .mini_cert file
+or a gen-mc store. Finding what runs out next month means reading all
+of them. expiry reads them once into a file of fixed size records sorted
+by date, and after that only what has changed:
+
+	expiry update [tree ...]
+	    adds the trees, openvpn, www and asterisk, to the index, and
+	    reads what is new or changed in all of them since the last time
+	expiry due [-n days] [-t tree] [-a]
+	    lists what runs out in the next days, 30 by default, and what
+	    has run out already: date, days left, tree, mc or x509, name,
+	    serial or user id, tab separated
+	expiry due -b mc|x509 [-n days] [-t tree]
+	    writes the same as a batch to issue again: a gen-mc roster,
+	    display_name,user_id, or the names for ovpn-bundle -f or
+	    www-issue -R -f
+
+A tree's sources are private/index; the certificates in private/certdb
+that aren't in the index, such as asterisk's before ca-db; the
+.mini_cert files in private/linksys and the gen-mc stores, *.mcs, in
+private. The index is read again when it changes, as openssl ca
+rewrites it; of certdb and linksys only the files that are new or
+changed are read, only the first 80 bytes of a MiniCert; a store is
+appended to, so only its new records are.
+
+Revoked certificates aren't due, nor is a certificate that has a CN
+with another one in its tree valid at least as long, or a MiniCert with
+a user id that has another MiniCert there valid as long: it was issued
+again already. A MiniCert goes by its user id, as gen-mc and the
+phones do, the display name of a user can change or be shared. Due is a binary search for
+the end of the date range in the mapped index file, the rest is the
+records before it.
+
+Usage: expiry [-i index_file] update [tree ...]
+       expiry [-i index_file] due [-n days] [-t tree] [-a] [-b mc|x509]
+
+16oct2026, v0.1
+ - first version
+
+17oct2026, v0.2
+ - MiniCerts are superseded by user id, not display name
+ - the MiniCert and store layouts are ../asterisk/gen-mc's genmc.h and
+   genmc_store_fmt.h, not copies
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include "genmc.h"
+#include "genmc_store_fmt.h"
+
+#define INDEX_MAGIC      "EXPIRY01"
+#define MC_B64_HEAD      ( GENMC_USER_INFO_LEN / 3 * 4 )  /* base64 of the user info */
+
+/* where records come from */
+enum
+{
+	SRC_TREE = 't',       /* a tree, its sources are found again each update */
+	SRC_INDEX = 'i',      /* private/index */
+	SRC_CERTDB = 'c',     /* private/certdb */
+	SRC_MC_DIR = 'm',     /* private/linksys */
+	SRC_STORE = 's'       /* private/<name>.mcs */
+};
+
+/* The index file: the header, the sources and the records, in the host's
+   byte order, so it can be mapped and searched as it is */
+typedef struct exp_header
+{
+	char magic[8];
+	int n_sources;
+	int n_recs;
+	long long updated;
+	char reserved[40];
+} exp_header;
+
+typedef struct exp_source
+{
+	char path[256];
+	char tree[32];
+	char type;
+	char reserved[7];
+	long long mtime;
+	long long size;       /* for a store, where its good records end */
+} exp_source;
+
+typedef struct exp_rec
+{
+	long long expiry;     /* time_t */
+	long long mtime;      /* of its file, to see if it changed */
+	unsigned short source;
+	char status;          /* V, R or E as in the index, V for a MiniCert */
+	char superseded;      /* the CN or user id has another, valid as long */
+	char name[72];        /* CN, or display name */
+	char id[36];          /* serial in hex, or user id */
+	char file[64];        /* under the source, a store's record number */
+} exp_rec;
+
+/* the index being updated */
+typedef struct exp_index
+{
+	exp_source *sources;
+	int n_sources;
+	exp_rec *recs;        /* the old ones, sorted by source and file */
+	int n_recs;
+	exp_rec *out;         /* the new ones */
+	int n_out, size_out;
+	long reused, read;
+} exp_index;
+
+/* prototypes */
+int  update( char *index_file, char **trees, int n_trees );
+int  due( char *index_file, int days, char *tree, int all, char *batch );
+int  load_index( char *index_file, exp_index *ix );
+int  add_tree( exp_index *ix, char *tree );
+int  add_source( exp_index *ix, char *path, char *tree, int type );
+int  find_sources( exp_index *ix, int t );
+int  update_source( exp_index *ix, int s, struct stat *st );
+int  read_ca_index( exp_index *ix, int s );
+int  read_certdb( exp_index *ix, int s );
+int  read_mc_dir( exp_index *ix, int s );
+int  read_store( exp_index *ix, int s, struct stat *st );
+int  keep_source( exp_index *ix, int s );
+exp_rec *old_rec( exp_index *ix, int s, char *file );
+exp_rec *new_rec( exp_index *ix, int s );
+void mark_superseded( exp_index *ix );
+int  write_index( char *index_file, exp_index *ix );
+long long asn1_expiry( char *s );
+long long mc_expiry( char *s );
+long long days_from_civil( int y, int m, int d );
+int  compare_expiry( const void *a, const void *b );
+int  compare_file( const void *a, const void *b );
+int  compare_name( const void *a, const void *b );
+int  compare_serial( const void *a, const void *b );
+int  same_name( exp_rec *x, exp_rec *y );
+void print_roster( exp_rec *r );
+
+/* for compare_name() */
+static exp_rec *name_recs;
+static exp_source *name_sources;
+
+static char *help =
+	"\n"
+	"Usage: expiry [-i index_file] update [tree ...]\n"
+	"       expiry [-i index_file] due [-n days] [-t tree] [-a] [-b mc|x509]\n"
+	"  Keeps an index of when the certificates and MiniCerts of the trees\n"
+	"  run out, sorted by date.\n"
+	"Commands:\n"
+	"  update         - Adds the trees, and reads what is new since the last\n"
+	"                   update in all of them\n"
+	"  due            - Lists what runs out in the next days or has already:\n"
+	"                   date, days left, tree, mc|x509, name, serial|user id\n"
+	"Options:\n"
+	"  -i <file>      - The index, it defaults to expiry.idx\n"
+	"  -n <days>      - How far ahead, it defaults to 30\n"
+	"  -t <tree>      - Only that tree, openvpn, www, asterisk\n"
+	"  -a             - Revoked and issued again too\n"
+	"  -b mc|x509     - A batch to issue again instead: the gen-mc roster of\n"
+	"                   the MiniCerts, or the names of the certificates of -t\n"
+	"  -h             - Displays this help\n"
+	"Examples:\n"
+	"  expiry update ../openvpn ../www ../asterisk\n"
+	"  expiry due -n 30\n"
+	"  expiry due -n 60 -t asterisk -b mc > renew.csv\n"
+	"  expiry due -n 60 -t www -b x509 > renew.txt\n"
+	"\n";
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	char *index_file = "expiry.idx", *tree = NULL, *batch = NULL, *cmd;
+	int days = 30, all = 0, ok, c;
+
+	while ( -1 != ( c = getopt( argc, argv, "+hi:" ) ) )
+	{
+		if ( 'i' != c )
+		{
+			fprintf( stderr, help );
+			exit( EXIT_FAILURE );
+		}
+		index_file = optarg;
+	}
+	if ( optind == argc )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	cmd = argv[optind];
+	argv += optind;
+	argc -= optind;
+	optind = 1;
+	while ( -1 != ( c = getopt( argc, argv, "hn:t:ab:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'n':
+				days = atoi( optarg );
+				if ( days < 0 || days > 36500 )
+				{
+					fprintf( stderr, "Error: days must be 0 to 36500.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 't':
+				tree = optarg;
+				break;
+			case 'a':
+				all = 1;
+				break;
+			case 'b':
+				batch = optarg;
+				if ( strcmp( batch, "mc" ) && strcmp( batch, "x509" ) )
+				{
+					fprintf( stderr, "Error: -b is mc or x509.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+	argv += optind;
+	argc -= optind;
+
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( !strcmp( cmd, "update" ) )
+		ok = update( index_file, argv, argc );
+	else if ( !strcmp( cmd, "due" ) && 0 == argc )
+	{
+		/* the names only mean something to the tree they came from */
+		if ( NULL != batch && !strcmp( batch, "x509" ) && NULL == tree )
+		{
+			fprintf( stderr, "Error: -b x509 needs -t, the names go back to one tree.\n" );
+			exit( EXIT_FAILURE );
+		}
+		ok = due( index_file, days, tree, all, batch );
+	}
+	else
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	return( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/******
+ update--
+ ******/
+
+int update( char *index_file, char **trees, int n_trees )
+{
+	/* Reads the old index, adds the trees, and builds the records again
+	   from every source, reusing the old ones of what hasn't changed */
+	exp_index ix;
+	struct stat st;
+	int i, n, s, ok = 1;
+
+	if ( !load_index( index_file, &ix ) )
+		return 0;
+	for ( i = 0; i < n_trees; ++i )
+		if ( !add_tree( &ix, trees[i] ) )
+			return 0;
+	if ( 0 == ix.n_sources )
+	{
+		fprintf( stderr, "Error: no trees in %s yet, give some.\n", index_file );
+		return 0;
+	}
+
+	/* a tree gets its sources found again, a new store or linksys is in
+	   from now on; they come after it, the index before certdb */
+	n = ix.n_sources;
+	for ( s = 0; s < n; ++s )
+		if ( SRC_TREE == ix.sources[s].type && !find_sources( &ix, s ) )
+			return 0;
+
+	for ( s = 0; s < ix.n_sources; ++s )
+	{
+		if ( SRC_TREE == ix.sources[s].type )
+			continue;
+		if ( 0 != stat( ix.sources[s].path, &st ) )
+		{
+			if ( ENOENT != errno )
+			{
+				fprintf( stderr, "Error: can't read %s: %s.\n",
+						ix.sources[s].path, strerror( errno ) );
+				ok = 0;
+			}
+			continue; /* gone, its records go too */
+		}
+		if ( !update_source( &ix, s, &st ) )
+			ok = 0;
+	}
+	if ( !ok )
+		return 0;
+
+	mark_superseded( &ix );
+	qsort( ix.out, ix.n_out, sizeof( exp_rec ), compare_expiry );
+	if ( !write_index( index_file, &ix ) )
+		return 0;
+	fprintf( stderr, "Index: %d records, %ld read, %ld unchanged.\n",
+			ix.n_out, ix.read, ix.reused );
+	free( ix.sources );
+	free( ix.recs );
+	free( ix.out );
+	return 1;
+}
+
+/**********
+ load_index--
+ **********/
+
+int load_index( char *index_file, exp_index *ix )
+{
+	/* The sources and records of the last update, none if there wasn't
+	   one. The records are sorted by source and file for old_rec(). */
+	exp_header h;
+	FILE *fp;
+	int ok;
+
+	memset( ix, 0, sizeof( exp_index ) );
+	if ( NULL == ( fp = fopen( index_file, "rb" ) ) )
+	{
+		if ( ENOENT == errno )
+			return 1;
+		fprintf( stderr, "Error: can't read %s: %s.\n", index_file, strerror( errno ) );
+		return 0;
+	}
+	ok = 1 == fread( &h, sizeof( h ), 1, fp ) &&
+		!memcmp( h.magic, INDEX_MAGIC, sizeof( h.magic ) ) &&
+		h.n_sources >= 0 && h.n_recs >= 0;
+	if ( ok )
+	{
+		ix->sources = malloc( ( h.n_sources + 1 ) * sizeof( exp_source ) );
+		ix->recs = malloc( ( h.n_recs + 1 ) * sizeof( exp_rec ) );
+		ok = NULL != ix->sources && NULL != ix->recs &&
+			(size_t)h.n_sources == fread( ix->sources, sizeof( exp_source ),
+				h.n_sources, fp ) &&
+			(size_t)h.n_recs == fread( ix->recs, sizeof( exp_rec ), h.n_recs, fp );
+	}
+	fclose( fp );
+	if ( !ok )
+	{
+		fprintf( stderr, "Error: %s isn't an expiry index, or a damaged one.\n",
+				index_file );
+		return 0;
+	}
+	ix->n_sources = h.n_sources;
+	ix->n_recs = h.n_recs;
+	qsort( ix->recs, ix->n_recs, sizeof( exp_rec ), compare_file );
+	return 1;
+}
+
+/********
+ add_tree--
+ ********/
+
+int add_tree( exp_index *ix, char *tree )
+{
+	/* A tree is known by its full path, and by its last part for -t */
+	char path[PATH_MAX], *base;
+
+	if ( NULL == realpath( tree, path ) )
+	{
+		fprintf( stderr, "Error: can't find %s: %s.\n", tree, strerror( errno ) );
+		return 0;
+	}
+	base = strrchr( path, '/' );
+	base = NULL != base && base[1] ? base + 1 : path;
+	return add_source( ix, path, base, SRC_TREE );
+}
+
+/**********
+ add_source--
+ **********/
+
+int add_source( exp_index *ix, char *path, char *tree, int type )
+{
+	/* Once each, a new one hasn't been read yet */
+	exp_source *src;
+	int s;
+
+	for ( s = 0; s < ix->n_sources; ++s )
+		if ( !strcmp( ix->sources[s].path, path ) )
+			return 1;
+	if ( strlen( path ) >= sizeof( src->path ) || ix->n_sources >= USHRT_MAX )
+	{
+		fprintf( stderr, "Error: %s: path too long, or too many sources.\n", path );
+		return 0;
+	}
+	if ( NULL == ( src = realloc( ix->sources,
+			( ix->n_sources + 1 ) * sizeof( exp_source ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	ix->sources = src;
+	src += ix->n_sources++;
+	memset( src, 0, sizeof( exp_source ) );
+	strcpy( src->path, path );
+	strncpy( src->tree, tree, sizeof( src->tree ) - 1 );
+	src->type = type;
+	src->mtime = -1;
+	return 1;
+}
+
+/************
+ find_sources--
+ ************/
+
+int find_sources( exp_index *ix, int t )
+{
+	/* What the tree has of private/index, certdb, linksys and *.mcs */
+	static struct { char *name; int type; } fixed[] =
+	{
+		{ "private/index", SRC_INDEX },
+		{ "private/certdb", SRC_CERTDB },
+		{ "private/linksys", SRC_MC_DIR },
+		{ NULL, 0 }
+	};
+	char path[512], tree[32];
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	int i, len;
+
+	/* add_source() may move the sources */
+	strcpy( tree, ix->sources[t].tree );
+	for ( i = 0; NULL != fixed[i].name; ++i )
+	{
+		snprintf( path, sizeof( path ), "%s/%s", ix->sources[t].path,
+				fixed[i].name );
+		if ( 0 == stat( path, &st ) && !add_source( ix, path, tree, fixed[i].type ) )
+			return 0;
+	}
+	snprintf( path, sizeof( path ), "%s/private", ix->sources[t].path );
+	if ( NULL == ( dir = opendir( path ) ) )
+		return 1;
+	while ( NULL != ( de = readdir( dir ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len <= 4 || strcmp( de->d_name + len - 4, ".mcs" ) )
+			continue;
+		snprintf( path, sizeof( path ), "%s/private/%s", ix->sources[t].path,
+				de->d_name );
+		if ( !add_source( ix, path, tree, SRC_STORE ) )
+		{
+			closedir( dir );
+			return 0;
+		}
+	}
+	closedir( dir );
+	return 1;
+}
+
+/*************
+ update_source--
+ *************/
+
+int update_source( exp_index *ix, int s, struct stat *st )
+{
+	exp_source *src = &ix->sources[s];
+	int changed = src->mtime != (long long)st->st_mtime ||
+		src->size != (long long)st->st_size;
+
+	switch ( src->type )
+	{
+		case SRC_INDEX:
+			if ( !changed )
+				return keep_source( ix, s );
+			src->mtime = st->st_mtime;
+			src->size = st->st_size;
+			return read_ca_index( ix, s );
+
+		case SRC_CERTDB:
+			/* the directory is listed every time, what the index has is
+			   left out and it may have changed; only the files that are
+			   new or changed are read */
+			src->mtime = st->st_mtime;
+			src->size = st->st_size;
+			return read_certdb( ix, s );
+
+		case SRC_MC_DIR:
+			/* a file written over in place doesn't change the directory,
+			   so every file is looked at, only to stat() it */
+			src->mtime = st->st_mtime;
+			src->size = st->st_size;
+			return read_mc_dir( ix, s );
+
+		case SRC_STORE:
+			return read_store( ix, s, st );
+	}
+	return 1;
+}
+
+/************
+ read_ca_index--
+ ************/
+
+int read_ca_index( exp_index *ix, int s )
+{
+	/* status<TAB>expiry<TAB>revoked<TAB>serial<TAB>file<TAB>subject, the
+	   name is the subject's CN */
+	char *data, *line, *next, *field[6], *cn, *e;
+	exp_rec *r;
+	FILE *fp;
+	long len;
+	int n;
+
+	if ( NULL == ( data = malloc( ix->sources[s].size + 1 ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	if ( NULL == ( fp = fopen( ix->sources[s].path, "rb" ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", ix->sources[s].path,
+				strerror( errno ) );
+		free( data );
+		return 0;
+	}
+	len = fread( data, 1, ix->sources[s].size, fp );
+	fclose( fp );
+	data[len] = '\0';
+
+	for ( line = data; '\0' != *line; line = next )
+	{
+		if ( NULL != ( next = strchr( line, '\n' ) ) )
+			*next++ = '\0';
+		else
+			next = line + strlen( line );
+		for ( n = 0, field[0] = line; n < 5 && NULL != ( e = strchr( field[n], '\t' ) ); )
+		{
+			*e = '\0';
+			field[++n] = e + 1;
+		}
+		if ( n < 5 || !strchr( "VRE", field[0][0] ) )
+			continue;
+		if ( NULL == ( r = new_rec( ix, s ) ) )
+		{
+			free( data );
+			return 0;
+		}
+		r->status = field[0][0];
+		r->expiry = asn1_expiry( field[1] );
+		strncpy( r->id, field[3], sizeof( r->id ) - 1 );
+		if ( NULL != ( cn = strstr( field[5], "/CN=" ) ) )
+		{
+			cn += 4;
+			n = strcspn( cn, "/" );
+			if ( n >= (int)sizeof( r->name ) )
+				n = sizeof( r->name ) - 1;
+			memcpy( r->name, cn, n );
+		}
+		if ( r->expiry < 0 )
+		{
+			fprintf( stderr, "Warning: %s: serial %s has no expiry date, left out.\n",
+					ix->sources[s].path, r->id );
+			--ix->n_out;
+			continue;
+		}
+		++ix->read;
+	}
+	free( data );
+	return 1;
+}
+
+/***********
+ read_certdb--
+ ***********/
+
+int read_certdb( exp_index *ix, int s )
+{
+	/* The <serial>.pem that the tree's index hasn't got */
+	char path[512], serial[64], **serials = NULL, *key;
+	exp_rec *r, *old;
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	X509 *x;
+	FILE *fp;
+	int i, n = 0, len;
+
+	/* the serials of the tree's index, read already */
+	for ( i = 0; i < ix->n_out; ++i )
+		if ( SRC_INDEX == ix->sources[ix->out[i].source].type &&
+				!strcmp( ix->sources[ix->out[i].source].tree, ix->sources[s].tree ) )
+			++n;
+	if ( NULL == ( serials = malloc( ( n + 1 ) * sizeof( char * ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	for ( i = 0, n = 0; i < ix->n_out; ++i )
+		if ( SRC_INDEX == ix->sources[ix->out[i].source].type &&
+				!strcmp( ix->sources[ix->out[i].source].tree, ix->sources[s].tree ) )
+			serials[n++] = ix->out[i].id;
+	qsort( serials, n, sizeof( char * ), compare_serial );
+
+	if ( NULL == ( dir = opendir( ix->sources[s].path ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", ix->sources[s].path,
+				strerror( errno ) );
+		free( serials );
+		return 0;
+	}
+	while ( NULL != ( de = readdir( dir ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len <= 4 || len >= (int)sizeof( r->file ) ||
+				strcmp( de->d_name + len - 4, ".pem" ) )
+			continue;
+		memcpy( serial, de->d_name, len - 4 );
+		serial[len - 4] = '\0';
+		key = serial;
+		if ( NULL != bsearch( &key, serials, n, sizeof( char * ), compare_serial ) )
+			continue;
+
+		snprintf( path, sizeof( path ), "%s/%s", ix->sources[s].path, de->d_name );
+		if ( 0 != stat( path, &st ) )
+			continue;
+		old = old_rec( ix, s, de->d_name );
+		if ( NULL != old && old->mtime == (long long)st.st_mtime )
+		{
+			if ( NULL == ( r = new_rec( ix, s ) ) )
+				break;
+			*r = *old;
+			++ix->reused;
+			continue;
+		}
+
+		x = NULL;
+		if ( NULL != ( fp = fopen( path, "r" ) ) )
+		{
+			x = PEM_read_X509( fp, NULL, NULL, NULL );
+			fclose( fp );
+		}
+		if ( NULL == x )
+		{
+			fprintf( stderr, "Warning: %s isn't a certificate, left out.\n", path );
+			ERR_clear_error();
+			continue;
+		}
+		if ( NULL == ( r = new_rec( ix, s ) ) )
+		{
+			X509_free( x );
+			break;
+		}
+		r->status = 'V';
+		r->mtime = st.st_mtime;
+		r->expiry = asn1_expiry( (char *)X509_get_notAfter( x )->data );
+		snprintf( r->id, sizeof( r->id ), "%.35s", serial );
+		strcpy( r->file, de->d_name );
+		X509_NAME_get_text_by_NID( X509_get_subject_name( x ), NID_commonName,
+				r->name, sizeof( r->name ) );
+		X509_free( x );
+		if ( r->expiry < 0 )
+		{
+			fprintf( stderr, "Warning: %s has no expiry date, left out.\n", path );
+			--ix->n_out;
+			continue;
+		}
+		++ix->read;
+	}
+	closedir( dir );
+	free( serials );
+	return NULL == de;
+}
+
+/***********
+ read_mc_dir--
+ ***********/
+
+int read_mc_dir( exp_index *ix, int s )
+{
+	/* The *.mini_cert, the user info is the first 80 base64 bytes */
+	char path[512], b64[MC_B64_HEAD];
+	unsigned char info[MC_B64_HEAD];
+	exp_rec *r, *old;
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	int fd, len, ok;
+
+	if ( NULL == ( dir = opendir( ix->sources[s].path ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", ix->sources[s].path,
+				strerror( errno ) );
+		return 0;
+	}
+	while ( NULL != ( de = readdir( dir ) ) )
+	{
+		len = strlen( de->d_name );
+		if ( len <= 10 || len >= (int)sizeof( r->file ) ||
+				strcmp( de->d_name + len - 10, ".mini_cert" ) )
+			continue;
+		snprintf( path, sizeof( path ), "%s/%s", ix->sources[s].path, de->d_name );
+		if ( 0 != stat( path, &st ) )
+			continue;
+		old = old_rec( ix, s, de->d_name );
+		if ( NULL != old && old->mtime == (long long)st.st_mtime )
+		{
+			if ( NULL == ( r = new_rec( ix, s ) ) )
+				break;
+			*r = *old;
+			++ix->reused;
+			continue;
+		}
+
+		ok = -1 != ( fd = open( path, O_RDONLY ) );
+		if ( ok )
+		{
+			ok = MC_B64_HEAD == read( fd, b64, MC_B64_HEAD ) &&
+				GENMC_USER_INFO_LEN == EVP_DecodeBlock( info, (unsigned char *)b64,
+					MC_B64_HEAD );
+			close( fd );
+		}
+		if ( !ok )
+		{
+			fprintf( stderr, "Warning: %s isn't a MiniCert, left out.\n", path );
+			continue;
+		}
+		if ( NULL == ( r = new_rec( ix, s ) ) )
+			break;
+		r->status = 'V';
+		r->mtime = st.st_mtime;
+		memcpy( r->name, info + GENMC_NAME_OFF, GENMC_NAME_MAX );
+		memcpy( r->id, info + GENMC_ID_OFF, GENMC_ID_MAX );
+		strcpy( r->file, de->d_name );
+		if ( ( r->expiry = mc_expiry( (char *)info + GENMC_EXPIRY_OFF ) ) < 0 )
+		{
+			fprintf( stderr, "Warning: %s has a bad expiry date, left out.\n", path );
+			--ix->n_out;
+			continue;
+		}
+		++ix->read;
+	}
+	closedir( dir );
+	return NULL == de;
+}
+
+/**********
+ read_store--
+ **********/
+
+int read_store( exp_index *ix, int s, struct stat *st )
+{
+	/* A gen-mc store is only ever appended to: the old records are kept
+	   and the new ones read, from where the good ones ended. A torn
+	   record at the end is where it ends for now. */
+	exp_source *src = &ix->sources[s];
+	unsigned char rec[STORE_REC_LEN];
+	char magic[8];
+	exp_rec *r;
+	long long off;
+	FILE *fp;
+
+	if ( src->mtime == (long long)st->st_mtime && src->size == (long long)st->st_size )
+		return keep_source( ix, s );
+	off = STORE_HDR_LEN;
+	if ( src->size >= STORE_HDR_LEN && st->st_size >= src->size )
+	{
+		if ( !keep_source( ix, s ) )
+			return 0;
+		off = src->size;
+	}
+
+	if ( NULL == ( fp = fopen( src->path, "rb" ) ) ||
+			1 != fread( magic, sizeof( magic ), 1, fp ) ||
+			memcmp( magic, STORE_MAGIC, sizeof( magic ) ) ||
+			0 != fseek( fp, off, SEEK_SET ) )
+	{
+		fprintf( stderr, "Error: %s isn't a gen-mc store.\n", src->path );
+		if ( NULL != fp )
+			fclose( fp );
+		return 0;
+	}
+	while ( 1 == fread( rec, sizeof( rec ), 1, fp ) )
+	{
+		if ( memcmp( rec, "MCR1", 4 ) ||
+				( (unsigned long)rec[REC_CRC_OFF] << 24 |
+				(unsigned long)rec[REC_CRC_OFF + 1] << 16 |
+				(unsigned long)rec[REC_CRC_OFF + 2] << 8 |
+				rec[REC_CRC_OFF + 3] ) != crc32( 0, rec, REC_CRC_OFF ) )
+			break;
+		if ( NULL == ( r = new_rec( ix, s ) ) )
+		{
+			fclose( fp );
+			return 0;
+		}
+		r->status = 'V';
+		memcpy( r->name, rec + REC_NAME_OFF, GENMC_NAME_MAX );
+		memcpy( r->id, rec + REC_ID_OFF, GENMC_ID_MAX );
+		sprintf( r->file, "%lld", ( off - STORE_HDR_LEN ) / STORE_REC_LEN );
+		off += STORE_REC_LEN;
+		if ( ( r->expiry = mc_expiry( (char *)rec + REC_EXPIRY_OFF ) ) < 0 )
+		{
+			--ix->n_out;
+			continue;
+		}
+		++ix->read;
+	}
+	fclose( fp );
+	src->mtime = st->st_mtime;
+	src->size = off;
+	return 1;
+}
+
+/***********
+ keep_source--
+ ***********/
+
+int keep_source( exp_index *ix, int s )
+{
+	/* The old records of an unchanged source */
+	exp_rec *r;
+	int i;
+
+	for ( i = 0; i < ix->n_recs; ++i )
+	{
+		if ( ix->recs[i].source != s )
+			continue;
+		if ( NULL == ( r = new_rec( ix, s ) ) )
+			return 0;
+		*r = ix->recs[i];
+		++ix->reused;
+	}
+	return 1;
+}
+
+/*******
+ old_rec--
+ *******/
+
+exp_rec *old_rec( exp_index *ix, int s, char *file )
+{
+	exp_rec key;
+
+	key.source = s;
+	strncpy( key.file, file, sizeof( key.file ) );
+	key.file[sizeof( key.file ) - 1] = '\0';
+	return bsearch( &key, ix->recs, ix->n_recs, sizeof( exp_rec ), compare_file );
+}
+
+/*******
+ new_rec--
+ *******/
+
+exp_rec *new_rec( exp_index *ix, int s )
+{
+	exp_rec *r;
+
+	if ( ix->n_out == ix->size_out )
+	{
+		ix->size_out = ix->size_out ? 2 * ix->size_out : 1024;
+		if ( NULL == ( r = realloc( ix->out, ix->size_out * sizeof( exp_rec ) ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			return NULL;
+		}
+		ix->out = r;
+	}
+	r = &ix->out[ix->n_out++];
+	memset( r, 0, sizeof( exp_rec ) );
+	r->source = s;
+	return r;
+}
+
+/***************
+ mark_superseded--
+ ***************/
+
+void mark_superseded( exp_index *ix )
+{
+	/* Of the certificates of a CN in a tree, or the MiniCerts of a user
+	   id, the one valid longest, and not revoked, is the one in use; the
+	   others are superseded. A MiniCert in a file and a store is that
+	   twice. */
+	int *order, i, j;
+
+	if ( NULL == ( order = malloc( ( ix->n_out + 1 ) * sizeof( int ) ) ) )
+		return; /* none are marked, the batch has more in it */
+	for ( i = 0; i < ix->n_out; ++i )
+		order[i] = i;
+	name_recs = ix->out;
+	name_sources = ix->sources;
+	qsort( order, ix->n_out, sizeof( int ), compare_name );
+	for ( i = 0; i < ix->n_out; i = j )
+	{
+		int in_use = 0;
+
+		for ( j = i; j < ix->n_out && 0 == same_name( &ix->out[order[i]],
+				&ix->out[order[j]] ); ++j )
+		{
+			exp_rec *r = &ix->out[order[j]];
+
+			r->superseded = 0;
+			if ( 'R' == r->status )
+				continue;
+			r->superseded = in_use;
+			in_use = 1;
+		}
+	}
+	free( order );
+	return;
+}
+
+/***********
+ write_index--
+ ***********/
+
+int write_index( char *index_file, exp_index *ix )
+{
+	/* Written to .new and renamed, a due reading it sees the old one or
+	   the new one */
+	char new_path[512];
+	exp_header h;
+	FILE *fp;
+	int ok;
+
+	memset( &h, 0, sizeof( h ) );
+	memcpy( h.magic, INDEX_MAGIC, sizeof( h.magic ) );
+	h.n_sources = ix->n_sources;
+	h.n_recs = ix->n_out;
+	h.updated = time( NULL );
+	snprintf( new_path, sizeof( new_path ), "%s.new", index_file );
+	ok = NULL != ( fp = fopen( new_path, "wb" ) );
+	if ( ok )
+	{
+		ok = 1 == fwrite( &h, sizeof( h ), 1, fp ) &&
+			(size_t)ix->n_sources == fwrite( ix->sources, sizeof( exp_source ),
+				ix->n_sources, fp ) &&
+			(size_t)ix->n_out == fwrite( ix->out, sizeof( exp_rec ), ix->n_out, fp );
+		ok = 0 == fclose( fp ) && ok;
+	}
+	if ( !ok || 0 != rename( new_path, index_file ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", index_file, strerror( errno ) );
+		remove( new_path );
+		return 0;
+	}
+	return 1;
+}
+
+/***
+ due--
+ ***/
+
+int due( char *index_file, int days, char *tree, int all, char *batch )
+{
+	/* The records are sorted by date, the last one due is found by
+	   binary search and everything before it is due */
+	exp_header *h;
+	exp_source *sources;
+	exp_rec *recs, *r;
+	struct stat st;
+	struct tm *tm;
+	char date[32];
+	time_t now, t;
+	long long limit;
+	void *map;
+	int fd, lo, hi, mid, mc, n = 0;
+
+	if ( -1 == ( fd = open( index_file, O_RDONLY ) ) || 0 != fstat( fd, &st ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s, run \"expiry update\" first.\n",
+				index_file, strerror( errno ) );
+		return 0;
+	}
+	map = (size_t)st.st_size >= sizeof( exp_header ) ?
+		mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+	close( fd );
+	h = map;
+	if ( MAP_FAILED == map || memcmp( h->magic, INDEX_MAGIC, sizeof( h->magic ) ) ||
+			h->n_sources < 0 || h->n_recs < 0 || (long long)st.st_size !=
+			(long long)sizeof( exp_header ) + (long long)h->n_sources *
+			(long long)sizeof( exp_source ) + (long long)h->n_recs *
+			(long long)sizeof( exp_rec ) )
+	{
+		fprintf( stderr, "Error: %s isn't an expiry index, or a damaged one.\n",
+				index_file );
+		if ( MAP_FAILED != map )
+			munmap( map, st.st_size );
+		return 0;
+	}
+	sources = (exp_source *)( h + 1 );
+	recs = (exp_rec *)( sources + h->n_sources );
+
+	now = time( NULL );
+	limit = (long long)now + days * 86400LL;
+	for ( lo = 0, hi = h->n_recs; lo < hi; )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		if ( recs[mid].expiry <= limit )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for ( r = recs; r < recs + lo; ++r )
+	{
+		if ( r->source >= h->n_sources ||
+				( NULL != tree && strcmp( sources[r->source].tree, tree ) ) ||
+				( !all && ( 'R' == r->status || r->superseded ) ) )
+			continue;
+		mc = SRC_MC_DIR == sources[r->source].type ||
+			SRC_STORE == sources[r->source].type;
+		if ( NULL != batch )
+		{
+			if ( mc != !strcmp( batch, "mc" ) )
+				continue;
+			if ( mc )
+				print_roster( r );
+			else
+				printf( "%s\n", r->name );
+		}
+		else
+		{
+			t = r->expiry;
+			tm = localtime( &t );
+			strftime( date, sizeof( date ), "%Y-%m-%d %H:%M", tm );
+			printf( "%s\t%lld\t%s\t%s\t%s\t%s\n", date,
+					( r->expiry - (long long)now ) / 86400, sources[r->source].tree,
+					mc ? "mc" : "x509", r->name, r->id );
+		}
+		++n;
+	}
+	munmap( map, st.st_size );
+	fprintf( stderr, "Due: %d in the next %d days.\n", n, days );
+	return 1;
+}
+
+/***********
+ asn1_expiry--
+ ***********/
+
+long long asn1_expiry( char *s )
+{
+	/* YYMMDDHHMMSSZ, as in the index and a UTCTime, or YYYYMMDDHHMMSSZ,
+	   a GeneralizedTime; UTC, so there's no mktime() */
+	int v[7], i, n, y;
+
+	n = 'Z' == s[12] ? 12 : 'Z' == s[14] ? 14 : 0;
+	if ( 0 == n )
+		return -1;
+	for ( i = 0; i < n; ++i )
+		if ( s[i] < '0' || s[i] > '9' )
+			return -1;
+	for ( i = 0; i < n / 2; ++i )
+		v[i] = ( s[2 * i] - '0' ) * 10 + s[2 * i + 1] - '0';
+	if ( 12 == n )
+		y = v[0] < 50 ? 2000 + v[0] : 1900 + v[0];
+	else
+		y = v[0] * 100 + v[1];
+	i = 12 == n ? 1 : 2;
+	return days_from_civil( y, v[i], v[i + 1] ) * 86400 +
+		v[i + 2] * 3600 + v[i + 3] * 60 + v[i + 4];
+}
+
+/*********
+ mc_expiry--
+ *********/
+
+long long mc_expiry( char *s )
+{
+	/* HHMMSSMMDDYY in local time, as gen-mc sets it. mktime() is called
+	   once per day, not per MiniCert: a batch gives them all the same
+	   few days. On the day the clock changes the hours after it are an
+	   hour out, it doesn't matter to days ahead. */
+	static char last_day[6];
+	static long long midnight = -1;
+	struct tm tm;
+	time_t t;
+	int i;
+
+	for ( i = 0; i < 12; ++i )
+		if ( s[i] < '0' || s[i] > '9' )
+			return -1;
+	if ( midnight < 0 || memcmp( last_day, s + 6, 6 ) )
+	{
+		memset( &tm, 0, sizeof( tm ) );
+		tm.tm_mon = ( s[6] - '0' ) * 10 + s[7] - '0' - 1;
+		tm.tm_mday = ( s[8] - '0' ) * 10 + s[9] - '0';
+		tm.tm_year = 100 + ( s[10] - '0' ) * 10 + s[11] - '0';
+		tm.tm_isdst = -1;
+		if ( -1 == ( t = mktime( &tm ) ) )
+			return -1;
+		memcpy( last_day, s + 6, 6 );
+		midnight = t;
+	}
+	return midnight + ( ( s[0] - '0' ) * 10 + s[1] - '0' ) * 3600 +
+		( ( s[2] - '0' ) * 10 + s[3] - '0' ) * 60 + ( s[4] - '0' ) * 10 + s[5] - '0';
+}
+
+/***************
+ days_from_civil--
+ ***************/
+
+long long days_from_civil( int y, int m, int d )
+{
+	/* days since 1 Jan 1970 of a Gregorian date */
+	long long era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = ( y >= 0 ? y : y - 399 ) / 400;
+	yoe = y - era * 400;
+	doy = ( 153 * ( m + ( m > 2 ? -3 : 9 ) ) + 2 ) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+/************
+ print_roster--
+ ************/
+
+void print_roster( exp_rec *r )
+{
+	/* display_name,user_id for gen-mc -b; a comma needs the quotes and a
+	   quote can't be in a roster at all */
+	if ( strchr( r->name, '"' ) || strchr( r->id, '"' ) )
+	{
+		fprintf( stderr, "Warning: %s has a '\"', left out of the roster.\n", r->name );
+		return;
+	}
+	if ( strchr( r->name, ',' ) || strchr( r->name, '#' ) )
+		printf( "\"%s\",", r->name );
+	else
+		printf( "%s,", r->name );
+	if ( strchr( r->id, ',' ) )
+		printf( "\"%s\"\n", r->id );
+	else
+		printf( "%s\n", r->id );
+	return;
+}
+
+/**************
+ compare_expiry--
+ **************/
+
+int compare_expiry( const void *a, const void *b )
+{
+	const exp_rec *x = a, *y = b;
+	int c;
+
+	if ( x->expiry != y->expiry )
+		return x->expiry < y->expiry ? -1 : 1;
+	if ( x->source != y->source )
+		return x->source < y->source ? -1 : 1;
+	if ( 0 != ( c = strcmp( x->name, y->name ) ) )
+		return c;
+	return strcmp( x->id, y->id );
+}
+
+/************
+ compare_file--
+ ************/
+
+int compare_file( const void *a, const void *b )
+{
+	const exp_rec *x = a, *y = b;
+
+	if ( x->source != y->source )
+		return x->source < y->source ? -1 : 1;
+	return strcmp( x->file, y->file );
+}
+
+/*********
+ same_name--
+ *********/
+
+int same_name( exp_rec *x, exp_rec *y )
+{
+	/* 0 if they are the same tree, kind and name: the CN of a
+	   certificate, the user id of a MiniCert */
+	exp_source *sx = &name_sources[x->source], *sy = &name_sources[y->source];
+	int mx = SRC_MC_DIR == sx->type || SRC_STORE == sx->type;
+	int my = SRC_MC_DIR == sy->type || SRC_STORE == sy->type;
+	int c;
+
+	if ( 0 != ( c = strcmp( sx->tree, sy->tree ) ) )
+		return c;
+	if ( mx != my )
+		return mx - my;
+	if ( mx )
+		return strcmp( x->id, y->id );
+	return strcmp( x->name, y->name );
+}
+
+/************
+ compare_name--
+ ************/
+
+int compare_name( const void *a, const void *b )
+{
+	/* by tree, kind and name or user id, the one valid longest first */
+	exp_rec *x = &name_recs[*(const int *)a], *y = &name_recs[*(const int *)b];
+	int c;
+
+	if ( 0 != ( c = same_name( x, y ) ) )
+		return c;
+	if ( x->expiry != y->expiry )
+		return x->expiry > y->expiry ? -1 : 1;
+	if ( x->source != y->source )
+		return x->source < y->source ? -1 : 1;
+	return strcmp( x->file, y->file );
+}
+
+/**************
+ compare_serial--
+ **************/
+
+int compare_serial( const void *a, const void *b )
+{
+	return strcasecmp( *(char * const *)a, *(char * const *)b );
+}
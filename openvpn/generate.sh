@@ -6,6 +6,10 @@ DAYS=3650
 HOSTNAME=vpn
 KEY_SIZE=2048
 DH_KEY_SIZE=${KEY_SIZE}
+# dh-pool take: -N for the RFC 7919 group when the pool is empty
+DH_POOL_FLAGS=
+# ovpn-crl: -F signs crl.pem again on every -r, for a server without crl-verify dir
+OVPN_CRL_FLAGS=
 
 #TYPE=tun
 TYPE=tap
@@ -18,12 +22,35 @@ export O="Paranoid Inc."
 export OU="Security"
 export CN=${HOSTNAME}
 #--------------------------------------------------------
+# with ../ca-db openssl ca runs with the CA locked, see ../ca-db
+if [ -x ../ca-db/ca-db ]
+    then
+        CA_DB=../ca-db/ca-db
+        CA_DB_RUN="${CA_DB} run"
+fi
+#--------------------------------------------------------
 _dirs="private private/crl private/certdb private/keys private/req private/certs private/arc"
 
 function reverse {
     P="private"
     FILES="req/$1.csr keys/$1.key certs/$1.cert $1_tcp.conf $1_udp.conf $1_tcp.ovpn $1_udp.ovpn arc/$1.tar.gz"
 
+    # only this certificate is taken out, others may have been issued since
+    if [ -n "${CA_DB}" ]
+        then
+            SERIAL=`openssl x509 -in $P/certs/$1.cert -noout -serial 2>/dev/null | cut -d= -f2`
+            if [ -n "${SERIAL}" ]
+                then
+                    ${CA_DB} drop ${SERIAL} > /dev/null 2>&1
+                    rm $P/certdb/${SERIAL}.pem > /dev/null 2>&1
+            fi
+            for file in $FILES
+                do rm $P/$file > /dev/null 2>&1
+            done
+            echo "Restoring previous state"
+            exit 2
+    fi
+
     S=`openssl x509 -in private/certdb/$(cat private/serial).pem -noout -subject | awk 'BEGIN {FS = "/"} ;{print $4}' | tr -d "CN="`
     SO=`openssl x509 -in private/certdb/$(cat private/serial.old).pem -noout -subject | awk 'BEGIN {FS = "/"} ;{print $4}' | tr -d "CN="`
 
@@ -69,6 +96,11 @@ if test -f private/index
     else touch private/index
 fi
 
+if test -f private/crl/crlnumber
+    then echo "File \"crlnumber\" is exist"
+    else echo 01 > private/crl/crlnumber
+fi
+
 if test -f private/CA_key.pem && \
    test -f private/CA_key.pem && \
    test -f private/keys/${HOSTNAME}.key && \
@@ -77,15 +109,24 @@ if test -f private/CA_key.pem && \
     then
         if [ -n "$1" ]
             then
-                if [ "$1" = "-r" ]
+                if [ "$1" = "-r" ] && [ -x ./ovpn-crl ]
+                    then
+                        # a delta CRL and crl/revoked/, see ovpn-crl.c
+                        shift
+                        ./ovpn-crl ${OVPN_CRL_FLAGS} "$@"
+                elif [ "$1" = "-r" ]
+                    then
+                        ${CA_DB_RUN} openssl ca -config openssl.conf -revoke private/certs/$2.cert
+                        ${CA_DB_RUN} openssl ca -gencrl -config openssl.conf -out private/crl/crl.pem
+                elif [ -x ./ovpn-bundle ]
                     then
-                        openssl ca -config openssl.conf -revoke private/certs/$2.cert
-                        openssl ca -gencrl -config openssl.conf -out private/crl/crl.pem
+                        # all the names at once, see ovpn-bundle.c
+                        ./ovpn-bundle -H ${HOSTNAME} -T ${TYPE} "$@"
                 else
                     echo "Generating $1 keyfiles"
                     export CN=$1
                     openssl req -new -nodes -config openssl.conf -keyout private/keys/$1.key -out private/req/$1.csr || reverse $1
-                    openssl ca -batch -config openssl.conf -out private/certs/$1.cert -infiles private/req/$1.csr || reverse $1
+                    ${CA_DB_RUN} openssl ca -batch -config openssl.conf -out private/certs/$1.cert -infiles private/req/$1.csr || reverse $1
 
                     cd private
 
@@ -112,14 +153,20 @@ if test -f private/CA_key.pem && \
         openssl req -config openssl.conf -new -nodes -keyout private/keys/${HOSTNAME}.key -out private/req/${HOSTNAME}.csr -newkey rsa:${KEY_SIZE} || exit 1
 
         # Для создания сертификата сервера необходимо подписать запрос на сертификат сервера  самоподписным доверенным сертификатом (CA).
-        openssl ca -batch -config openssl.conf -extensions server -out private/certs/${HOSTNAME}.cert -infiles private/req/${HOSTNAME}.csr
+        ${CA_DB_RUN} openssl ca -batch -config openssl.conf -extensions server -out private/certs/${HOSTNAME}.cert -infiles private/req/${HOSTNAME}.csr
         # Просмотр результата генерации сертификата
         openssl x509 -noout -text -in private/certs/${HOSTNAME}.cert
 
         # Создание файла параметров Диффи-Хэлмана
-        openssl dhparam -out private/dh${DH_KEY_SIZE}.pem ${DH_KEY_SIZE} || exit 1
+        # made ahead of time if dh-pool is built, see ../dh-pool
+        if [ -x ../dh-pool/dh-pool ]
+            then
+                ../dh-pool/dh-pool take -b ${DH_KEY_SIZE} ${DH_POOL_FLAGS} -o private/dh${DH_KEY_SIZE}.pem || exit 1
+            else
+                openssl dhparam -out private/dh${DH_KEY_SIZE}.pem ${DH_KEY_SIZE} || exit 1
+        fi
 
-        openssl ca -gencrl -config openssl.conf -out private/crl/crl.pem
+        ${CA_DB_RUN} openssl ca -gencrl -config openssl.conf -out private/crl/crl.pem
 
         # TLS Auth
         /usr/sbin/openvpn --genkey --secret private/ta.key || exit 1
@@ -0,0 +1,721 @@
+/*
+ovpn-bundle - builds OpenVPN client bundles in one process
+
+generate.sh makes a client with openssl req, openssl ca, makeconf.py
+four times and tar, eight or so processes and a dozen files written,
+read back and deleted per client. This does the same for a whole list
+of clients in one process: the CA and openssl.conf are loaded once and
+the clients are built on a pool of threads.
+
+For each client it writes, as openssl req and openssl ca would:
+
+	private/keys/<name>.key     the 2048-bit key, PKCS#8, mode 0600
+	private/req/<name>.csr      the certificate request
+	private/certs/<name>.cert   the certificate, text and PEM
+	private/certdb/<serial>.pem the same, for the CA's records
+	private/arc/<name>.tar.gz   the bundle, with ta.key, CA_cert.pem and
+	                            the udp/tcp .conf and .ovpn files
+
+The certificate follows the [ ca ] section of openssl.conf: its dir,
+files, default_days, default_md, policy, x509_extensions and
+unique_subject. The request's subject is [ req_distinguished_name ]
+with CN set to the client's name, so the environment generate.sh sets
+up is needed for its $ENV:: values. The configs are CLIENT_TEMPLATE out
+of makeconf.py, or a file with just the template in it, compiled once
+by ovpn_tmpl.c; the .conf files are only ever in the bundle, as before.
+HOSTNAME and TYPE, and any other %(KEY)s the template has, are given
+with -D KEY=VALUE or in a -V file of KEY=VALUE lines.
+
+With -i it also writes private/arc/<name>.ovpn, a profile with the CA,
+the certificate, the key and ta.key in it, that OpenVPN can use on its
+own. -A leaves the tar.gz out then.
+
+The serial numbers for the whole list are taken from private/serial
+before the first certificate is signed, so a run that dies half way
+leaves a gap and never hands one out twice. private/index gets the new
+certificates when they are all done; index, index.attr and serial are
+rotated to .old like openssl ca does, so "generate.sh -r" and its
+undo work as before.
+
+Usage: ovpn-bundle [-c openssl.conf] [-t makeconf.py] [-H hostname]
+                   [-T tun|tap] [-D KEY=VALUE] [-V vars_file]
+                   [-i udp|tcp [-A]] [-j threads] [-f names_file] [name ...]
+
+16oct2026, v0.1
+ - first version
+
+16oct2026, v0.2
+ - openssl.conf and the CA are read by ovpn_ca.c, which ovpn-crl uses too
+
+16oct2026, v0.3
+ - the template is compiled once, the configs of a client are rendered
+   into one buffer per thread
+ - -D and -V for the template's variables, -H and -T set two of them
+ - -i writes a .ovpn with everything inline, -A without the tar.gz
+
+16oct2026, v0.4
+ - the CA is locked while the index and serial are read and written,
+   another ovpn-bundle, ca-db or generate.sh can run at the same time
+
+16oct2026, v0.5
+ - the checks, the index, the tar.gz and the thread locks are in
+   ovpn_ca.c, shared with ../www/www-issue
+
+16oct2026, v0.6
+ - the clients are reserved in the index while they are built, two
+   runs with the same name can't both build it
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <openssl/conf.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include "ovpn_ca.h"
+#include "ovpn_tmpl.h"
+
+/* what goes in every bundle besides the client's own files */
+typedef struct bundle_conf
+{
+	char *ta_key;         /* as it is */
+	long ta_key_len;
+	char *template;       /* makeconf.py CLIENT_TEMPLATE */
+	tmpl_var *vars;       /* for the template, the last one of a KEY wins */
+	int n_vars, size_vars;
+	tmpl *conf_t, *ovpn_t, *inline_t;
+	char *inline_proto;   /* -i, or NULL */
+	int archive;
+} bundle_conf;
+
+/* where a worker renders the configs, kept from one client to the next */
+typedef struct bundle_buf
+{
+	char *data;
+	long size;
+} bundle_buf;
+
+/* one client */
+typedef ca_cert bundle;
+
+typedef struct bundle_run
+{
+	ca_conf *ca;
+	bundle_conf *bc;
+	bundle *bundles;
+	int n_bundles;
+	int next;             /* next bundle for a worker to take */
+	pthread_mutex_t lock;
+} bundle_run;
+
+/* prototypes */
+int  load_template( bundle_conf *bc, char *makeconf_file );
+int  add_var( bundle_conf *bc, char *key_value );
+int  read_vars( bundle_conf *bc, char *vars_file );
+int  read_names( char *names_file, char ***names, int *n_names );
+void *bundle_worker( void *arg );
+int  build_bundle( ca_conf *ca, bundle_conf *bc, bundle *b, bundle_buf *buf );
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	ca_conf ca;
+	bundle_conf bc;
+	bundle_run run;
+	bundle *b;
+	pthread_t *threads;
+	char **names = NULL;
+	char *conf_file = "openssl.conf", *makeconf_file = "makeconf.py";
+	char *names_file = NULL, path[512];
+	int n_names = 0, n_threads, n_started = 0;
+	int built = 0, failed = 0, i, j, c;
+	char *help =
+		"\n"
+		"Usage: ovpn-bundle [options] <name> [<name> ...]\n"
+		"       ovpn-bundle [options] -f <names_file>\n"
+		"  Builds a key, certificate and private/arc/<name>.tar.gz bundle for\n"
+		"  every client, like \"generate.sh <name>\" does for one. Run it where\n"
+		"  generate.sh is, with its environment (C, ST, L, O, OU, CN) set.\n"
+		"Options:\n"
+		"  -c <conf>      - The openssl.conf with the CA, it defaults to openssl.conf\n"
+		"  -t <makeconf>  - Where CLIENT_TEMPLATE is, it defaults to makeconf.py\n"
+		"  -H <hostname>  - The server's name in the configs, it defaults to vpn\n"
+		"  -T tun|tap     - The device type in the configs, it defaults to tap\n"
+		"  -D <KEY=VALUE> - Sets %(KEY)s in the template, -H is -D HOSTNAME=...\n"
+		"  -V <file>      - Reads KEY=VALUE lines for the template from a file\n"
+		"  -i udp|tcp     - Writes private/arc/<name>.ovpn too, with the CA, the\n"
+		"                   certificate, the key and ta.key inline\n"
+		"  -A             - With -i, leaves the tar.gz out\n"
+		"  -j <threads>   - Clients built at once, it defaults to the number of CPUs\n"
+		"  -f <file>      - Read the names from a file, one per line, - for stdin.\n"
+		"                   Blank lines and # comments are skipped\n"
+		"  -h             - Displays this help\n"
+		"\n";
+
+	memset( &bc, 0, sizeof( bc ) );
+	bc.archive = 1;
+	if ( !add_var( &bc, "HOSTNAME=vpn" ) || !add_var( &bc, "TYPE=tap" ) )
+		exit( EXIT_FAILURE );
+	n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+
+	while ( -1 != ( c = getopt( argc, argv, "hc:t:H:T:D:V:i:Aj:f:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'c':
+				conf_file = optarg;
+				break;
+			case 't':
+				makeconf_file = optarg;
+				break;
+			case 'H':
+				snprintf( path, sizeof( path ), "HOSTNAME=%s", optarg );
+				if ( !add_var( &bc, path ) )
+					exit( EXIT_FAILURE );
+				break;
+			case 'T':
+				if ( strcmp( optarg, "tun" ) && strcmp( optarg, "tap" ) )
+				{
+					fprintf( stderr, "Error: the type must be tun or tap.\n" );
+					exit( EXIT_FAILURE );
+				}
+				snprintf( path, sizeof( path ), "TYPE=%s", optarg );
+				if ( !add_var( &bc, path ) )
+					exit( EXIT_FAILURE );
+				break;
+			case 'D':
+				if ( !add_var( &bc, optarg ) )
+					exit( EXIT_FAILURE );
+				break;
+			case 'V':
+				if ( !read_vars( &bc, optarg ) )
+					exit( EXIT_FAILURE );
+				break;
+			case 'i':
+				if ( strcmp( optarg, "udp" ) && strcmp( optarg, "tcp" ) )
+				{
+					fprintf( stderr, "Error: the inline profile is udp or tcp.\n" );
+					exit( EXIT_FAILURE );
+				}
+				bc.inline_proto = optarg;
+				break;
+			case 'A':
+				bc.archive = 0;
+				break;
+			case 'j':
+				if ( ( n_threads = atoi( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: number of threads must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'f':
+				names_file = optarg;
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+	if ( NULL != names_file && !read_names( names_file, &names, &n_names ) )
+		exit( EXIT_FAILURE );
+	if ( NULL == names_file )
+	{
+		names = argv + optind;
+		n_names = argc - optind;
+	}
+	if ( 0 == n_names )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+	if ( !bc.archive && NULL == bc.inline_proto )
+	{
+		fprintf( stderr, "Error: -A is for -i, there would be nothing to write.\n" );
+		exit( EXIT_FAILURE );
+	}
+
+	umask( 022 );
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( !ca_load( &ca, conf_file ) || !load_template( &bc, makeconf_file ) )
+		exit( EXIT_FAILURE );
+	snprintf( path, sizeof( path ), "%s/ta.key", ca.dir );
+	if ( NULL == ( bc.ta_key = read_file( path, &bc.ta_key_len ) ) )
+		exit( EXIT_FAILURE );
+	if ( !tmpl_compile( &bc.conf_t, bc.template, bc.vars, bc.n_vars, 0, NULL, NULL ) ||
+			!tmpl_compile( &bc.ovpn_t, bc.template, bc.vars, bc.n_vars, TMPL_CRLF,
+				NULL, NULL ) ||
+			( NULL != bc.inline_proto && !tmpl_compile( &bc.inline_t, bc.template,
+				bc.vars, bc.n_vars, TMPL_CRLF | TMPL_INLINE, ca.ca_pem, bc.ta_key ) ) )
+		exit( EXIT_FAILURE );
+
+	/* every name is checked before anything is signed, a bad one or one
+	   that is there already is left out */
+	if ( NULL == ( run.bundles = calloc( n_names, sizeof( bundle ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		exit( EXIT_FAILURE );
+	}
+	run.n_bundles = 0;
+	for ( i = 0; i < n_names; ++i )
+	{
+		b = &run.bundles[run.n_bundles];
+		if ( !check_name( names[i] ) || !policy_subject( &ca, names[i], &b->subject ) )
+		{
+			++failed;
+			continue;
+		}
+		strcpy( b->name, names[i] );
+		b->days = ca.days;
+		run.n_bundles++;
+	}
+	if ( !ca_lock( &ca ) ||
+			!ca_check( &ca, run.bundles, run.n_bundles, sizeof( bundle ), 0, "" ) )
+		exit( EXIT_FAILURE );
+	for ( i = j = 0; i < run.n_bundles; ++i )
+		if ( run.bundles[i].err )
+		{
+			X509_NAME_free( run.bundles[i].subject );
+			++failed;
+		}
+		else
+			run.bundles[j++] = run.bundles[i];
+	run.n_bundles = j;
+
+	if ( !ca_take_serials( &ca, run.bundles, run.n_bundles, sizeof( bundle ) ) ||
+			!ca_reserve( &ca, run.bundles, run.n_bundles, sizeof( bundle ) ) )
+		exit( EXIT_FAILURE );
+	ca_unlock( &ca );
+
+	/* the clients are built on the threads, in any order */
+	if ( n_threads > run.n_bundles )
+		n_threads = run.n_bundles > 0 ? run.n_bundles : 1;
+	run.ca = &ca;
+	run.bc = &bc;
+	run.next = 0;
+	pthread_mutex_init( &run.lock, NULL );
+	thread_setup();
+	if ( NULL != ( threads = calloc( n_threads, sizeof( pthread_t ) ) ) )
+		for ( ; n_started < n_threads; ++n_started )
+			if ( pthread_create( &threads[n_started], NULL, bundle_worker, &run ) )
+				break;
+	if ( 0 == n_started )
+		bundle_worker( &run ); /* on this thread then */
+	for ( i = 0; i < n_started; ++i )
+		pthread_join( threads[i], NULL );
+	free( threads );
+	thread_cleanup();
+	pthread_mutex_destroy( &run.lock );
+
+	for ( i = 0; i < run.n_bundles; ++i )
+	{
+		if ( run.bundles[i].err )
+			++failed;
+		else
+			++built;
+	}
+	if ( run.n_bundles > 0 && ( !ca_lock( &ca ) ||
+			!ca_write_index( &ca, run.bundles, run.n_bundles, sizeof( bundle ) ) ) )
+		failed += built;
+	ca_unlock( &ca );
+
+	fprintf( stderr, "Bundles: %d built, %d failed.\n", built, failed );
+	for ( i = 0; i < run.n_bundles; ++i )
+	{
+		X509_NAME_free( run.bundles[i].subject );
+		BN_free( run.bundles[i].serial );
+	}
+	free( run.bundles );
+	tmpl_free( bc.conf_t );
+	tmpl_free( bc.ovpn_t );
+	tmpl_free( bc.inline_t );
+	for ( i = 0; i < bc.n_vars; ++i )
+		free( bc.vars[i].key );
+	free( bc.vars );
+	free( bc.ta_key );
+	free( bc.template );
+	ca_free( &ca );
+	return( failed ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+/*************
+ load_template--
+ *************/
+
+int load_template( bundle_conf *bc, char *makeconf_file )
+{
+	/* CLIENT_TEMPLATE = """...""" out of makeconf.py, as python has it */
+	char *py, *start, *end;
+	long len;
+
+	if ( NULL == ( py = read_file( makeconf_file, &len ) ) )
+		return 0;
+	if ( NULL == strstr( py, "CLIENT_TEMPLATE" ) )
+	{
+		/* a file with only the template */
+		bc->template = py;
+		return 1;
+	}
+	if ( NULL == ( start = strstr( strstr( py, "CLIENT_TEMPLATE" ), "\"\"\"" ) ) ||
+			NULL == ( end = strstr( start + 3, "\"\"\"" ) ) )
+	{
+		fprintf( stderr, "Error: CLIENT_TEMPLATE in %s isn't a \"\"\" string.\n",
+				makeconf_file );
+		free( py );
+		return 0;
+	}
+	*end = '\0';
+	bc->template = strdup( start + 3 );
+	free( py );
+	return NULL != bc->template;
+}
+
+/*******
+ add_var--
+ *******/
+
+int add_var( bundle_conf *bc, char *key_value )
+{
+	/* KEY=VALUE, KEY as python has names */
+	char *s, *key;
+
+	for ( s = key_value; '_' == *s || isalnum( (unsigned char)*s ); ++s )
+		;
+	if ( s == key_value || '=' != *s )
+	{
+		fprintf( stderr, "Error: %s isn't KEY=VALUE.\n", key_value );
+		return 0;
+	}
+	if ( bc->n_vars == bc->size_vars )
+	{
+		bc->size_vars = bc->size_vars ? 2 * bc->size_vars : 16;
+		bc->vars = realloc( bc->vars, bc->size_vars * sizeof( tmpl_var ) );
+	}
+	if ( NULL == bc->vars || NULL == ( key = strdup( key_value ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	key[s - key_value] = '\0';
+	bc->vars[bc->n_vars].key = key;
+	bc->vars[bc->n_vars++].value = key + ( s - key_value ) + 1;
+	return 1;
+}
+
+/*********
+ read_vars--
+ *********/
+
+int read_vars( bundle_conf *bc, char *vars_file )
+{
+	/* KEY=VALUE lines, blank lines and # comments skipped */
+	char line[1024], *s, *e;
+	FILE *fp;
+	int ok = 1;
+
+	if ( NULL == ( fp = fopen( vars_file, "r" ) ) )
+	{
+		fprintf( stderr, "Error: variables file %s not found.\n", vars_file );
+		return 0;
+	}
+	while ( ok && NULL != fgets( line, sizeof( line ), fp ) )
+	{
+		for ( s = line; isspace( (unsigned char)*s ); ++s )
+			;
+		e = s + strcspn( s, "\r\n" );
+		*e = '\0';
+		if ( '\0' != *s && '#' != *s )
+			ok = add_var( bc, s );
+	}
+	fclose( fp );
+	return ok;
+}
+
+/**********
+ read_names--
+ **********/
+
+int read_names( char *names_file, char ***names, int *n_names )
+{
+	/* One name per line, a lone "-" is stdin */
+	char line[256], *s, *e;
+	FILE *fp;
+	int size = 0;
+
+	if ( !strcmp( names_file, "-" ) )
+		fp = stdin;
+	else if ( NULL == ( fp = fopen( names_file, "r" ) ) )
+	{
+		fprintf( stderr, "Error: names file %s not found.\n", names_file );
+		return 0;
+	}
+	*names = NULL;
+	*n_names = 0;
+	while ( NULL != fgets( line, sizeof( line ), fp ) )
+	{
+		for ( s = line; isspace( (unsigned char)*s ); ++s )
+			;
+		for ( e = s + strlen( s ); e > s && isspace( (unsigned char)e[-1] ); --e )
+			;
+		*e = '\0';
+		if ( '\0' == *s || '#' == *s )
+			continue;
+		if ( *n_names == size )
+		{
+			size = size ? 2 * size : 256;
+			if ( NULL == ( *names = realloc( *names, size * sizeof( char * ) ) ) )
+			{
+				fprintf( stderr, "Error: out of memory.\n" );
+				return 0;
+			}
+		}
+		if ( NULL == ( ( *names )[( *n_names )++] = strdup( s ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			return 0;
+		}
+	}
+	if ( fp != stdin )
+		fclose( fp );
+	return 1;
+}
+
+/*************
+ bundle_worker--
+ *************/
+
+void *bundle_worker( void *arg )
+{
+	bundle_run *run = arg;
+	bundle_buf buf;
+	bundle *b;
+
+	memset( &buf, 0, sizeof( buf ) );
+	for ( ;; )
+	{
+		pthread_mutex_lock( &run->lock );
+		b = run->next < run->n_bundles ? &run->bundles[run->next++] : NULL;
+		pthread_mutex_unlock( &run->lock );
+		if ( NULL == b )
+			break;
+		b->err = !build_bundle( run->ca, run->bc, b, &buf );
+	}
+	if ( NULL != buf.data )
+		OPENSSL_cleanse( buf.data, buf.size );
+	free( buf.data );
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/************
+ build_bundle--
+ ************/
+
+int build_bundle( ca_conf *ca, bundle_conf *bc, bundle *b, bundle_buf *buf )
+{
+	/* Key, request, certificate and bundle of one client. Whatever was
+	   written is taken away again if it fails. */
+	EVP_PKEY *pkey = NULL;
+	RSA *rsa = NULL;
+	BIGNUM *e = NULL;
+	X509_REQ *req = NULL;
+	X509_NAME *req_name;
+	X509 *x = NULL;
+	X509V3_CTX v3ctx;
+	ASN1_TIME *not_after;
+	BIO *key_bio = NULL, *req_bio = NULL, *cert_bio = NULL;
+	member m[10];
+	tmpl *t;
+	tmpl_value values[TMPL_SLOTS];
+	char *serial_hex = NULL, subject[512], expiry[32];
+	char key_path[512], req_path[512], cert_path[512], db_path[512];
+	char arc_path[512], ovpn_path[512];
+	long pem_off = 0, size;
+	int ok = 0, k;
+
+	memset( m, 0, sizeof( m ) );
+	snprintf( key_path, sizeof( key_path ), "%s/keys/%s.key", ca->dir, b->name );
+	snprintf( req_path, sizeof( req_path ), "%s/req/%s.csr", ca->dir, b->name );
+	snprintf( cert_path, sizeof( cert_path ), "%s/certs/%s.cert", ca->dir, b->name );
+	snprintf( arc_path, sizeof( arc_path ), "%s/arc/%s.tar.gz", ca->dir, b->name );
+	snprintf( ovpn_path, sizeof( ovpn_path ), "%s/arc/%s.ovpn", ca->dir, b->name );
+	serial_hex = BN_bn2hex( b->serial );
+	snprintf( db_path, sizeof( db_path ), "%s/%s.pem", ca->new_certs_dir,
+			serial_hex );
+
+	/* the key, openssl req -new -nodes */
+	if ( NULL == ( e = BN_new() ) || !BN_set_word( e, RSA_F4 ) ||
+			NULL == ( rsa = RSA_new() ) ||
+			!RSA_generate_key_ex( rsa, ca->key_bits, e, NULL ) ||
+			NULL == ( pkey = EVP_PKEY_new() ) || !EVP_PKEY_assign_RSA( pkey, rsa ) )
+	{
+		RSA_free( rsa );
+		goto done;
+	}
+
+	/* the request, the whole [ req_distinguished_name ] with CN = name */
+	if ( NULL == ( req = X509_REQ_new() ) || !X509_REQ_set_version( req, 0 ) ||
+			!X509_REQ_set_pubkey( req, pkey ) )
+		goto done;
+	req_name = X509_REQ_get_subject_name( req );
+	for ( k = 0; k < ca->n_dn; ++k )
+		if ( !X509_NAME_add_entry_by_txt( req_name, ca->dn_field[k], MBSTRING_ASC,
+				(unsigned char *)( NID_commonName == OBJ_txt2nid( ca->dn_field[k] ) ?
+					b->name : ca->dn_value[k] ), -1, -1, 0 ) )
+			goto done;
+	if ( !X509_REQ_sign( req, pkey, ca->req_md ) )
+		goto done;
+
+	/* the certificate, openssl ca */
+	if ( NULL == ( x = X509_new() ) || !X509_set_version( x, 2 ) ||
+			NULL == BN_to_ASN1_INTEGER( b->serial, X509_get_serialNumber( x ) ) ||
+			!X509_set_issuer_name( x, X509_get_subject_name( ca->ca_cert ) ) ||
+			NULL == X509_gmtime_adj( X509_get_notBefore( x ), 0 ) ||
+			NULL == X509_time_adj_ex( X509_get_notAfter( x ), ca->days, 0, NULL ) ||
+			!X509_set_subject_name( x, b->subject ) || !X509_set_pubkey( x, pkey ) )
+		goto done;
+	if ( NULL != ca->extensions )
+	{
+		X509V3_set_ctx( &v3ctx, ca->ca_cert, x, NULL, NULL, 0 );
+		X509V3_set_nconf( &v3ctx, ca->conf );
+		if ( !X509V3_EXT_add_nconf( ca->conf, &v3ctx, ca->extensions, x ) )
+			goto done;
+	}
+	if ( !X509_sign( x, ca->ca_key, ca->md ) )
+		goto done;
+
+	/* the three of them in PEM, the certificate with its text first */
+	key_bio = BIO_new( BIO_s_mem() );
+	req_bio = BIO_new( BIO_s_mem() );
+	cert_bio = BIO_new( BIO_s_mem() );
+	if ( NULL == key_bio || NULL == req_bio || NULL == cert_bio ||
+			!PEM_write_bio_PrivateKey( key_bio, pkey, NULL, NULL, 0, NULL, NULL ) ||
+			!PEM_write_bio_X509_REQ( req_bio, req ) || !X509_print( cert_bio, x ) ||
+			( pem_off = BIO_pending( cert_bio ) ) <= 0 ||
+			!PEM_write_bio_X509( cert_bio, x ) )
+		goto done;
+
+	/* the bundle has what tar had, in the same order */
+	snprintf( m[0].path, sizeof( m[0].path ), "req/%s.csr", b->name );
+	m[0].data = bio_data( req_bio, &m[0].len );
+	m[0].mode = 0644;
+	snprintf( m[1].path, sizeof( m[1].path ), "keys/%s.key", b->name );
+	m[1].data = bio_data( key_bio, &m[1].len );
+	m[1].mode = 0600;
+	snprintf( m[2].path, sizeof( m[2].path ), "certs/%s.cert", b->name );
+	m[2].data = bio_data( cert_bio, &m[2].len );
+	m[2].mode = 0644;
+	strcpy( m[3].path, "ta.key" );
+	m[3].data = bc->ta_key;
+	m[3].len = bc->ta_key_len;
+	m[3].mode = 0600;
+	strcpy( m[4].path, "CA_cert.pem" );
+	m[4].data = ca->ca_pem;
+	m[4].len = ca->ca_pem_len;
+	m[4].mode = 0644;
+
+	/* the four configs, and the inline profile last, go to the worker's
+	   buffer in one go */
+	values[TMPL_NAME].s = b->name;
+	values[TMPL_NAME].len = strlen( b->name );
+	values[TMPL_CERT].s = m[2].data + pem_off;
+	values[TMPL_CERT].len = m[2].len - pem_off;
+	values[TMPL_KEY].s = m[1].data;
+	values[TMPL_KEY].len = m[1].len;
+	for ( k = bc->archive ? 5 : 9, size = 0; k < 10; ++k )
+	{
+		t = 9 == k ? bc->inline_t : k < 7 ? bc->conf_t : bc->ovpn_t;
+		values[TMPL_PROTO].s = 9 == k ? bc->inline_proto : k % 2 ? "tcp" : "udp";
+		if ( NULL == t || NULL == values[TMPL_PROTO].s )
+			continue;
+		values[TMPL_PROTO].len = 3;
+		m[k].len = tmpl_size( t, values );
+		size += m[k].len;
+	}
+	if ( size > buf->size )
+	{
+		if ( NULL != buf->data )
+			OPENSSL_cleanse( buf->data, buf->size );
+		free( buf->data );
+		buf->size = 2 * size;
+		if ( NULL == ( buf->data = malloc( buf->size ) ) )
+		{
+			buf->size = 0;
+			goto done;
+		}
+	}
+	for ( k = bc->archive ? 5 : 9, size = 0; k < 10; ++k )
+	{
+		t = 9 == k ? bc->inline_t : k < 7 ? bc->conf_t : bc->ovpn_t;
+		values[TMPL_PROTO].s = 9 == k ? bc->inline_proto : k % 2 ? "tcp" : "udp";
+		if ( NULL == t || NULL == values[TMPL_PROTO].s )
+			continue;
+		m[k].data = buf->data + size;
+		size += tmpl_render( t, values, m[k].data );
+		snprintf( m[k].path, sizeof( m[k].path ), "%s_%s.%s", b->name,
+				values[TMPL_PROTO].s, k < 7 ? "conf" : "ovpn" );
+		m[k].mode = 0644;
+	}
+
+	if ( !write_file( req_path, m[0].data, m[0].len, 0644 ) ||
+			!write_file( key_path, m[1].data, m[1].len, 0600 ) ||
+			!write_file( cert_path, m[2].data, m[2].len, 0644 ) ||
+			!write_file( db_path, m[2].data, m[2].len, 0644 ) ||
+			( bc->archive && !write_tar_gz( arc_path, m, 9 ) ) ||
+			( NULL != bc->inline_t &&
+				!write_file( ovpn_path, m[9].data, m[9].len, 0600 ) ) )
+	{
+		fprintf( stderr, "Error: %s: writing the files failed: %s.\n", b->name,
+				strerror( errno ) );
+		goto done;
+	}
+
+	/* and its line for the database */
+	not_after = X509_get_notAfter( x );
+	snprintf( expiry, sizeof( expiry ), "%.*s", not_after->length,
+			not_after->data );
+	X509_NAME_oneline( b->subject, subject, sizeof( subject ) );
+	snprintf( b->index_line, sizeof( b->index_line ), "V\t%s\t\t%s\tunknown\t%s\n",
+			expiry, serial_hex, subject );
+	ok = 1;
+
+done:
+	if ( !ok )
+	{
+		fprintf( stderr, "Error: %s: not built.\n", b->name );
+		ERR_print_errors_fp( stderr );
+		unlink( key_path );
+		unlink( req_path );
+		unlink( cert_path );
+		unlink( db_path );
+		unlink( arc_path );
+		unlink( ovpn_path );
+	}
+	if ( NULL != m[1].data )
+		OPENSSL_cleanse( m[1].data, m[1].len );
+	BIO_free( key_bio );
+	BIO_free( req_bio );
+	BIO_free( cert_bio );
+	X509_free( x );
+	X509_REQ_free( req );
+	EVP_PKEY_free( pkey );
+	BN_free( e );
+	OPENSSL_free( serial_hex );
+	return ok;
+}
@@ -0,0 +1,859 @@
+/*
+ovpn-crl - revokes OpenVPN client certificates and keeps the CRL current
+
+"generate.sh -r" runs openssl ca -revoke and then openssl ca -gencrl,
+which reads all of private/index and signs a CRL with every revoked
+certificate in it, expired or not, every time. This keeps its own
+record of the revocations in private/crl and only does the work the
+new ones need:
+
+	private/crl/revocations   one line per revoked certificate, appended
+	                          to: serial, date[,reason], expiry and the
+	                          number of the CRL it was first in
+	private/crl/revoked/      an empty file per revoked certificate,
+	                          named by its serial in decimal, for
+	                          "crl-verify crl/revoked dir" on the server
+	private/crl/crl.pem       the base CRL, every revoked certificate
+	                          that hasn't expired
+	private/crl/delta.pem     a delta CRL with what was revoked since
+	                          the base
+	private/crl/crl.base      the number and date of the base CRL,
+	                          where its revocations end in the
+	                          journal and the number crl.pem has
+
+A new base is signed when there is none, when the delta has grown to
+-B certificates, when half the base's default_crl_days are gone or
+with -b. Otherwise only the delta is signed. OpenVPN reads crl.pem and
+knows nothing of deltas: crl.pem is signed again, with the number of
+the delta, by -F, or by the next run without names, from cron, if
+something was revoked since it was last. That is one signing of every
+revoked certificate for all the revocations in between, not one each.
+A server with "crl-verify crl/revoked dir" needs neither, it sees the
+file as soon as it is there.
+
+Certificates stay revoked in private/index as openssl ca would have
+it, and the first run, or -b, picks up the ones openssl ca revoked.
+
+The revocations are kept in a tree by serial while it runs, adding one
+is O(log n). A run that signs only the delta reads the journal from
+where the base's revocations end, and signs only what was revoked
+since the base. The index is read and written back whole, as openssl
+ca does it: a revocation changes the certificate's line, and openssl
+ca won't load an index with a second line for a serial. The base and
+crl.pem are the whole CRL, that is why they are signed only now and
+then.
+
+Usage: ovpn-crl [-c openssl.conf] [-R reason] [-s serial] [-b] [-F]
+                [-B delta_size] [name ...]
+
+16oct2026, v0.1
+ - first version
+
+16oct2026, v0.2
+ - the CA is locked for the whole run, the index and crlnumber are
+   shared with ovpn-bundle, ca-db and generate.sh
+
+16oct2026, v0.3
+ - a serial ovpn-bundle or www-issue has only reserved isn't revoked
+
+16oct2026, v0.4
+ - crl.pem is signed again whenever something is revoked, the delta
+   only had it until the next base and the server reads crl.pem
+
+17oct2026, v0.5
+ - crl.pem is signed again with -F or by the next run without names,
+   not on every revocation
+ - a delta reads the journal from where the base's revocations end
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <search.h>
+#include <sys/stat.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include "ovpn_ca.h"
+
+#define DELTA_SIZE     1000   /* revocations in a delta before a new base */
+#define MAX_TARGETS    4096
+
+/* one revoked certificate */
+typedef struct revocation
+{
+	BIGNUM *serial;
+	char revoked[48];     /* the index's date[,reason] */
+	char expiry[24];
+	long crl_number;      /* the first CRL it was in */
+} revocation;
+
+/* the CRL being made, for twalk() */
+typedef struct crl_walk
+{
+	X509_CRL *crl;        /* or NULL to count them */
+	long since;           /* only the ones after this CRL, or -1 */
+	long n;
+	char *dir;            /* the crl-verify dir, made to match with a base */
+	int err;
+} crl_walk;
+
+static const char *crl_reasons[] =
+{
+	"unspecified", "keyCompromise", "CACompromise", "affiliationChanged",
+	"superseded", "cessationOfOperation", "certificateHold", NULL,
+	"removeFromCRL"
+};
+
+/* prototypes */
+int  load_revocations( char *path, long from, void **tree, long *n );
+int  add_revocation( void **tree, BIGNUM *serial, char *revoked, char *expiry,
+		long crl_number, revocation **rev );
+int  cmp_revocation( const void *a, const void *b );
+int  revoke_index( ca_conf *ca, BIGNUM **targets, int n_targets,
+		char *revoked, char **expiry, int import, void **tree, long crl_number,
+		FILE *journal );
+int  journal_revocation( FILE *journal, revocation *rev );
+int  touch_serial( char *dir, BIGNUM *serial );
+int  cert_serial( ca_conf *ca, char *name, BIGNUM **serial );
+int  reason_code( char *revoked );
+int  write_crl( ca_conf *ca, void *tree, long number, long base, char *path,
+		char *dir, char *delta_url );
+void add_to_crl( const void *node, VISIT visit, int depth );
+long count_since( void *tree, long base );
+int  expired( char *utctime );
+int  read_base( char *path, long *number, time_t *when, long *end, long *full );
+int  write_base( char *path, long number, time_t when, long end, long full );
+
+static crl_walk *walk;
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	ca_conf ca;
+	BIGNUM *targets[MAX_TARGETS], *number = NULL;
+	void *tree = NULL;
+	FILE *journal;
+	struct stat st;
+	char *reason = NULL, revoked[48], date[24], *expiry[MAX_TARGETS];
+	char path[512], dir[512], journal_path[512], base_path[512], full_path[512], *s;
+	char url[1024], *delta_url = NULL;
+	long n_revocations = 0, delta_size = DELTA_SIZE, crl_number, base = -1;
+	long base_end = 0, full = -1, from;
+	time_t base_time = 0, now;
+	int n_targets = 0, new_base = 0, sign_full = 0, import, failed = 0, i, c;
+	char *help =
+		"\n"
+		"Usage: ovpn-crl [options] [<name> ...]\n"
+		"  Revokes the clients' certificates and signs a delta CRL, or a new\n"
+		"  base CRL when it is time. Without names it brings the delta up to\n"
+		"  date and crl.pem too if anything was revoked since it was signed.\n"
+		"  Run it where generate.sh is.\n"
+		"Options:\n"
+		"  -c <conf>      - The openssl.conf with the CA, it defaults to openssl.conf\n"
+		"  -R <reason>    - Why: keyCompromise, CACompromise, affiliationChanged,\n"
+		"                   superseded, cessationOfOperation or certificateHold\n"
+		"  -s <serial>    - Revoke a certificate by its serial number, in hex\n"
+		"  -b             - Sign a new base CRL and check it against private/index\n"
+		"  -F             - Sign crl.pem again now if anything was revoked since\n"
+		"  -u <url>       - Where the delta CRL is published, for the base's\n"
+		"                   Freshest CRL. It defaults to the file delta.pem\n"
+		"  -B <count>     - Revocations in a delta CRL before a new base is signed,\n"
+		"                   it defaults to 1000\n"
+		"  -h             - Displays this help\n"
+		"\n";
+	char *conf_file = "openssl.conf";
+
+	memset( targets, 0, sizeof( targets ) );
+	while ( -1 != ( c = getopt( argc, argv, "hc:R:s:bFB:u:" ) ) )
+	{
+		switch ( c )
+		{
+			case 'c':
+				conf_file = optarg;
+				break;
+			case 'R':
+				reason = optarg;
+				if ( reason_code( reason ) < 1 )
+				{
+					fprintf( stderr, "Error: unknown reason %s.\n", reason );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 's':
+				if ( MAX_TARGETS == n_targets ||
+						!BN_hex2bn( &targets[n_targets], optarg ) )
+				{
+					fprintf( stderr, "Error: bad serial number %s.\n", optarg );
+					exit( EXIT_FAILURE );
+				}
+				n_targets++;
+				break;
+			case 'b':
+				new_base = 1;
+				break;
+			case 'F':
+				sign_full = 1;
+				break;
+			case 'u':
+				delta_url = optarg;
+				break;
+			case 'B':
+				if ( ( delta_size = atol( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: the delta size must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( !ca_load( &ca, conf_file ) || !ca_lock( &ca ) )
+		exit( EXIT_FAILURE );
+	for ( i = optind; i < argc; ++i )
+	{
+		if ( MAX_TARGETS == n_targets )
+		{
+			fprintf( stderr, "Error: more than %d certificates at once.\n",
+					MAX_TARGETS );
+			exit( EXIT_FAILURE );
+		}
+		if ( !cert_serial( &ca, argv[i], &targets[n_targets] ) )
+		{
+			++failed;
+			continue;
+		}
+		n_targets++;
+	}
+
+	snprintf( journal_path, sizeof( journal_path ), "%s/revocations", ca.crl_dir );
+	snprintf( base_path, sizeof( base_path ), "%s/crl.base", ca.crl_dir );
+	snprintf( dir, sizeof( dir ), "%s/revoked", ca.crl_dir );
+	if ( 0 != mkdir( dir, 0755 ) && EEXIST != errno )
+	{
+		fprintf( stderr, "Error: can't make %s: %s.\n", dir, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+
+	/* no journal yet, the revocations openssl ca made are taken from the
+	   index; so they are with -b, in case one was missed */
+	import = new_base || 0 != stat( journal_path, &st );
+	new_base |= import;
+	if ( !read_base( base_path, &base, &base_time, &base_end, &full ) )
+		new_base = 1;
+
+	/* a delta only needs what came after the base */
+	from = new_base ? 0 : base_end;
+	if ( !load_revocations( journal_path, from, &tree, &n_revocations ) )
+		exit( EXIT_FAILURE );
+
+	/* every CRL gets the next number */
+	snprintf( path, sizeof( path ), "%s/crlnumber", ca.crl_dir );
+	s = NULL != ca.crlnumber_file ? ca.crlnumber_file : path;
+	if ( 0 != stat( s, &st ) && !write_file( s, "01\n", 3, 0644 ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", s, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+	if ( !take_serial( s, 1, &number ) )
+		exit( EXIT_FAILURE );
+	crl_number = BN_get_word( number );
+	BN_free( number );
+
+	/* the revocations go to the index first, like openssl ca -revoke */
+	now = time( NULL );
+	strftime( date, sizeof( date ), "%y%m%d%H%M%SZ", gmtime( &now ) );
+	snprintf( revoked, sizeof( revoked ), "%s%s%s", date, NULL != reason ? "," : "",
+			NULL != reason ? reason : "" );
+	if ( NULL == ( journal = fopen( journal_path, "a" ) ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", journal_path,
+				strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+	memset( expiry, 0, sizeof( expiry ) );
+	if ( n_targets > 0 || import )
+		failed += revoke_index( &ca, targets, n_targets, revoked, expiry, import,
+				&tree, crl_number, journal );
+	if ( 0 != fflush( journal ) || 0 != fsync( fileno( journal ) ) ||
+			0 != fclose( journal ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", journal_path,
+				strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+	for ( i = 0; i < n_targets; ++i )
+		if ( NULL != expiry[i] && !touch_serial( dir, targets[i] ) )
+			++failed;
+
+	/* a delta on the base, or a new base; crl.pem with -F or from cron */
+	if ( !new_base && ( now - base_time > ca.crl_days * 86400 / 2 ||
+			count_since( tree, base ) >= delta_size ) )
+		new_base = 1;
+	sign_full = !new_base && ( sign_full || 0 == n_targets ) &&
+		count_since( tree, full ) > 0;
+	if ( ( new_base || sign_full ) && from > 0 &&
+			!load_revocations( journal_path, 0, &tree, &n_revocations ) )
+		exit( EXIT_FAILURE );
+	if ( NULL == delta_url )
+	{
+		s = realpath( ca.crl_dir, NULL );
+		snprintf( url, sizeof( url ), "file://%s/delta.pem",
+				NULL != s ? s : ca.crl_dir );
+		free( s );
+		delta_url = url;
+	}
+	snprintf( full_path, sizeof( full_path ), "%s/crl.pem", ca.crl_dir );
+	if ( NULL != ca.crl )
+		snprintf( full_path, sizeof( full_path ), "%s", ca.crl );
+	if ( new_base )
+	{
+		if ( write_crl( &ca, tree, crl_number, -1, full_path, dir, delta_url ) < 0 ||
+				0 != stat( journal_path, &st ) ||
+				!write_base( base_path, crl_number, now, st.st_size, crl_number ) )
+			exit( EXIT_FAILURE );
+		snprintf( path, sizeof( path ), "%s/delta.pem", ca.crl_dir );
+		unlink( path );
+		fprintf( stderr, "Base CRL %lX signed.\n", crl_number );
+	}
+	else
+	{
+		snprintf( path, sizeof( path ), "%s/delta.pem", ca.crl_dir );
+		if ( ( c = write_crl( &ca, tree, crl_number, base, path, NULL, NULL ) ) < 0 )
+			exit( EXIT_FAILURE );
+		fprintf( stderr, "Delta CRL %lX on base %lX signed, %d revoked since.\n",
+				crl_number, base, c );
+
+		/* a server without crl/revoked reads crl.pem */
+		if ( sign_full )
+		{
+			if ( write_crl( &ca, tree, crl_number, -1, full_path, NULL, delta_url ) < 0 ||
+					!write_base( base_path, base, base_time, base_end, crl_number ) )
+				exit( EXIT_FAILURE );
+			fprintf( stderr, "CRL %lX signed, with all of them.\n", crl_number );
+		}
+	}
+
+	for ( i = 0; i < n_targets; ++i )
+	{
+		BN_free( targets[i] );
+		free( expiry[i] );
+	}
+	ca_free( &ca );
+	return( failed ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+/****************
+ load_revocations--
+ ****************/
+
+int load_revocations( char *path, long from, void **tree, long *n )
+{
+	/* The journal from byte from on, the ones in the tree already are
+	   left out: serial<TAB>date[,reason]<TAB>expiry<TAB>crl number */
+	char line[256], serial[128], revoked[48], expiry[24];
+	BIGNUM *bn;
+	long crl_number, at = from;
+	FILE *fp;
+
+	*n = 0;
+	if ( NULL == ( fp = fopen( path, "r" ) ) )
+		return ENOENT == errno;
+	if ( 0 != fseek( fp, from, SEEK_SET ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", path, strerror( errno ) );
+		fclose( fp );
+		return 0;
+	}
+	for ( ; NULL != fgets( line, sizeof( line ), fp ); at = ftell( fp ) )
+	{
+		bn = NULL;
+		if ( 4 != sscanf( line, "%127s %47s %23s %lx", serial, revoked, expiry,
+				&crl_number ) || !BN_hex2bn( &bn, serial ) )
+		{
+			fprintf( stderr, "Error: %s is broken at byte %ld.\n", path, at );
+			fclose( fp );
+			return 0;
+		}
+		if ( add_revocation( tree, bn, revoked, expiry, crl_number, NULL ) )
+			++*n;
+		else
+			BN_free( bn );
+	}
+	fclose( fp );
+	return 1;
+}
+
+/**************
+ add_revocation--
+ **************/
+
+int add_revocation( void **tree, BIGNUM *serial, char *revoked, char *expiry,
+		long crl_number, revocation **rev )
+{
+	/* Returns 0 if the serial is there already, the tree has the serial
+	   from then on */
+	revocation *r, **found;
+
+	if ( NULL == ( r = calloc( 1, sizeof( revocation ) ) ) )
+		return 0;
+	r->serial = serial;
+	snprintf( r->revoked, sizeof( r->revoked ), "%s", revoked );
+	snprintf( r->expiry, sizeof( r->expiry ), "%s", expiry );
+	r->crl_number = crl_number;
+	if ( NULL == ( found = tsearch( r, tree, cmp_revocation ) ) || *found != r )
+	{
+		free( r );
+		return 0;
+	}
+	if ( NULL != rev )
+		*rev = r;
+	return 1;
+}
+
+/**************
+ cmp_revocation--
+ **************/
+
+int cmp_revocation( const void *a, const void *b )
+{
+	return BN_cmp( ( (const revocation *)a )->serial,
+			( (const revocation *)b )->serial );
+}
+
+/************
+ revoke_index--
+ ************/
+
+int revoke_index( ca_conf *ca, BIGNUM **targets, int n_targets,
+		char *revoked, char **expiry, int import, void **tree, long crl_number,
+		FILE *journal )
+{
+	/* Marks the targets revoked in the index, V to R as openssl ca does,
+	   and journals them. With import the ones already R are journalled too
+	   if they aren't. Returns the number of targets that couldn't be. */
+	char *data, *out, *line, *next, *field[6], *s, *seen;
+	revocation *rev;
+	BIGNUM *serial = NULL;
+	long len, out_len = 0;
+	int failed = 0, changed = 0, i, k;
+
+	if ( NULL == ( data = read_file( ca->database, &len ) ) )
+		return n_targets;
+	out = malloc( len + n_targets * 48 + 1 );
+	seen = calloc( n_targets + 1, 1 );
+	if ( NULL == out || NULL == seen )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		free( out );
+		free( data );
+		return n_targets;
+	}
+	for ( line = data; line < data + len; line = next )
+	{
+		if ( NULL != ( next = strchr( line, '\n' ) ) )
+			*next++ = '\0';
+		else
+			next = data + len;
+
+		/* V|R|E expiry revoked serial file subject */
+		for ( s = line, k = 0; k < 6; ++k )
+		{
+			field[k] = s;
+			if ( k < 5 && NULL != ( s = strchr( s, '\t' ) ) )
+				*s++ = '\0';
+			else if ( k < 5 )
+				break;
+		}
+		if ( k < 6 || !BN_hex2bn( &serial, field[3] ) )
+		{
+			/* not a line to change, as it was */
+			for ( i = 0; i < k; ++i )
+				out_len += sprintf( out + out_len, "%s%s", field[i], i < k - 1 ? "\t" : "" );
+			if ( next > line + strlen( line ) )
+				out[out_len++] = '\n';
+			continue;
+		}
+		for ( i = 0; i < n_targets; ++i )
+			if ( 0 == BN_cmp( serial, targets[i] ) )
+				break;
+		if ( i < n_targets )
+			seen[i] = 1;
+		if ( i < n_targets && 0 != ca_pending( field[4] ) )
+		{
+			/* ovpn-bundle or www-issue is still signing it, or crashed
+			   doing it: its line is theirs to replace */
+			fprintf( stderr, "Error: %s isn't issued yet.\n", field[5] );
+			++failed;
+		}
+		else if ( i < n_targets && 'V' == field[0][0] )
+		{
+			field[0] = "R";
+			field[2] = revoked;
+			expiry[i] = strdup( field[1] );
+			changed = 1;
+			if ( add_revocation( tree, BN_dup( serial ), revoked, field[1],
+					crl_number, &rev ) )
+				failed += !journal_revocation( journal, rev );
+		}
+		else if ( i < n_targets && NULL == expiry[i] )
+		{
+			fprintf( stderr, "Error: %s is revoked already.\n", field[5] );
+			++failed;
+		}
+		else if ( import && 'R' == field[0][0] )
+		{
+			if ( add_revocation( tree, BN_dup( serial ), field[2], field[1],
+					crl_number, &rev ) )
+				failed += !journal_revocation( journal, rev );
+		}
+		out_len += sprintf( out + out_len, "%s\t%s\t%s\t%s\t%s\t%s\n", field[0],
+				field[1], field[2], field[3], field[4], field[5] );
+	}
+	BN_free( serial );
+
+	for ( i = 0; i < n_targets; ++i )
+		if ( !seen[i] )
+		{
+			s = BN_bn2hex( targets[i] );
+			fprintf( stderr, "Error: no valid certificate %s in %s.\n", s,
+					ca->database );
+			OPENSSL_free( s );
+			++failed;
+		}
+	if ( changed && !rotate( ca->database, out, out_len ) )
+		failed = n_targets;
+	free( seen );
+	free( out );
+	free( data );
+	return failed;
+}
+
+/******************
+ journal_revocation--
+ ******************/
+
+int journal_revocation( FILE *journal, revocation *rev )
+{
+	char *hex;
+	int ok;
+
+	hex = BN_bn2hex( rev->serial );
+	ok = fprintf( journal, "%s\t%s\t%s\t%lX\n", hex, rev->revoked, rev->expiry,
+			rev->crl_number ) > 0;
+	OPENSSL_free( hex );
+	return ok;
+}
+
+/************
+ touch_serial--
+ ************/
+
+int touch_serial( char *dir, BIGNUM *serial )
+{
+	/* OpenVPN looks for the serial in decimal, the file can be empty */
+	char path[512], *dec;
+	int fd;
+
+	dec = BN_bn2dec( serial );
+	snprintf( path, sizeof( path ), "%s/%s", dir, dec );
+	OPENSSL_free( dec );
+	if ( ( fd = open( path, O_WRONLY | O_CREAT, 0644 ) ) < 0 )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	close( fd );
+	return 1;
+}
+
+/***********
+ cert_serial--
+ ***********/
+
+int cert_serial( ca_conf *ca, char *name, BIGNUM **serial )
+{
+	/* The serial of private/certs/<name>.cert, as generate.sh -r has it */
+	char path[512];
+	X509 *x;
+	FILE *fp;
+
+	*serial = NULL;
+	if ( strchr( name, '/' ) || '.' == name[0] )
+	{
+		fprintf( stderr, "Error: %s isn't a client name.\n", name );
+		return 0;
+	}
+	snprintf( path, sizeof( path ), "%s/certs/%s.cert", ca->dir, name );
+	if ( NULL == ( fp = fopen( path, "r" ) ) )
+	{
+		fprintf( stderr, "Error: there is no %s.\n", path );
+		return 0;
+	}
+	x = PEM_read_X509( fp, NULL, NULL, NULL );
+	fclose( fp );
+	if ( NULL == x )
+	{
+		fprintf( stderr, "Error: can't read %s.\n", path );
+		return 0;
+	}
+	*serial = ASN1_INTEGER_to_BN( X509_get_serialNumber( x ), NULL );
+	X509_free( x );
+	return NULL != *serial;
+}
+
+/***********
+ reason_code--
+ ***********/
+
+int reason_code( char *revoked )
+{
+	/* The CRLReason of "date,reason" or of the reason, -1 if none */
+	char *s;
+	int i;
+
+	s = strchr( revoked, ',' );
+	s = NULL != s ? s + 1 : revoked;
+	for ( i = 0; i < (int)( sizeof( crl_reasons ) / sizeof( crl_reasons[0] ) ); ++i )
+		if ( NULL != crl_reasons[i] && !strcasecmp( s, crl_reasons[i] ) )
+			return i;
+	return -1;
+}
+
+/*********
+ write_crl--
+ *********/
+
+int write_crl( ca_conf *ca, void *tree, long number, long base, char *path,
+		char *dir, char *delta_url )
+{
+	/* Signs a CRL of the revocations in the tree that haven't expired: all
+	   of them for a base, base < 0, or the ones after the base for a
+	   delta. A base makes the crl-verify dir match it too, and points to
+	   its deltas, without a Freshest CRL they aren't looked for. Returns
+	   the number in the CRL, or -1. */
+	X509_CRL *crl;
+	X509_EXTENSION *ext;
+	char freshest[1100];
+	ASN1_TIME *t;
+	ASN1_INTEGER *n;
+	crl_walk w;
+	FILE *fp;
+	char new_path[512];
+	int ok;
+
+	crl = X509_CRL_new();
+	t = ASN1_TIME_new();
+	n = ASN1_INTEGER_new();
+	if ( NULL == crl || NULL == t || NULL == n ||
+			!X509_CRL_set_version( crl, 1 ) ||
+			!X509_CRL_set_issuer_name( crl, X509_get_subject_name( ca->ca_cert ) ) ||
+			NULL == X509_gmtime_adj( t, 0 ) || !X509_CRL_set_lastUpdate( crl, t ) ||
+			NULL == X509_time_adj_ex( t, ca->crl_days, 0, NULL ) ||
+			!X509_CRL_set_nextUpdate( crl, t ) )
+		goto fail;
+
+	w.crl = crl;
+	w.since = base;
+	w.n = 0;
+	w.dir = dir;
+	w.err = 0;
+	walk = &w;
+	twalk( tree, add_to_crl );
+	walk = NULL;
+	if ( w.err )
+		goto fail;
+	X509_CRL_sort( crl );
+
+	if ( !ASN1_INTEGER_set( n, number ) ||
+			!X509_CRL_add1_ext_i2d( crl, NID_crl_number, n, 0, 0 ) )
+		goto fail;
+	if ( base >= 0 && ( !ASN1_INTEGER_set( n, base ) ||
+			!X509_CRL_add1_ext_i2d( crl, NID_delta_crl, n, 1, 0 ) ) )
+		goto fail;
+	if ( NULL != delta_url )
+	{
+		snprintf( freshest, sizeof( freshest ), "URI:%s", delta_url );
+		ext = X509V3_EXT_conf_nid( NULL, NULL, NID_freshest_crl, freshest );
+		ok = NULL != ext && X509_CRL_add_ext( crl, ext, -1 );
+		X509_EXTENSION_free( ext );
+		if ( !ok )
+			goto fail;
+	}
+	if ( !X509_CRL_sign( crl, ca->ca_key, ca->md ) )
+		goto fail;
+
+	/* written next to it and renamed, the server never sees half a CRL */
+	snprintf( new_path, sizeof( new_path ), "%s.new", path );
+	if ( NULL == ( fp = fopen( new_path, "w" ) ) )
+		goto fail;
+	ok = PEM_write_X509_CRL( fp, crl );
+	if ( 0 != fclose( fp ) || !ok || 0 != rename( new_path, path ) )
+	{
+		unlink( new_path );
+		goto fail;
+	}
+	ASN1_INTEGER_free( n );
+	ASN1_TIME_free( t );
+	X509_CRL_free( crl );
+	return w.n;
+
+fail:
+	fprintf( stderr, "Error: can't make %s.\n", path );
+	ERR_print_errors_fp( stderr );
+	ASN1_INTEGER_free( n );
+	ASN1_TIME_free( t );
+	X509_CRL_free( crl );
+	return -1;
+}
+
+/**********
+ add_to_crl--
+ **********/
+
+void add_to_crl( const void *node, VISIT visit, int depth )
+{
+	revocation *r = *(revocation **)node;
+	X509_REVOKED *rev;
+	ASN1_TIME *t;
+	ASN1_ENUMERATED *e;
+	char date[24], path[512], *dec;
+	int code;
+
+	if ( ( postorder != visit && leaf != visit ) || walk->err )
+		return;
+	if ( walk->since >= 0 && r->crl_number <= walk->since )
+		return;
+
+	/* an expired certificate can't be used, revoked or not */
+	if ( expired( r->expiry ) )
+	{
+		if ( NULL != walk->dir )
+		{
+			dec = BN_bn2dec( r->serial );
+			snprintf( path, sizeof( path ), "%s/%s", walk->dir, dec );
+			unlink( path );
+			OPENSSL_free( dec );
+		}
+		return;
+	}
+	if ( NULL != walk->dir && !touch_serial( walk->dir, r->serial ) )
+		walk->err = 1;
+	if ( NULL == walk->crl )
+	{
+		walk->n++;
+		return;
+	}
+
+	snprintf( date, sizeof( date ), "%.*s", (int)strcspn( r->revoked, "," ),
+			r->revoked );
+	rev = X509_REVOKED_new();
+	t = ASN1_TIME_new();
+	if ( NULL == rev || NULL == t || !ASN1_TIME_set_string( t, date ) ||
+			!X509_REVOKED_set_revocationDate( rev, t ) ||
+			NULL == BN_to_ASN1_INTEGER( r->serial, rev->serialNumber ) )
+		walk->err = 1;
+	if ( !walk->err && ( code = reason_code( r->revoked ) ) >= 0 &&
+			strchr( r->revoked, ',' ) )
+	{
+		e = ASN1_ENUMERATED_new();
+		if ( NULL == e || !ASN1_ENUMERATED_set( e, code ) ||
+				!X509_REVOKED_add1_ext_i2d( rev, NID_crl_reason, e, 0, 0 ) )
+			walk->err = 1;
+		ASN1_ENUMERATED_free( e );
+	}
+	ASN1_TIME_free( t );
+	if ( walk->err || !X509_CRL_add0_revoked( walk->crl, rev ) )
+	{
+		walk->err = 1;
+		X509_REVOKED_free( rev );
+		return;
+	}
+	walk->n++;
+	return;
+}
+
+/***********
+ count_since--
+ ***********/
+
+long count_since( void *tree, long base )
+{
+	/* What a delta on the base would have in it */
+	crl_walk w;
+
+	memset( &w, 0, sizeof( w ) );
+	w.since = base;
+	walk = &w;
+	twalk( tree, add_to_crl );
+	walk = NULL;
+	return w.n;
+}
+
+/*******
+ expired--
+ *******/
+
+int expired( char *utctime )
+{
+	ASN1_TIME *t;
+	int past;
+
+	if ( NULL == ( t = ASN1_TIME_new() ) )
+		return 0;
+	past = ASN1_TIME_set_string( t, utctime ) && X509_cmp_time( t, NULL ) < 0;
+	ASN1_TIME_free( t );
+	return past;
+}
+
+/*********
+ read_base--
+ *********/
+
+int read_base( char *path, long *number, time_t *when, long *end, long *full )
+{
+	/* crl.base: the number of the base CRL, when it was signed, the size
+	   of the journal then and the number of crl.pem. One from before v0.5
+	   has the first two, its journal is read from the start */
+	long t;
+	FILE *fp;
+	int n;
+
+	if ( NULL == ( fp = fopen( path, "r" ) ) )
+		return 0;
+	n = fscanf( fp, "%lx %ld %ld %lx", number, &t, end, full );
+	fclose( fp );
+	*when = t;
+	if ( n < 4 )
+	{
+		*end = 0;
+		*full = *number;
+	}
+	return n >= 2;
+}
+
+/**********
+ write_base--
+ **********/
+
+int write_base( char *path, long number, time_t when, long end, long full )
+{
+	char line[128];
+
+	snprintf( line, sizeof( line ), "%lX %ld %ld %lX\n", number, (long)when, end, full );
+	return rotate( path, line, strlen( line ) );
+}
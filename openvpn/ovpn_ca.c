@@ -0,0 +1,949 @@
+/*
+ovpn_ca - the CA of openssl.conf, for the openvpn tools
+
+16oct2026, v0.1
+ - out of ovpn-bundle, for ovpn-crl
+
+16oct2026, v0.2
+ - ca_lock(), the lock ../ca-db and generate.sh take too
+ - rotate() never leaves the file missing, take_serial() keeps to a
+   lease's serial.limit
+
+16oct2026, v0.3
+ - the batch calls, the archives and the thread locks, out of
+   ovpn-bundle and ../www/www-issue, which had a copy each
+
+16oct2026, v0.4
+ - ca_reserve(): a batch's serials are in the index, pending, from
+   the check on, two runs can't both issue a subject
+
+17oct2026, v0.5
+ - read_serial() and write_serial(), out of ../ca-db, take_serial()
+   is made of them
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <zlib.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+#include "ovpn_ca.h"
+
+/* for thread_setup() */
+static pthread_mutex_t *ssl_locks;
+
+static int read_subjects( ca_conf *ca, char ***subjects, int *n_subjects,
+		char ***pending, int *n_pending );
+static char *index_field( char *line, char *end, int k );
+
+
+/*******
+ ca_load--
+ *******/
+
+int ca_load( ca_conf *ca, char *conf_file )
+{
+	/* Everything openssl.conf says, and the CA itself */
+	STACK_OF(CONF_VALUE) *sect;
+	CONF_VALUE *cv;
+	char *s, *req;
+	long line = -1;
+	FILE *fp;
+	int i;
+
+	memset( ca, 0, sizeof( ca_conf ) );
+	ca->lock_fd = -1;
+	ca->conf = NCONF_new( NULL );
+	if ( !NCONF_load( ca->conf, conf_file, &line ) )
+	{
+		if ( line > 0 )
+			fprintf( stderr, "Error: %s line %ld: ", conf_file, line );
+		else
+			fprintf( stderr, "Error: %s: ", conf_file );
+		ERR_print_errors_fp( stderr );
+		return 0;
+	}
+
+	/* [ ca ] */
+	if ( NULL == ( ca->section = ca_string( ca, "ca", "default_ca", 1 ) ) ||
+			NULL == ( ca->dir = ca_string( ca, ca->section, "dir", 1 ) ) ||
+			NULL == ( ca->database = ca_string( ca, ca->section, "database", 1 ) ) ||
+			NULL == ( ca->serial_file = ca_string( ca, ca->section, "serial", 1 ) ) ||
+			NULL == ( ca->new_certs_dir = ca_string( ca, ca->section, "new_certs_dir", 1 ) ) ||
+			NULL == ( ca->policy = ca_string( ca, ca->section, "policy", 1 ) ) )
+		return 0;
+	ca->extensions = ca_string( ca, ca->section, "x509_extensions", 0 );
+	s = ca_string( ca, ca->section, "default_days", 0 );
+	ca->days = NULL != s ? atol( s ) : 30;
+	s = ca_string( ca, ca->section, "default_md", 0 );
+	if ( NULL == ( ca->md = EVP_get_digestbyname( NULL != s ? s : "sha256" ) ) )
+	{
+		fprintf( stderr, "Error: %s: unknown default_md %s.\n", conf_file, s );
+		return 0;
+	}
+	s = ca_string( ca, ca->section, "unique_subject", 0 );
+	ca->unique_subject = NULL == s || strchr( "yYtT", s[0] ) || !strcmp( s, "1" );
+	if ( NULL != ca->extensions &&
+			NULL == NCONF_get_section( ca->conf, ca->extensions ) )
+	{
+		fprintf( stderr, "Error: %s: no [ %s ] section.\n", conf_file,
+				ca->extensions );
+		return 0;
+	}
+
+	/* the CRL, crlnumber isn't in every openssl.conf */
+	ca->crl_dir = ca_string( ca, ca->section, "crl_dir", 0 );
+	if ( NULL == ca->crl_dir )
+		ca->crl_dir = ca->dir;
+	ca->crl = ca_string( ca, ca->section, "crl", 0 );
+	ca->crlnumber_file = ca_string( ca, ca->section, "crlnumber", 0 );
+	s = ca_string( ca, ca->section, "default_crl_days", 0 );
+	ca->crl_days = NULL != s ? atol( s ) : 30;
+
+	/* [ req ], and the subject of every request */
+	s = ca_string( ca, "req", "default_bits", 0 );
+	ca->key_bits = NULL != s ? atoi( s ) : 2048;
+	s = ca_string( ca, "req", "default_md", 0 );
+	ca->req_md = EVP_get_digestbyname( NULL != s ? s : "sha256" );
+	if ( NULL == ca->req_md )
+		ca->req_md = EVP_sha256();
+	if ( NULL == ( req = ca_string( ca, "req", "distinguished_name", 1 ) ) )
+		return 0;
+	if ( NULL == ( sect = NCONF_get_section( ca->conf, req ) ) )
+	{
+		fprintf( stderr, "Error: %s: no [ %s ] section.\n", conf_file, req );
+		return 0;
+	}
+	for ( i = 0; i < sk_CONF_VALUE_num( sect ) && ca->n_dn < CA_MAX_DN; ++i )
+	{
+		cv = sk_CONF_VALUE_value( sect, i );
+		if ( NID_undef == OBJ_txt2nid( cv->name ) )
+			continue;
+		ca->dn_field[ca->n_dn] = cv->name;
+		ca->dn_value[ca->n_dn++] = cv->value;
+	}
+
+	/* the CA */
+	if ( NULL == ( s = ca_string( ca, ca->section, "certificate", 1 ) ) )
+		return 0;
+	if ( NULL == ( fp = fopen( s, "r" ) ) ||
+			NULL == ( ca->ca_cert = PEM_read_X509( fp, NULL, NULL, NULL ) ) )
+	{
+		fprintf( stderr, "Error: can't read the CA certificate %s.\n", s );
+		if ( NULL != fp )
+			fclose( fp );
+		return 0;
+	}
+	fclose( fp );
+	if ( NULL == ( ca->ca_pem = read_file( s, &ca->ca_pem_len ) ) )
+		return 0;
+	if ( NULL == ( s = ca_string( ca, ca->section, "private_key", 1 ) ) )
+		return 0;
+	if ( NULL == ( fp = fopen( s, "r" ) ) ||
+			NULL == ( ca->ca_key = PEM_read_PrivateKey( fp, NULL, NULL, NULL ) ) )
+	{
+		fprintf( stderr, "Error: can't read the CA key %s.\n", s );
+		if ( NULL != fp )
+			fclose( fp );
+		return 0;
+	}
+	fclose( fp );
+	if ( !X509_check_private_key( ca->ca_cert, ca->ca_key ) )
+	{
+		fprintf( stderr, "Error: the CA key doesn't match its certificate.\n" );
+		return 0;
+	}
+	return 1;
+}
+
+/*******
+ ca_free--
+ *******/
+
+void ca_free( ca_conf *ca )
+{
+	ca_unlock( ca );
+	EVP_PKEY_free( ca->ca_key );
+	X509_free( ca->ca_cert );
+	free( ca->ca_pem );
+	NCONF_free( ca->conf );
+	memset( ca, 0, sizeof( ca_conf ) );
+	ca->lock_fd = -1;
+	return;
+}
+
+/*********
+ ca_string--
+ *********/
+
+char *ca_string( ca_conf *ca, char *section, char *name, int required )
+{
+	char *s;
+
+	s = NCONF_get_string( ca->conf, section, name );
+	if ( NULL == s )
+	{
+		ERR_clear_error();
+		if ( required )
+			fprintf( stderr, "Error: %s is missing from [ %s ].\n", name, section );
+	}
+	return s;
+}
+
+/*******
+ ca_lock--
+ *******/
+
+int ca_lock( ca_conf *ca )
+{
+	/* Waits for the CA's files, ca_unlock() or exiting gives them back */
+	char path[512];
+
+	if ( ca->lock_fd >= 0 )
+		return 1;
+	snprintf( path, sizeof( path ), "%s.lock", ca->database );
+	if ( ( ca->lock_fd = open( path, O_RDWR | O_CREAT, 0600 ) ) < 0 ||
+			0 != flock( ca->lock_fd, LOCK_EX ) )
+	{
+		fprintf( stderr, "Error: can't lock %s: %s.\n", path, strerror( errno ) );
+		if ( ca->lock_fd >= 0 )
+			close( ca->lock_fd );
+		ca->lock_fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+/*********
+ ca_unlock--
+ *********/
+
+void ca_unlock( ca_conf *ca )
+{
+	if ( ca->lock_fd < 0 )
+		return;
+	close( ca->lock_fd );
+	ca->lock_fd = -1;
+	return;
+}
+
+/*********
+ read_file--
+ *********/
+
+char *read_file( char *path, long *len )
+{
+	/* The whole file, NUL terminated */
+	struct stat st;
+	char *data = NULL;
+	FILE *fp;
+
+	if ( NULL == ( fp = fopen( path, "rb" ) ) || 0 != fstat( fileno( fp ), &st ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", path, strerror( errno ) );
+		if ( NULL != fp )
+			fclose( fp );
+		return NULL;
+	}
+	if ( NULL == ( data = malloc( st.st_size + 1 ) ) ||
+			st.st_size != (long)fread( data, 1, st.st_size, fp ) )
+	{
+		fprintf( stderr, "Error: can't read %s.\n", path );
+		fclose( fp );
+		free( data );
+		return NULL;
+	}
+	fclose( fp );
+	data[st.st_size] = '\0';
+	*len = st.st_size;
+	return data;
+}
+
+/**********
+ write_file--
+ **********/
+
+int write_file( char *path, char *data, long len, int mode )
+{
+	int fd, ok;
+
+	if ( ( fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, mode ) ) < 0 )
+		return 0;
+	ok = len == write( fd, data, len );
+	return 0 == close( fd ) && ok;
+}
+
+/**********
+ sync_file--
+ **********/
+
+static int sync_file( char *path, char *data, long len )
+{
+	/* write_file(), and on the disk before it returns */
+	int fd, ok;
+
+	if ( ( fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 )
+		return 0;
+	ok = len == write( fd, data, len ) && 0 == fsync( fd );
+	return 0 == close( fd ) && ok;
+}
+
+/******
+ rotate--
+ ******/
+
+int rotate( char *path, char *data, long len )
+{
+	/* Replaces the file the way openssl ca does: the new one is written
+	   to path.new, the old one becomes path.old. The old one is linked
+	   there and the new one renamed over it, so after a crash path is
+	   one or the other, never missing or half written */
+	char new_path[512], old_path[512];
+	struct stat st;
+
+	snprintf( new_path, sizeof( new_path ), "%s.new", path );
+	snprintf( old_path, sizeof( old_path ), "%s.old", path );
+	if ( !sync_file( new_path, data, len ) ||
+			( 0 == stat( path, &st ) && ( ( 0 != unlink( old_path ) &&
+				ENOENT != errno ) || 0 != link( path, old_path ) ) ) ||
+			0 != rename( new_path, path ) )
+	{
+		fprintf( stderr, "Error: can't write %s: %s.\n", path, strerror( errno ) );
+		return 0;
+	}
+	return 1;
+}
+
+/***********
+ take_serial--
+ ***********/
+
+int take_serial( char *path, long n, BIGNUM **first )
+{
+	/* Takes n numbers out of a serial or crlnumber file: the first is
+	   returned, the one after the last is written back before any of
+	   them is used. On a host with a lease of serials, path.limit has the
+	   one after its last, see ../ca-db. The CA is to be ca_lock()ed. */
+	BIGNUM *next = NULL, *limit = NULL;
+	char limit_path[512];
+	struct stat st;
+	int ok;
+
+	*first = NULL;
+	if ( !read_serial( path, first ) )
+		return 0;
+	next = BN_dup( *first );
+	BN_add_word( next, n );
+	snprintf( limit_path, sizeof( limit_path ), "%s.limit", path );
+	if ( 0 == stat( limit_path, &st ) &&
+			( !read_serial( limit_path, &limit ) || BN_cmp( next, limit ) > 0 ) )
+	{
+		fprintf( stderr, "Error: %s: %ld more serials are past the lease in %s.\n",
+				path, n, limit_path );
+		ok = 0;
+	}
+	else
+		ok = write_serial( path, next );
+	BN_free( limit );
+	BN_free( next );
+	if ( !ok )
+	{
+		BN_free( *first );
+		*first = NULL;
+	}
+	return ok;
+}
+
+/***********
+ read_serial--
+ ***********/
+
+int read_serial( char *path, BIGNUM **bn )
+{
+	/* A serial file as openssl has it, the number in hex */
+	char *s;
+	long len;
+
+	if ( NULL == ( s = read_file( path, &len ) ) )
+		return 0;
+	s[strcspn( s, "\r\n" )] = '\0';
+	if ( !BN_hex2bn( bn, s ) )
+	{
+		fprintf( stderr, "Error: %s doesn't hold a serial number.\n", path );
+		free( s );
+		return 0;
+	}
+	free( s );
+	return 1;
+}
+
+/************
+ write_serial--
+ ************/
+
+int write_serial( char *path, BIGNUM *bn )
+{
+	char *hex, s[256];
+	int ok;
+
+	hex = BN_bn2hex( bn );
+	/* openssl wants an even number of digits */
+	snprintf( s, sizeof( s ), "%s%s\n", strlen( hex ) % 2 ? "0" : "", hex );
+	ok = rotate( path, s, strlen( s ) );
+	OPENSSL_free( hex );
+	return ok;
+}
+
+/**********
+ check_name--
+ **********/
+
+int check_name( char *name )
+{
+	/* The name goes into file names and the configs, so it is kept to
+	   letters, digits, '.', '_' and '-' */
+	char *s;
+
+	if ( 0 == strlen( name ) || strlen( name ) > CA_NAME_MAX || '.' == name[0] ||
+			'-' == name[0] )
+	{
+		fprintf( stderr, "Error: %s: a name must be 1 to %d characters, not starting with '.' or '-'.\n",
+				name, CA_NAME_MAX );
+		return 0;
+	}
+	for ( s = name; *s; ++s )
+		if ( !isalnum( (unsigned char)*s ) && !strchr( "._-", *s ) )
+		{
+			fprintf( stderr, "Error: %s: a name can only have letters, digits, '.', '_' and '-'.\n",
+					name );
+			return 0;
+		}
+	return 1;
+}
+
+/**************
+ policy_subject--
+ **************/
+
+int policy_subject( ca_conf *ca, char *name, X509_NAME **subject )
+{
+	/* The subject openssl ca gives the request: the policy's fields in its
+	   order, "match" ones have to be the same as the CA's, "supplied" ones
+	   have to be there and "optional" ones are kept if they are */
+	STACK_OF(CONF_VALUE) *policy;
+	CONF_VALUE *cv;
+	X509_NAME *ca_name = X509_get_subject_name( ca->ca_cert );
+	char ca_value[256], *value;
+	int i, k, nid;
+
+	*subject = NULL;
+	if ( NULL == ( policy = NCONF_get_section( ca->conf, ca->policy ) ) )
+	{
+		fprintf( stderr, "Error: no [ %s ] section.\n", ca->policy );
+		return 0;
+	}
+	*subject = X509_NAME_new();
+	for ( i = 0; i < sk_CONF_VALUE_num( policy ); ++i )
+	{
+		cv = sk_CONF_VALUE_value( policy, i );
+		if ( NID_undef == ( nid = OBJ_txt2nid( cv->name ) ) )
+		{
+			fprintf( stderr, "Error: unknown field %s in [ %s ].\n", cv->name,
+					ca->policy );
+			goto fail;
+		}
+		value = NULL;
+		if ( NID_commonName == nid )
+			value = name;
+		else
+			for ( k = 0; k < ca->n_dn; ++k )
+				if ( nid == OBJ_txt2nid( ca->dn_field[k] ) )
+					value = ca->dn_value[k];
+
+		if ( !strcmp( cv->value, "match" ) )
+		{
+			if ( X509_NAME_get_text_by_NID( ca_name, nid, ca_value,
+					sizeof( ca_value ) ) < 0 || NULL == value ||
+					strcmp( ca_value, value ) )
+			{
+				fprintf( stderr, "Error: %s: the %s field needed to be the same in the CA certificate and the request.\n",
+						name, cv->name );
+				goto fail;
+			}
+		}
+		else if ( !strcmp( cv->value, "supplied" ) )
+		{
+			if ( NULL == value || '\0' == *value )
+			{
+				fprintf( stderr, "Error: %s: the %s field needed to be supplied.\n",
+						name, cv->name );
+				goto fail;
+			}
+		}
+		else if ( strcmp( cv->value, "optional" ) )
+		{
+			fprintf( stderr, "Error: %s:%s invalid type in 'policy' configuration.\n",
+					cv->name, cv->value );
+			goto fail;
+		}
+		if ( NULL != value && '\0' != *value &&
+				!X509_NAME_add_entry_by_NID( *subject, nid, MBSTRING_ASC,
+					(unsigned char *)value, -1, -1, 0 ) )
+			goto fail;
+	}
+	return 1;
+
+fail:
+	X509_NAME_free( *subject );
+	*subject = NULL;
+	return 0;
+}
+
+/************
+ read_subjects--
+ ************/
+
+static int read_subjects( ca_conf *ca, char ***subjects, int *n_subjects,
+		char ***pending, int *n_pending )
+{
+	/* The subjects of the valid certificates in the database, and the
+	   ones another run has reserved, sorted:
+	   V<TAB>expiry<TAB>revoked<TAB>serial<TAB>file<TAB>subject */
+	char line[2048], *s, *file, ***list;
+	FILE *fp;
+	int size[2] = { 0, 0 }, *n, busy;
+
+	*subjects = *pending = NULL;
+	*n_subjects = *n_pending = 0;
+	if ( NULL == ( fp = fopen( ca->database, "r" ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", ca->database,
+				strerror( errno ) );
+		return 0;
+	}
+	while ( NULL != fgets( line, sizeof( line ), fp ) )
+	{
+		line[strcspn( line, "\r\n" )] = '\0';
+		if ( NULL == ( file = index_field( line, line + strlen( line ), 4 ) ) ||
+				NULL == ( s = index_field( line, line + strlen( line ), 5 ) ) )
+			continue;
+		busy = ca_pending( file );
+		if ( busy < 0 || ( 0 == busy && 'V' != line[0] ) )
+			continue;
+		list = busy ? pending : subjects;
+		n = busy ? n_pending : n_subjects;
+		if ( *n == size[busy] )
+		{
+			size[busy] = size[busy] ? 2 * size[busy] : 256;
+			*list = realloc( *list, size[busy] * sizeof( char * ) );
+		}
+		if ( NULL == *list || NULL == ( ( *list )[( *n )++] = strdup( s ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			fclose( fp );
+			return 0;
+		}
+	}
+	fclose( fp );
+	qsort( *subjects, *n_subjects, sizeof( char * ), compare_subjects );
+	qsort( *pending, *n_pending, sizeof( char * ), compare_subjects );
+	return 1;
+}
+
+/**********
+ index_field--
+ **********/
+
+static char *index_field( char *line, char *end, int k )
+{
+	/* Where field k of an index line starts, NULL if it has fewer */
+	char *s;
+
+	for ( s = line; k > 0; --k )
+		if ( NULL == ( s = memchr( s, '\t', end - s ) ) )
+			return NULL;
+		else
+			++s;
+	return s;
+}
+
+/*********
+ ca_pending--
+ *********/
+
+int ca_pending( char *file )
+{
+	/* The file of a line ca_reserve() wrote is pending.<pid>: 1 while
+	   that run is going, -1 when it is gone or is this one, 0 for a
+	   line that isn't a reservation */
+	char *end;
+	long pid;
+
+	if ( strncmp( file, "pending.", 8 ) )
+		return 0;
+	pid = strtol( file + 8, &end, 10 );
+	if ( pid <= 0 || pid == (long)getpid() )
+		return -1;
+	return 0 == kill( (pid_t)pid, 0 ) || EPERM == errno ? 1 : -1;
+}
+
+/********
+ ca_check--
+ ********/
+
+int ca_check( ca_conf *ca, void *certs, int n_certs, size_t cert_size, int renew, char *hint )
+{
+	/* With the CA ca_lock()ed, before anything is signed: a subject with
+	   a valid certificate in the index is refused with unique_subject,
+	   with renew the new one takes its place. A name twice is refused
+	   too, its files would be written twice, and so is one another run
+	   has reserved, whatever unique_subject says. The refused get err,
+	   it only fails if the index can't be read. */
+	ca_cert *c;
+	char **subjects, **pending, *subject;
+	int n_subjects, n_pending, i, j;
+
+	if ( !read_subjects( ca, &subjects, &n_subjects, &pending, &n_pending ) )
+		return 0;
+	for ( i = 0; i < n_certs; ++i )
+	{
+		if ( ( c = CA_CERT( certs, cert_size, i ) )->err )
+			continue;
+		X509_NAME_oneline( c->subject, c->index_line, sizeof( c->index_line ) );
+		subject = c->index_line;
+		c->renew = NULL != bsearch( &subject, subjects, n_subjects,
+				sizeof( char * ), compare_subjects );
+		if ( NULL != bsearch( &subject, pending, n_pending,
+				sizeof( char * ), compare_subjects ) )
+		{
+			fprintf( stderr, "Error: %s: %s is being issued by another run.\n",
+					c->name, c->index_line );
+			c->err = 1;
+			continue;
+		}
+		for ( j = 0; j < i; ++j )
+			if ( !CA_CERT( certs, cert_size, j )->err &&
+					!strcmp( CA_CERT( certs, cert_size, j )->name, c->name ) )
+				break;
+		if ( j < i || ( c->renew && ca->unique_subject && !renew ) )
+		{
+			fprintf( stderr, "Error: %s: there is a valid certificate for %s already%s.\n",
+					c->name, c->index_line, j < i ? "" : hint );
+			c->err = 1;
+		}
+		c->renew = c->renew && renew;
+	}
+	for ( i = 0; i < n_subjects; ++i )
+		free( subjects[i] );
+	free( subjects );
+	for ( i = 0; i < n_pending; ++i )
+		free( pending[i] );
+	free( pending );
+	return 1;
+}
+
+/***************
+ ca_take_serials--
+ ***************/
+
+int ca_take_serials( ca_conf *ca, void *certs, int n_certs, size_t cert_size )
+{
+	/* Hands out the next serial numbers to the certificates without err,
+	   the serial file has the one after them before anything is signed */
+	BIGNUM *serial;
+	ca_cert *c;
+	int i, n_serials = 0;
+
+	for ( i = 0; i < n_certs; ++i )
+		n_serials += !CA_CERT( certs, cert_size, i )->err;
+	if ( 0 == n_serials )
+		return 1;
+	if ( !take_serial( ca->serial_file, n_serials, &serial ) )
+		return 0;
+	for ( i = 0; i < n_certs; ++i )
+		if ( !( c = CA_CERT( certs, cert_size, i ) )->err )
+		{
+			c->serial = BN_dup( serial );
+			BN_add_word( serial, 1 );
+		}
+	BN_free( serial );
+	return 1;
+}
+
+/**********
+ ca_reserve--
+ **********/
+
+int ca_reserve( ca_conf *ca, void *certs, int n_certs, size_t cert_size )
+{
+	/* After ca_take_serials(), before the CA is ca_unlock()ed: a line
+	   for each certificate, its file pending.<pid>, so that the runs
+	   and openssl ca after this one see it while it is signed. A new
+	   one is V, which unique_subject keeps to one, a renewal E, it is
+	   next to the valid one it renews. ca_write_index() puts the real
+	   lines in their place, ca_pending() tells the ones a crash left */
+	char *old, *data, *hex;
+	ASN1_TIME *expiry;
+	ca_cert *c;
+	long len, size;
+	int i, ok;
+
+	if ( NULL == ( old = read_file( ca->database, &len ) ) )
+		return 0;
+	if ( NULL == ( data = malloc( len + 1 + n_certs * 2 * sizeof( c->index_line ) + 1 ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		free( old );
+		return 0;
+	}
+	memcpy( data, old, len );
+	size = len;
+	if ( size > 0 && '\n' != data[size - 1] )
+		data[size++] = '\n';
+	for ( i = 0; i < n_certs; ++i )
+		if ( !( c = CA_CERT( certs, cert_size, i ) )->err )
+		{
+			expiry = X509_time_adj_ex( NULL, c->days, 0, NULL );
+			hex = BN_bn2hex( c->serial );
+			size += snprintf( data + size, 2 * sizeof( c->index_line ),
+					"%c\t%.*s\t\t%s\tpending.%ld\t%s\n", c->renew ? 'E' : 'V',
+					NULL != expiry ? expiry->length : 0,
+					NULL != expiry ? (char *)expiry->data : "", hex,
+					(long)getpid(), c->index_line );
+			OPENSSL_free( hex );
+			ASN1_TIME_free( expiry );
+		}
+	ok = rotate( ca->database, data, size );
+	free( data );
+	free( old );
+	return ok;
+}
+
+/**************
+ ca_write_index--
+ **************/
+
+int ca_write_index( ca_conf *ca, void *certs, int n_certs, size_t cert_size )
+{
+	/* Adds the certificates issued to the database in serial order, the
+	   ones they renew are marked revoked, superseded, as
+	   "openssl ca -revoke -crl_reason superseded" does. The lines
+	   ca_reserve() wrote go, and the ones of runs that are gone */
+	char path[512], revoked[32], line[2048], **renewed, *old, *data, *attr;
+	char *s, *next, *subject, *tab, *file;
+	ca_cert *c;
+	time_t t = time( NULL );
+	long len, size, n;
+	int n_renewed = 0, i, ok = 1;
+
+	if ( NULL == ( old = read_file( ca->database, &len ) ) )
+		return 0;
+	strftime( revoked, sizeof( revoked ), "%y%m%d%H%M%SZ,superseded", gmtime( &t ) );
+	renewed = malloc( ( n_certs + 1 ) * sizeof( char * ) );
+	for ( i = 0, size = len + 1; i < n_certs && NULL != renewed; ++i )
+		if ( !( c = CA_CERT( certs, cert_size, i ) )->err )
+		{
+			size += strlen( c->index_line ) + strlen( revoked );
+			if ( !c->renew )
+				continue;
+			s = strrchr( c->index_line, '\t' ) + 1;
+			if ( NULL == ( renewed[n_renewed] = strdup( s ) ) )
+				ok = 0;
+			else
+				renewed[n_renewed++][strcspn( s, "\n" )] = '\0';
+		}
+	if ( !ok || NULL == renewed || NULL == ( data = malloc( size + 1 ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		while ( n_renewed > 0 )
+			free( renewed[--n_renewed] );
+		free( renewed );
+		free( old );
+		return 0;
+	}
+	qsort( renewed, n_renewed, sizeof( char * ), compare_subjects );
+
+	/* V<TAB>expiry<TAB><TAB>... becomes R<TAB>expiry<TAB>revoked<TAB>... */
+	for ( s = old, size = 0; s < old + len; s = next )
+	{
+		next = memchr( s, '\n', old + len - s );
+		next = NULL != next ? next + 1 : old + len;
+		n = next - s;
+		if ( NULL != ( file = index_field( s, next, 4 ) ) && ca_pending( file ) < 0 )
+			continue;
+		if ( n_renewed > 0 && 'V' == s[0] && n < (long)sizeof( line ) )
+		{
+			memcpy( line, s, n );
+			line[n] = '\0';
+			line[strcspn( line, "\r\n" )] = '\0';
+			subject = strrchr( line, '\t' );
+			tab = strchr( line + 2, '\t' );
+			if ( NULL != subject && NULL != tab && '\t' == tab[1] &&
+					( ++subject, NULL != bsearch( &subject, renewed, n_renewed,
+						sizeof( char * ), compare_subjects ) ) )
+			{
+				size += sprintf( data + size, "R%.*s%s%s\n", (int)( tab - line ),
+						line + 1, revoked, tab + 1 );
+				continue;
+			}
+		}
+		memcpy( data + size, s, n );
+		size += n;
+	}
+	if ( size > 0 && '\n' != data[size - 1] )
+		data[size++] = '\n';
+	for ( i = 0; i < n_certs; ++i )
+		if ( !( c = CA_CERT( certs, cert_size, i ) )->err )
+		{
+			strcpy( data + size, c->index_line );
+			size += strlen( c->index_line );
+		}
+	ok = rotate( ca->database, data, size );
+	free( data );
+	while ( n_renewed > 0 )
+		free( renewed[--n_renewed] );
+	free( renewed );
+	free( old );
+
+	snprintf( path, sizeof( path ), "%s.attr", ca->database );
+	attr = ca->unique_subject ? "unique_subject = yes\n" : "unique_subject = no\n";
+	return ok && rotate( path, attr, strlen( attr ) );
+}
+
+/****************
+ compare_subjects--
+ ****************/
+
+int compare_subjects( const void *a, const void *b )
+{
+	return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+/************
+ write_tar_gz--
+ ************/
+
+int write_tar_gz( char *path, member *members, int n_members )
+{
+	/* A ustar archive of the members, gzipped on the way out */
+	unsigned char hdr[TAR_BLOCK], pad[TAR_BLOCK];
+	time_t now = time( NULL );
+	gzFile gz;
+	long n;
+	int i, ok = 1;
+
+	if ( NULL == ( gz = gzopen( path, "wb" ) ) )
+		return 0;
+	memset( pad, 0, sizeof( pad ) );
+	for ( i = 0; i < n_members && ok; ++i )
+	{
+		tar_header( hdr, &members[i], now );
+		ok = TAR_BLOCK == gzwrite( gz, hdr, TAR_BLOCK ) &&
+			members[i].len == gzwrite( gz, members[i].data, members[i].len );
+		n = ( TAR_BLOCK - members[i].len % TAR_BLOCK ) % TAR_BLOCK;
+		if ( ok && n > 0 )
+			ok = n == gzwrite( gz, pad, n );
+	}
+	/* two empty blocks end the archive */
+	ok = ok && TAR_BLOCK == gzwrite( gz, pad, TAR_BLOCK ) &&
+		TAR_BLOCK == gzwrite( gz, pad, TAR_BLOCK );
+	return Z_OK == gzclose( gz ) && ok;
+}
+
+/**********
+ tar_header--
+ **********/
+
+void tar_header( unsigned char *hdr, member *m, time_t mtime )
+{
+	unsigned int sum = 0;
+	int i;
+
+	memset( hdr, 0, TAR_BLOCK );
+	memcpy( hdr, m->path, sizeof( m->path ) );
+	sprintf( (char *)hdr + 100, "%07o", m->mode );
+	sprintf( (char *)hdr + 108, "%07o", (unsigned int)getuid() & 07777777 );
+	sprintf( (char *)hdr + 116, "%07o", (unsigned int)getgid() & 07777777 );
+	sprintf( (char *)hdr + 124, "%011lo", (unsigned long)m->len );
+	sprintf( (char *)hdr + 136, "%011lo", (unsigned long)mtime );
+	hdr[156] = '0';
+	memcpy( hdr + 257, "ustar", 6 );
+	memcpy( hdr + 263, "00", 2 );
+
+	/* the checksum is taken with its own field as spaces */
+	memset( hdr + 148, ' ', 8 );
+	for ( i = 0; i < TAR_BLOCK; ++i )
+		sum += hdr[i];
+	sprintf( (char *)hdr + 148, "%06o", sum );
+	hdr[155] = ' ';
+	return;
+}
+
+/********
+ bio_data--
+ ********/
+
+char *bio_data( BIO *bio, long *len )
+{
+	char *data;
+
+	*len = BIO_get_mem_data( bio, &data );
+	return data;
+}
+
+/************
+ thread_setup--
+ ************/
+
+static void ssl_lock( int mode, int n, const char *file, int line )
+{
+	if ( mode & CRYPTO_LOCK )
+		pthread_mutex_lock( &ssl_locks[n] );
+	else
+		pthread_mutex_unlock( &ssl_locks[n] );
+}
+
+static unsigned long ssl_thread_id( void )
+{
+	return (unsigned long)pthread_self();
+}
+
+void thread_setup( void )
+{
+	/* OpenSSL before 1.1 needs these before it is used from several
+	   threads */
+	int i;
+
+	ssl_locks = OPENSSL_malloc( CRYPTO_num_locks() * sizeof( pthread_mutex_t ) );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_init( &ssl_locks[i], NULL );
+	CRYPTO_set_id_callback( ssl_thread_id );
+	CRYPTO_set_locking_callback( ssl_lock );
+	return;
+}
+
+/**************
+ thread_cleanup--
+ **************/
+
+void thread_cleanup( void )
+{
+	int i;
+
+	CRYPTO_set_locking_callback( NULL );
+	CRYPTO_set_id_callback( NULL );
+	for ( i = 0; i < CRYPTO_num_locks(); ++i )
+		pthread_mutex_destroy( &ssl_locks[i] );
+	OPENSSL_free( ssl_locks );
+	return;
+}
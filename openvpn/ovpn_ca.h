@@ -0,0 +1,118 @@
+/*
+ovpn_ca - the CA of openssl.conf, for the openvpn tools
+
+ca_load() reads what openssl ca and openssl req would out of
+openssl.conf: the default_ca section, the [ req ] settings and the
+subject of a request, and loads the CA certificate and key. The
+helpers write the CA's files the way openssl ca does, so the tools and
+generate.sh can take turns on the same private/ directory.
+../www/www-issue is built with it too.
+
+The CA's files are shared with generate.sh and ../ca-db, and any number
+of them can run at once: ca_lock() takes the lock they all take on
+<database>.lock, for reading the files and writing them back.
+
+ovpn-bundle and www-issue issue in batches: a ca_cert for each
+certificate, the first member of the tool's own entry, ca_check(),
+ca_take_serials() and ca_reserve() before anything is signed and
+ca_write_index() when they are done. The CA is locked for each of the
+two, not while they sign: ca_reserve() puts the batch in the index as
+pending lines, the next ca_check() refuses those subjects. The batch
+calls take the size of an entry, as qsort() does. The archives, and
+OpenSSL's locks for the threads, are here too.
+
+Errors are printed to stderr as they happen, the calls return 0 then.
+*/
+
+#ifndef OVPN_CA_H
+#define OVPN_CA_H
+
+#include <time.h>
+#include <openssl/conf.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/bio.h>
+
+#define CA_MAX_DN      16     /* fields in a distinguished name */
+#define CA_NAME_MAX    64     /* the longest CN there can be */
+#define TAR_BLOCK      512
+
+typedef struct ca_conf
+{
+	CONF *conf;
+	char *section;        /* the default_ca section */
+	char *dir;
+	char *database, *serial_file, *new_certs_dir;
+	char *crl_dir, *crl, *crlnumber_file;
+	char *policy, *extensions;
+	long days, crl_days;
+	const EVP_MD *md;
+	int unique_subject;
+	int key_bits;
+	const EVP_MD *req_md;
+	int n_dn;             /* the request subject, CN is the client's */
+	char *dn_field[CA_MAX_DN], *dn_value[CA_MAX_DN];
+	X509 *ca_cert;
+	EVP_PKEY *ca_key;
+	char *ca_pem;         /* CA_cert.pem as it is */
+	long ca_pem_len;
+	int lock_fd;          /* ca_lock(), -1 without */
+} ca_conf;
+
+/* a certificate of a batch */
+typedef struct ca_cert
+{
+	char name[CA_NAME_MAX + 1];
+	X509_NAME *subject;   /* by the policy */
+	BIGNUM *serial;
+	long days;
+	int renew;            /* it takes the place of a valid certificate */
+	int err;              /* 0, or it isn't issued */
+	char index_line[1024];  /* its subject until it is issued, then its line */
+} ca_cert;
+
+#define CA_CERT( certs, size, i ) \
+	( (ca_cert *)( (char *)( certs ) + (size_t)( i ) * ( size ) ) )
+
+/* a file of an archive, in memory */
+typedef struct member
+{
+	char path[100];       /* as much as a tar header has */
+	char *data;
+	long len;
+	int mode;
+} member;
+
+int  ca_load( ca_conf *ca, char *conf_file );
+void ca_free( ca_conf *ca );
+char *ca_string( ca_conf *ca, char *section, char *name, int required );
+int  ca_lock( ca_conf *ca );
+void ca_unlock( ca_conf *ca );
+
+/* files */
+char *read_file( char *path, long *len );
+int  write_file( char *path, char *data, long len, int mode );
+int  rotate( char *path, char *data, long len );
+int  take_serial( char *path, long n, BIGNUM **first );
+int  read_serial( char *path, BIGNUM **bn );
+int  write_serial( char *path, BIGNUM *bn );
+
+/* batches */
+int  check_name( char *name );
+int  policy_subject( ca_conf *ca, char *name, X509_NAME **subject );
+int  ca_check( ca_conf *ca, void *certs, int n_certs, size_t cert_size, int renew, char *hint );
+int  ca_take_serials( ca_conf *ca, void *certs, int n_certs, size_t cert_size );
+int  ca_reserve( ca_conf *ca, void *certs, int n_certs, size_t cert_size );
+int  ca_pending( char *file );
+int  ca_write_index( ca_conf *ca, void *certs, int n_certs, size_t cert_size );
+int  compare_subjects( const void *a, const void *b );
+
+/* archives and threads */
+int  write_tar_gz( char *path, member *members, int n_members );
+void tar_header( unsigned char *hdr, member *m, time_t mtime );
+char *bio_data( BIO *bio, long *len );
+void thread_setup( void );
+void thread_cleanup( void );
+
+#endif /* OVPN_CA_H */
@@ -0,0 +1,375 @@
+/*
+ovpn_tmpl - makeconf.py's templates, compiled
+
+16oct2026, v0.1
+ - first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "ovpn_tmpl.h"
+
+/* a run of text, or a client's value */
+typedef struct tmpl_seg
+{
+	long off, len;        /* in text */
+	int slot;             /* or -1 */
+} tmpl_seg;
+
+struct tmpl
+{
+	char *text;
+	long len, size;
+	tmpl_seg *segs;
+	int n_segs, size_segs;
+	int flags;
+	int used[TMPL_SLOTS]; /* times each value is in it */
+};
+
+static const char *slot_names[TMPL_SLOTS] = { "NAME", "PROTO", NULL, NULL };
+
+static int add_text( tmpl *t, const char *s, long len );
+static int add_slot( tmpl *t, int slot );
+static int add_block( tmpl *t, char *tag, char *file, int slot );
+static int compile_line( tmpl *t, char *line, long len, tmpl_var *vars,
+		int n_vars );
+static char *inline_tag( char *line, long len, int *direction );
+
+
+/************
+ tmpl_compile--
+ ************/
+
+int tmpl_compile( tmpl **t, char *text, tmpl_var *vars, int n_vars, int flags,
+		char *ca_pem, char *ta_key )
+{
+	char *line, *end, *tag;
+	long len;
+	int direction, slot;
+
+	if ( NULL == ( *t = calloc( 1, sizeof( tmpl ) ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	( *t )->flags = flags;
+
+	for ( line = text; '\0' != *line; line = end )
+	{
+		end = strchr( line, '\n' );
+		end = NULL != end ? end + 1 : line + strlen( line );
+		len = end - line;
+
+		if ( ( flags & TMPL_INLINE ) &&
+				NULL != ( tag = inline_tag( line, len, &direction ) ) )
+		{
+			slot = !strcmp( tag, "cert" ) ? TMPL_CERT :
+				!strcmp( tag, "key" ) ? TMPL_KEY : -1;
+			if ( direction >= 0 )
+			{
+				char kd[32];
+
+				sprintf( kd, "key-direction %d\n", direction );
+				if ( !add_text( *t, kd, strlen( kd ) ) )
+					goto fail;
+			}
+			if ( !add_block( *t, tag, !strcmp( tag, "ca" ) ? ca_pem : ta_key, slot ) )
+				goto fail;
+			continue;
+		}
+		if ( !compile_line( *t, line, len, vars, n_vars ) )
+			goto fail;
+	}
+
+	/* and the newline print adds, as it is in clientwin too */
+	( *t )->flags &= ~TMPL_CRLF;
+	if ( !add_text( *t, "\n", 1 ) )
+		goto fail;
+	( *t )->flags = flags;
+	return 1;
+
+fail:
+	tmpl_free( *t );
+	*t = NULL;
+	return 0;
+}
+
+/************
+ compile_line--
+ ************/
+
+static int compile_line( tmpl *t, char *line, long len, tmpl_var *vars,
+		int n_vars )
+{
+	char *s, *e, *run;
+	long key_len;
+	int i;
+
+	for ( s = run = line; s < line + len; ++s )
+	{
+		if ( '%' != *s )
+			continue;
+		if ( !add_text( t, run, s - run ) )
+			return 0;
+		if ( '%' == s[1] )
+		{
+			if ( !add_text( t, "%", 1 ) )
+				return 0;
+			run = ++s + 1;
+			continue;
+		}
+		if ( '(' != s[1] || NULL == ( e = memchr( s, ')', line + len - s ) ) ||
+				's' != e[1] )
+		{
+			fprintf( stderr, "Error: the template has a %% that isn't %%%% or %%(KEY)s: %.*s",
+					(int)len, line );
+			return 0;
+		}
+		key_len = e - s - 2;
+
+		/* the client's own, or fixed now */
+		for ( i = 0; i < TMPL_SLOTS; ++i )
+			if ( NULL != slot_names[i] && (long)strlen( slot_names[i] ) == key_len &&
+					!strncmp( s + 2, slot_names[i], key_len ) )
+				break;
+		if ( i < TMPL_SLOTS )
+		{
+			if ( !add_slot( t, i ) )
+				return 0;
+		}
+		else
+		{
+			/* the last one given wins */
+			for ( i = n_vars - 1; i >= 0; --i )
+				if ( (long)strlen( vars[i].key ) == key_len &&
+						!strncmp( s + 2, vars[i].key, key_len ) )
+					break;
+			if ( i < 0 )
+			{
+				fprintf( stderr, "Error: the template has %%(%.*s)s and there is no %.*s.\n",
+						(int)key_len, s + 2, (int)key_len, s + 2 );
+				return 0;
+			}
+			if ( !add_text( t, vars[i].value, strlen( vars[i].value ) ) )
+				return 0;
+		}
+		s = e + 1;
+		run = s + 1;
+	}
+	return add_text( t, run, line + len - run );
+}
+
+/**********
+ inline_tag--
+ **********/
+
+static char *inline_tag( char *line, long len, int *direction )
+{
+	/* ca, cert, key or tls-auth if the line is one of them, with the
+	   key direction of tls-auth */
+	static char *tags[] = { "ca", "cert", "key", "tls-auth", NULL };
+	char *s = line, *e;
+	int i;
+
+	*direction = -1;
+	while ( s < line + len && isspace( (unsigned char)*s ) )
+		++s;
+	for ( e = s; e < line + len && !isspace( (unsigned char)*e ); ++e )
+		;
+	for ( i = 0; NULL != tags[i]; ++i )
+		if ( (long)strlen( tags[i] ) == e - s && !strncmp( s, tags[i], e - s ) )
+			break;
+	if ( NULL == tags[i] )
+		return NULL;
+
+	/* tls-auth file [direction] */
+	if ( 3 == i )
+	{
+		for ( s = e; s < line + len && isspace( (unsigned char)*s ); ++s )
+			;
+		for ( ; s < line + len && !isspace( (unsigned char)*s ); ++s )
+			;
+		for ( ; s < line + len && isspace( (unsigned char)*s ); ++s )
+			;
+		if ( s < line + len && isdigit( (unsigned char)*s ) )
+			*direction = *s - '0';
+	}
+	return tags[i];
+}
+
+/*********
+ add_block--
+ *********/
+
+static int add_block( tmpl *t, char *tag, char *file, int slot )
+{
+	/* <tag>, the file or the client's value, </tag> */
+	char open[32], close[32];
+	long len;
+
+	sprintf( open, "<%s>\n", tag );
+	sprintf( close, "</%s>\n", tag );
+	if ( !add_text( t, open, strlen( open ) ) )
+		return 0;
+	if ( slot >= 0 )
+	{
+		if ( !add_slot( t, slot ) )
+			return 0;
+	}
+	else
+	{
+		if ( NULL == file )
+		{
+			fprintf( stderr, "Error: nothing to put in <%s>.\n", tag );
+			return 0;
+		}
+		len = strlen( file );
+		if ( !add_text( t, file, len ) ||
+				( len > 0 && '\n' != file[len - 1] && !add_text( t, "\n", 1 ) ) )
+			return 0;
+	}
+	return add_text( t, close, strlen( close ) );
+}
+
+/********
+ add_text--
+ ********/
+
+static int add_text( tmpl *t, const char *s, long len )
+{
+	/* Appended to the last run if it is one, \n as \r\n for TMPL_CRLF */
+	long need = len, i;
+	tmpl_seg *seg;
+
+	if ( 0 == len )
+		return 1;
+	if ( t->flags & TMPL_CRLF )
+		for ( i = 0; i < len; ++i )
+			need += '\n' == s[i];
+	if ( t->len + need > t->size )
+	{
+		t->size = 2 * ( t->len + need ) + 256;
+		if ( NULL == ( t->text = realloc( t->text, t->size ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			return 0;
+		}
+	}
+	seg = t->n_segs > 0 ? &t->segs[t->n_segs - 1] : NULL;
+	if ( NULL == seg || seg->slot >= 0 )
+	{
+		if ( !add_slot( t, -1 ) )
+			return 0;
+		seg = &t->segs[t->n_segs - 1];
+		seg->off = t->len;
+	}
+	for ( i = 0; i < len; ++i )
+	{
+		if ( ( t->flags & TMPL_CRLF ) && '\n' == s[i] )
+			t->text[t->len++] = '\r';
+		t->text[t->len++] = s[i];
+	}
+	seg->len += need;
+	return 1;
+}
+
+/********
+ add_slot--
+ ********/
+
+static int add_slot( tmpl *t, int slot )
+{
+	tmpl_seg *seg;
+
+	if ( t->n_segs == t->size_segs )
+	{
+		t->size_segs = t->size_segs ? 2 * t->size_segs : 32;
+		if ( NULL == ( t->segs = realloc( t->segs, t->size_segs * sizeof( tmpl_seg ) ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			return 0;
+		}
+	}
+	seg = &t->segs[t->n_segs++];
+	seg->off = 0;
+	seg->len = 0;
+	seg->slot = slot;
+	if ( slot >= 0 )
+		t->used[slot]++;
+	return 1;
+}
+
+/*********
+ tmpl_size--
+ *********/
+
+long tmpl_size( tmpl *t, tmpl_value *values )
+{
+	/* What tmpl_render() writes, for these values */
+	long size = t->len, i, n;
+	int slot;
+
+	for ( slot = 0; slot < TMPL_SLOTS; ++slot )
+	{
+		if ( 0 == t->used[slot] )
+			continue;
+		n = values[slot].len;
+		if ( t->flags & TMPL_CRLF )
+			for ( i = 0; i < values[slot].len; ++i )
+				n += '\n' == values[slot].s[i];
+		size += t->used[slot] * n;
+	}
+	return size;
+}
+
+/***********
+ tmpl_render--
+ ***********/
+
+long tmpl_render( tmpl *t, tmpl_value *values, char *buf )
+{
+	tmpl_seg *seg;
+	char *out = buf, *s;
+	long i;
+
+	for ( seg = t->segs; seg < t->segs + t->n_segs; ++seg )
+	{
+		if ( seg->slot < 0 )
+		{
+			memcpy( out, t->text + seg->off, seg->len );
+			out += seg->len;
+		}
+		else if ( !( t->flags & TMPL_CRLF ) )
+		{
+			memcpy( out, values[seg->slot].s, values[seg->slot].len );
+			out += values[seg->slot].len;
+		}
+		else
+		{
+			s = values[seg->slot].s;
+			for ( i = 0; i < values[seg->slot].len; ++i )
+			{
+				if ( '\n' == s[i] )
+					*out++ = '\r';
+				*out++ = s[i];
+			}
+		}
+	}
+	return out - buf;
+}
+
+/*********
+ tmpl_free--
+ *********/
+
+void tmpl_free( tmpl *t )
+{
+	if ( NULL == t )
+		return;
+	free( t->text );
+	free( t->segs );
+	free( t );
+	return;
+}
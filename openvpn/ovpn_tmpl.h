@@ -0,0 +1,55 @@
+/*
+ovpn_tmpl - makeconf.py's templates, compiled
+
+A template is compiled once into runs of text and the places the
+client's own values go. Everything that is the same for every client,
+the variables given to tmpl_compile() and with TMPL_INLINE the CA and
+ta.key, is in the text by then, so rendering a client is a few
+memcpy()s into a buffer tmpl_size() said is big enough.
+
+%(KEY)s and %% are read as python's % does. NAME and PROTO are the
+client's, any other KEY has to be one of the variables.
+
+With TMPL_INLINE the ca, cert, key and tls-auth lines are replaced by
+<ca>, <cert>, <key> and <tls-auth> blocks with the files in them, for
+a .ovpn that needs nothing else. TMPL_CRLF is "makeconf.py clientwin".
+
+Errors are printed to stderr as they happen, the calls return 0 then.
+*/
+
+#ifndef OVPN_TMPL_H
+#define OVPN_TMPL_H
+
+#define TMPL_CRLF      1
+#define TMPL_INLINE    2
+
+/* the client's values */
+enum
+{
+	TMPL_NAME,
+	TMPL_PROTO,
+	TMPL_CERT,            /* PEM, for TMPL_INLINE */
+	TMPL_KEY,
+	TMPL_SLOTS
+};
+
+typedef struct tmpl_var
+{
+	char *key, *value;
+} tmpl_var;
+
+typedef struct tmpl_value
+{
+	char *s;
+	long len;
+} tmpl_value;
+
+typedef struct tmpl tmpl;
+
+int  tmpl_compile( tmpl **t, char *text, tmpl_var *vars, int n_vars, int flags,
+		char *ca_pem, char *ta_key );
+long tmpl_size( tmpl *t, tmpl_value *values );
+long tmpl_render( tmpl *t, tmpl_value *values, char *buf );
+void tmpl_free( tmpl *t );
+
+#endif /* OVPN_TMPL_H */
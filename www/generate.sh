@@ -5,6 +5,8 @@ DAYS=3650
 CERT_NAME=$1
 KEY_SIZE=2048
 DH_KEY_SIZE=${KEY_SIZE}
+# dh-pool take: -N for the RFC 7919 group when the pool is empty
+DH_POOL_FLAGS=
 
 #--------------------------------------------------------
 export C="US"
@@ -14,6 +16,11 @@ export O="Paranoid"
 export OU="Security"
 export CN=${CERT_NAME}
 #--------------------------------------------------------
+# with ../ca-db openssl ca runs with the CA locked, see ../ca-db
+if [ -x ../ca-db/ca-db ]
+    then CA_DB_RUN="../ca-db/ca-db run"
+fi
+#--------------------------------------------------------
 _dirs="private private/crl private/certdb private/keys private/arc"
 
 for dir in $_dirs
@@ -38,7 +45,11 @@ fi
 
 if test -f private/CA_key.crt && test -f private/CA_cert.crt && test -f private/dh${DH_KEY_SIZE}.pem
     then
-        if [ -n "$1" ]
+        if [ -n "$1" ] && [ -x ./www-issue ]
+            then
+                # all the names, or -f manifest, at once, see www-issue.c
+                ./www-issue "$@"
+        elif [ -n "$1" ]
             then
                 echo "Generating $1 keyfiles"
 
@@ -46,7 +57,7 @@ if test -f private/CA_key.crt && test -f private/CA_cert.crt && test -f private/
                 openssl req -config openssl.conf -new -nodes -keyout private/keys/${CERT_NAME}.key -out private/keys/${CERT_NAME}.csr -newkey rsa:${KEY_SIZE} || exit 1
 
                 # Для создания сертификата сервера необходимо подписать запрос на сертификат сервера  самоподписным доверенным сертификатом (CA).
-                openssl ca -batch -config openssl.conf -out private/keys/${CERT_NAME}.cert -infiles private/keys/${CERT_NAME}.csr
+                ${CA_DB_RUN} openssl ca -batch -config openssl.conf -out private/keys/${CERT_NAME}.cert -infiles private/keys/${CERT_NAME}.csr
                 # Просмотр результата генерации сертификата
                 openssl x509 -noout -text -in private/keys/${CERT_NAME}.cert
 
@@ -67,7 +78,13 @@ if test -f private/CA_key.crt && test -f private/CA_cert.crt && test -f private/
         openssl x509 -text -in private/CA_cert.crt -out private/CA_cert.cer
 
         # Создание файла параметров Диффи-Хэлмана
-        openssl dhparam -out private/dh${DH_KEY_SIZE}.pem ${DH_KEY_SIZE} || exit 1
+        # made ahead of time if dh-pool is built, see ../dh-pool
+        if [ -x ../dh-pool/dh-pool ]
+            then
+                ../dh-pool/dh-pool take -b ${DH_KEY_SIZE} ${DH_POOL_FLAGS} -o private/dh${DH_KEY_SIZE}.pem || exit 1
+            else
+                openssl dhparam -out private/dh${DH_KEY_SIZE}.pem ${DH_KEY_SIZE} || exit 1
+        fi
 
         cd private
         FILES="CA_key.crt CA_cert.crt CA_cert.cer dh${DH_KEY_SIZE}.pem"
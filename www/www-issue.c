@@ -0,0 +1,878 @@
+/*
+www-issue - issues web server certificates from a manifest
+
+generate.sh issues one certificate per run, for $1, with openssl req,
+openssl ca, openssl x509 -text, cat and tar, and no way to give it
+anything but the name. At a rotation that is thousands of runs. This
+reads a manifest of hosts, loads the CA and openssl.conf once and
+issues the certificates on a thread pool, the keys made on every CPU.
+
+The manifest has a host per line, its name first and then any of
+
+	san=a.example.com,b.example.com,IP:10.0.0.1,...
+	    the subjectAltNames, without a type a name is DNS: and an
+	    address is IP:. Without san= it is DNS:*.<name>, what
+	    [ alt_names ] gives generate.sh
+	key=rsa:2048 or key=ec:prime256v1
+	    the key, it defaults to -k or rsa:<default_bits>
+	days=825
+	    how long it is valid, it defaults to -d or default_days
+
+with blank lines and # comments skipped. Names on the command line are
+hosts with everything defaulted.
+
+For each host it writes what generate.sh does:
+
+	private/keys/<name>.key          the key, mode 0600
+	private/keys/<name>.csr          the certificate request
+	private/keys/<name>.cert         the certificate, text and PEM
+	private/keys/<name>.chained.crt  the same and CA_cert.crt
+	private/certdb/<serial>.pem      the certificate, for the CA's records
+	private/arc/<name>.tar.gz        the five of them, CA_cert.cer and the
+	                                 DH parameters
+
+The subject and the extensions follow the [ ca ] section of
+openssl.conf, as ovpn-bundle does, with the subjectAltName of the
+x509_extensions section replaced by the host's own. The serial numbers
+are taken from private/serial before the first certificate is signed
+and private/index gets the new certificates when they are all done,
+rotated to .old like openssl ca does. A host with a valid certificate
+is refused, with -R it is renewed: its old certificate is marked
+revoked, superseded, in the same write.
+
+openssl.conf and the CA are read by ../openvpn/ovpn_ca.c.
+
+Usage: www-issue [-c openssl.conf] [-p dhparam] [-k key] [-d days] [-R]
+                 [-j threads] [-q] [-f manifest] [name ...]
+
+16oct2026, v0.1
+ - first version
+
+16oct2026, v0.2
+ - the CA is locked while the index and serial are read and written
+
+16oct2026, v0.3
+ - the checks, the index, the tar.gz and the thread locks are in
+   ../openvpn/ovpn_ca.c, shared with ovpn-bundle
+
+16oct2026, v0.4
+ - the hosts are reserved in the index while they are issued, two
+   runs with the same host, -R or not, can't both issue it
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include <openssl/conf.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include "ovpn_ca.h"
+
+#define SAN_MAX_LEN    4096
+
+/* the key of a host */
+typedef struct key_type
+{
+	int type;             /* EVP_PKEY_RSA or EVP_PKEY_EC */
+	int bits;             /* RSA */
+	int curve;            /* EC */
+} key_type;
+
+/* one host, its certificate first for the ca_*() calls */
+typedef struct host
+{
+	ca_cert c;            /* renew: it has a valid certificate already */
+	char *san;            /* for X509V3_EXT_nconf_nid(), or NULL */
+	key_type key;
+} host;
+
+/* what goes in every archive besides the host's own files */
+typedef struct issue_conf
+{
+	char *ca_cer;         /* CA_cert.cer */
+	long ca_cer_len;
+	char *dh;             /* the DH parameters */
+	long dh_len;
+	char dh_name[100];
+} issue_conf;
+
+typedef struct issue_run
+{
+	ca_conf *ca;
+	issue_conf *ic;
+	host *hosts;
+	int n_hosts;
+	int next;             /* next host for a worker to take */
+	int done, failed;
+	double shown;         /* when progress() last wrote */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} issue_run;
+
+/* prototypes */
+int  read_manifest( char *manifest_file, key_type *key, long days,
+		host **hosts, int *n_hosts );
+int  parse_host( char *line, key_type *key, long days, host *h );
+int  parse_key( char *s, key_type *key );
+int  parse_san( char *s, host *h );
+void *issue_worker( void *arg );
+int  issue_host( ca_conf *ca, issue_conf *ic, host *h );
+EVP_PKEY *make_key( key_type *key );
+int  add_extensions( ca_conf *ca, X509 *x, host *h );
+void progress( issue_run *run, double start, int last );
+double now( void );
+
+
+/****
+ main--
+ ****/
+
+int main( int argc, char **argv )
+{
+	ca_conf ca;
+	issue_conf ic;
+	issue_run run;
+	key_type key;
+	host *h;
+	pthread_t *threads;
+	struct timespec until;
+	char *conf_file = "openssl.conf", *manifest_file = NULL;
+	char *key_spec = NULL, *dh_file = NULL, path[512];
+	double start, t;
+	long days = 0;
+	int n_threads, n_started = 0, renew = 0, quiet = 0;
+	int issued = 0, failed = 0, last, i, j, c;
+	char *help =
+		"\n"
+		"Usage: www-issue [options] <name> [<name> ...]\n"
+		"       www-issue [options] -f <manifest>\n"
+		"  Issues a key, certificate and private/arc/<name>.tar.gz for every\n"
+		"  host, like \"generate.sh <name>\" does for one. Run it where\n"
+		"  generate.sh is, with its environment (C, ST, L, O, OU) set.\n"
+		"Options:\n"
+		"  -c <conf>      - The openssl.conf with the CA, it defaults to openssl.conf\n"
+		"  -f <manifest>  - Hosts, one per line: name [san=...] [key=...] [days=...]\n"
+		"                   - for stdin. Blank lines and # comments are skipped\n"
+		"  -p <dhparam>   - The DH parameters for the archives, it defaults to\n"
+		"                   private/dh<default_bits>.pem\n"
+		"  -k <key>       - rsa:<bits> or ec:<curve>, it defaults to rsa:<default_bits>\n"
+		"  -d <days>      - How long they are valid, it defaults to default_days\n"
+		"  -R             - Renew: a host's valid certificate is revoked, superseded\n"
+		"  -j <threads>   - Hosts issued at once, it defaults to the number of CPUs\n"
+		"  -q             - No progress, only the errors and the total\n"
+		"  -h             - Displays this help\n"
+		"\n";
+
+	n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+	while ( -1 != ( c = getopt( argc, argv, "hc:f:p:k:d:Rj:q" ) ) )
+	{
+		switch ( c )
+		{
+			case 'c':
+				conf_file = optarg;
+				break;
+			case 'f':
+				manifest_file = optarg;
+				break;
+			case 'p':
+				dh_file = optarg;
+				break;
+			case 'k':
+				key_spec = optarg;
+				break;
+			case 'd':
+				if ( ( days = atol( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: days must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'R':
+				renew = 1;
+				break;
+			case 'j':
+				if ( ( n_threads = atoi( optarg ) ) < 1 )
+				{
+					fprintf( stderr, "Error: number of threads must be at least 1.\n" );
+					exit( EXIT_FAILURE );
+				}
+				break;
+			case 'q':
+				quiet = 1;
+				break;
+			default:
+				fprintf( stderr, help );
+				exit( EXIT_FAILURE );
+		}
+	}
+	if ( NULL == manifest_file && optind == argc )
+	{
+		fprintf( stderr, help );
+		exit( EXIT_FAILURE );
+	}
+
+	/* CN is the host's, openssl.conf only needs it to be there */
+	setenv( "CN", "www-issue", 0 );
+	umask( 022 );
+	OpenSSL_add_all_algorithms();
+	ERR_load_crypto_strings();
+	if ( !ca_load( &ca, conf_file ) )
+		exit( EXIT_FAILURE );
+	memset( &key, 0, sizeof( key ) );
+	key.type = EVP_PKEY_RSA;
+	key.bits = ca.key_bits;
+	if ( NULL != key_spec && !parse_key( key_spec, &key ) )
+		exit( EXIT_FAILURE );
+	if ( 0 == days )
+		days = ca.days;
+
+	memset( &ic, 0, sizeof( ic ) );
+	snprintf( path, sizeof( path ), "%s/dh%d.pem", ca.dir, ca.key_bits );
+	if ( NULL == dh_file )
+		dh_file = path;
+	snprintf( ic.dh_name, sizeof( ic.dh_name ), "%.99s",
+			NULL != strrchr( dh_file, '/' ) ? strrchr( dh_file, '/' ) + 1 : dh_file );
+	if ( NULL == ( ic.dh = read_file( dh_file, &ic.dh_len ) ) )
+		exit( EXIT_FAILURE );
+	snprintf( path, sizeof( path ), "%s/CA_cert.cer", ca.dir );
+	if ( NULL == ( ic.ca_cer = read_file( path, &ic.ca_cer_len ) ) )
+		exit( EXIT_FAILURE );
+
+	if ( NULL != manifest_file )
+	{
+		if ( !read_manifest( manifest_file, &key, days, &run.hosts, &run.n_hosts ) )
+			exit( EXIT_FAILURE );
+	}
+	else
+	{
+		if ( NULL == ( run.hosts = calloc( argc - optind, sizeof( host ) ) ) )
+		{
+			fprintf( stderr, "Error: out of memory.\n" );
+			exit( EXIT_FAILURE );
+		}
+		for ( run.n_hosts = 0; optind < argc; ++optind )
+			if ( !parse_host( argv[optind], &key, days, &run.hosts[run.n_hosts] ) )
+				++failed;
+			else
+				run.n_hosts++;
+	}
+
+	/* every host is checked before anything is signed, a bad one or one
+	   that is there already is left out */
+	for ( i = 0; i < run.n_hosts; ++i )
+	{
+		h = &run.hosts[i];
+		h->c.err = !check_name( h->c.name ) ||
+			!policy_subject( &ca, h->c.name, &h->c.subject );
+	}
+	if ( !ca_lock( &ca ) || !ca_check( &ca, run.hosts, run.n_hosts, sizeof( host ),
+				renew, ", -R renews it" ) )
+		exit( EXIT_FAILURE );
+	for ( i = j = 0; i < run.n_hosts; ++i )
+		if ( run.hosts[i].c.err )
+		{
+			X509_NAME_free( run.hosts[i].c.subject );
+			free( run.hosts[i].san );
+			++failed;
+		}
+		else
+			run.hosts[j++] = run.hosts[i];
+	run.n_hosts = j;
+
+	if ( !ca_take_serials( &ca, run.hosts, run.n_hosts, sizeof( host ) ) ||
+			!ca_reserve( &ca, run.hosts, run.n_hosts, sizeof( host ) ) )
+		exit( EXIT_FAILURE );
+	ca_unlock( &ca );
+
+	/* the hosts are issued on the threads, in any order, this one
+	   reports how far they are */
+	if ( n_threads > run.n_hosts )
+		n_threads = run.n_hosts > 0 ? run.n_hosts : 1;
+	run.ca = &ca;
+	run.ic = &ic;
+	run.next = run.done = run.failed = 0;
+	run.shown = 0;
+	pthread_mutex_init( &run.lock, NULL );
+	pthread_cond_init( &run.cond, NULL );
+	thread_setup();
+	start = now();
+	if ( NULL != ( threads = calloc( n_threads, sizeof( pthread_t ) ) ) )
+		for ( ; n_started < n_threads; ++n_started )
+			if ( pthread_create( &threads[n_started], NULL, issue_worker, &run ) )
+				break;
+	if ( 0 == n_started )
+		issue_worker( &run ); /* on this thread then */
+	pthread_mutex_lock( &run.lock );
+	for ( last = -1; run.done < run.n_hosts; )
+	{
+		until.tv_sec = time( NULL ) + 1;
+		until.tv_nsec = 0;
+		pthread_cond_timedwait( &run.cond, &run.lock, &until );
+		if ( !quiet && run.done != last )
+		{
+			last = run.done;
+			progress( &run, start, 0 );
+		}
+	}
+	pthread_mutex_unlock( &run.lock );
+	for ( i = 0; i < n_started; ++i )
+		pthread_join( threads[i], NULL );
+	free( threads );
+	thread_cleanup();
+	if ( !quiet && run.n_hosts > 0 )
+		progress( &run, start, 1 );
+	pthread_cond_destroy( &run.cond );
+	pthread_mutex_destroy( &run.lock );
+
+	for ( i = 0; i < run.n_hosts; ++i )
+	{
+		if ( run.hosts[i].c.err )
+			++failed;
+		else
+			++issued;
+	}
+	if ( run.n_hosts > 0 && ( !ca_lock( &ca ) ||
+			!ca_write_index( &ca, run.hosts, run.n_hosts, sizeof( host ) ) ) )
+	{
+		failed += issued;
+		issued = 0;
+	}
+	ca_unlock( &ca );
+
+	t = now() - start;
+	fprintf( stderr, "Certificates: %d issued, %d failed in %.2fs, %.1f/s.\n",
+			issued, failed, t, t > 0 ? issued / t : 0.0 );
+	for ( i = 0; i < run.n_hosts; ++i )
+	{
+		X509_NAME_free( run.hosts[i].c.subject );
+		BN_free( run.hosts[i].c.serial );
+		free( run.hosts[i].san );
+	}
+	free( run.hosts );
+	free( ic.dh );
+	free( ic.ca_cer );
+	ca_free( &ca );
+	return( failed ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+/*************
+ read_manifest--
+ *************/
+
+int read_manifest( char *manifest_file, key_type *key, long days,
+		host **hosts, int *n_hosts )
+{
+	char line[SAN_MAX_LEN + 256], *s;
+	FILE *fp;
+	int size = 0, line_no = 0, ok = 1;
+
+	*hosts = NULL;
+	*n_hosts = 0;
+	if ( !strcmp( manifest_file, "-" ) )
+		fp = stdin;
+	else if ( NULL == ( fp = fopen( manifest_file, "r" ) ) )
+	{
+		fprintf( stderr, "Error: can't read %s: %s.\n", manifest_file,
+				strerror( errno ) );
+		return 0;
+	}
+	while ( ok && NULL != fgets( line, sizeof( line ), fp ) )
+	{
+		++line_no;
+		if ( NULL != ( s = strchr( line, '#' ) ) )
+			*s = '\0';
+		for ( s = line; isspace( (unsigned char)*s ); ++s )
+			;
+		if ( '\0' == *s )
+			continue;
+		if ( *n_hosts == size )
+		{
+			size = size ? 2 * size : 256;
+			if ( NULL == ( *hosts = realloc( *hosts, size * sizeof( host ) ) ) )
+			{
+				fprintf( stderr, "Error: out of memory.\n" );
+				ok = 0;
+				break;
+			}
+		}
+		if ( !parse_host( s, key, days, &( *hosts )[*n_hosts] ) )
+		{
+			fprintf( stderr, "Error: %s line %d.\n", manifest_file, line_no );
+			ok = 0;
+			break;
+		}
+		( *n_hosts )++;
+	}
+	if ( stdin != fp )
+		fclose( fp );
+	if ( ok && 0 == *n_hosts )
+	{
+		fprintf( stderr, "Error: there are no hosts in %s.\n", manifest_file );
+		ok = 0;
+	}
+	if ( !ok )
+	{
+		while ( *n_hosts > 0 )
+			free( ( *hosts )[--( *n_hosts )].san );
+		free( *hosts );
+		*hosts = NULL;
+	}
+	return ok;
+}
+
+/**********
+ parse_host--
+ **********/
+
+int parse_host( char *line, key_type *key, long days, host *h )
+{
+	/* name [san=...] [key=...] [days=...] */
+	char *s, *next;
+	int first = 1;
+
+	memset( h, 0, sizeof( host ) );
+	h->key = *key;
+	h->c.days = days;
+	for ( s = line; '\0' != *s; s = next )
+	{
+		while ( isspace( (unsigned char)*s ) )
+			++s;
+		if ( '\0' == *s )
+			break;
+		for ( next = s; '\0' != *next && !isspace( (unsigned char)*next ); ++next )
+			;
+		if ( '\0' != *next )
+			*next++ = '\0';
+
+		if ( first )
+		{
+			if ( strlen( s ) > CA_NAME_MAX )
+			{
+				fprintf( stderr, "Error: %s: a name must be 1 to %d characters.\n", s,
+						CA_NAME_MAX );
+				return 0;
+			}
+			strcpy( h->c.name, s );
+			first = 0;
+		}
+		else if ( !strncmp( s, "san=", 4 ) )
+		{
+			if ( !parse_san( s + 4, h ) )
+				return 0;
+		}
+		else if ( !strncmp( s, "key=", 4 ) )
+		{
+			if ( !parse_key( s + 4, &h->key ) )
+				return 0;
+		}
+		else if ( !strncmp( s, "days=", 5 ) )
+		{
+			if ( ( h->c.days = atol( s + 5 ) ) < 1 )
+			{
+				fprintf( stderr, "Error: %s: days must be at least 1.\n", h->c.name );
+				return 0;
+			}
+		}
+		else
+		{
+			fprintf( stderr, "Error: %s: %s isn't san=, key= or days=.\n", h->c.name, s );
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*********
+ parse_key--
+ *********/
+
+int parse_key( char *s, key_type *key )
+{
+	/* rsa:<bits> or ec:<curve>, the curve by its name or NIST's */
+	if ( !strncmp( s, "rsa:", 4 ) )
+	{
+		key->type = EVP_PKEY_RSA;
+		if ( ( key->bits = atoi( s + 4 ) ) < 1024 )
+		{
+			fprintf( stderr, "Error: %s: an RSA key has at least 1024 bits.\n", s );
+			return 0;
+		}
+		return 1;
+	}
+	if ( !strncmp( s, "ec:", 3 ) )
+	{
+		key->type = EVP_PKEY_EC;
+		key->curve = EC_curve_nist2nid( s + 3 );
+		if ( NID_undef == key->curve )
+			key->curve = OBJ_sn2nid( s + 3 );
+		if ( NID_undef == key->curve )
+		{
+			fprintf( stderr, "Error: %s: unknown curve.\n", s );
+			return 0;
+		}
+		return 1;
+	}
+	fprintf( stderr, "Error: %s: a key is rsa:<bits> or ec:<curve>.\n", s );
+	return 0;
+}
+
+/*********
+ parse_san--
+ *********/
+
+int parse_san( char *s, host *h )
+{
+	/* a,b,IP:c,... to DNS:a,DNS:b,IP:c for X509V3_EXT_nconf_nid() */
+	static char *types[] = { "DNS:", "IP:", "email:", "URI:", "RID:", NULL };
+	unsigned char addr[16];
+	char item[256], *end;
+	long len = 0, n;
+	int i;
+
+	free( h->san );
+	if ( NULL == ( h->san = malloc( SAN_MAX_LEN ) ) )
+	{
+		fprintf( stderr, "Error: out of memory.\n" );
+		return 0;
+	}
+	h->san[0] = '\0';
+	for ( ; '\0' != *s; s = '\0' != *end ? end + 1 : end )
+	{
+		end = s + strcspn( s, "," );
+		if ( end == s )
+			continue;
+		snprintf( item, sizeof( item ), "%.*s", (int)( end - s ), s );
+		for ( i = 0; NULL != types[i]; ++i )
+			if ( !strncmp( item, types[i], strlen( types[i] ) ) )
+				break;
+		n = snprintf( h->san + len, SAN_MAX_LEN - len, "%s%s%s", len ? "," : "",
+				NULL != types[i] ? "" :
+				1 == inet_pton( AF_INET, item, addr ) ||
+				1 == inet_pton( AF_INET6, item, addr ) ? "IP:" : "DNS:", item );
+		if ( n >= SAN_MAX_LEN - len )
+		{
+			fprintf( stderr, "Error: %s: the san= is over %d characters.\n", h->c.name,
+					SAN_MAX_LEN );
+			return 0;
+		}
+		len += n;
+	}
+	if ( 0 == len )
+	{
+		fprintf( stderr, "Error: %s: san= is empty.\n", h->c.name );
+		return 0;
+	}
+	return 1;
+}
+
+/************
+ issue_worker--
+ ************/
+
+void *issue_worker( void *arg )
+{
+	issue_run *run = arg;
+	host *h;
+	int ok;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &run->lock );
+		h = run->next < run->n_hosts ? &run->hosts[run->next++] : NULL;
+		pthread_mutex_unlock( &run->lock );
+		if ( NULL == h )
+			break;
+		ok = issue_host( run->ca, run->ic, h );
+		pthread_mutex_lock( &run->lock );
+		h->c.err = !ok;
+		run->failed += !ok;
+		if ( ++run->done == run->n_hosts )
+			pthread_cond_signal( &run->cond );
+		pthread_mutex_unlock( &run->lock );
+	}
+	ERR_remove_state( 0 );
+	return NULL;
+}
+
+/**********
+ issue_host--
+ **********/
+
+int issue_host( ca_conf *ca, issue_conf *ic, host *h )
+{
+	/* Key, request, certificate and archive of one host. Whatever was
+	   written is taken away again if it fails. */
+	EVP_PKEY *pkey = NULL;
+	X509_REQ *req = NULL;
+	X509_NAME *req_name;
+	X509 *x = NULL;
+	ASN1_TIME *not_after;
+	BIO *key_bio = NULL, *req_bio = NULL, *cert_bio = NULL;
+	member m[7];
+	char *serial_hex = NULL, *chained = NULL, subject[512], expiry[32];
+	char key_path[512], req_path[512], cert_path[512], chained_path[512];
+	char db_path[512], arc_path[512];
+	int ok = 0, k;
+
+	memset( m, 0, sizeof( m ) );
+	snprintf( key_path, sizeof( key_path ), "%s/keys/%s.key", ca->dir, h->c.name );
+	snprintf( req_path, sizeof( req_path ), "%s/keys/%s.csr", ca->dir, h->c.name );
+	snprintf( cert_path, sizeof( cert_path ), "%s/keys/%s.cert", ca->dir, h->c.name );
+	snprintf( chained_path, sizeof( chained_path ), "%s/keys/%s.chained.crt",
+			ca->dir, h->c.name );
+	snprintf( arc_path, sizeof( arc_path ), "%s/arc/%s.tar.gz", ca->dir, h->c.name );
+	serial_hex = BN_bn2hex( h->c.serial );
+	snprintf( db_path, sizeof( db_path ), "%s/%s.pem", ca->new_certs_dir,
+			serial_hex );
+
+	/* the request, the whole [ req_distinguished_name ] with CN = name */
+	if ( NULL == ( pkey = make_key( &h->key ) ) ||
+			NULL == ( req = X509_REQ_new() ) || !X509_REQ_set_version( req, 0 ) ||
+			!X509_REQ_set_pubkey( req, pkey ) )
+		goto done;
+	req_name = X509_REQ_get_subject_name( req );
+	for ( k = 0; k < ca->n_dn; ++k )
+		if ( !X509_NAME_add_entry_by_txt( req_name, ca->dn_field[k], MBSTRING_ASC,
+				(unsigned char *)( NID_commonName == OBJ_txt2nid( ca->dn_field[k] ) ?
+					h->c.name : ca->dn_value[k] ), -1, -1, 0 ) )
+			goto done;
+	if ( !X509_REQ_sign( req, pkey, ca->req_md ) )
+		goto done;
+
+	/* the certificate, openssl ca */
+	if ( NULL == ( x = X509_new() ) || !X509_set_version( x, 2 ) ||
+			NULL == BN_to_ASN1_INTEGER( h->c.serial, X509_get_serialNumber( x ) ) ||
+			!X509_set_issuer_name( x, X509_get_subject_name( ca->ca_cert ) ) ||
+			NULL == X509_gmtime_adj( X509_get_notBefore( x ), 0 ) ||
+			NULL == X509_time_adj_ex( X509_get_notAfter( x ), h->c.days, 0, NULL ) ||
+			!X509_set_subject_name( x, h->c.subject ) || !X509_set_pubkey( x, pkey ) ||
+			!add_extensions( ca, x, h ) || !X509_sign( x, ca->ca_key, ca->md ) )
+		goto done;
+
+	/* the three of them in PEM, the certificate with its text first */
+	key_bio = BIO_new( BIO_s_mem() );
+	req_bio = BIO_new( BIO_s_mem() );
+	cert_bio = BIO_new( BIO_s_mem() );
+	if ( NULL == key_bio || NULL == req_bio || NULL == cert_bio ||
+			!PEM_write_bio_PrivateKey( key_bio, pkey, NULL, NULL, 0, NULL, NULL ) ||
+			!PEM_write_bio_X509_REQ( req_bio, req ) || !X509_print( cert_bio, x ) ||
+			!PEM_write_bio_X509( cert_bio, x ) )
+		goto done;
+
+	/* the archive has what tar had, in the same order */
+	snprintf( m[0].path, sizeof( m[0].path ), "keys/%s.csr", h->c.name );
+	m[0].data = bio_data( req_bio, &m[0].len );
+	m[0].mode = 0644;
+	snprintf( m[1].path, sizeof( m[1].path ), "keys/%s.key", h->c.name );
+	m[1].data = bio_data( key_bio, &m[1].len );
+	m[1].mode = 0600;
+	snprintf( m[2].path, sizeof( m[2].path ), "keys/%s.cert", h->c.name );
+	m[2].data = bio_data( cert_bio, &m[2].len );
+	m[2].mode = 0644;
+	snprintf( m[3].path, sizeof( m[3].path ), "keys/%s.chained.crt", h->c.name );
+	m[3].len = m[2].len + ca->ca_pem_len;
+	if ( NULL == ( chained = m[3].data = malloc( m[3].len ) ) )
+		goto done;
+	memcpy( m[3].data, m[2].data, m[2].len );
+	memcpy( m[3].data + m[2].len, ca->ca_pem, ca->ca_pem_len );
+	m[3].mode = 0644;
+	strcpy( m[4].path, "CA_cert.cer" );
+	m[4].data = ic->ca_cer;
+	m[4].len = ic->ca_cer_len;
+	m[4].mode = 0644;
+	strcpy( m[5].path, "CA_cert.crt" );
+	m[5].data = ca->ca_pem;
+	m[5].len = ca->ca_pem_len;
+	m[5].mode = 0644;
+	memcpy( m[6].path, ic->dh_name, sizeof( m[6].path ) );
+	m[6].data = ic->dh;
+	m[6].len = ic->dh_len;
+	m[6].mode = 0644;
+
+	if ( !write_file( req_path, m[0].data, m[0].len, 0644 ) ||
+			!write_file( key_path, m[1].data, m[1].len, 0600 ) ||
+			!write_file( cert_path, m[2].data, m[2].len, 0644 ) ||
+			!write_file( chained_path, m[3].data, m[3].len, 0644 ) ||
+			!write_file( db_path, m[2].data, m[2].len, 0644 ) ||
+			!write_tar_gz( arc_path, m, 7 ) )
+	{
+		fprintf( stderr, "Error: %s: writing the files failed: %s.\n", h->c.name,
+				strerror( errno ) );
+		goto done;
+	}
+
+	/* and its line for the database */
+	not_after = X509_get_notAfter( x );
+	snprintf( expiry, sizeof( expiry ), "%.*s", not_after->length,
+			not_after->data );
+	X509_NAME_oneline( h->c.subject, subject, sizeof( subject ) );
+	snprintf( h->c.index_line, sizeof( h->c.index_line ), "V\t%s\t\t%s\tunknown\t%s\n",
+			expiry, serial_hex, subject );
+	ok = 1;
+
+done:
+	if ( !ok )
+	{
+		fprintf( stderr, "Error: %s: not issued.\n", h->c.name );
+		ERR_print_errors_fp( stderr );
+		unlink( key_path );
+		unlink( req_path );
+		unlink( cert_path );
+		unlink( chained_path );
+		unlink( db_path );
+		unlink( arc_path );
+	}
+	if ( NULL != m[1].data )
+		OPENSSL_cleanse( m[1].data, m[1].len );
+	free( chained );
+	BIO_free( key_bio );
+	BIO_free( req_bio );
+	BIO_free( cert_bio );
+	X509_free( x );
+	X509_REQ_free( req );
+	EVP_PKEY_free( pkey );
+	OPENSSL_free( serial_hex );
+	return ok;
+}
+
+/********
+ make_key--
+ ********/
+
+EVP_PKEY *make_key( key_type *key )
+{
+	EVP_PKEY *pkey;
+	RSA *rsa = NULL;
+	EC_KEY *ec = NULL;
+	BIGNUM *e = NULL;
+	int ok = 0;
+
+	if ( NULL == ( pkey = EVP_PKEY_new() ) )
+		return NULL;
+	if ( EVP_PKEY_RSA == key->type )
+		ok = NULL != ( e = BN_new() ) && BN_set_word( e, RSA_F4 ) &&
+			NULL != ( rsa = RSA_new() ) &&
+			RSA_generate_key_ex( rsa, key->bits, e, NULL ) &&
+			EVP_PKEY_assign_RSA( pkey, rsa );
+	else
+	{
+		/* named, as openssl ecparam -name does it */
+		ok = NULL != ( ec = EC_KEY_new_by_curve_name( key->curve ) );
+		if ( ok )
+			EC_KEY_set_asn1_flag( ec, OPENSSL_EC_NAMED_CURVE );
+		ok = ok && EC_KEY_generate_key( ec ) && EVP_PKEY_assign_EC_KEY( pkey, ec );
+	}
+	BN_free( e );
+	if ( !ok )
+	{
+		RSA_free( rsa );
+		EC_KEY_free( ec );
+		EVP_PKEY_free( pkey );
+		return NULL;
+	}
+	return pkey;
+}
+
+/**************
+ add_extensions--
+ **************/
+
+int add_extensions( ca_conf *ca, X509 *x, host *h )
+{
+	/* The x509_extensions section as openssl ca adds it, with the host's
+	   subjectAltName in place of the section's */
+	STACK_OF(CONF_VALUE) *sect;
+	CONF_VALUE *cv;
+	X509_EXTENSION *ext;
+	X509V3_CTX v3ctx;
+	char san[CA_NAME_MAX + 8];
+	int i, san_done = 0;
+
+	if ( NULL == ca->extensions )
+		sect = NULL;
+	else if ( NULL == ( sect = NCONF_get_section( ca->conf, ca->extensions ) ) )
+		return 0;
+	X509V3_set_ctx( &v3ctx, ca->ca_cert, x, NULL, NULL, 0 );
+	X509V3_set_nconf( &v3ctx, ca->conf );
+	for ( i = 0; i < sk_CONF_VALUE_num( sect ); ++i )
+	{
+		cv = sk_CONF_VALUE_value( sect, i );
+		if ( NID_subject_alt_name == OBJ_sn2nid( cv->name ) ||
+				NID_subject_alt_name == OBJ_ln2nid( cv->name ) )
+		{
+			if ( san_done++ )
+				continue;
+			/* what [ alt_names ] gives generate.sh */
+			snprintf( san, sizeof( san ), "DNS:*.%s", h->c.name );
+			ext = X509V3_EXT_nconf_nid( ca->conf, &v3ctx, NID_subject_alt_name,
+					NULL != h->san ? h->san : san );
+		}
+		else
+			ext = X509V3_EXT_nconf( ca->conf, &v3ctx, cv->name, cv->value );
+		if ( NULL == ext || !X509_add_ext( x, ext, -1 ) )
+		{
+			X509_EXTENSION_free( ext );
+			return 0;
+		}
+		X509_EXTENSION_free( ext );
+	}
+
+	/* given in the manifest, and the section has none */
+	if ( !san_done && NULL != h->san )
+	{
+		ext = X509V3_EXT_nconf_nid( ca->conf, &v3ctx, NID_subject_alt_name, h->san );
+		if ( NULL == ext || !X509_add_ext( x, ext, -1 ) )
+		{
+			X509_EXTENSION_free( ext );
+			return 0;
+		}
+		X509_EXTENSION_free( ext );
+	}
+	return 1;
+}
+
+/********
+ progress--
+ ********/
+
+void progress( issue_run *run, double start, int last )
+{
+	/* n/total and the rate so far, over itself on a terminal, every
+	   10 seconds in a log */
+	double t = now() - start;
+	int tty = isatty( 2 );
+
+	if ( !tty && !last && t - run->shown < 10 )
+		return;
+	run->shown = t;
+	fprintf( stderr, "%s%d/%d issued, %d failed, %.1f/s%s", tty ? "\r" : "",
+			run->done - run->failed, run->n_hosts, run->failed,
+			t > 0 ? ( run->done - run->failed ) / t : 0.0,
+			tty && !last ? "" : "\n" );
+	return;
+}
+
+/***
+ now--
+ ***/
+
+double now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}